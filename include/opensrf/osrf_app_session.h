@@ -33,8 +33,6 @@ enum OSRF_SESSION_TYPE {
 struct osrf_app_request_struct;
 typedef struct osrf_app_request_struct osrfAppRequest;
 
-#define OSRF_REQUEST_HASH_SIZE 64
-
 /**
 	@brief Default size of output buffer.
 */
@@ -91,8 +89,12 @@ struct osrf_app_session_struct {
 
 	int transport_error;
 
-	/** Hash table of pending requests. */
-	osrfAppRequest* request_hash[ OSRF_REQUEST_HASH_SIZE ];
+	/** Table of pending requests, indexed by request id (see osrf_app_session.c). */
+	osrfAppRequest** requests;
+	/** How many slots the table of pending requests has: zero, or a power of 2. */
+	unsigned int request_slots;
+	/** How many requests are pending. */
+	unsigned int request_count;
 
 	/** Boolean: true if the app wants to terminate the process.  Typically this means that */
 	/** a drone has lost its database connection and can therefore no longer function.      */
@@ -100,9 +102,36 @@ struct osrf_app_session_struct {
 
 	/** Buffer used by server drone to collect outbound response messages */
 	growing_buffer* outbuf;
+
+	/** Boolean: true if the peer has told us that it can read CBOR message bodies. */
+	int peer_accepts_cbor;
+
+	/** Boolean: true if the peer has told us that it can read raw chunks of a result. */
+	int peer_accepts_raw_chunks;
 };
 typedef struct osrf_app_session_struct osrfAppSession;
 
+/**
+	@brief Callback for receiving the results of a request as they arrive.
+
+	The handler owns the osrfMessage, and must free it.  The third parameter is whatever
+	the calling code passed to osrfAppSessionSetResultHandler().
+*/
+typedef void (*osrfResultHandler)( osrfAppSession* session, osrfMessage* msg, void* data );
+
+/**
+	@brief Names one outstanding request, for waiting on several at once.
+
+	See osrfAppSessionWaitAny() and osrfAppSessionWaitAll().
+*/
+struct osrf_app_request_handle_struct {
+	/** The session that sent the request, or NULL to leave this handle out. */
+	osrfAppSession* session;
+	/** The request id that osrfAppSessionSendRequest() returned. */
+	int request_id;
+};
+typedef struct osrf_app_request_handle_struct osrfAppRequestHandle;
+
 // --------------------------------------------------------------------------
 // PUBLIC API ***
 // --------------------------------------------------------------------------
@@ -121,6 +150,10 @@ char* osrfAppSessionSetIngress( const char* );
 
 const char* osrfAppSessionGetIngress();
 
+void osrfAppSessionSetCBOR( int enabled );
+
+void osrfAppSessionSetRawChunks( int enabled );
+
 osrfAppSession* osrf_app_session_find_session( const char* session_id );
 
 /* DEPRECATED; use osrfAppSessionSendRequest() instead. */
@@ -139,6 +172,20 @@ int osrf_app_session_request_complete( const osrfAppSession* session, int reques
 osrfMessage* osrfAppSessionRequestRecv(
 		osrfAppSession* session, int request_id, int timeout );
 
+osrfMessage* osrfAppSessionRequestRecvMs(
+		osrfAppSession* session, int request_id, int timeout_ms );
+
+int osrfAppSessionWaitAny( osrfAppRequestHandle* handles, int count, int timeout );
+
+int osrfAppSessionWaitAnyMs( osrfAppRequestHandle* handles, int count, int timeout_ms );
+
+int osrfAppSessionWaitAll( osrfAppRequestHandle* handles, int count, int timeout );
+
+int osrfAppSessionWaitAllMs( osrfAppRequestHandle* handles, int count, int timeout_ms );
+
+int osrfAppSessionSetResultHandler( osrfAppSession* session, int request_id,
+		osrfResultHandler handler, void* data );
+
 void osrf_app_session_request_finish( osrfAppSession* session, int request_id );
 
 int osrf_app_session_request_resend( osrfAppSession*, int request_id );
@@ -155,12 +202,16 @@ void osrf_app_session_set_remote( osrfAppSession* session, const char* remote_id
 
 void osrf_app_session_push_queue( osrfAppSession*, osrfMessage* msg );
 
+void osrf_app_session_push_raw_chunk( osrfAppSession* session, const char* body );
+
 int osrfAppSessionConnect( osrfAppSession* );
 
 int osrf_app_session_disconnect( osrfAppSession* );
 
 int osrf_app_session_queue_wait( osrfAppSession*, int timeout, int* recvd );
 
+int osrf_app_session_queue_wait_ms( osrfAppSession*, int timeout_ms, int* recvd );
+
 void osrfAppSessionFree( osrfAppSession* );
 
 void osrf_app_session_request_reset_timeout( osrfAppSession* session, int req_id );
@@ -0,0 +1,50 @@
+#ifndef OSRF_CBOR_H
+#define OSRF_CBOR_H
+
+/**
+	@file osrf_cbor.h
+	@brief Header for the binary (CBOR) encoding of message bodies.
+
+	A message body is normally the JSON for an array of osrfMessages, most of it
+	quotation marks, punctuation, and key names.  Alternatively the same array may travel
+	as CBOR (RFC 8949), encoded in base64 so that it needs no escaping for XML, behind a
+	prefix that no JSON text can begin with.  We send it that way only when it comes out
+	shorter.
+
+	The CBOR mirrors the JSON:
+	- Arrays and objects are CBOR arrays and maps of indefinite length.
+	- A classed object -- the JSON {"__c":name,"__p":data} -- is tag 27 on the array
+	[name, data].
+	- Integers are CBOR integers.  Other numbers are decimal fractions (tag 4), so that
+	they keep their digits: 25.00 comes back as 25.00, not 25.
+	- Strings, true, false, and null are what you would expect.
+
+	Decoding produces the same jsonObject tree as jsonParseArena() would produce from
+	the JSON, so the calling code needn't care which way the body came.
+*/
+
+#include <opensrf/utils.h>
+#include <opensrf/osrf_json.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Marks a message body as base64-encoded CBOR. */
+#define OSRF_CBOR_BODY_PREFIX "cbor:"
+
+int osrfCborFromJSON( growing_buffer* buf, const char* json );
+
+jsonObject* osrfCborParse( jsonArena* arena, const unsigned char* data, size_t len );
+
+char* osrfCborBodyFromJSON( const char* json );
+
+int osrfCborIsBody( const char* body );
+
+jsonObject* osrfCborParseBody( jsonArena* arena, const char* body );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
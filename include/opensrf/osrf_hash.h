@@ -3,7 +3,7 @@
 
 /**
 	@file osrf_hash.h
-	@brief A hybrid between a hash table and a doubly linked list.
+	@brief A hybrid between a hash table and a list.
 
 	The hash table supports random lookups by key.  The list supports iterative traversals.
 	The sequence of entries in the list reflects the sequence in which the keys were added.
@@ -33,6 +33,15 @@ void osrfHashSetCallback( osrfHash* hash, void (*callback) (char* key, void* ite
 
 void* osrfHashSet( osrfHash* hash, void* item, const char* key, ... );
 
+osrfHash* osrfHashFromPairs( void* (*alloc)( void* ctx, size_t size ), void* ctx,
+		void** pairs, unsigned int count );
+
+void osrfHashSetInternKeys( osrfHash* hash, int intern_keys );
+
+const char* osrfHashIntern( const char* s );
+
+void osrfHashInternStats( unsigned long* count, unsigned long* bytes );
+
 void* osrfHashRemove( osrfHash* hash, const char* key, ... );
 
 void* osrfHashExtract( osrfHash* hash, const char* key, ... );
@@ -134,6 +134,38 @@ struct _jsonIteratorStruct {
 };
 typedef struct _jsonIteratorStruct jsonIterator;
 
+/**
+	@brief A region of memory from which jsonParseArena() carves a whole jsonObject tree.
+
+	Everything in the tree -- nodes, containers, keys, and strings -- is bump-allocated
+	from a short list of large blocks, and is released all at once by jsonArenaReset() or
+	jsonArenaFree().  The individual jsonObjects must not be freed with jsonObjectFree().
+*/
+struct _jsonArenaStruct;
+typedef struct _jsonArenaStruct jsonArena;
+
+/**
+	@brief Builds a jsonObject tree in a jsonArena from JSON that arrives in pieces.
+
+	See jsonNewBuilder().
+*/
+struct jsonBuilderStruct;
+typedef struct jsonBuilderStruct jsonBuilder;
+
+/**
+	@brief How well the free list of unused jsonObjects is working, as seen by one thread.
+
+	Each thread keeps its own free list.  What overflows a thread's list goes, a batch at a
+	time, to a depot shared by all threads, whence a thread whose list runs dry may take it.
+*/
+struct _jsonObjectPoolStatsStruct {
+	unsigned long hits;      /**< jsonObjects this thread reused instead of calling malloc(). */
+	unsigned long misses;    /**< jsonObjects this thread had to get from malloc(). */
+	unsigned long length;    /**< Unused jsonObjects on this thread's free list now. */
+	unsigned long depot;     /**< Unused jsonObjects in the shared depot now. */
+};
+typedef struct _jsonObjectPoolStatsStruct jsonObjectPoolStats;
+
 /**
 	@brief Macros for upward compatibility with an old, defunct version
     of the JSON parser.
@@ -150,6 +182,30 @@ jsonObject* jsonParseRaw( const char* str );
 
 jsonObject* jsonParseFmt( const char* str, ... );
 
+jsonObject* jsonParseArena( jsonArena* arena, const char* str );
+
+jsonArena* jsonNewArena( size_t block_size );
+
+void* jsonArenaAlloc( jsonArena* arena, size_t size );
+
+char* jsonArenaStrndup( jsonArena* arena, const char* s, size_t len );
+
+size_t jsonArenaUsed( const jsonArena* arena );
+
+void jsonArenaReset( jsonArena* arena );
+
+void jsonArenaFree( jsonArena* arena );
+
+jsonBuilder* jsonNewBuilder( jsonArena* arena );
+
+int jsonBuilderPush( jsonBuilder* builder, const char* str, size_t len );
+
+jsonObject* jsonBuilderFinish( jsonBuilder* builder );
+
+void jsonBuilderReset( jsonBuilder* builder, jsonArena* arena );
+
+void jsonBuilderFree( jsonBuilder* builder );
+
 jsonObject* jsonNewObject(const char* data);
 
 jsonObject* jsonNewObjectFmt(const char* data, ...);
@@ -166,6 +222,14 @@ void jsonObjectFree( jsonObject* o );
 
 void jsonObjectFreeUnused( void );
 
+void jsonSetFreeListCap( unsigned long cap );
+
+void jsonObjectGetPoolStats( jsonObjectPoolStats* stats );
+
+void jsonSetInternKeys( int intern );
+
+int jsonInternKeys( void );
+
 unsigned long jsonObjectPush(jsonObject* o, jsonObject* newo);
 
 unsigned long jsonObjectSetKey(
@@ -176,6 +240,9 @@ unsigned long jsonObjectSetKey(
 char* jsonObjectToJSON( const jsonObject* obj );
 char* jsonObjectToJSONRaw( const jsonObject* obj );
 
+void jsonObjectDecodeToBuffer( const jsonObject* obj, growing_buffer* buf,
+		size_t* xml_extra );
+
 jsonObject* jsonObjectGetKey( jsonObject* obj, const char* key );
 
 const jsonObject* jsonObjectGetKeyConst( const jsonObject* obj, const char* key );
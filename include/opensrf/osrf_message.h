@@ -102,9 +102,25 @@ struct osrf_message_struct {
 
 	/** Magical TZ hint. */
 	char* sender_tz;
+
+	/** Boolean: true if the sender can read message bodies encoded as CBOR. */
+	int accept_cbor;
+
+	/** Boolean: true if the sender can read a chunked result sent as raw chunks. */
+	int accept_raw_chunks;
 };
 typedef struct osrf_message_struct osrfMessage;
 
+/**
+	@brief Marks a message body as a raw chunk of a result.
+
+	Such a body is not an array of osrfMessages, but a header and a slice of the JSON for
+	a result too big for one message:
+
+	chunk:<request id>:<offset>:<length>:<the slice itself>
+*/
+#define OSRF_RAW_CHUNK_PREFIX "chunk:"
+
 const char* osrf_message_set_locale( osrfMessage* msg, const char* locale );
 
 const char* osrf_message_set_tz( osrfMessage* msg, const char* tz );
@@ -132,12 +148,19 @@ char* osrf_message_to_xml( osrfMessage* );
 
 jsonObject* osrfMessageToJSON( const osrfMessage* msg );
 
+void osrfMessageToBuffer( const osrfMessage* msg, growing_buffer* buf );
+
+size_t osrfMessageResultToBuffer( const osrfMessage* msg, const jsonObject* result,
+		growing_buffer* buf, size_t* result_start, size_t* xml_extra );
+
 char* osrf_message_serialize(const osrfMessage*);
 
 osrfList* osrfMessageDeserialize( const char* string, osrfList* list );
 
 int osrf_message_deserialize(const char* json, osrfMessage* msgs[], int count);
 
+int osrfMessageDeserializeJSON( const jsonObject* json, osrfMessage* msgs[], int count );
+
 void osrf_message_set_params( osrfMessage* msg, const jsonObject* o );
 
 void osrf_message_set_method( osrfMessage* msg, const char* method_name );
@@ -150,6 +173,14 @@ const jsonObject* osrfMessageGetResult( osrfMessage* msg );
 
 char* osrfMessageSerializeBatch( osrfMessage* msgs [], int count );
 
+void osrfMessageRawChunkToBuffer( growing_buffer* buf, int request_id, size_t offset,
+		const char* data, size_t len );
+
+int osrfMessageIsRawChunk( const char* body );
+
+int osrfMessageParseRawChunk( const char* body, int* request_id, size_t* offset,
+		const char** data, size_t* len );
+
 #ifdef __cplusplus
 }
 #endif
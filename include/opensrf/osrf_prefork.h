@@ -1,6 +1,8 @@
 #ifndef OSRF_PREFORK_H
 #define OSRF_PREFORK_H
 
+#include <opensrf/osrf_json.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -18,6 +20,8 @@ extern "C" {
 
 int osrf_prefork_run(const char* appname);
 
+jsonObject* osrf_prefork_stats( void );
+
 #ifdef __cplusplus
 }
 #endif
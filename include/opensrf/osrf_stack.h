@@ -21,6 +21,8 @@ struct osrf_app_session_struct*  osrf_stack_transport_handler( transport_message
 
 int osrf_stack_process( transport_client* client, int timeout, int* msg_received );
 
+int osrf_stack_process_ms( transport_client* client, int timeout_ms, int* msg_received );
+
 #ifdef __cplusplus
 }
 #endif
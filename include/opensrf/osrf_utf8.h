@@ -58,6 +58,11 @@ int is__utf8( int c );
 
 int buffer_append_utf8( growing_buffer* buf, const char* string );
 
+// Likewise, while adding to *xml_extra the additional
+// length the result will need when escaped for XML
+
+int buffer_append_utf8_xml( growing_buffer* buf, const char* string, size_t* xml_extra );
+
 #ifdef __cplusplus
 }
 #endif
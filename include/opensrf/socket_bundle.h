@@ -16,6 +16,9 @@
 	functions for opening UDP sockets are completely unused at this writing.
 
 	All socket traffic is expected to consist of text; i.e. binary data is not supported.
+
+	Data sockets are switched to non-blocking mode the first time they are read, and stay
+	that way.  Sends wait for buffer space as needed, so callers see no difference.
 */
 
 #include <opensrf/utils.h>
@@ -51,6 +54,30 @@ extern "C" {
 struct socket_node_struct;
 typedef struct socket_node_struct socket_node;
 
+/**
+	@brief Mechanism used by socket_wait_all() to detect activity.
+
+	The zero value is the default, so that a socket_manager allocated with safe_malloc()
+	and never configured uses epoll.
+*/
+typedef enum {
+	SOCKET_BACKEND_EPOLL = 0,  /**< epoll(7); no limit on descriptor values. */
+	SOCKET_BACKEND_SELECT      /**< select(2); descriptors must be below FD_SETSIZE. */
+} socket_backend;
+
+/**
+	@brief Running totals of input activity for a socket_manager.
+
+	Comparing two snapshots tells how many system calls and callbacks it took to receive
+	whatever arrived in between -- a message, for example.
+*/
+typedef struct {
+	unsigned long recv_calls;   /**< Calls to recv(), including those that found no data. */
+	unsigned long fcntl_calls;  /**< Calls to fcntl() made to change a socket's blocking mode. */
+	unsigned long deliveries;   /**< Buffers passed to the data_received callback. */
+	unsigned long bytes;        /**< Bytes received. */
+} socket_stats;
+
 
 /* Maintains the socket set */
 /**
@@ -85,11 +112,23 @@ struct socket_manager_struct {
 
 	socket_node* socket;       /**< Linked list of managed sockets. */
 	void* blob;                /**< Opaque pointer from the calling code .*/
+
+	/* The remaining members are private to socket_bundle.c.  All of them are valid when
+	   zeroed, so calling code need not initialize them. */
+	socket_backend backend;    /**< How socket_wait_all() detects activity. */
+	socket_node** node_table;  /**< Managed sockets, indexed by file descriptor. */
+	int node_table_size;       /**< Number of slots in node_table. */
+	int epoll_fd;              /**< epoll instance; meaningful only if epoll_pid is set. */
+	pid_t epoll_pid;           /**< Process that created epoll_fd, or 0 if there is none. */
+
+	socket_stats stats;        /**< Input counters; may be read, but not written, by callers. */
 };
 typedef struct socket_manager_struct socket_manager;
 
 void socket_manager_free(socket_manager* mgr);
 
+int socket_manager_set_backend( socket_manager* mgr, socket_backend backend );
+
 int socket_open_tcp_server(socket_manager*, int port, const char* listen_ip );
 
 int socket_open_unix_server(socket_manager* mgr, const char* path);
@@ -110,8 +149,12 @@ void socket_disconnect(socket_manager*, int sock_fd);
 
 int socket_wait(socket_manager* mgr, int timeout, int sock_fd);
 
+int socket_wait_ms(socket_manager* mgr, int timeout_ms, int sock_fd);
+
 int socket_wait_all(socket_manager* mgr, int timeout);
 
+int socket_wait_all_ms(socket_manager* mgr, int timeout_ms);
+
 void _socket_print_list(socket_manager* mgr);
 
 int socket_connected(int sock_fd);
@@ -50,6 +50,10 @@ const char* osrfStringArrayGetString( const osrfStringArray* arr, int index );
 int osrfStringArrayContains(
 	const osrfStringArray* arr, const char* string );
 
+void osrfStringArrayClear( osrfStringArray* arr );
+
+void osrfStringArraySwap( osrfStringArray* one, osrfStringArray* two );
+
 void osrfStringArrayFree( osrfStringArray* );
 
 void osrfStringArrayRemove( osrfStringArray* arr, const char* str );
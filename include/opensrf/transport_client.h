@@ -54,6 +54,8 @@ int client_connected( const transport_client* client );
 
 transport_message* client_recv( transport_client* client, int timeout );
 
+transport_message* client_recv_ms( transport_client* client, int timeout_ms );
+
 int client_sock_fd( transport_client* client );
 
 #ifdef __cplusplus
@@ -10,6 +10,7 @@
 */
 
 #include <string.h>
+#include <stdint.h>
 #include <libxml/globals.h>
 #include <libxml/xmlerror.h>
 #include <libxml/parser.h>
@@ -18,6 +19,7 @@
 #include <libxml/xmlmemory.h>
 
 #include <opensrf/utils.h>
+#include <opensrf/osrf_json.h>
 #include <opensrf/xml_utils.h>
 #include <opensrf/log.h>
 
@@ -54,10 +56,26 @@ struct transport_message_struct {
 	int error_code;        /**< Value of the "code" attribute of &lt;error&gt;. */
 	int broadcast;         /**< Value of the "broadcast" attribute in the message element. */
 	char* msg_xml;         /**< The entire message as XML, complete with entity encoding. */
+	char* body_xml;        /**< Entity-encoded body awaiting message_prepare_xml(), if any. */
+	size_t body_xml_offset; /**< Offset of the entity-encoded body within msg_xml. */
+	size_t body_xml_length; /**< Length of the entity-encoded body within msg_xml (0 if unknown). */
+	jsonObject* body_json; /**< The body, parsed as it arrived, if the transport_session did so. */
+	jsonArena* body_arena; /**< Holds body_json. */
 	struct transport_message_struct* next;
 };
 typedef struct transport_message_struct transport_message;
 
+/**
+	@brief First byte of a packed transport_message.
+
+	No XML document can begin with this byte, so a reader can tell a packed message from
+	an XML stanza by looking at the first byte.
+*/
+#define MESSAGE_PACKED_MAGIC '\x01'
+
+/** Size of the header of a packed transport_message: the magic byte plus a length. */
+#define MESSAGE_PACKED_HEADER_SIZE (1 + sizeof(uint32_t))
+
 transport_message* message_init( const char* body, const char* subject,
 		const char* thread, const char* recipient, const char* sender );
 
@@ -71,8 +89,17 @@ void message_set_osrf_xid( transport_message* msg, const char* osrf_xid );
 
 int message_prepare_xml( transport_message* msg );
 
+transport_message* message_forward( transport_message* msg, const char* recipient,
+		const char* router_from );
+
 int message_free( transport_message* msg );
 
+char* message_pack( const transport_message* msg, size_t* size );
+
+size_t message_packed_size( const char* header );
+
+transport_message* new_message_from_packed( const char* data, size_t size );
+
 void jid_get_username( const char* jid, char buf[], int size );
 
 void jid_get_resource( const char* jid, char buf[], int size );
@@ -97,6 +97,15 @@ struct transport_session_struct {
 
 	int component;                        /**< Boolean; true if we're a Jabber component. */
 
+	/** Input counters of sock_mgr as of the end of the previous message stanza. */
+	socket_stats msg_stats_mark;
+
+	/** Bodies at least this long are parsed as JSON while they arrive; 0 means never. */
+	size_t body_parse_threshold;
+	jsonBuilder* body_builder;            /**< Parses a long &lt;body&gt; as it arrives. */
+	jsonArena* body_arena;                /**< Holds what body_builder has built so far. */
+	int body_parsing;                     /**< Boolean; true if the current body is being parsed. */
+
 	/** Callback from calling code, for when a complete message stanza is received. */
 	void (*message_callback) ( void* user_data, transport_message* msg );
 	//void (iq_callback) ( void* user_data, transport_iq_message* iq );
@@ -108,6 +117,8 @@ transport_session* init_transport( const char* server, int port,
 
 int session_wait( transport_session* session, int timeout );
 
+int session_wait_ms( transport_session* session, int timeout_ms );
+
 int session_send_msg( transport_session* session, transport_message* msg );
 
 int session_connected( transport_session* session );
@@ -123,6 +134,8 @@ int session_connect( transport_session* session,
 
 int session_disconnect( transport_session* session );
 
+void session_set_body_parsing( transport_session* session, size_t threshold );
+
 #ifdef __cplusplus
 }
 #endif
@@ -319,6 +319,7 @@ growing_buffer* buffer_init( int initial_num_bytes);
 
 int buffer_add(growing_buffer* gb, const char* c);
 int buffer_add_n(growing_buffer* gb, const char* data, size_t n);
+int buffer_reserve( growing_buffer* gb, size_t total_len );
 int buffer_fadd(growing_buffer* gb, const char* format, ... );
 int buffer_reset( growing_buffer* gb);
 char* buffer_data( const growing_buffer* gb);
@@ -358,6 +359,10 @@ int clr_fl( int fd, int flags );
 // Utility method
 double get_timestamp_millis( void );
 
+long long get_monotonic_millis( void );
+
+int timeout_seconds_to_millis( int seconds );
+
 
 /* returns true if the whole string is a number */
 int stringisnum(const char* s);
@@ -377,6 +382,16 @@ char* md5sum( const char* text );
 */
 int osrfUtilsCheckFileDescriptor( int fd );
 
+/*
+	What osrfXmlEscapingLength() charges for each character
+	that needs escaping.  Serializers that keep a running
+	count as they write (see buffer_append_utf8_xml()) use
+	the same figures.
+*/
+#define OSRF_XML_EXTRA_QUOTE 11
+#define OSRF_XML_EXTRA_LT_GT 3
+#define OSRF_XML_EXTRA_AMP   4
+
 /*
 	Returns the approximate additional length of
 	a string after XML escaping <, >, &, and ".
@@ -0,0 +1,173 @@
+/*
+	Compare the two encodings of a message body -- JSON, and base64-encoded
+	CBOR -- on payloads shaped like everyday traffic: a small request, a
+	RESULT carrying one classed object, and RESULTs carrying pages of
+	fieldmapper rows.
+
+	For each payload, report the size of the body and of the whole message
+	stanza both ways.  Then the CPU time: what the sender spends turning the
+	JSON into CBOR, and what the receiver spends turning the stanza into
+	osrfMessages, XML parsing included.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+#include "opensrf/osrf_message.h"
+#include "opensrf/osrf_cbor.h"
+#include "opensrf/transport_message.h"
+
+/* Room for as many osrfMessages as osrf_stack.c allows in one stanza */
+#define MAX_MSGS_PER_PACKET 256
+
+/* Spend at least this much CPU time on each measurement, in seconds */
+#define MIN_TIME 0.5
+
+static double cpu_seconds( void );
+static char* make_request( void );
+static char* make_rows( int rows );
+static char* make_result( const char* content );
+static char* make_stanza( const char* body );
+static double time_encode( const char* json );
+static double time_receive( const char* xml );
+static void measure( const char* name, char* json );
+
+int main( void ) {
+	printf( "%-14s %10s %10s %10s %10s %12s %12s %12s\n", "payload", "json body",
+		"cbor body", "json xml", "cbor xml", "usec encode", "usec recv(j)", "usec recv(c)" );
+
+	measure( "request", make_request() );
+	measure( "1 object", make_result( "{\"__c\":\"au\",\"__p\":[null,\"Jane\",\"Doe\",1,"
+		"\"2009-10-14T11:27:36-0400\",\"t\",\"f\",null,42,\"jdoe@example.org\",\"25.00\"]}" ));
+	measure( "50 rows", make_result( make_rows( 50 )));
+	measure( "1000 rows", make_result( make_rows( 1000 )));
+	measure( "20000 rows", make_result( make_rows( 20000 )));
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A REQUEST such as a client sends to search for something */
+static char* make_request( void ) {
+	osrfMessage* msg = osrf_message_init( REQUEST, 1, 1 );
+	osrf_message_set_method( msg, "open-ils.search.biblio.multiclass.query" );
+	jsonObject* params = jsonParse( "[{\"limit\":10,\"offset\":0,\"org_unit\":1,"
+		"\"depth\":0},\"harry potter\",1]" );
+	osrf_message_set_params( msg, params );
+	jsonObjectFree( params );
+	msg->accept_cbor = 1;
+
+	char* json = osrfMessageSerializeBatch( &msg, 1 );
+	osrfMessageFree( msg );
+	return json;
+}
+
+/* The JSON for an array of copies, encoded as fieldmapper objects */
+static char* make_rows( int rows ) {
+	growing_buffer* buf = buffer_init( 1024 );
+	buffer_add_char( buf, '[' );
+	int i;
+	for( i = 0; i < rows; ++i ) {
+		if( i )
+			buffer_add_char( buf, ',' );
+		buffer_fadd( buf,
+			"{\"__c\":\"acp\",\"__p\":[null,null,null,%d,\"31234%06d\",null,"
+			"\"2009-10-14T11:27:36-0400\",1,%d,\"f\",\"t\",null,\"t\",\"2009-10-14T11:27:36-0400\","
+			"1,\"25.00\",\"t\",0,\"t\",\"f\",1,\"t\",%d,null,\"Copy note: \\\"fragile\\\" & <old>\","
+			"\"0.00\",null,%d,\"f\",null]}",
+			i + 100, i, i % 7, i * 3, i + 5 );
+	}
+	buffer_add_char( buf, ']' );
+	return buffer_release( buf );
+}
+
+/* The JSON for a RESULT carrying the given content, plus the closing STATUS */
+static char* make_result( const char* content ) {
+	jsonObject* obj = jsonParse( content );
+	osrfMessage* msgs[ 2 ];
+	msgs[ 0 ] = osrf_message_init( RESULT, 1, 1 );
+	osrf_message_set_status_info( msgs[ 0 ], NULL, "OK", OSRF_STATUS_OK );
+	osrf_message_set_result( msgs[ 0 ], obj );
+	msgs[ 1 ] = osrf_message_init( STATUS, 1, 1 );
+	osrf_message_set_status_info( msgs[ 1 ], "osrfConnectStatus", "Request Complete",
+		OSRF_STATUS_COMPLETE );
+
+	char* json = osrfMessageSerializeBatch( msgs, 2 );
+	osrfMessageFree( msgs[ 0 ] );
+	osrfMessageFree( msgs[ 1 ] );
+	jsonObjectFree( obj );
+	return json;
+}
+
+/* The XML for a message stanza with the given body */
+static char* make_stanza( const char* body ) {
+	transport_message* msg = message_init( body, NULL, "thread", "client@localhost/drone",
+		"service@localhost/listener" );
+	message_prepare_xml( msg );
+	char* xml = strdup( msg->msg_xml );
+	message_free( msg );
+	return xml;
+}
+
+/* CPU time per translation of the JSON into a CBOR body */
+static double time_encode( const char* json ) {
+	long count = 0;
+	double start = cpu_seconds();
+	double elapsed;
+	do {
+		free( osrfCborBodyFromJSON( json ));
+		++count;
+	} while( ( elapsed = cpu_seconds() - start ) < MIN_TIME );
+	return elapsed / count;
+}
+
+/* CPU time per trip from a stanza to osrfMessages, as osrf_stack.c makes it */
+static double time_receive( const char* xml ) {
+	osrfMessage* arr[ MAX_MSGS_PER_PACKET ];
+	long count = 0;
+	double start = cpu_seconds();
+	double elapsed;
+	do {
+		transport_message* msg = new_message_from_xml( xml );
+		int num_msgs = osrf_message_deserialize( msg->body, arr, MAX_MSGS_PER_PACKET );
+		if( num_msgs < 1 ) {
+			fprintf( stderr, "no messages received\n" );
+			exit( 1 );
+		}
+		while( num_msgs > 0 )
+			osrfMessageFree( arr[ --num_msgs ] );
+		message_free( msg );
+		++count;
+	} while( ( elapsed = cpu_seconds() - start ) < MIN_TIME );
+	return elapsed / count;
+}
+
+static void measure( const char* name, char* json ) {
+	char* body = osrfCborBodyFromJSON( json );
+	if( !body ) {
+		printf( "%-14s %10lu %10s   (no shorter as CBOR, so it stays JSON)\n", name,
+			(unsigned long) strlen( json ), "-" );
+		free( json );
+		return;
+	}
+
+	char* json_xml = make_stanza( json );
+	char* cbor_xml = make_stanza( body );
+
+	printf( "%-14s %10lu %10lu %10lu %10lu %12.1f %12.1f %12.1f\n", name,
+		(unsigned long) strlen( json ), (unsigned long) strlen( body ),
+		(unsigned long) strlen( json_xml ), (unsigned long) strlen( cbor_xml ),
+		time_encode( json ) * 1e6, time_receive( json_xml ) * 1e6,
+		time_receive( cbor_xml ) * 1e6 );
+
+	free( cbor_xml );
+	free( json_xml );
+	free( body );
+	free( json );
+}
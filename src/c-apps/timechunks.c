@@ -0,0 +1,265 @@
+/*
+	Compare the two ways of sending a result too big for one message: as
+	partial RESULT messages, each carrying its slice of the JSON escaped into
+	a JSON string, or as raw chunks, each carrying its slice as is.
+
+	For a result of about 20MB, report the bytes on the wire (the message
+	stanzas, XML escaping included) both ways.  Then the client's CPU time
+	to turn the stanzas back into the result, as osrf_app_session.c does:
+	collecting the strings from the partial RESULTs, or the raw chunks, and
+	parsing the whole thing at the end.
+
+	The client really collects the partial RESULTs in a growing_buffer,
+	which tops out at BUFFER_MAX_SIZE -- so it can't take a result this big
+	that way at all.  To have something to compare, we collect them in
+	plain memory instead.
+
+	For reference, we also time feeding the raw chunks to a jsonBuilder as
+	they arrive, and copying the finished tree to the heap.  That leaves
+	less to do after the last chunk, but costs more in all.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+#include "opensrf/osrf_message.h"
+#include "opensrf/osrf_app_session.h"
+#include "opensrf/transport_message.h"
+
+/* How big a result to send */
+#define RESULT_SIZE 20000000
+
+/* How many times to receive the result each way; we report the best */
+#define ROUNDS 5
+
+static double cpu_seconds( void );
+static char* make_result( size_t size, int* rows );
+static osrfStringArray* partial_stanzas( const char* payload, size_t size );
+static osrfStringArray* raw_stanzas( const char* payload, size_t size );
+static char* make_stanza( const char* body );
+static size_t wire_bytes( const osrfStringArray* stanzas );
+static jsonObject* receive_partial( const osrfStringArray* stanzas );
+static jsonObject* receive_raw( const osrfStringArray* stanzas );
+static jsonObject* receive_raw_builder( const osrfStringArray* stanzas );
+static double time_receive( jsonObject* (*receive)( const osrfStringArray* ),
+		const osrfStringArray* stanzas, int rows );
+
+int main( void ) {
+	int rows;
+	char* payload = make_result( RESULT_SIZE, &rows );
+	size_t size = strlen( payload );
+
+	osrfStringArray* partial = partial_stanzas( payload, size );
+	osrfStringArray* raw = raw_stanzas( payload, size );
+
+	printf( "%12s %8s %14s %14s\n", "", "stanzas", "bytes on wire", "client cpu ms" );
+	printf( "%-12s %8d %14lu %14.1f\n", "partial", partial->size,
+		(unsigned long) wire_bytes( partial ),
+		time_receive( receive_partial, partial, rows ) * 1e3 );
+	printf( "%-12s %8d %14lu %14.1f\n", "raw", raw->size,
+		(unsigned long) wire_bytes( raw ),
+		time_receive( receive_raw, raw, rows ) * 1e3 );
+	printf( "%-12s %8d %14lu %14.1f\n", "raw+builder", raw->size,
+		(unsigned long) wire_bytes( raw ),
+		time_receive( receive_raw_builder, raw, rows ) * 1e3 );
+
+	osrfStringArrayFree( raw );
+	osrfStringArrayFree( partial );
+	free( payload );
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+	The JSON for an array of copies, encoded as fieldmapper objects.  It's too big for a
+	growing_buffer, so we build it in plain memory.
+*/
+static char* make_result( size_t size, int* rows ) {
+	char* json = safe_malloc( size + 1024 );
+	char* p = json;
+	*p++ = '[';
+	int i;
+	for( i = 0; p - json < size; ++i ) {
+		if( i )
+			*p++ = ',';
+		p += sprintf( p,
+			"{\"__c\":\"acp\",\"__p\":[null,null,null,%d,\"31234%06d\",null,"
+			"\"2009-10-14T11:27:36-0400\",1,%d,\"f\",\"t\",null,\"t\",\"2009-10-14T11:27:36-0400\","
+			"1,\"25.00\",\"t\",0,\"t\",\"f\",1,\"t\",%d,null,\"Copy note: \\\"fragile\\\" & <old>\","
+			"\"0.00\",null,%d,\"f\",null]}",
+			i + 100, i, i % 7, i * 3, i + 5 );
+	}
+	strcpy( p, "]" );
+	*rows = i;
+	return json;
+}
+
+/* The stanzas that osrfSendChunkedResult() sends to a client that can't take raw chunks */
+static osrfStringArray* partial_stanzas( const char* payload, size_t size ) {
+	osrfStringArray* stanzas = osrfNewStringArray( 512 );
+	growing_buffer* buf = buffer_init( OSRF_MSG_CHUNK_SIZE + 256 );
+	size_t i;
+	for( i = 0; i < size; i += OSRF_MSG_CHUNK_SIZE ) {
+		size_t len = size - i > OSRF_MSG_CHUNK_SIZE ? OSRF_MSG_CHUNK_SIZE : size - i;
+		osrfMessage* msg = osrf_message_init( RESULT, 1, 1 );
+		osrf_message_set_status_info( msg, "osrfResultPartial", "Partial Response",
+			OSRF_STATUS_PARTIAL );
+		char* slice = strndup( payload + i, len );
+		jsonObject* slice_obj = jsonNewObject( slice );
+		free( slice );
+
+		buffer_reset( buf );
+		buffer_add_char( buf, '[' );
+		osrfMessageResultToBuffer( msg, slice_obj, buf, NULL, NULL );
+		buffer_add_char( buf, ']' );
+		char* xml = make_stanza( OSRF_BUFFER_C_STR( buf ));
+		osrfStringArrayAdd( stanzas, xml );
+		free( xml );
+		jsonObjectFree( slice_obj );
+		osrfMessageFree( msg );
+	}
+	buffer_free( buf );
+	return stanzas;
+}
+
+/* The stanzas that osrfSendChunkedResult() sends to a client that can take raw chunks */
+static osrfStringArray* raw_stanzas( const char* payload, size_t size ) {
+	osrfStringArray* stanzas = osrfNewStringArray( 512 );
+	growing_buffer* buf = buffer_init( OSRF_MSG_CHUNK_SIZE + 256 );
+	size_t i;
+	for( i = 0; i < size; i += OSRF_MSG_CHUNK_SIZE ) {
+		size_t len = size - i > OSRF_MSG_CHUNK_SIZE ? OSRF_MSG_CHUNK_SIZE : size - i;
+		buffer_reset( buf );
+		osrfMessageRawChunkToBuffer( buf, 1, i, payload + i, len );
+		char* xml = make_stanza( OSRF_BUFFER_C_STR( buf ));
+		osrfStringArrayAdd( stanzas, xml );
+		free( xml );
+	}
+	buffer_free( buf );
+	return stanzas;
+}
+
+/* The XML for a message stanza with the given body */
+static char* make_stanza( const char* body ) {
+	transport_message* msg = message_init( body, NULL, "thread", "client@localhost/drone",
+		"service@localhost/listener" );
+	message_prepare_xml( msg );
+	char* xml = strdup( msg->msg_xml );
+	message_free( msg );
+	return xml;
+}
+
+static size_t wire_bytes( const osrfStringArray* stanzas ) {
+	size_t total = 0;
+	int i;
+	for( i = 0; i < stanzas->size; ++i )
+		total += strlen( osrfStringArrayGetString( stanzas, i ));
+	return total;
+}
+
+/* Collect the strings from the partial RESULTs, then parse the lot */
+static jsonObject* receive_partial( const osrfStringArray* stanzas ) {
+	char* collected = safe_malloc( RESULT_SIZE + 1024 );
+	size_t used = 0;
+	int i;
+	for( i = 0; i < stanzas->size; ++i ) {
+		transport_message* msg = new_message_from_xml( osrfStringArrayGetString( stanzas, i ));
+		osrfMessage* arr[ 1 ];
+		if( osrf_message_deserialize( msg->body, arr, 1 ) == 1 ) {
+			const char* partial = jsonObjectGetString( arr[ 0 ]->_result_content );
+			if( partial ) {
+				size_t len = strlen( partial );
+				memcpy( collected + used, partial, len + 1 );
+				used += len;
+			}
+			osrfMessageFree( arr[ 0 ] );
+		}
+		message_free( msg );
+	}
+
+	jsonObject* result = jsonParse( collected );
+	free( collected );
+	return result;
+}
+
+/* Collect the raw chunks, then parse the lot */
+static jsonObject* receive_raw( const osrfStringArray* stanzas ) {
+	char* collected = safe_malloc( RESULT_SIZE + 1024 );
+	size_t used = 0;
+	int i;
+	for( i = 0; i < stanzas->size; ++i ) {
+		transport_message* msg = new_message_from_xml( osrfStringArrayGetString( stanzas, i ));
+		int request_id;
+		size_t offset;
+		const char* data;
+		size_t len;
+		if( !osrfMessageParseRawChunk( msg->body, &request_id, &offset, &data, &len )
+				&& offset == used ) {
+			memcpy( collected + used, data, len );
+			used += len;
+			collected[ used ] = '\0';
+		}
+		message_free( msg );
+	}
+
+	jsonObject* result = jsonParse( collected );
+	free( collected );
+	return result;
+}
+
+/* Feed each raw chunk to a jsonBuilder, then copy out the finished tree */
+static jsonObject* receive_raw_builder( const osrfStringArray* stanzas ) {
+	jsonArena* arena = jsonNewArena( 0 );
+	jsonBuilder* builder = jsonNewBuilder( arena );
+	size_t expected_offset = 0;
+	int i;
+	for( i = 0; i < stanzas->size; ++i ) {
+		transport_message* msg = new_message_from_xml( osrfStringArrayGetString( stanzas, i ));
+		int request_id;
+		size_t offset;
+		const char* data;
+		size_t len;
+		if( !osrfMessageParseRawChunk( msg->body, &request_id, &offset, &data, &len )
+				&& offset == expected_offset ) {
+			jsonBuilderPush( builder, data, len );
+			expected_offset += len;
+		}
+		message_free( msg );
+	}
+
+	jsonObject* result = jsonObjectDecodeClass( jsonBuilderFinish( builder ));
+	jsonBuilderFree( builder );
+	jsonArenaFree( arena );
+	return result;
+}
+
+static double time_receive( jsonObject* (*receive)( const osrfStringArray* ),
+		const osrfStringArray* stanzas, int rows ) {
+	double best = 1e9;
+	int i;
+	for( i = 0; i < ROUNDS; ++i ) {
+		double start = cpu_seconds();
+		jsonObject* result = receive( stanzas );
+		double elapsed = cpu_seconds() - start;
+		if( elapsed < best )
+			best = elapsed;
+
+		// Spot-check the last row
+		const jsonObject* row = jsonObjectGetIndex( result, rows - 1 );
+		if( !result || result->size != rows || !row || !row->classname
+				|| strcmp( row->classname, "acp" )
+				|| jsonObjectGetNumber( jsonObjectGetIndex( row, 3 )) != rows + 99 ) {
+			fprintf( stderr, "result not received intact\n" );
+			exit( 1 );
+		}
+		jsonObjectFree( result );
+	}
+	return best;
+}
@@ -0,0 +1,171 @@
+/*
+	Compare the latency of several requests made one after another with that
+	of the same requests made at once.
+
+	Each request goes to opensrf.cslow on a session of its own, as if to a
+	different service, and asks it to wait a second.  One after another, the
+	client waits for each answer before sending the next request.  At once,
+	it sends them all, then takes the answers as they come with
+	osrfAppSessionWaitAny() -- or waits for the lot with
+	osrfAppSessionWaitAll().
+
+	Unlike the other timing programs, this one needs a running system, with
+	enough opensrf.cslow drones to serve the requests side by side.
+
+	usage: timefanout <config file> <context> [requests]
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+#include "opensrf/osrf_app_session.h"
+#include "opensrf/osrf_system.h"
+
+#define SERVICE "opensrf.cslow"
+#define METHOD "opensrf.cslow.wait"
+
+/* How many seconds to wait for an answer */
+#define TIMEOUT 30
+
+static double wall_seconds( void );
+static void open_sessions( osrfAppRequestHandle* handles, int count );
+static void send_request( osrfAppRequestHandle* handle );
+static int receive_all( osrfAppRequestHandle* handle );
+static double time_sequential( osrfAppRequestHandle* handles, int count );
+static double time_wait_any( osrfAppRequestHandle* handles, int count );
+static double time_wait_all( osrfAppRequestHandle* handles, int count );
+
+int main( int argc, char* argv[] ) {
+	if( argc < 3 ) {
+		fprintf( stderr, "usage: %s <config file> <context> [requests]\n", argv[ 0 ] );
+		return 1;
+	}
+
+	int count = argc > 3 ? atoi( argv[ 3 ] ) : 5;
+	if( count < 1 )
+		count = 1;
+
+	if( !osrfSystemBootstrapClientResc( argv[ 1 ], argv[ 2 ], "timefanout" ) ) {
+		fprintf( stderr, "Unable to bootstrap client for requests\n" );
+		return 1;
+	}
+
+	osrfAppRequestHandle* handles = safe_malloc( count * sizeof( osrfAppRequestHandle ) );
+	open_sessions( handles, count );
+
+	printf( "%d requests of %s, one second each\n", count, METHOD );
+	printf( "%-16s %10.1f msec\n", "one at a time", time_sequential( handles, count ) * 1e3 );
+	printf( "%-16s %10.1f msec\n", "at once, any", time_wait_any( handles, count ) * 1e3 );
+	printf( "%-16s %10.1f msec\n", "at once, all", time_wait_all( handles, count ) * 1e3 );
+
+	int i;
+	for( i = 0; i < count; ++i )
+		osrfAppSessionFree( handles[ i ].session );
+	free( handles );
+	osrf_system_shutdown();
+	return 0;
+}
+
+static double wall_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A connected session apiece, so that each request has a drone to itself */
+static void open_sessions( osrfAppRequestHandle* handles, int count ) {
+	int i;
+	for( i = 0; i < count; ++i ) {
+		handles[ i ].session = osrfAppSessionClientInit( SERVICE );
+		if( !handles[ i ].session || !osrfAppSessionConnect( handles[ i ].session ) ) {
+			fprintf( stderr, "Unable to connect to %s\n", SERVICE );
+			exit( 1 );
+		}
+		handles[ i ].request_id = -1;
+	}
+}
+
+static void send_request( osrfAppRequestHandle* handle ) {
+	jsonObject* params = jsonParse( "[1]" );
+	handle->request_id = osrfAppSessionSendRequest( handle->session, params, METHOD, 1 );
+	jsonObjectFree( params );
+	if( handle->request_id < 0 ) {
+		fprintf( stderr, "Unable to send a request to %s\n", SERVICE );
+		exit( 1 );
+	}
+}
+
+/* Collect whatever results are waiting, and finish the request if it's complete */
+static int receive_all( osrfAppRequestHandle* handle ) {
+	osrfMessage* msg;
+	while( ( msg = osrfAppSessionRequestRecv( handle->session, handle->request_id, 0 ) ) ) {
+		if( msg->is_exception ) {
+			fprintf( stderr, "%s failed: %s\n", METHOD, msg->status_text );
+			exit( 1 );
+		}
+		osrfMessageFree( msg );
+	}
+
+	if( !osrf_app_session_request_complete( handle->session, handle->request_id ) )
+		return 0;
+	osrf_app_session_request_finish( handle->session, handle->request_id );
+	return 1;
+}
+
+static double time_sequential( osrfAppRequestHandle* handles, int count ) {
+	double start = wall_seconds();
+	int i;
+	for( i = 0; i < count; ++i ) {
+		send_request( handles + i );
+		if( osrfAppSessionWaitAll( handles + i, 1, TIMEOUT ) ) {
+			fprintf( stderr, "No answer from %s\n", SERVICE );
+			exit( 1 );
+		}
+		receive_all( handles + i );
+	}
+	return wall_seconds() - start;
+}
+
+static double time_wait_any( osrfAppRequestHandle* handles, int count ) {
+	osrfAppRequestHandle* pending = safe_malloc( count * sizeof( osrfAppRequestHandle ) );
+	memcpy( pending, handles, count * sizeof( osrfAppRequestHandle ) );
+
+	double start = wall_seconds();
+	int i;
+	for( i = 0; i < count; ++i )
+		send_request( pending + i );
+
+	int left = count;
+	while( left ) {
+		i = osrfAppSessionWaitAny( pending, count, TIMEOUT );
+		if( i < 0 ) {
+			fprintf( stderr, "No answer from %s\n", SERVICE );
+			exit( 1 );
+		}
+		if( receive_all( pending + i ) ) {
+			pending[ i ].session = NULL;
+			--left;
+		}
+	}
+
+	double elapsed = wall_seconds() - start;
+	free( pending );
+	return elapsed;
+}
+
+static double time_wait_all( osrfAppRequestHandle* handles, int count ) {
+	double start = wall_seconds();
+	int i;
+	for( i = 0; i < count; ++i )
+		send_request( handles + i );
+
+	if( osrfAppSessionWaitAll( handles, count, TIMEOUT ) ) {
+		fprintf( stderr, "No answer from %s\n", SERVICE );
+		exit( 1 );
+	}
+	for( i = 0; i < count; ++i )
+		receive_all( handles + i );
+	return wall_seconds() - start;
+}
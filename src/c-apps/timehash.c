@@ -0,0 +1,283 @@
+/*
+	Measure what a JSON object costs: the heap it occupies, and the time it takes
+	to look up one of its keys, for objects from a few keys up to a few hundred.
+	Typical OpenSRF traffic is dominated by objects at the small end.
+
+	Then measure what a drone pays to hold a parsed result set -- rows of
+	identically keyed objects -- with and without key interning.
+
+	Finally, time a bare osrfHash at the sizes of a router's class table or
+	a session cache: inserts, lookups, and removals followed by re-inserts.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+#include "opensrf/osrf_hash.h"
+
+/* How many objects of each size to build when measuring memory */
+#define OBJECTS 10000
+
+/* Shape of the result set: how many rows, with how many columns each */
+#define ROWS 5000
+#define COLUMNS 20
+
+static double cpu_seconds( void );
+static size_t heap_in_use( void );
+static jsonObject* make_object( int keys );
+static void measure( int keys );
+static size_t resident_size( void );
+static char* make_result_set( void );
+static void measure_result_set( const char* json, int intern );
+static void measure_big_hash( int count );
+
+int main( void ) {
+	static const int sizes[] = { 3, 8, 12, 20, 40, 200 };
+	int i;
+
+	printf( "%6s %14s %16s %16s\n", "keys", "bytes/object", "nsec/lookup hit", "nsec/lookup miss" );
+	for( i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++i )
+		measure( sizes[ i ] );
+
+	char* json = make_result_set();
+	printf( "\n%d rows of %d columns (%lu bytes of JSON):\n", ROWS, COLUMNS,
+		(unsigned long) strlen( json ) );
+	printf( "%10s %14s %14s %14s\n", "interning", "heap bytes", "bytes/row", "resident KB" );
+	measure_result_set( json, 0 );
+	measure_result_set( json, 1 );
+	free( json );
+
+	static const int big_sizes[] = { 100, 1000, 10000, 100000 };
+	printf( "\n%8s %14s %14s %14s %14s\n", "items", "nsec/insert", "nsec/hit",
+		"nsec/miss", "nsec/churn" );
+	for( i = 0; i < sizeof( big_sizes ) / sizeof( big_sizes[ 0 ] ); ++i )
+		measure_big_hash( big_sizes[ i ] );
+
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Bytes currently allocated from the heap, or zero if we can't tell */
+static size_t heap_in_use( void ) {
+#if defined(__GLIBC__) && ( __GLIBC__ > 2 || __GLIBC_MINOR__ >= 33 )
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+/* A JSON_HASH with column-like keys, each holding a short string */
+static jsonObject* make_object( int keys ) {
+	jsonObject* obj = jsonNewObjectType( JSON_HASH );
+	char key[ 32 ];
+	int i;
+	for( i = 0; i < keys; ++i ) {
+		snprintf( key, sizeof( key ), "column_%d", i );
+		jsonObjectSetKey( obj, key, jsonNewObject( "value" ) );
+	}
+	return obj;
+}
+
+static void measure( int keys ) {
+	static jsonObject* objs[ OBJECTS ];
+	int i, j;
+
+	// Memory: build a batch of objects, and see how much the heap grew.
+	// The values and the jsonObjects themselves are included.
+	jsonObjectFreeUnused();
+	size_t before = heap_in_use();
+	for( i = 0; i < OBJECTS; ++i )
+		objs[ i ] = make_object( keys );
+	size_t after = heap_in_use();
+
+	// Lookups: every key in turn, against each object in turn
+	char names[ keys ][ 32 ];
+	for( j = 0; j < keys; ++j )
+		snprintf( names[ j ], sizeof( names[ j ] ), "column_%d", j );
+
+	long lookups = 0;
+	int found = 0;
+	double start = cpu_seconds();
+	while( lookups < 5000000 ) {
+		for( i = 0; i < OBJECTS; i += 7 ) {
+			for( j = 0; j < keys; ++j )
+				found += jsonObjectGetKeyConst( objs[ i ], names[ j ] ) != NULL;
+			lookups += keys;
+		}
+	}
+	double hit_time = cpu_seconds() - start;
+
+	long misses = 0;
+	start = cpu_seconds();
+	while( misses < 5000000 ) {
+		for( i = 0; i < OBJECTS; i += 7 ) {
+			found += jsonObjectGetKeyConst( objs[ i ], "no_such_column" ) != NULL;
+			++misses;
+		}
+	}
+	double miss_time = cpu_seconds() - start;
+
+	if( found != lookups ) {
+		fprintf( stderr, "lookups failed\n" );
+		exit( 1 );
+	}
+
+	printf( "%6d %14.1f %16.1f %16.1f\n", keys,
+			(double) ( after - before ) / OBJECTS,
+			hit_time * 1e9 / lookups, miss_time * 1e9 / misses );
+
+	for( i = 0; i < OBJECTS; ++i )
+		jsonObjectFree( objs[ i ] );
+}
+
+/* Resident set size in bytes, from /proc, or zero if we can't tell */
+static size_t resident_size( void ) {
+	unsigned long pages = 0;
+	unsigned long resident = 0;
+	FILE* f = fopen( "/proc/self/statm", "r" );
+	if( !f )
+		return 0;
+	if( fscanf( f, "%lu %lu", &pages, &resident ) != 2 )
+		resident = 0;
+	fclose( f );
+	return resident * sysconf( _SC_PAGESIZE );
+}
+
+/* A JSON array of rows such as a database query might return */
+static char* make_result_set( void ) {
+	growing_buffer* buf = buffer_init( ROWS * COLUMNS * 32 );
+	int row, col;
+
+	buffer_add_char( buf, '[' );
+	for( row = 0; row < ROWS; ++row ) {
+		if( row )
+			buffer_add_char( buf, ',' );
+		buffer_add_char( buf, '{' );
+		for( col = 0; col < COLUMNS; ++col ) {
+			if( col )
+				buffer_add_char( buf, ',' );
+			buffer_fadd( buf, "\"column_name_%d\":\"%d\"", col, row * COLUMNS + col );
+		}
+		buffer_add_char( buf, '}' );
+	}
+	buffer_add_char( buf, ']' );
+	return buffer_release( buf );
+}
+
+/*
+	Parse the result set and hold onto it, as a drone does while working on it.
+	Do it in a child process, so that neither run inherits pages freed by the other.
+*/
+static void measure_result_set( const char* json, int intern ) {
+	fflush( stdout );
+	pid_t pid = fork();
+	if( pid < 0 ) {
+		perror( "fork" );
+		exit( 1 );
+	} else if( pid > 0 ) {
+		waitpid( pid, NULL, 0 );
+		return;
+	}
+
+	jsonSetInternKeys( intern );
+	jsonObjectFreeUnused();
+	malloc_trim( 0 );     // Give back what the earlier measurements freed
+
+	size_t heap_before = heap_in_use();
+	size_t rss_before = resident_size();
+	jsonObject* rows = jsonParse( json );
+	size_t heap_after = heap_in_use();
+	size_t rss_after = resident_size();
+
+	if( !rows || rows->size != ROWS ) {
+		fprintf( stderr, "parse failed\n" );
+		exit( 1 );
+	}
+
+	printf( "%10s %14lu %14.1f %14ld\n", intern ? "on" : "off",
+		(unsigned long) ( heap_after - heap_before ),
+		(double) ( heap_after - heap_before ) / ROWS,
+		(long) ( rss_after - rss_before ) / 1024 );
+
+	jsonObjectFree( rows );
+	fflush( stdout );
+	_exit( 0 );
+}
+
+/* Session-ID-like keys in a bare osrfHash: build it, look things up, churn it */
+static void measure_big_hash( int count ) {
+	char** keys = safe_malloc( count * sizeof( char* ) );
+	char key[ 64 ];
+	int i;
+	for( i = 0; i < count; ++i ) {
+		snprintf( key, sizeof( key ), "session_%d_%08x", i, (unsigned) i * 2654435761u );
+		keys[ i ] = strdup( key );
+	}
+
+	int rounds = 1000000 / count;
+	if( rounds < 1 )
+		rounds = 1;
+
+	double insert_time = 0.0;
+	double hit_time = 0.0;
+	double miss_time = 0.0;
+	double churn_time = 0.0;
+	long found = 0;
+	int round;
+
+	for( round = 0; round < rounds; ++round ) {
+		osrfHash* hash = osrfNewHash();
+
+		double start = cpu_seconds();
+		for( i = 0; i < count; ++i )
+			osrfHashSet( hash, keys[ i ], keys[ i ] );
+		insert_time += cpu_seconds() - start;
+
+		start = cpu_seconds();
+		for( i = 0; i < count; ++i )
+			found += osrfHashGet( hash, keys[ i ] ) != NULL;
+		hit_time += cpu_seconds() - start;
+
+		start = cpu_seconds();
+		for( i = 0; i < count; ++i )
+			found += osrfHashGet( hash, keys[ i ] + 1 ) != NULL;
+		miss_time += cpu_seconds() - start;
+
+		// Retire every other session and start a new one in its place, twice over
+		start = cpu_seconds();
+		int pass;
+		for( pass = 0; pass < 2; ++pass ) {
+			for( i = pass; i < count; i += 2 ) {
+				osrfHashRemove( hash, keys[ i ] );
+				osrfHashSet( hash, keys[ i ], keys[ i ] );
+			}
+		}
+		churn_time += cpu_seconds() - start;
+
+		osrfHashFree( hash );
+	}
+
+	if( found != (long) rounds * count ) {
+		fprintf( stderr, "lookups failed\n" );
+		exit( 1 );
+	}
+
+	double ops = (double) rounds * count;
+	printf( "%8d %14.1f %14.1f %14.1f %14.1f\n", count, insert_time * 1e9 / ops,
+		hit_time * 1e9 / ops, miss_time * 1e9 / ops, churn_time * 1e9 / ops );
+
+	for( i = 0; i < count; ++i )
+		free( keys[ i ] );
+	free( keys );
+}
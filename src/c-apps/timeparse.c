@@ -0,0 +1,202 @@
+/*
+	Measure the throughput of jsonParse() on payloads shaped like real OpenSRF
+	traffic: a small method request, a page of fieldmapper objects, and a
+	bibliographic record carrying a large MARCXML string.
+
+	Each payload is parsed both onto the heap with jsonParse() and into a
+	jsonArena with jsonParseArena().  Parsing and freeing are timed separately,
+	and with glibc we also count the calls to the allocator in each phase.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+
+static double cpu_seconds( void );
+static char* make_request( void );
+static char* make_fieldmapper( int count );
+static char* make_bib_record( size_t size );
+static void time_parse( const char* name, const char* json, int count );
+static void time_heap( const char* json, int count );
+static void time_arena( const char* json, int count );
+static void report( const char* mode, size_t len, int count, double parse_time,
+		double free_time, unsigned long parse_allocs, unsigned long free_calls );
+
+/* How many trees to build before freeing them, to keep the clock calls out of the timing */
+#define BATCH 100
+
+static unsigned long allocs = 0;
+static unsigned long frees = 0;
+
+#ifdef __GLIBC__
+extern void* __libc_malloc( size_t size );
+extern void* __libc_calloc( size_t n, size_t size );
+extern void* __libc_realloc( void* p, size_t size );
+extern void __libc_free( void* p );
+
+/* Count the calls to the allocator, including the ones inside libopensrf and libc */
+void* malloc( size_t size ) { ++allocs; return __libc_malloc( size ); }
+void* calloc( size_t n, size_t size ) { ++allocs; return __libc_calloc( n, size ); }
+void* realloc( void* p, size_t size ) { ++allocs; return __libc_realloc( p, size ); }
+void free( void* p ) { if( p ) ++frees; __libc_free( p ); }
+#endif
+
+int main( void ) {
+
+	char* json = make_request();
+	time_parse( "request", json, 200000 );
+	free( json );
+
+	json = make_fieldmapper( 500 );
+	time_parse( "fieldmapper x500", json, 200 );
+	free( json );
+
+	json = make_bib_record( 200 * 1024 );
+	time_parse( "bib record", json, 500 );
+	free( json );
+
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* An osrfMessage REQUEST, as a client would send it */
+static char* make_request( void ) {
+	return strdup(
+		"[{\"__c\":\"osrfMessage\",\"__p\":{\"threadTrace\":\"1\",\"locale\":\"en-US\","
+		"\"type\":\"REQUEST\",\"payload\":{\"__c\":\"osrfMethod\",\"__p\":{\"method\":"
+		"\"open-ils.search.biblio.multiclass.query\",\"params\":[{\"limit\":10,"
+		"\"offset\":0},\"harry potter\",1]}}}}]" );
+}
+
+/* A result full of copies, encoded as fieldmapper objects */
+static char* make_fieldmapper( int count ) {
+	growing_buffer* buf = buffer_init( 1024 );
+	buffer_add( buf, "[{\"__c\":\"osrfMessage\",\"__p\":{\"threadTrace\":\"1\","
+		"\"type\":\"RESULT\",\"payload\":{\"__c\":\"osrfResult\",\"__p\":{"
+		"\"status\":\"OK\",\"statusCode\":200,\"content\":[" );
+	int i;
+	for( i = 0; i < count; ++i ) {
+		if( i )
+			buffer_add_char( buf, ',' );
+		buffer_fadd( buf,
+			"{\"__c\":\"acp\",\"__p\":[null,null,null,%d,\"31234%06d\",null,"
+			"\"2009-10-14T11:27:36-0400\",1,%d,\"f\",\"t\",null,\"t\",\"2009-10-14T11:27:36-0400\","
+			"1,\"25.00\",\"t\",0,\"t\",\"f\",1,\"t\",%d,null,\"Copy note: \\\"fragile\\\"\","
+			"\"0.00\",null,%d,\"f\",null]}",
+			i + 100, i, i % 7, i * 3, i + 5 );
+	}
+	buffer_add( buf, "]}}}}]" );
+	return buffer_release( buf );
+}
+
+/* A bib record whose MARCXML runs to the requested size */
+static char* make_bib_record( size_t size ) {
+	static const char field[] =
+		"<datafield tag=\\\"520\\\" ind1=\\\" \\\" ind2=\\\" \\\">"
+		"<subfield code=\\\"a\\\">An orphan boy learns that he is a wizard and "
+		"attends a school of witchcraft and wizardry.</subfield></datafield>\\n";
+	growing_buffer* buf = buffer_init( size + 1024 );
+	buffer_add( buf, "[{\"__c\":\"osrfMessage\",\"__p\":{\"threadTrace\":\"1\","
+		"\"type\":\"RESULT\",\"payload\":{\"__c\":\"osrfResult\",\"__p\":{"
+		"\"status\":\"OK\",\"statusCode\":200,\"content\":{\"__c\":\"bre\",\"__p\":["
+		"null,null,null,\"t\",1,\"2009-10-14T11:27:36-0400\",\"f\",1234,"
+		"\"<record xmlns=\\\"http://www.loc.gov/MARC21/slim\\\">\\n" );
+	while( buf->n_used < size )
+		buffer_add( buf, field );
+	buffer_add( buf, "</record>\",\"AUTOGEN\",1]}}}}}]" );
+	return buffer_release( buf );
+}
+
+static void time_parse( const char* name, const char* json, int count ) {
+	jsonObject* obj = jsonParse( json );
+	if( !obj ) {
+		fprintf( stderr, "%s: parse failed\n", name );
+		exit( 1 );
+	}
+	jsonObjectFree( obj );
+	printf( "%s, %lu bytes:\n", name, (unsigned long) strlen( json ) );
+	count = ( count + BATCH - 1 ) / BATCH * BATCH;
+	time_heap( json, count );
+	time_arena( json, count );
+}
+
+/* jsonParse() and jsonObjectFree() */
+static void time_heap( const char* json, int count ) {
+	jsonObject* objs[ BATCH ];
+	double parse_time = 0.0;
+	double free_time = 0.0;
+	unsigned long parse_allocs = 0;
+	unsigned long free_calls = 0;
+
+	int i, j;
+	for( i = 0; i < count; i += BATCH ) {
+		unsigned long before = allocs;
+		double start = cpu_seconds();
+		for( j = 0; j < BATCH; ++j )
+			objs[ j ] = jsonParse( json );
+		double mid = cpu_seconds();
+		parse_allocs += allocs - before;
+
+		before = frees;
+		for( j = 0; j < BATCH; ++j )
+			jsonObjectFree( objs[ j ] );
+		free_time += cpu_seconds() - mid;
+		parse_time += mid - start;
+		free_calls += frees - before;
+	}
+
+	report( "heap", strlen( json ), count, parse_time, free_time, parse_allocs, free_calls );
+}
+
+/* jsonParseArena() and jsonArenaReset(), one arena per tree as osrf_message.c uses them */
+static void time_arena( const char* json, int count ) {
+	jsonArena* arenas[ BATCH ];
+	double parse_time = 0.0;
+	double free_time = 0.0;
+	unsigned long parse_allocs = 0;
+	unsigned long free_calls = 0;
+
+	int i, j;
+	for( j = 0; j < BATCH; ++j )
+		arenas[ j ] = jsonNewArena( 0 );
+
+	for( i = 0; i < count; i += BATCH ) {
+		unsigned long before = allocs;
+		double start = cpu_seconds();
+		for( j = 0; j < BATCH; ++j )
+			jsonParseArena( arenas[ j ], json );
+		double mid = cpu_seconds();
+		parse_allocs += allocs - before;
+
+		before = frees;
+		for( j = 0; j < BATCH; ++j )
+			jsonArenaReset( arenas[ j ] );
+		free_time += cpu_seconds() - mid;
+		parse_time += mid - start;
+		free_calls += frees - before;
+	}
+
+	for( j = 0; j < BATCH; ++j )
+		jsonArenaFree( arenas[ j ] );
+
+	report( "arena", strlen( json ), count, parse_time, free_time, parse_allocs, free_calls );
+}
+
+static void report( const char* mode, size_t len, int count, double parse_time,
+		double free_time, unsigned long parse_allocs, unsigned long free_calls ) {
+	printf( "  %-5s %10.2f usec/parse %8.2f usec/free %8.1f MB/sec",
+			mode, parse_time * 1e6 / count, free_time * 1e6 / count,
+			len * (double) count / ( parse_time + free_time ) / 1e6 );
+#ifdef __GLIBC__
+	printf( " %10.1f allocs/parse %10.1f frees/tree",
+			(double) parse_allocs / count, (double) free_calls / count );
+#endif
+	printf( "\n" );
+}
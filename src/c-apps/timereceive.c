@@ -0,0 +1,169 @@
+/*
+	Measure how long a client waits, after the last byte of a large response
+	arrives, before it has the osrfMessages in hand.
+
+	The response is a message stanza whose body is a page of fieldmapper
+	objects, several megabytes of JSON.  We push the XML through a
+	transport_session a slice at a time, as session_wait() would while reading
+	the socket, and convert the body the way osrf_stack.c does.
+
+	Without body parsing, all of the JSON parsing happens after the last slice.
+	With it, most of the parsing happens while the earlier slices arrive, and
+	what's left for the end is finishing the tree and building the messages.
+	Building the messages -- copying the content out of the tree -- costs the
+	same either way.
+	The total CPU time is reported too, since the two ways don't cost the same.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+#include "opensrf/osrf_message.h"
+#include "opensrf/transport_session.h"
+
+/* How much XML to hand the session at a time, like one read from the socket */
+#define SLICE_SIZE 65536
+
+/* How many times to receive each response; we report the best */
+#define ROUNDS 5
+
+/* Room for as many osrfMessages as osrf_stack.c allows in one stanza */
+#define MAX_MSGS_PER_PACKET 256
+
+static double cpu_seconds( void );
+static double wall_seconds( void );
+static char* make_response( size_t size );
+static void measure( size_t size );
+static void receive( const char* xml, size_t threshold, double* latency, double* cpu );
+static void message_handler( void* blob, transport_message* msg );
+
+/* How many osrfMessages the last stanza turned into */
+static int messages_received = 0;
+
+int main( void ) {
+	// The session's body buffer tops out at BUFFER_MAX_SIZE, so stay under it
+	static const size_t sizes[] = { 1000000, 10000000 };
+	int i;
+
+	printf( "%10s %18s %18s %16s %16s\n", "body bytes", "msec after (whole)",
+		"msec after (live)", "cpu msec (whole)", "cpu msec (live)" );
+	for( i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++i )
+		measure( sizes[ i ] );
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double wall_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A message stanza carrying a RESULT full of copies, encoded as fieldmapper objects */
+static char* make_response( size_t size ) {
+	growing_buffer* buf = buffer_init( 1024 );
+	buffer_add( buf, "[{\"__c\":\"osrfMessage\",\"__p\":{\"threadTrace\":\"1\","
+		"\"type\":\"RESULT\",\"payload\":{\"__c\":\"osrfResult\",\"__p\":{"
+		"\"status\":\"OK\",\"statusCode\":200,\"content\":[" );
+	int i;
+	for( i = 0; buf->n_used < size; ++i ) {
+		if( i )
+			buffer_add_char( buf, ',' );
+		buffer_fadd( buf,
+			"{\"__c\":\"acp\",\"__p\":[null,null,null,%d,\"31234%06d\",null,"
+			"\"2009-10-14T11:27:36-0400\",1,%d,\"f\",\"t\",null,\"t\",\"2009-10-14T11:27:36-0400\","
+			"1,\"25.00\",\"t\",0,\"t\",\"f\",1,\"t\",%d,null,\"Copy note: \\\"fragile\\\" & <old>\","
+			"\"0.00\",null,%d,\"f\",null]}",
+			i + 100, i, i % 7, i * 3, i + 5 );
+	}
+	buffer_add( buf, "]}}}}]" );
+	char* body = buffer_release( buf );
+
+	transport_message* msg = message_init( body, NULL, "thread", "client@localhost/drone",
+		"service@localhost/listener" );
+	message_prepare_xml( msg );
+	char* xml = strdup( msg->msg_xml );
+	message_free( msg );
+	free( body );
+	return xml;
+}
+
+static void measure( size_t size ) {
+	char* xml = make_response( size );
+	double whole_latency = 1e9, whole_cpu = 1e9;
+	double live_latency = 1e9, live_cpu = 1e9;
+	int i;
+
+	for( i = 0; i < ROUNDS; ++i ) {
+		double latency, cpu;
+		receive( xml, 0, &latency, &cpu );
+		if( latency < whole_latency ) whole_latency = latency;
+		if( cpu < whole_cpu ) whole_cpu = cpu;
+		int whole_messages = messages_received;
+
+		receive( xml, SLICE_SIZE, &latency, &cpu );
+		if( latency < live_latency ) live_latency = latency;
+		if( cpu < live_cpu ) live_cpu = cpu;
+
+		if( messages_received != 1 || whole_messages != 1 ) {
+			fprintf( stderr, "response not received\n" );
+			exit( 1 );
+		}
+	}
+
+	printf( "%10lu %18.2f %18.2f %16.2f %16.2f\n", (unsigned long) size,
+		whole_latency * 1e3, live_latency * 1e3, whole_cpu * 1e3, live_cpu * 1e3 );
+	free( xml );
+}
+
+/*
+	Push one stanza through a new transport_session.  Report the time from the
+	arrival of the last slice until the osrfMessages are built, and the CPU time
+	for the whole stanza.
+*/
+static void receive( const char* xml, size_t threshold, double* latency, double* cpu ) {
+	transport_session* session = init_transport( "localhost", 5222, NULL, NULL, 0 );
+	session->message_callback = message_handler;
+	session_set_body_parsing( session, threshold );
+
+	static const char header[] = "<stream:stream xmlns:stream='http://etherx.jabber.org/streams'>";
+	xmlParseChunk( session->parser_ctxt, header, sizeof( header ) - 1, 0 );
+
+	messages_received = 0;
+	size_t len = strlen( xml );
+	size_t offset = 0;
+	double cpu_start = cpu_seconds();
+	double last = 0.0;
+	while( offset < len ) {
+		size_t slice = len - offset > SLICE_SIZE ? SLICE_SIZE : len - offset;
+		last = wall_seconds();
+		xmlParseChunk( session->parser_ctxt, xml + offset, slice, 0 );
+		offset += slice;
+	}
+	*latency = wall_seconds() - last;
+	*cpu = cpu_seconds() - cpu_start;
+
+	session_discard( session );
+}
+
+/* Turn the body into osrfMessages, as osrf_stack_transport_handler() does */
+static void message_handler( void* blob, transport_message* msg ) {
+	osrfMessage* arr[ MAX_MSGS_PER_PACKET ];
+	int num_msgs;
+	if( msg->body_json )
+		num_msgs = osrfMessageDeserializeJSON( msg->body_json, arr, MAX_MSGS_PER_PACKET );
+	else
+		num_msgs = osrf_message_deserialize( msg->body, arr, MAX_MSGS_PER_PACKET );
+
+	messages_received = num_msgs;
+	while( num_msgs > 0 )
+		osrfMessageFree( arr[ --num_msgs ] );
+	message_free( msg );
+}
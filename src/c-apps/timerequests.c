@@ -0,0 +1,100 @@
+/*
+	Measure what it costs to find a pending request in a session, as every
+	result that arrives for the session must, with more and more requests
+	pending at once.
+
+	For each number of pending requests, report the CPU time per lookup of
+	a request that is pending, and of one that isn't (as when a late result
+	turns up for a request already finished).
+
+	Nothing goes over the wire.  This program supplies its own versions of
+	the few library functions that would reach the network or the
+	settings server, so that sending a request does no more than record it.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/log.h"
+#include "opensrf/osrf_app_session.h"
+
+/* Spend at least this much CPU time on each measurement, in seconds */
+#define MIN_TIME 0.5
+
+static int dummy_client;
+
+static double cpu_seconds( void );
+static double time_lookups( osrfAppSession* session, int first_id, int count );
+static void measure( int pending );
+
+/* Stand-ins for the library's network and settings functions */
+
+transport_client* osrfSystemGetTransportClient( void ) {
+	return (transport_client*) &dummy_client;
+}
+
+char* osrf_settings_host_value( const char* path, ... ) {
+	return NULL;
+}
+
+int client_send_message( transport_client* client, transport_message* msg ) {
+	return 0;
+}
+
+int osrf_stack_process_ms( transport_client* client, int timeout_ms, int* msg_received ) {
+	if( msg_received )
+		*msg_received = 0;
+	return 0;
+}
+
+int main( void ) {
+	osrfLogSetLevel( OSRF_LOG_WARNING );
+
+	printf( "%10s %14s %14s\n", "pending", "nsec (found)", "nsec (missing)" );
+	measure( 100 );
+	measure( 1000 );
+	measure( 10000 );
+	measure( 100000 );
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* CPU time per lookup, cycling through count request ids from first_id on */
+static double time_lookups( osrfAppSession* session, int first_id, int count ) {
+	long lookups = 0;
+	long found = 0;
+	double start = cpu_seconds();
+	double elapsed;
+	do {
+		int i;
+		for( i = 0; i < count; ++i )
+			found += osrfAppSessionSetResultHandler( session, first_id + i, NULL, NULL ) == 0;
+		lookups += count;
+	} while( ( elapsed = cpu_seconds() - start ) < MIN_TIME );
+
+	// Make sure that we found what we should have, and nothing else
+	if( found != ( first_id == 1 ? lookups : 0 )) {
+		fprintf( stderr, "wrong requests found\n" );
+		exit( 1 );
+	}
+	return elapsed / lookups;
+}
+
+static void measure( int pending ) {
+	osrfAppSession* session = osrf_app_server_session_init( "session", "service", "remote" );
+	session->state = OSRF_SESSION_CONNECTED;
+
+	int i;
+	for( i = 0; i < pending; ++i )
+		osrfAppSessionSendRequest( session, NULL, "opensrf.system.echo", 1 );
+
+	printf( "%10d %14.1f %14.1f\n", pending, time_lookups( session, 1, pending ) * 1e9,
+		time_lookups( session, pending + 1, pending ) * 1e9 );
+
+	osrfAppSessionFree( session );
+}
@@ -0,0 +1,236 @@
+/*
+	Measure how fast a server can turn responses into the JSON text of
+	RESULT messages, as a streaming method does once per row.
+
+	The rows are classed objects like those of a Fieldmapper result set.
+	Each is serialized three ways: the old way, by building a jsonObject
+	tree for the whole message and serializing the tree; straight into
+	the bundling buffer, followed by a scan to size the result for XML;
+	and straight into the buffer, tallying the XML escaping on the way.
+
+	Then do the same for a few single responses of several megabytes,
+	such as a method returns when it isn't streaming.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/osrf_json.h"
+#include "opensrf/osrf_message.h"
+
+/* How many responses to send, and how big to let a bundle grow */
+#define RESPONSES 200000
+#define BUNDLE_SIZE 25600
+
+/* How many rows to put in each big response, and how many of those to send */
+#define BIG_ROWS 20000
+#define BIG_RESPONSES 10
+
+typedef size_t (*responder)( const jsonObject* row, growing_buffer* outbuf );
+
+static double cpu_seconds( void );
+static jsonObject* make_row( int n, int columns );
+static double time_responses( responder respond, jsonObject** rows, int count,
+	int responses, size_t* bytes );
+static void measure( int columns );
+static void measure_big( void );
+static size_t message_size( const jsonObject* row );
+static void bundle( growing_buffer* outbuf );
+static size_t respond_by_tree( const jsonObject* row, growing_buffer* outbuf );
+static size_t respond_scan( const jsonObject* row, growing_buffer* outbuf );
+static size_t respond_direct( const jsonObject* row, growing_buffer* outbuf );
+
+int main( void ) {
+	static const int sizes[] = { 5, 20, 60 };
+	int i;
+
+	printf( "%8s %12s %16s %16s %16s\n", "columns", "bytes/resp",
+		"resp/sec (tree)", "resp/sec (scan)", "resp/sec (tally)" );
+	for( i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++i )
+		measure( sizes[ i ] );
+
+	measure_big();
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A classed row: a mix of numbers, strings, nulls, and a nested classed object */
+static jsonObject* make_row( int n, int columns ) {
+	char text[ 64 ];
+	jsonObject* fields = jsonNewObjectType( JSON_ARRAY );
+	int i;
+	for( i = 0; i < columns; ++i ) {
+		switch( i % 4 ) {
+			case 0 :
+				jsonObjectPush( fields, jsonNewNumberObject( n * columns + i ));
+				break;
+			case 1 :
+				snprintf( text, sizeof( text ), "Value \"%d\" of row %d", i, n );
+				jsonObjectPush( fields, jsonNewObject( text ));
+				break;
+			case 2 :
+				jsonObjectPush( fields, jsonNewObject( NULL ));
+				break;
+			default :
+				if( i == 3 )
+					jsonObjectPush( fields, make_row( n + 1, 3 ));
+				else
+					jsonObjectPush( fields, jsonNewObject( "t" ));
+				break;
+		}
+	}
+	jsonObjectSetClass( fields, columns > 3 ? "aou" : "aout" );
+	return fields;
+}
+
+/*
+	Send some responses, cycling through the given rows, and return the
+	CPU time it took.  Add the sizes reported by the responder to *bytes,
+	so that the caller can make sure each way came up with the same ones.
+*/
+static double time_responses( responder respond, jsonObject** rows, int count,
+		int responses, size_t* bytes ) {
+	growing_buffer* outbuf = buffer_init( BUNDLE_SIZE + 1024 );
+	int i;
+
+	*bytes = 0;
+	double start = cpu_seconds();
+	for( i = 0; i < responses; ++i )
+		*bytes += respond( rows[ i % count ], outbuf );
+	double elapsed = cpu_seconds() - start;
+
+	buffer_free( outbuf );
+	return elapsed;
+}
+
+static void measure( int columns ) {
+	jsonObject* rows[ 100 ];
+	int i;
+	for( i = 0; i < 100; ++i )
+		rows[ i ] = make_row( i, columns );
+
+	size_t tree_bytes, scan_bytes, direct_bytes;
+	double tree_time = time_responses( respond_by_tree, rows, 100, RESPONSES, &tree_bytes );
+	double scan_time = time_responses( respond_scan, rows, 100, RESPONSES, &scan_bytes );
+	double direct_time = time_responses( respond_direct, rows, 100, RESPONSES, &direct_bytes );
+
+	if( tree_bytes != direct_bytes || scan_bytes != direct_bytes ) {
+		fprintf( stderr, "output differs\n" );
+		exit( 1 );
+	}
+
+	size_t msg_bytes = 0;
+	for( i = 0; i < 100; ++i )
+		msg_bytes += message_size( rows[ i ] );
+
+	printf( "%8d %12.1f %16.0f %16.0f %16.0f\n", columns, msg_bytes / 100.0,
+		RESPONSES / tree_time, RESPONSES / scan_time, RESPONSES / direct_time );
+
+	for( i = 0; i < 100; ++i )
+		jsonObjectFree( rows[ i ] );
+}
+
+/* A single response holding a whole result set */
+static void measure_big( void ) {
+	jsonObject* set = jsonNewObjectType( JSON_ARRAY );
+	int i;
+	for( i = 0; i < BIG_ROWS; ++i )
+		jsonObjectPush( set, make_row( i, 20 ));
+
+	size_t tree_bytes, scan_bytes, direct_bytes;
+	double tree_time = time_responses( respond_by_tree, &set, 1, BIG_RESPONSES, &tree_bytes );
+	double scan_time = time_responses( respond_scan, &set, 1, BIG_RESPONSES, &scan_bytes );
+	double direct_time = time_responses( respond_direct, &set, 1, BIG_RESPONSES,
+		&direct_bytes );
+
+	if( tree_bytes != direct_bytes || scan_bytes != direct_bytes ) {
+		fprintf( stderr, "output differs\n" );
+		exit( 1 );
+	}
+
+	printf( "\n%d rows in one response:\n", BIG_ROWS );
+	printf( "%12s %16s %16s %16s\n", "bytes/resp", "msec/resp (tree)",
+		"msec/resp (scan)", "msec/resp (tally)" );
+	printf( "%12lu %16.2f %16.2f %16.2f\n", (unsigned long) message_size( set ),
+		tree_time * 1e3 / BIG_RESPONSES, scan_time * 1e3 / BIG_RESPONSES,
+		direct_time * 1e3 / BIG_RESPONSES );
+
+	jsonObjectFree( set );
+}
+
+/* The length of the JSON for a RESULT message, for the report */
+static size_t message_size( const jsonObject* row ) {
+	growing_buffer* buf = buffer_init( 1024 );
+	osrfMessage* msg = osrf_message_init( RESULT, 1, 1 );
+	osrf_message_set_status_info( msg, NULL, "OK", OSRF_STATUS_OK );
+	osrfMessageResultToBuffer( msg, row, buf, NULL, NULL );
+	osrfMessageFree( msg );
+	size_t size = buffer_length( buf );
+	buffer_free( buf );
+	return size;
+}
+
+/* Start a new bundle whenever the current one gets big enough to send */
+static void bundle( growing_buffer* outbuf ) {
+	if( buffer_length( outbuf ) >= BUNDLE_SIZE )
+		buffer_reset( outbuf );
+	buffer_add_char( outbuf, buffer_length( outbuf ) ? ',' : '[' );
+}
+
+/*
+	The old way: serialize the response to see how big it is, escaping included.
+	Then clone it into the message, build a tree, and serialize that.
+*/
+static size_t respond_by_tree( const jsonObject* row, growing_buffer* outbuf ) {
+	char* data = jsonObjectToJSON( row );
+	size_t data_size = strlen( data ) + osrfXmlEscapingLength( data );
+	free( data );
+
+	osrfMessage* msg = osrf_message_init( RESULT, 1, 1 );
+	osrf_message_set_status_info( msg, NULL, "OK", OSRF_STATUS_OK );
+	osrf_message_set_result( msg, row );
+
+	jsonObject* tree = osrfMessageToJSON( msg );
+	char* json = jsonObjectToJSON( tree );
+	jsonObjectFree( tree );
+	osrfMessageFree( msg );
+
+	size_t len = strlen( json );
+	bundle( outbuf );
+	buffer_add_n( outbuf, json, len );
+	free( json );
+	return len + data_size;
+}
+
+/* Straight into the bundle, then scan the response for characters XML will escape */
+static size_t respond_scan( const jsonObject* row, growing_buffer* outbuf ) {
+	osrfMessage* msg = osrf_message_init( RESULT, 1, 1 );
+	osrf_message_set_status_info( msg, NULL, "OK", OSRF_STATUS_OK );
+
+	bundle( outbuf );
+	size_t before = buffer_length( outbuf );
+	size_t start;
+	size_t raw_size = osrfMessageResultToBuffer( msg, row, outbuf, &start, NULL );
+	osrfMessageFree( msg );
+	size_t data_size = raw_size + osrfXmlEscapingLength( OSRF_BUFFER_C_STR( outbuf ) + start );
+	return buffer_length( outbuf ) - before + data_size;
+}
+
+/* Straight into the bundle, tallying the XML escaping on the way */
+static size_t respond_direct( const jsonObject* row, growing_buffer* outbuf ) {
+	osrfMessage* msg = osrf_message_init( RESULT, 1, 1 );
+	osrf_message_set_status_info( msg, NULL, "OK", OSRF_STATUS_OK );
+
+	bundle( outbuf );
+	size_t before = buffer_length( outbuf );
+	size_t extra_size = 0;
+	size_t raw_size = osrfMessageResultToBuffer( msg, row, outbuf, NULL, &extra_size );
+	osrfMessageFree( msg );
+	return buffer_length( outbuf ) - before + raw_size + extra_size;
+}
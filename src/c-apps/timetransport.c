@@ -0,0 +1,171 @@
+/*
+	Measure the throughput of message_prepare_xml(), and compare the per-message
+	CPU cost of the two ways the router can pass a transport_message along:
+	copying it with message_init(), or handing it to message_forward().  Also
+	compare the two ways a prefork listener can hand a request to a drone:
+	as XML, or packed by message_pack().
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "opensrf/utils.h"
+#include "opensrf/transport_message.h"
+
+static double cpu_seconds( void );
+static char* make_body( size_t size );
+static double time_prepare( const char* body, int count );
+static double time_copy( const char* body, int count );
+static double time_forward( const char* body, int count );
+static double time_handoff( const char* body, int count, int packed );
+
+int main( void ) {
+
+	static const struct { size_t size; int count; } runs[] = {
+		{ 1024, 20000 },
+		{ 65536, 2000 },
+		{ 4194304, 20 }
+	};
+
+	int i;
+	for( i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i ) {
+		char* body = make_body( runs[i].size );
+		double prepare = time_prepare( body, runs[i].count );
+		printf( "%8lu byte body: message_prepare_xml %10.2f usec/msg, %8.1f MB/sec\n",
+				(unsigned long) runs[i].size, prepare * 1e6 / runs[i].count,
+				runs[i].size * (double) runs[i].count / prepare / 1e6 );
+		free( body );
+	}
+
+	for( i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i ) {
+		char* body = make_body( runs[i].size );
+		double copy = time_copy( body, runs[i].count );
+		double forward = time_forward( body, runs[i].count );
+		printf( "%8lu byte body: copy %10.2f usec/msg, forward %10.2f usec/msg\n",
+				(unsigned long) runs[i].size, copy * 1e6 / runs[i].count,
+				forward * 1e6 / runs[i].count );
+		free( body );
+	}
+
+	for( i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i ) {
+		char* body = make_body( runs[i].size );
+		double xml = time_handoff( body, runs[i].count, 0 );
+		double packed = time_handoff( body, runs[i].count, 1 );
+		printf( "%8lu byte body: handoff as xml %10.2f usec/msg, packed %10.2f usec/msg\n",
+				(unsigned long) runs[i].size, xml * 1e6 / runs[i].count,
+				packed * 1e6 / runs[i].count );
+		free( body );
+	}
+
+	return 0;
+}
+
+static double cpu_seconds( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A JSON-ish body with the usual sprinkling of characters that need escaping */
+static char* make_body( size_t size ) {
+	static const char pattern[] =
+		"{\"__c\":\"osrfMessage\",\"__p\":{\"type\":\"REQUEST\",\"payload\":"
+		"[\"a < b && c > d\"]}},";
+	char* body = safe_malloc( size + 1 );
+	size_t i;
+	for( i = 0; i < size; ++i )
+		body[i] = pattern[ i % (sizeof(pattern) - 1) ];
+	body[size] = '\0';
+	return body;
+}
+
+/* Serialize a message with a freshly built body */
+static double time_prepare( const char* body, int count ) {
+	double elapsed = 0.0;
+	int i;
+	for( i = 0; i < count; ++i ) {
+		transport_message* msg = message_init( body, "", "thread", "drone@host/svc_1",
+				"client@host/res" );
+		message_set_router_info( msg, "client@host/res", NULL, NULL, NULL, 0 );
+		message_set_osrf_xid( msg, "xid" );
+
+		double begin = cpu_seconds();
+		message_prepare_xml( msg );
+		elapsed += cpu_seconds() - begin;
+
+		message_free( msg );
+	}
+	return elapsed;
+}
+
+/* What the router used to do: copy the message */
+static double time_copy( const char* body, int count ) {
+	double elapsed = 0.0;
+	int i;
+	for( i = 0; i < count; ++i ) {
+		transport_message* msg = message_init( body, "", "thread", "router@host/svc",
+				"client@host/res" );
+		message_set_osrf_xid( msg, "xid" );
+
+		double begin = cpu_seconds();
+		transport_message* new_msg = message_init( msg->body, msg->subject, msg->thread,
+				"drone@host/svc_1", msg->sender );
+		message_set_router_info( new_msg, msg->sender, NULL, NULL, NULL, 0 );
+		message_set_osrf_xid( new_msg, msg->osrf_xid );
+		message_prepare_xml( new_msg );
+		elapsed += cpu_seconds() - begin;
+
+		message_free( new_msg );
+		message_free( msg );
+	}
+	return elapsed;
+}
+
+/* What the router does now */
+static double time_forward( const char* body, int count ) {
+	double elapsed = 0.0;
+	int i;
+	for( i = 0; i < count; ++i ) {
+		transport_message* msg = message_init( body, "", "thread", "router@host/svc",
+				"client@host/res" );
+		message_set_osrf_xid( msg, "xid" );
+
+		double begin = cpu_seconds();
+		transport_message* new_msg = message_forward( msg, "drone@host/svc_1", msg->sender );
+		message_prepare_xml( new_msg );
+		elapsed += cpu_seconds() - begin;
+
+		message_free( new_msg );
+		message_free( msg );
+	}
+	return elapsed;
+}
+
+/* Encode a request in the listener and decode it in the drone */
+static double time_handoff( const char* body, int count, int packed ) {
+	double elapsed = 0.0;
+	int i;
+	for( i = 0; i < count; ++i ) {
+		transport_message* msg = message_init( body, "", "thread", "svc_listener@host/res",
+				"router@host/router" );
+		message_set_router_info( msg, "client@host/res", NULL, NULL, NULL, 0 );
+		message_set_osrf_xid( msg, "xid" );
+
+		double begin = cpu_seconds();
+		transport_message* received;
+		if( packed ) {
+			size_t size;
+			char* data = message_pack( msg, &size );
+			received = new_message_from_packed( data, size );
+			free( data );
+		} else {
+			message_prepare_xml( msg );
+			received = new_message_from_xml( msg->msg_xml );
+		}
+		elapsed += cpu_seconds() - begin;
+
+		message_free( received );
+		message_free( msg );
+	}
+	return elapsed;
+}
@@ -341,7 +341,11 @@ static char* osrfHttpTranslatorParseRequest(osrfHttpTranslator* trans) {
 
 static int osrfHttpTranslatorCheckStatus(osrfHttpTranslator* trans, transport_message* msg) {
     osrfMessage* omsgList[MAX_MSGS_PER_PACKET];
-    int numMsgs = osrf_message_deserialize(msg->body, omsgList, MAX_MSGS_PER_PACKET);
+    int numMsgs;
+    if(msg->body_json)
+        numMsgs = osrfMessageDeserializeJSON(msg->body_json, omsgList, MAX_MSGS_PER_PACKET);
+    else
+        numMsgs = osrf_message_deserialize(msg->body, omsgList, MAX_MSGS_PER_PACKET);
     osrfLogDebug(OSRF_LOG_MARK, "parsed %d response messages", numMsgs);
     if(numMsgs == 0) return 0;
 
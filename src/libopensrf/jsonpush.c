@@ -60,6 +60,14 @@ typedef enum {
 	PP_ERROR             // encountered invalid JSON; can't continue
 } PPState;
 
+/**
+	True for a character that can appear in a string literal as itself: anything but a
+	quotation mark, a backslash, or a control character.  Bytes of multibyte UTF-8
+	characters qualify.
+*/
+#define PP_PLAIN_CHAR(c) ( (unsigned char) (c) >= 0x20 && (c) != 0x7F \
+	&& (c) != '\"' && (c) != '\\' )
+
 struct StateNodeStruct;
 typedef struct StateNodeStruct StateNode;
 
@@ -159,12 +167,21 @@ JSONPushParser* jsonNewPushParser( const JSONHandlerMap* map, void* blob )
 	This function makes it possible to reuse the same parser for multiple documents, e.g.
 	multiple input files, without having to destroy and recreate it.  The expectation is
 	that it be called after jsonPush() returns.
+
+	The previous document need not have been complete.  Any levels of nesting left open
+	are abandoned, and their StateNodes go back to the free list.
 */
 void jsonPushParserReset( JSONPushParser* parser ) {
 	if( parser ) {
+		while( parser->state_stack )
+			pop_pp_state( parser );
+		osrfStringArrayClear( parser->keylist );
+		buffer_reset( parser->buf );
 		parser->line = 1;
 		parser->pos = 1;
 		parser->state = PP_BEGIN;
+		parser->again = '\0';
+		parser->word_idx = 0;
 	}
 }
 
@@ -364,6 +381,18 @@ int jsonPush( JSONPushParser* parser, const char* str, size_t length ) {
 				rc = do_begin( parser, str[i] );
 				break;
 			case PP_STR :
+				if( ! parser->again ) {
+					// Copy a run of plain characters in one go.  Leave the
+					// last one for do_str(), so that we advance as usual.
+					size_t run = 0;
+					while( i + run < length && PP_PLAIN_CHAR( str[ i + run ] ) )
+						++run;
+					if( run > 1 ) {
+						buffer_add_n( parser->buf, str + i, run - 1 );
+						i += run - 1;
+						parser->pos += run - 1;
+					}
+				}
 				rc = do_str( parser, str[i] );
 				break;
 			case PP_SLASH :
@@ -528,7 +557,7 @@ static int do_str    ( JSONPushParser* parser, char c ) {
 		}
 	} else if( '\\' == c ) {
 		parser->state = PP_SLASH;       // Handle an escaped special character
-	} else if( iscntrl( (unsigned char) c ) || ! isprint( (unsigned char) c ) ) {
+	} else if( ! PP_PLAIN_CHAR( c ) ) {
 		report_pp_error( parser, "Illegal character 0x%02X in string literal",
 			(unsigned int) c );
 		rc = 1;
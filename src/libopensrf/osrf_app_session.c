@@ -6,9 +6,16 @@
 #include <time.h>
 #include "opensrf/osrf_app_session.h"
 #include "opensrf/osrf_stack.h"
+#include "opensrf/osrf_cbor.h"
 
 static char* current_ingress = NULL;
 
+/** Boolean: true if we read, and send when asked, message bodies encoded as CBOR. */
+static int cbor_enabled = 0;
+
+/** Boolean: true if we ask for chunked results as raw chunks, and send them so when asked. */
+static int raw_chunks_enabled = 0;
+
 struct osrf_app_request_struct {
 	/** The controlling session. */
 	struct osrf_app_session_struct* session;
@@ -23,25 +30,55 @@ struct osrf_app_request_struct {
 	osrfMessage* payload;
 	/** Linked list of responses to the request. */
 	osrfMessage* result;
+	/** The last message in the list of responses, so that we can append in constant time. */
+	osrfMessage* result_tail;
+
+	/** If not NULL, receives each response as it arrives, instead of the list. */
+	osrfResultHandler handler;
+	/** Passed to the handler. */
+	void* handler_data;
+	/** How many responses we have passed to the handler. */
+	unsigned long handled;
 
     /** Buffer used to collect partial response messages */
     growing_buffer* part_response_buffer;
 
+	/** Collects a result arriving as raw chunks.  It may outgrow a growing_buffer. */
+	char* chunk_data;
+	/** How many bytes of raw chunks we have received for the current result. */
+	size_t chunk_offset;
+	/** How many bytes chunk_data has room for. */
+	size_t chunk_alloc;
+	/** Boolean: true if a raw chunk has gone missing, or come out of order. */
+	int chunk_failed;
+
 	/** Boolean; if true, then a call that is waiting on a response will reset the
 	timeout and set this variable back to false. */
 	int reset_timeout;
-	/** Linkage pointers for a linked list.  We maintain a hash table of pending requests,
-	    and each slot of the hash table is a doubly linked list. */
-	osrfAppRequest* next;
-	osrfAppRequest* prev;
 };
 
-static inline unsigned int request_id_hash( int req_id );
+/** The fewest slots that a session's table of pending requests may have. */
+#define REQUEST_TABLE_MIN_SLOTS 16
+
+static inline unsigned int request_distance( const osrfAppSession* session,
+		const osrfAppRequest* req, unsigned int index );
+static int find_request_slot( const osrfAppSession* session, int req_id );
+static void place_app_request( osrfAppSession* session, osrfAppRequest* req );
+static void grow_request_table( osrfAppSession* session );
 static osrfAppRequest* find_app_request( const osrfAppSession* session, int req_id );
+static osrfMessage* _osrf_app_request_dequeue( osrfAppRequest* req );
+static void _osrf_app_request_finish_chunks( osrfAppRequest* req, osrfMessage* result );
 static void add_app_request( osrfAppSession* session, osrfAppRequest* req );
 
 /* Send the given message */
 static int _osrf_app_session_send( osrfAppSession*, osrfMessage* msg );
+static int prepare_to_send( osrfAppSession* session, const osrfMessage* msg );
+static int send_body( osrfAppSession* session, const char* body, const char* note );
+static size_t chunk_length( const char* payload, size_t size, size_t chunk_size );
+
+/* Wait on several requests at once */
+static int wait_for_requests( osrfAppRequestHandle* handles, int count, int timeout_ms,
+		int all );
 
 static int osrfAppSessionMakeLocaleRequest(
 		osrfAppSession* session, const jsonObject* params, const char* method_name,
@@ -76,10 +113,16 @@ static osrfAppRequest* _osrf_app_request_init(
 	req->complete       = 0;
 	req->payload        = msg;
 	req->result         = NULL;
+	req->result_tail    = NULL;
+	req->handler        = NULL;
+	req->handler_data   = NULL;
+	req->handled        = 0;
 	req->reset_timeout  = 0;
-	req->next           = NULL;
-	req->prev           = NULL;
 	req->part_response_buffer = NULL;
+	req->chunk_data     = NULL;
+	req->chunk_offset   = 0;
+	req->chunk_alloc    = 0;
+	req->chunk_failed   = 0;
 
 	return req;
 }
@@ -105,6 +148,8 @@ static void _osrf_app_request_free( osrfAppRequest * req ) {
         if (req->part_response_buffer)
             buffer_free(req->part_response_buffer);
 
+		free( req->chunk_data );
+
 		free( req );
 	}
 }
@@ -114,12 +159,22 @@ static void _osrf_app_request_free( osrfAppRequest * req ) {
 	@param req Pointer to the osrfAppRequest for the original REQUEST message.
 	@param result Pointer to an osrfMessage received in response to the request.
 
-	For each osrfAppRequest we maintain a linked list of response messages, and traverse
-	it to find the end.
+	A partial RESULT carries a piece of a chunked result, which we collect.  The message
+	that ends a chunked result (whether its pieces came as partial RESULTs or as raw
+	chunks) becomes a RESULT carrying the whole thing.
+
+	For each osrfAppRequest we maintain a linked list of response messages, and a pointer
+	to the end of it.  If the request has a result handler, we pass the message to the
+	handler instead, and it never goes into the list.
+
+	Either way the message belongs to the request now.  A message that we absorb into a
+	chunked response, or can't use at all, we free.
 */
 static void _osrf_app_request_push_queue( osrfAppRequest* req, osrfMessage* result ){
-	if(req == NULL || result == NULL)
+	if(req == NULL || result == NULL) {
+		osrfMessageFree( result );
 		return;
+	}
 
     if (result->status_code == OSRF_STATUS_PARTIAL) {
         osrfLogDebug(OSRF_LOG_MARK, "received partial message response");
@@ -141,11 +196,16 @@ static void _osrf_app_request_push_queue( osrfAppRequest* req, osrfMessage* resu
             buffer_add(req->part_response_buffer, partial);
         }
 
-        // all done.  req and result are freed by the caller
+        // all done with this piece
+        osrfMessageFree(result);
         return;
 
     } else if (result->status_code == OSRF_STATUS_NOCONTENT) {
-        if (req->part_response_buffer && req->part_response_buffer->n_used) {
+        if (req->chunk_offset || req->chunk_failed) {
+            // the result came as raw chunks
+            _osrf_app_request_finish_chunks(req, result);
+
+        } else if (req->part_response_buffer && req->part_response_buffer->n_used) {
 
             // part_response_buffer contains a stitched-together JSON string
             osrfLogDebug(OSRF_LOG_MARK, 
@@ -165,108 +225,244 @@ static void _osrf_app_request_push_queue( osrfAppRequest* req, osrfMessage* resu
         } else {
             osrfLogDebug(OSRF_LOG_MARK, 
                 "Received OSRF_STATUS_NOCONTENT with no preceeding content");
+            osrfMessageFree(result);
             return;
         }
     }
 
+	if( req->handler ) {
+		osrfLogDebug( OSRF_LOG_MARK, "App Session passing result [%d] to result handler",
+				result->thread_trace );
+		if( result->sender_locale )
+			osrf_app_session_set_locale( req->session, result->sender_locale );
+		++req->handled;
+		req->handler( req->session, result, req->handler_data );
+		return;
+	}
+
 	osrfLogDebug( OSRF_LOG_MARK, "App Session pushing request [%d] onto request queue",
 			result->thread_trace );
 
-	if(req->result == NULL) {
+	result->next = NULL;
+	if(req->result == NULL)
 		req->result = result;   // Add the first node
+	else
+		req->result_tail->next = result;
+	req->result_tail = result;
+}
 
-	} else {
+/**
+	@brief Install a result received as raw chunks in the message that ends it.
+	@param req Pointer to the osrfAppRequest for the original REQUEST message.
+	@param result Pointer to the osrfMessage that ends the chunked result.
 
-		// Find the last node in the list, and append the new node to it
-		osrfMessage* ptr = req->result;
-		osrfMessage* ptr2 = req->result->next;
-		while( ptr2 ) {
-			ptr = ptr2;
-			ptr2 = ptr2->next;
-		}
-		ptr->next = result;
+	The raw chunks are plain JSON, so one pass of the parser turns them into the result.
+	If a chunk went missing, or the JSON is invalid, the message becomes an exception
+	instead.  Either way, get ready for another result.
+*/
+static void _osrf_app_request_finish_chunks( osrfAppRequest* req, osrfMessage* result ) {
+	int ok = 0;
+	if( req->chunk_failed )
+		osrfLogError( OSRF_LOG_MARK, "Raw chunks for request %d went missing",
+			req->request_id );
+	else {
+		osrfLogDebug( OSRF_LOG_MARK, "raw chunked response complete, parsing %lu bytes",
+			(unsigned long) req->chunk_offset );
+		osrf_message_set_result_content( result, req->chunk_data );
+		if( result->_result_content )
+			ok = 1;
+		else
+			osrfLogError( OSRF_LOG_MARK, "Raw chunks for request %d are not valid JSON",
+				req->request_id );
+	}
+
+	if( ok )
+		osrf_message_set_status_info( result, NULL, "OK", OSRF_STATUS_OK );
+	else {
+		osrf_message_set_status_info( result, "osrfMethodException",
+			"Chunked response incomplete or invalid", OSRF_STATUS_INTERNALSERVERERROR );
+		result->is_exception = 1;
+	}
+
+	// A big result leaves a big buffer; don't keep it around
+	free( req->chunk_data );
+	req->chunk_data = NULL;
+	req->chunk_offset = 0;
+	req->chunk_alloc = 0;
+	req->chunk_failed = 0;
+}
+
+/**
+	@brief Remove the first message from the list of responses to a request.
+	@param req Pointer to the osrfAppRequest.
+	@return Pointer to the first message, or NULL if the list is empty.
+
+	The calling code is responsible for freeing the message.
+*/
+static osrfMessage* _osrf_app_request_dequeue( osrfAppRequest* req ) {
+	osrfMessage* msg = req->result;
+	if( msg ) {
+		req->result = msg->next;
+		if( NULL == req->result )
+			req->result_tail = NULL;
+		msg->next = NULL;
 	}
+	return msg;
 }
 
 /**
 	@brief Remove an osrfAppRequest (identified by request_id) from an osrfAppSession.
 	@param session Pointer to the osrfAppSession that owns the osrfAppRequest.
 	@param req_id request_id of the osrfAppRequest to be removed.
+
+	The requests that follow it in the table, out of their home slots, move back one slot
+	each, so that nothing is left to mark the gap.
 */
 void osrf_app_session_request_finish( osrfAppSession* session, int req_id ) {
 
 	if( session ) {
-		// Search the hash table for the request in question
-		unsigned int index = request_id_hash( req_id );
-		osrfAppRequest* old_req = session->request_hash[ index ];
-		while( old_req ) {
-			if( old_req->request_id == req_id )
-				break;
-			else
-				old_req = old_req->next;
+		int index = find_request_slot( session, req_id );
+		if( index < 0 )
+			return;
+
+		_osrf_app_request_free( session->requests[ index ] );
+		--session->request_count;
+
+		unsigned int mask = session->request_slots - 1;
+		unsigned int hole = (unsigned int) index;
+		unsigned int next = ( hole + 1 ) & mask;
+		osrfAppRequest* req;
+		while( ( req = session->requests[ next ] ) && request_distance( session, req, next ) ) {
+			session->requests[ hole ] = req;
+			hole = next;
+			next = ( next + 1 ) & mask;
 		}
+		session->requests[ hole ] = NULL;
+	}
+}
 
-		if( old_req ) {
-			// Remove the request from the doubly linked list
-			if( old_req->prev )
-				old_req->prev->next = old_req->next;
-			else
-				session->request_hash[ index ] = old_req->next;
-
-			if( old_req->next )
-				old_req->next->prev = old_req->prev;
+/**
+	@brief How far a request in the table of pending requests is from its home slot.
+	@param session Pointer to the osrfAppSession that owns the table.
+	@param req Pointer to the osrfAppRequest.
+	@param index The slot where the request is, or might be put.
+	@return How many slots past its home slot that is.
 
-			_osrf_app_request_free( old_req );
-		}
-	}
+	A request's home slot is selected by the low bits of its request id.
+*/
+static inline unsigned int request_distance( const osrfAppSession* session,
+		const osrfAppRequest* req, unsigned int index ) {
+	return ( index - (unsigned int) req->request_id ) & ( session->request_slots - 1 );
 }
 
 /**
-	@brief Derive a hash key from a request id.
-	@param req_id The request id.
-	@return The corresponding hash key; an index into request_hash[].
+	@brief Find the slot holding a given request in the table of pending requests.
+	@param session Pointer to the relevant osrfAppSession.
+	@param req_id The request_id of the osrfAppRequest being sought.
+	@return The index of the slot if found, or -1 if not.
+
+	A client numbers its requests in sequence, so the pending ones nearly always sit in
+	their home slots, and a lookup touches one slot whether it finds the request or not.
 
-	If OSRF_REQUEST_HASH_SIZE is a power of two, then this calculation should
-	reduce to a binary AND.
+	Should a request be displaced, we probe forward from its home slot.  Since no request
+	is ever further from home than one that it displaced (see place_app_request()), we
+	can stop at an empty slot, or at a request closer to home than the one we're seeking
+	would be.
 */
-static inline unsigned int request_id_hash( int req_id ) {
-	return ((unsigned int) req_id ) % OSRF_REQUEST_HASH_SIZE;
+static int find_request_slot( const osrfAppSession* session, int req_id ) {
+	if( 0 == session->request_count )
+		return -1;
+
+	unsigned int mask = session->request_slots - 1;
+	unsigned int index = (unsigned int) req_id & mask;
+	unsigned int distance = 0;
+	osrfAppRequest* req;
+	while( ( req = session->requests[ index ] ) ) {
+		if( req->request_id == req_id )
+			return (int) index;
+		else if( request_distance( session, req, index ) < distance )
+			break;
+		index = ( index + 1 ) & mask;
+		++distance;
+	}
+
+	return -1;
 }
 
 /**
-	@brief Search for an osrfAppRequest in the hash table, given a request id.
+	@brief Search for an osrfAppRequest in the table of pending requests, given a request id.
 	@param session Pointer to the relevant osrfAppSession.
 	@param req_id The request_id of the osrfAppRequest being sought.
 	@return A pointer to the osrfAppRequest if found, or NULL if not.
 */
 static osrfAppRequest* find_app_request( const osrfAppSession* session, int req_id ) {
+	int index = find_request_slot( session, req_id );
+	return index < 0 ? NULL : session->requests[ index ];
+}
 
-	osrfAppRequest* req = session->request_hash[ request_id_hash( req_id) ];
-	while( req ) {
-		if( req->request_id == req_id )
-			break;
-		else
-			req = req->next;
+/**
+	@brief Put a request in the table of pending requests.
+	@param session Pointer to the session to which the request belongs.
+	@param req Pointer to the osrfAppRequest to be stored.
+
+	Probe forward from the request's home slot to an empty one.  On the way, wherever we
+	find a request closer to its home than ours would be, put ours there, and carry on
+	with the one it displaced.  That keeps every request as close to home as the others
+	allow.
+
+	The caller is responsible for making sure that there's room.
+*/
+static void place_app_request( osrfAppSession* session, osrfAppRequest* req ) {
+	unsigned int mask = session->request_slots - 1;
+	unsigned int index = (unsigned int) req->request_id & mask;
+	unsigned int distance = 0;
+	osrfAppRequest* resident;
+	while( ( resident = session->requests[ index ] ) ) {
+		unsigned int resident_distance = request_distance( session, resident, index );
+		if( resident_distance < distance ) {
+			session->requests[ index ] = req;
+			req = resident;
+			distance = resident_distance;
+		}
+		index = ( index + 1 ) & mask;
+		++distance;
 	}
+	session->requests[ index ] = req;
+}
 
-	return req;
+/**
+	@brief Double the size of the table of pending requests, or create it.
+	@param session Pointer to the session that owns the table.
+*/
+static void grow_request_table( osrfAppSession* session ) {
+	osrfAppRequest** old_requests = session->requests;
+	unsigned int old_slots = session->request_slots;
+
+	session->request_slots = old_slots ? old_slots * 2 : REQUEST_TABLE_MIN_SLOTS;
+	session->requests = safe_calloc( session->request_slots * sizeof( osrfAppRequest* ) );
+
+	unsigned int i;
+	for( i = 0; i < old_slots; ++i )
+		if( old_requests[ i ] )
+			place_app_request( session, old_requests[ i ] );
+	free( old_requests );
 }
 
 /**
-	@brief Add an osrfAppRequest to the hash table of a given osrfAppSession.
+	@brief Add an osrfAppRequest to the table of pending requests of a given osrfAppSession.
 	@param session Pointer to the session to which the request belongs.
 	@param req Pointer to the osrfAppRequest to be stored.
 
-	Find the right spot in the hash table; then add the request to the linked list at that
-	spot.  We just add it to the head of the list, without trying to maintain any particular
-	ordering.
+	The table is an array of slots, indexed by the low bits of the request id.  We keep it
+	no more than three quarters full, doubling it as needed, so that however many requests
+	are pending, finding one costs about the same.
 */
 static void add_app_request( osrfAppSession* session, osrfAppRequest* req ) {
 	if( session && req ) {
-		unsigned int index = request_id_hash( req->request_id );
-		req->next = session->request_hash[ index ];
-		req->prev = NULL;
-		session->request_hash[ index ] = req;
+		if( ( session->request_count + 1 ) * 4 > session->request_slots * 3 )
+			grow_request_table( session );
+		place_app_request( session, req );
+		++session->request_count;
 	}
 }
 
@@ -292,14 +488,14 @@ void osrf_app_session_request_reset_timeout( osrfAppSession* session, int req_id
 /**
 	@brief Fetch the next response message to a given previous request, subject to a timeout.
 	@param req Pointer to the osrfAppRequest representing the request.
-	@param timeout Maxmimum time to wait, in seconds.
+	@param timeout_ms Maxmimum time to wait, in milliseconds.
 
 	@return Pointer to the next osrfMessage for this request, if one is available, or if it
 	becomes available before the end of the timeout; otherwise NULL;
 
 	If there is already a message available in the input queue for this request, dequeue and
-	return it immediately.  Otherwise wait up to timeout seconds until you either get an
-	input message for the specified request, run out of time, or encounter an error.
+	return it immediately.  Otherwise wait up to timeout_ms milliseconds until you either get
+	an input message for the specified request, run out of time, or encounter an error.
 
 	If the only message we receive for this request is a STATUS message with a status code
 	OSRF_STATUS_COMPLETE, then return NULL.  That means that the server has nothing further
@@ -308,33 +504,42 @@ void osrf_app_session_request_reset_timeout( osrfAppSession* session, int req_id
 	You may also receive other messages for other requests, and other sessions.  These other
 	messages will be wholly or partially processed behind the scenes while you wait for the
 	one you want.
+
+	If the request has a result handler, the results go to the handler, and we return
+	NULL when the request is complete.  Each result restarts the timeout.
+
+	We measure the time with the monotonic clock.  When the time is up we look once more,
+	without waiting, before we give up.
 */
-static osrfMessage* _osrf_app_request_recv( osrfAppRequest* req, int timeout ) {
+static osrfMessage* _osrf_app_request_recv( osrfAppRequest* req, int timeout_ms ) {
 
 	if(req == NULL) return NULL;
 
 	if( req->result != NULL ) {
 		/* Dequeue the next message in the list */
-		osrfMessage* tmp_msg = req->result;
-		req->result = req->result->next;
-		return tmp_msg;
+		return _osrf_app_request_dequeue( req );
 	}
 
-	time_t start = time(NULL);
-	time_t remaining = (time_t) timeout;
+	if( timeout_ms < 0 )
+		timeout_ms = 0;
+
+	long long deadline = get_monotonic_millis() + timeout_ms;
+	int remaining = timeout_ms;
+	int last_look = ( 0 == remaining );
+	unsigned long handled = req->handled;
 
 	// Wait repeatedly for input messages until you either receive one for the request
 	// you're interested in, run out of time, or encounter an error.
 	// Wait repeatedly because you may also receive messages for other requests, or for
 	// other sessions, and process them behind the scenes. These are not the messages
 	// you're looking for.
-	while( remaining >= 0 ) {
+	for( ;; ) {
 		/* tell the session to wait for stuff */
-		osrfLogDebug( OSRF_LOG_MARK,  "In app_request receive with remaining time [%d]",
-				(int) remaining );
+		osrfLogDebug( OSRF_LOG_MARK,  "In app_request receive with remaining time [%d ms]",
+				remaining );
 
 
-		osrf_app_session_queue_wait( req->session, 0, NULL );
+		osrf_app_session_queue_wait_ms( req->session, 0, NULL );
 		if(req->session->transport_error) {
 			osrfLogError(OSRF_LOG_MARK, "Transport error in recv()");
 			return NULL;
@@ -343,8 +548,7 @@ static osrfMessage* _osrf_app_request_recv( osrfAppRequest* req, int timeout ) {
 		if( req->result != NULL ) { /* if we received any results for this request */
 			/* dequeue the first message in the list */
 			osrfLogDebug( OSRF_LOG_MARK, "app_request_recv received a message, returning it" );
-			osrfMessage* ret_msg = req->result;
-			req->result = ret_msg->next;
+			osrfMessage* ret_msg = _osrf_app_request_dequeue( req );
 			if (ret_msg->sender_locale)
 				osrf_app_session_set_locale(req->session, ret_msg->sender_locale);
 
@@ -354,7 +558,7 @@ static osrfMessage* _osrf_app_request_recv( osrfAppRequest* req, int timeout ) {
 		if( req->complete )
 			return NULL;
 
-		osrf_app_session_queue_wait( req->session, (int) remaining, NULL );
+		osrf_app_session_queue_wait_ms( req->session, remaining, NULL );
 
 		if(req->session->transport_error) {
 			osrfLogError(OSRF_LOG_MARK, "Transport error in recv()");
@@ -364,8 +568,7 @@ static osrfMessage* _osrf_app_request_recv( osrfAppRequest* req, int timeout ) {
 		if( req->result != NULL ) { /* if we received any results for this request */
 			/* dequeue the first message in the list */
 			osrfLogDebug( OSRF_LOG_MARK,  "app_request_recv received a message, returning it");
-			osrfMessage* ret_msg = req->result;
-			req->result = ret_msg->next;
+			osrfMessage* ret_msg = _osrf_app_request_dequeue( req );
 			if (ret_msg->sender_locale)
 				osrf_app_session_set_locale(req->session, ret_msg->sender_locale);
 
@@ -379,17 +582,26 @@ static osrfMessage* _osrf_app_request_recv( osrfAppRequest* req, int timeout ) {
 		if(req->reset_timeout) {
 			// We got a reprieve.  This happens when a client receives a STATUS message
 			// with a status code OSRF_STATUS_CONTINUE.  We restart the timer from the
-			// beginning -- but only once.  We reset reset_timeout to zero. so that a
-			// second attempted reprieve will allow, at most, only one more second.
-			remaining = (time_t) timeout;
+			// beginning.  We reset reset_timeout to zero, so that it takes another
+			// such message to earn another reprieve.
+			deadline = get_monotonic_millis() + timeout_ms;
 			req->reset_timeout = 0;
 			osrfLogDebug( OSRF_LOG_MARK, "Received a timeout reset");
+		} else if( req->handled != handled ) {
+			// The result handler got something, so the server is still at work.  Restart
+			// the timer, as we would for the next call if we were returning results.
+			handled = req->handled;
+			deadline = get_monotonic_millis() + timeout_ms;
+		} else if( last_look )
+			break;
+
+		long long left = deadline - get_monotonic_millis();
+		if( left > 0 ) {
+			remaining = (int) left;
+			last_look = 0;
 		} else {
-			// Subtract the amount of time taken during this loop 
-			// iteration, not the combined time of all iterations.
-			time_t tmp = time(NULL);
-			remaining -= (int) (tmp - start);
-			start = tmp;
+			remaining = 0;
+			last_look = 1;
 		}
 	}
 
@@ -476,6 +688,31 @@ const char* osrfAppSessionGetIngress() {
     return current_ingress;
 }
 
+/**
+	@brief Turn the CBOR encoding of message bodies on or off.
+	@param enabled Boolean: true to turn it on.
+
+	When it's on, our requests and connects tell the server that we can read CBOR, and
+	we send CBOR to any client that tells us the same.  When it's off, we send only JSON.
+	Either way, we can read whatever arrives.
+*/
+void osrfAppSessionSetCBOR( int enabled ) {
+	cbor_enabled = enabled ? 1 : 0;
+}
+
+/**
+	@brief Turn raw chunks of chunked results on or off.
+	@param enabled Boolean: true to turn them on.
+
+	When they're on, our requests and connects tell the server that we can take raw
+	chunks, and we send chunked results as raw chunks to any client that tells us the
+	same.  When they're off, chunked results go as partial RESULT messages, which any
+	peer can read.  Either way, we can read raw chunks that arrive.
+*/
+void osrfAppSessionSetRawChunks( int enabled ) {
+	raw_chunks_enabled = enabled ? 1 : 0;
+}
+
 /**
 	@brief Find the osrfAppSession for a given session id.
 	@param session_id The session id to look for.
@@ -588,6 +825,8 @@ osrfAppSession* osrfAppSessionClientInit( const char* remote_service ) {
 	session->transport_error = 0;
 	session->panic = 0;
 	session->outbuf = NULL;   // Not used by client
+	session->peer_accepts_cbor = 0;
+	session->peer_accepts_raw_chunks = 0;
 
 	#ifdef ASSUME_STATELESS
 	session->stateless = 1;
@@ -612,10 +851,10 @@ osrfAppSession* osrfAppSessionClientInit( const char* remote_service ) {
 	session->userData = NULL;
 	session->userDataFree = NULL;
 
-	// Initialize the hash table
-	int i;
-	for( i = 0; i < OSRF_REQUEST_HASH_SIZE; ++i )
-		session->request_hash[ i ] = NULL;
+	// The table of pending requests starts out empty
+	session->requests = NULL;
+	session->request_slots = 0;
+	session->request_count = 0;
 
 	_osrf_app_session_push_session( session );
 	return session;
@@ -695,13 +934,15 @@ osrfAppSession* osrf_app_server_session_init(
 	session->userDataFree = NULL;
 	session->transport_error = 0;
 
-	// Initialize the hash table
-	int i;
-	for( i = 0; i < OSRF_REQUEST_HASH_SIZE; ++i )
-		session->request_hash[ i ] = NULL;
+	// The table of pending requests starts out empty
+	session->requests = NULL;
+	session->request_slots = 0;
+	session->request_count = 0;
 
 	session->panic = 0;
 	session->outbuf = buffer_init( 4096 );
+	session->peer_accepts_cbor = 0;
+	session->peer_accepts_raw_chunks = 0;
 
 	_osrf_app_session_push_session( session );
 	return session;
@@ -791,6 +1032,8 @@ static int osrfAppSessionMakeLocaleRequest(
 
 	osrfMessage* req_msg = osrf_message_init( REQUEST, ++(session->thread_trace), protocol );
 	osrf_message_set_method(req_msg, method_name);
+	req_msg->accept_cbor = cbor_enabled;
+	req_msg->accept_raw_chunks = raw_chunks_enabled;
 
 	if (locale) {
 		osrf_message_set_locale(req_msg, locale);
@@ -904,14 +1147,123 @@ void osrf_app_session_set_remote( osrfAppSession* session, const char* remote_id
 	@param msg Pointer to the osrfMessage to be added.
 
 	The thread_trace member of the osrfMessage is the request_id of the osrfAppRequest.
-	Find the corresponding request in the session and append the osrfMessage to its list.
+	Find the corresponding request in the session and append the osrfMessage to its list,
+	or pass it to the request's result handler.  If there's no such request, free the
+	osrfMessage.
 */
 void osrf_app_session_push_queue( osrfAppSession* session, osrfMessage* msg ) {
 	if( session && msg ) {
 		osrfAppRequest* req = find_app_request( session, msg->thread_trace );
 		if( req )
 			_osrf_app_request_push_queue( req, msg );
+		else
+			osrfMessageFree( msg );
+	}
+}
+
+/**
+	@brief Feed a raw chunk of a result to the osrfAppRequest that it answers.
+	@param session Pointer to the osrfAppSession that owns the request.
+	@param body Pointer to the message body carrying the chunk.
+
+	The request collects the chunks until the message that ends the result arrives.  A
+	chunk whose offset isn't where the previous one left off spoils the whole result.
+
+	The chunks are not parsed as they arrive.  A jsonBuilder could do that, but it costs
+	more in all than a single pass of the parser at the end, plus the copy of its tree to
+	the heap.
+*/
+void osrf_app_session_push_raw_chunk( osrfAppSession* session, const char* body ) {
+	if( NULL == session )
+		return;
+
+	int req_id;
+	size_t offset;
+	const char* data;
+	size_t len;
+	if( osrfMessageParseRawChunk( body, &req_id, &offset, &data, &len ) ) {
+		osrfLogWarning( OSRF_LOG_MARK, "Dropping an invalid raw chunk" );
+		return;
+	}
+
+	osrfAppRequest* req = find_app_request( session, req_id );
+	if( NULL == req ) {
+		osrfLogWarning( OSRF_LOG_MARK, "Dropping a raw chunk for unknown request %d", req_id );
+		return;
+	} else if( req->chunk_failed )
+		return;
+
+	if( offset != req->chunk_offset ) {
+		osrfLogError( OSRF_LOG_MARK, "Raw chunk for request %d at offset %lu; expected %lu",
+			req_id, (unsigned long) offset, (unsigned long) req->chunk_offset );
+		req->chunk_failed = 1;
+		return;
+	}
+
+	if( req->chunk_offset + len >= req->chunk_alloc ) {
+		size_t alloc = req->chunk_alloc ? req->chunk_alloc * 2 : OSRF_MSG_CHUNK_SIZE + 1;
+		while( req->chunk_offset + len >= alloc )
+			alloc *= 2;
+		char* chunk_data = realloc( req->chunk_data, alloc );
+		if( NULL == chunk_data ) {
+			osrfLogError( OSRF_LOG_MARK, "Out of Memory" );
+			exit( 99 );
+		}
+		req->chunk_data = chunk_data;
+		req->chunk_alloc = alloc;
+	}
+
+	osrfLogDebug( OSRF_LOG_MARK, "adding %lu bytes to raw chunked response",
+		(unsigned long) len );
+	memcpy( req->chunk_data + req->chunk_offset, data, len );
+	req->chunk_offset += len;
+	req->chunk_data[ req->chunk_offset ] = '\0';
+}
+
+/**
+	@brief Have the results of a request passed to a function as they arrive.
+	@param session Pointer to the osrfAppSession that owns the request.
+	@param req_id Request ID of the osrfAppRequest.
+	@param handler Pointer to the function to receive the results, or NULL to queue them
+	as usual.
+	@param data Pointer to be passed to the handler, for the calling code's own use.
+	@return 0 if successful, or -1 if there is no such request.
+
+	Normally the results of a request wait in a queue until osrfAppSessionRequestRecv()
+	returns them one at a time.  For a method that streams back a great many results, the
+	queue can grow large if they arrive faster than the calling code asks for them.  With
+	a handler, each result goes to the handler as soon as it has been received, and
+	need not be kept any longer than the handler keeps it.
+
+	The handler receives each RESULT message in turn -- including the exception that stands
+	in for an unexpected STATUS.  It owns the message, and must free it with
+	osrfMessageFree().  It must not finish the request, or free the session.
+
+	Any results already queued go to the handler right away.  Thereafter the calling code
+	keeps the results coming by calling osrfAppSessionRequestRecv(), which returns NULL
+	when the request is complete (or when the time runs out between results).
+*/
+int osrfAppSessionSetResultHandler( osrfAppSession* session, int req_id,
+		osrfResultHandler handler, void* data ) {
+	if( NULL == session )
+		return -1;
+
+	osrfAppRequest* req = find_app_request( session, req_id );
+	if( NULL == req )
+		return -1;
+
+	req->handler = handler;
+	req->handler_data = data;
+
+	if( handler ) {
+		osrfMessage* msg;
+		while( ( msg = _osrf_app_request_dequeue( req ) ) ) {
+			++req->handled;
+			handler( session, msg, data );
+		}
 	}
+
+	return 0;
 }
 
 /**
@@ -939,6 +1291,8 @@ int osrfAppSessionConnect( osrfAppSession* session ) {
 
 	/* defaulting to protocol 1 for now */
 	osrfMessage* con_msg = osrf_message_init( CONNECT, session->thread_trace, 1 );
+	con_msg->accept_cbor = cbor_enabled;
+	con_msg->accept_raw_chunks = raw_chunks_enabled;
 
 	// Address this message to the router
 	osrf_app_session_reset_remote( session );
@@ -948,18 +1302,18 @@ int osrfAppSessionConnect( osrfAppSession* session ) {
 	if(ret)
 		return 0;
 
-	time_t start = time(NULL);
-	time_t remaining = (time_t) timeout;
+	long long remaining = timeout_seconds_to_millis( timeout );
+	long long deadline = get_monotonic_millis() + remaining;
 
 	// Wait for the acknowledgement.  We look for it repeatedly because, under the covers,
 	// we may receive and process messages other than the one we're looking for.
-	while( session->state != OSRF_SESSION_CONNECTED && remaining >= 0 ) {
-		osrf_app_session_queue_wait( session, remaining, NULL );
+	while( session->state != OSRF_SESSION_CONNECTED && remaining > 0 ) {
+		osrf_app_session_queue_wait_ms( session, (int) remaining, NULL );
 		if(session->transport_error) {
 			osrfLogError(OSRF_LOG_MARK, "cannot communicate with %s", session->remote_service);
 			return 0;
 		}
-		remaining -= (int) (time(NULL) - start);
+		remaining = deadline - get_monotonic_millis();
 	}
 
 	if(session->state == OSRF_SESSION_CONNECTED)
@@ -1043,7 +1397,28 @@ static int osrfAppSessionSendBatch( osrfAppSession* session, osrfMessage* msgs[]
 	if( !(session && msgs && size > 0) ) return -1;
 	int retval = 0;
 
-	osrfMessage* msg = msgs[0];
+	if( prepare_to_send( session, msgs[0] ))
+		return -1;
+
+	// Translate the collection of osrfMessages into a JSON array
+	char* string = osrfMessageSerializeBatch(msgs, size);
+
+	// Send the JSON as the payload of a transport_message
+	if( string ) {
+		retval = osrfSendTransportPayload( session, string );
+		free(string);
+	}
+
+	return retval;
+}
+
+/**
+	@brief Get an osrfAppSession ready to send a message.
+	@param session Pointer to the osrfAppSession responsible for sending the message.
+	@param msg Pointer to the first (or only) osrfMessage to be sent; may be NULL.
+	@return 0 upon success, or -1 if we needed to connect and couldn't.
+*/
+static int prepare_to_send( osrfAppSession* session, const osrfMessage* msg ) {
 
 	if(msg) {
 
@@ -1073,16 +1448,35 @@ static int osrfAppSessionSendBatch( osrfAppSession* session, osrfMessage* msgs[]
 		}
 	}
 
-	// Translate the collection of osrfMessages into a JSON array
-	char* string = osrfMessageSerializeBatch(msgs, size);
+	return 0;
+}
 
-	// Send the JSON as the payload of a transport_message
-	if( string ) {
-		retval = osrfSendTransportPayload( session, string );
-		free(string);
+/**
+	@brief Decide how much of a payload to send in the next chunk.
+	@param payload Pointer to the rest of the payload.
+	@param size Length of the rest of the payload.
+	@param chunk_size The most we want to send in a chunk.
+	@return The length of the next chunk.
+
+	A chunk may not end in the middle of a UTF-8 character, lest the character be lost.
+	So we back up to the start of the character -- or if one character takes up the whole
+	chunk, we go on to the end of it.
+*/
+static size_t chunk_length( const char* payload, size_t size, size_t chunk_size ) {
+	if( size <= chunk_size )
+		return size;
+
+	size_t len = chunk_size;
+	while( len > 0 && 0x80 == ( (unsigned char) payload[ len ] & 0xC0 ) )
+		--len;
+
+	if( 0 == len ) {
+		len = chunk_size;
+		while( len < size && 0x80 == ( (unsigned char) payload[ len ] & 0xC0 ) )
+			++len;
 	}
 
-	return retval;
+	return len;
 }
 
 /**
@@ -1094,49 +1488,60 @@ static int osrfAppSessionSendBatch( osrfAppSession* session, osrfMessage* msgs[]
 	@param chunk_size chunk_size to use
 
 	@return 0 upon success, or -1 upon failure.
+
+	If raw chunks are turned on (see osrfAppSessionSetRawChunks()), and the client can take
+	them, the chunks go as raw chunks: slices of the payload as is, each with its offset
+	and length.  Otherwise each chunk is a partial RESULT message, with its slice of the
+	payload escaped into a JSON string.  Either way, a final RESULT message tells the
+	client that the chunked result is complete.
 */
 int osrfSendChunkedResult(
         osrfAppSession* session, int request_id, const char* payload,
         size_t payload_size, size_t chunk_size ) {
 
 	// chunking payload
-	int i;
-	for (i = 0; i < payload_size; i += chunk_size) {
-		osrfMessage* msg = osrf_message_init(RESULT, request_id, 1);
-		osrf_message_set_status_info(msg,
-			"osrfResultPartial",
-			"Partial Response",
-			OSRF_STATUS_PARTIAL
-		);
-
-		// see how long this chunk is.  If this is the last
-		// chunk, it will likely be less than chunk_size
-		int partial_size = strlen(&payload[i]);
-		if (partial_size > chunk_size)
-			partial_size = chunk_size;
-
-		// substr(data, i, partial_size)
-		char partial_buf[partial_size + 1];
-		memcpy(partial_buf, &payload[i], partial_size);
-		partial_buf[partial_size] = '\0';
-
-		// package the partial chunk as a JSON string object
-		jsonObject*  partial_obj = jsonNewObject(partial_buf);
-		osrf_message_set_result(msg, partial_obj);
-		jsonObjectFree(partial_obj);
-
-		// package the osrf message within an array then
-		// serialize to json for delivery
-		jsonObject* arr = jsonNewObject(NULL);
-
-		// msg json freed when arr is freed
-		jsonObjectPush(arr, osrfMessageToJSON(msg));
-		char* json = jsonObjectToJSON(arr);
-
-		osrfSendTransportPayload(session, json);
-		osrfMessageFree(msg);
-		jsonObjectFree(arr);
-		free(json);
+	growing_buffer* buf = buffer_init( chunk_size + 256 );
+	size_t i;
+	if( raw_chunks_enabled && session->peer_accepts_raw_chunks ) {
+		size_t len;
+		for( i = 0; i < payload_size; i += len ) {
+			len = chunk_length( payload + i, payload_size - i, chunk_size );
+			buffer_reset( buf );
+			osrfMessageRawChunkToBuffer( buf, request_id, i, payload + i, len );
+			send_body( session, OSRF_BUFFER_C_STR( buf ), " as a raw chunk" );
+		}
+	} else {
+		size_t partial_size;
+		for (i = 0; i < payload_size; i += partial_size) {
+			osrfMessage* msg = osrf_message_init(RESULT, request_id, 1);
+			osrf_message_set_status_info(msg,
+				"osrfResultPartial",
+				"Partial Response",
+				OSRF_STATUS_PARTIAL
+			);
+
+			// see how long this chunk is.  If this is the last
+			// chunk, it will likely be less than chunk_size.
+			// The payload may be a slice of a larger buffer, so
+			// go by payload_size rather than by a terminal nul.
+			partial_size = chunk_length(&payload[i], payload_size - i, chunk_size);
+
+			// package the partial chunk as a JSON string object
+			char* partial_buf = strndup(&payload[i], partial_size);
+			jsonObject* partial_obj = jsonNewObject(partial_buf);
+			free(partial_buf);
+
+			// package the osrf message within an array then
+			// serialize to json for delivery
+			buffer_reset(buf);
+			buffer_add_char(buf, '[');
+			osrfMessageResultToBuffer(msg, partial_obj, buf, NULL, NULL);
+			buffer_add_char(buf, ']');
+
+			osrfSendTransportPayload(session, OSRF_BUFFER_C_STR(buf));
+			osrfMessageFree(msg);
+			jsonObjectFree(partial_obj);
+		}
 	}
 
 	// all chunks sent; send the final partial-complete msg
@@ -1147,13 +1552,13 @@ int osrfSendChunkedResult(
 		OSRF_STATUS_NOCONTENT
 	);
 
-	jsonObject* arr = jsonNewObject(NULL);
-	jsonObjectPush(arr, osrfMessageToJSON(msg));
-	char* json = jsonObjectToJSON(arr);
-	osrfSendTransportPayload(session, json);
+	buffer_reset(buf);
+	buffer_add_char(buf, '[');
+	osrfMessageToBuffer(msg, buf);
+	buffer_add_char(buf, ']');
+	osrfSendTransportPayload(session, OSRF_BUFFER_C_STR(buf));
 	osrfMessageFree(msg);
-	jsonObjectFree(arr);
-	free(json);
+	buffer_free(buf);
 
 	return 0;
 }
@@ -1165,11 +1570,30 @@ int osrfSendChunkedResult(
 	@return 0 upon success, or -1 upon failure.
 
 	In practice the payload is normally a JSON string, but this function assumes nothing
-	about it.
+	about it.  If the peer has asked for CBOR, and we're willing, we send the payload as
+	CBOR instead, provided that it's JSON that translates exactly, and comes out shorter.
 */
 int osrfSendTransportPayload( osrfAppSession* session, const char* payload ) {
+	char* cbor_body = NULL;
+	if( cbor_enabled && session->peer_accepts_cbor )
+		cbor_body = osrfCborBodyFromJSON( payload );
+
+	int retval = send_body( session, cbor_body ? cbor_body : payload,
+		cbor_body ? " as CBOR" : "" );
+	free( cbor_body );
+	return retval;
+}
+
+/**
+	@brief Wrap a message body in a transport message and send it, exactly as is.
+	@param session Pointer to the osrfAppSession responsible for sending the message.
+	@param body The message body.
+	@param note A note on the form of the body, for the log; may be empty.
+	@return 0 upon success.  Upon failure we exit.
+*/
+static int send_body( osrfAppSession* session, const char* body, const char* note ) {
 	transport_message* t_msg = message_init(
-		payload, "", session->session_id, session->remote_id, NULL );
+		body, "", session->session_id, session->remote_id, NULL );
 	message_set_osrf_xid( t_msg, osrfLogGetXid() );
 
 	int retval = client_send_message( session->transport_handle, t_msg );
@@ -1178,10 +1602,10 @@ int osrfSendTransportPayload( osrfAppSession* session, const char* payload ) {
 		exit(99);
 	}
 
-	osrfLogInfo(OSRF_LOG_MARK, "[%s] sent %d bytes of data to %s",
-		session->remote_service, strlen( payload ), t_msg->recipient );
+	osrfLogInfo(OSRF_LOG_MARK, "[%s] sent %d bytes of data to %s%s",
+		session->remote_service, strlen( body ), t_msg->recipient, note );
 
-	osrfLogDebug( OSRF_LOG_MARK, "Sent: %s", payload );
+	osrfLogDebug( OSRF_LOG_MARK, "Sent: %s", body );
 
 	message_free( t_msg );
 	return retval;
@@ -1212,7 +1636,21 @@ static int _osrf_app_session_send( osrfAppSession* session, osrfMessage* msg ){
 	to true; otherwise set it to false.
 	@return 0 upon success (even if a timeout occurs), or -1 upon failure.
 
-	A thin wrapper for osrf_stack_process().  The timeout applies only to the first
+	A wrapper for osrf_app_session_queue_wait_ms(), for a timeout in whole seconds.
+*/
+int osrf_app_session_queue_wait( osrfAppSession* session, int timeout, int* recvd ){
+	return osrf_app_session_queue_wait_ms( session, timeout_seconds_to_millis( timeout ), recvd );
+}
+
+/**
+	@brief Wait for any input messages to arrive, and process them as needed.
+	@param session Pointer to the osrfAppSession whose transport_session we will use.
+	@param timeout_ms How many milliseconds to wait for the first input message.
+	@param recvd Pointer to an boolean int.  If you receive at least one message, set the boolean
+	to true; otherwise set it to false.
+	@return 0 upon success (even if a timeout occurs), or -1 upon failure.
+
+	A thin wrapper for osrf_stack_process_ms().  The timeout applies only to the first
 	message; process subsequent messages if they are available, but don't wait for them.
 
 	The first parameter identifies an osrfApp session, but all we really use it for is to
@@ -1229,10 +1667,10 @@ static int _osrf_app_session_send( osrfAppSession* session, osrfMessage* msg ){
 	relevant request.  A server session receiving a REQUEST message may execute the
 	requested method.  And so forth.
 */
-int osrf_app_session_queue_wait( osrfAppSession* session, int timeout, int* recvd ){
+int osrf_app_session_queue_wait_ms( osrfAppSession* session, int timeout_ms, int* recvd ){
 	if(session == NULL) return 0;
-	osrfLogDebug(OSRF_LOG_MARK, "AppSession in queue_wait with timeout %d", timeout );
-	return osrf_stack_process(session->transport_handle, timeout, recvd);
+	osrfLogDebug(OSRF_LOG_MARK, "AppSession in queue_wait with timeout %d ms", timeout_ms );
+	return osrf_stack_process_ms(session->transport_handle, timeout_ms, recvd);
 }
 
 /**
@@ -1280,16 +1718,12 @@ void osrfAppSessionFree( osrfAppSession* session ){
 	free(session->session_id);
 	free(session->remote_service);
 
-	// Free the request hash
-	int i;
-	for( i = 0; i < OSRF_REQUEST_HASH_SIZE; ++i ) {
-		osrfAppRequest* app = session->request_hash[ i ];
-		while( app ) {
-			osrfAppRequest* next = app->next;
-			_osrf_app_request_free( app );
-			app = next;
-		}
-	}
+	// Free the pending requests
+	unsigned int i;
+	for( i = 0; i < session->request_slots; ++i )
+		if( session->requests[ i ] )
+			_osrf_app_request_free( session->requests[ i ] );
+	free( session->requests );
 
 	if( session->outbuf )
 		buffer_free( session->outbuf );
@@ -1304,15 +1738,166 @@ void osrfAppSessionFree( osrfAppSession* session ){
 	@param timeout How many seconds to wait.
 	@return A pointer to the received osrfMessage if one arrives; otherwise NULL.
 
-	A thin wrapper.  Given a session and a request ID, look up the corresponding request
-	and pass it to _osrf_app_request_recv().
+	A wrapper for osrfAppSessionRequestRecvMs(), for a timeout in whole seconds.
 */
 osrfMessage* osrfAppSessionRequestRecv(
 		osrfAppSession* session, int req_id, int timeout ) {
+	return osrfAppSessionRequestRecvMs( session, req_id, timeout_seconds_to_millis( timeout ) );
+}
+
+/**
+	@brief Wait for a response to a given request, subject to a timeout.
+	@param session Pointer to the osrfAppSession that owns the request.
+	@param req_id Request ID for the request.
+	@param timeout_ms How many milliseconds to wait.
+	@return A pointer to the received osrfMessage if one arrives; otherwise NULL.
+
+	A thin wrapper.  Given a session and a request ID, look up the corresponding request
+	and pass it to _osrf_app_request_recv().
+*/
+osrfMessage* osrfAppSessionRequestRecvMs(
+		osrfAppSession* session, int req_id, int timeout_ms ) {
 	if(req_id < 0 || session == NULL)
 		return NULL;
 	osrfAppRequest* req = find_app_request( session, req_id );
-	return _osrf_app_request_recv( req, timeout );
+	return _osrf_app_request_recv( req, timeout_ms );
+}
+
+/**
+	@brief Wait until any of several requests has something to report.
+	@param handles Array of osrfAppRequestHandles naming the requests.
+	@param count How many handles are in the array.
+	@param timeout How many seconds to wait.
+	@return The index of a handle whose request has a result waiting, or is complete; or
+	-1 if none does within the time, or there's a transport error.
+
+	A wrapper for osrfAppSessionWaitAnyMs(), for a timeout in whole seconds.
+*/
+int osrfAppSessionWaitAny( osrfAppRequestHandle* handles, int count, int timeout ) {
+	return osrfAppSessionWaitAnyMs( handles, count, timeout_seconds_to_millis( timeout ) );
+}
+
+/**
+	@brief Wait until any of several requests has something to report.
+	@param handles Array of osrfAppRequestHandles naming the requests.
+	@param count How many handles are in the array.
+	@param timeout_ms How many milliseconds to wait.
+	@return The index of a handle whose request has a result waiting, or is complete; or
+	-1 if none does within the time, or there's a transport error.
+
+	This is the way to make several requests at once -- of one service or of several --
+	and take the results as they come, instead of waiting for each request in turn.  Send
+	all the requests, then call this function repeatedly.  For each index it returns, call
+	osrfAppSessionRequestRecvMs() with a timeout of zero.  When that returns NULL, the
+	request is complete; set the session of its handle to NULL so that we leave it out.
+
+	A request with a result handler goes to its handler as the results arrive, and we
+	report the request only when it's complete.
+
+	We skip a handle whose session is NULL.  A request that no longer exists (because it
+	has been finished) counts as complete.
+
+	All the sessions must share a transport client, as the client sessions in a process
+	do.  While we wait, we process whatever else arrives for any session.
+*/
+int osrfAppSessionWaitAnyMs( osrfAppRequestHandle* handles, int count, int timeout_ms ) {
+	if( NULL == handles )
+		return -1;
+	return wait_for_requests( handles, count, timeout_ms, 0 );
+}
+
+/**
+	@brief Wait until all of several requests are complete.
+	@param handles Array of osrfAppRequestHandles naming the requests.
+	@param count How many handles are in the array.
+	@param timeout How many seconds to wait.
+	@return 0 if all the requests are complete, or -1 if some aren't within the time, or
+	there's a transport error.
+
+	A wrapper for osrfAppSessionWaitAllMs(), for a timeout in whole seconds.
+*/
+int osrfAppSessionWaitAll( osrfAppRequestHandle* handles, int count, int timeout ) {
+	return osrfAppSessionWaitAllMs( handles, count, timeout_seconds_to_millis( timeout ) );
+}
+
+/**
+	@brief Wait until all of several requests are complete.
+	@param handles Array of osrfAppRequestHandles naming the requests.
+	@param count How many handles are in the array.
+	@param timeout_ms How many milliseconds to wait.
+	@return 0 if all the requests are complete, or -1 if some aren't within the time, or
+	there's a transport error.
+
+	The results wait in each request's queue (or go to its result handler) as usual, for
+	osrfAppSessionRequestRecv() to collect afterwards.  So the time it takes is that of the
+	slowest request, not the sum of them all.
+
+	Handles are treated as for osrfAppSessionWaitAnyMs().
+*/
+int osrfAppSessionWaitAllMs( osrfAppRequestHandle* handles, int count, int timeout_ms ) {
+	if( NULL == handles )
+		return -1;
+	return wait_for_requests( handles, count, timeout_ms, 1 );
+}
+
+/**
+	@brief Wait until any, or all, of several requests are ready.
+	@param handles Array of osrfAppRequestHandles naming the requests.
+	@param count How many handles are in the array.
+	@param timeout_ms How many milliseconds to wait.
+	@param all Boolean: true to wait until all the requests are complete; false to wait
+	until any of them has a result waiting, or is complete.
+	@return For all, 0 if successful; otherwise the index of the handle whose request is
+	ready.  Either way, -1 if we run out of time, or there's a transport error.
+
+	We check the requests before each wait, and wait for whatever arrives next.  When the
+	time is up we look once more, without waiting, before we give up.
+*/
+static int wait_for_requests( osrfAppRequestHandle* handles, int count, int timeout_ms,
+		int all ) {
+
+	long long deadline = get_monotonic_millis() + timeout_ms;
+	int remaining = timeout_ms;
+	int last_look = 0;
+
+	for( ;; ) {
+		// Look for a request that's ready, and for one we're still waiting on
+		osrfAppSession* waiting = NULL;
+		int i;
+		for( i = 0; i < count; ++i ) {
+			if( NULL == handles[ i ].session )
+				continue;
+
+			osrfAppRequest* req = find_app_request( handles[ i ].session,
+					handles[ i ].request_id );
+			if( NULL == req || req->complete || ( !all && req->result ) ) {
+				if( !all )
+					return i;
+			} else if( NULL == waiting )
+				waiting = handles[ i ].session;
+		}
+
+		if( NULL == waiting )
+			return all ? 0 : -1;    // Nothing left to wait on
+		else if( last_look )
+			return -1;              // Out of time
+
+		if( remaining <= 0 ) {
+			remaining = 0;
+			last_look = 1;
+		}
+
+		osrfLogDebug( OSRF_LOG_MARK, "Waiting on %d requests with remaining time [%d ms]",
+				count, remaining );
+		osrf_app_session_queue_wait_ms( waiting, remaining, NULL );
+		if( waiting->transport_error ) {
+			osrfLogError( OSRF_LOG_MARK, "Transport error while waiting on requests" );
+			return -1;
+		}
+
+		long long left = deadline - get_monotonic_millis();
+		remaining = left > 0 ? (int) left : 0;
+	}
 }
 
 /**
@@ -1351,10 +1936,10 @@ int osrfAppRequestRespond( osrfAppSession* ses, int requestId, const jsonObject*
 	@param data Pointer to a jsonObject containing the data payload.
 	@return  Zero in all cases.
 
-	If the @a data parameter is not NULL, translate the jsonObject into a JSON string, and
-	incorporate that string into a RESULT message as as the payload .  Also build a STATUS
-	message indicating that the response is complete.  Send both messages bundled together
-	in the same transport_message.
+	If the @a data parameter is not NULL, translate the jsonObject into a RESULT message.
+	Also build a STATUS message indicating that the response is complete.  Send both
+	messages bundled together in the same transport_message.  A result too big for one
+	message goes out in chunks first, and the STATUS message follows by itself.
 
 	If the @a data parameter is NULL, send only a STATUS message indicating that the response
 	is complete.
@@ -1366,10 +1951,20 @@ int osrfAppRequestRespondComplete(
 	osrf_message_set_status_info( status, "osrfConnectStatus", "Request Complete",
 			OSRF_STATUS_COMPLETE );
 
+	growing_buffer* buf = buffer_init( 256 );
+	OSRF_BUFFER_ADD_CHAR( buf, '[' );
+
 	if (data) {
-		char* json = jsonObjectToJSON(data);
-		size_t raw_size = strlen(json);
-		size_t extra_size = osrfXmlEscapingLength(json);
+		osrfMessage* payload = osrf_message_init( RESULT, requestId, 1 );
+		osrf_message_set_status_info( payload, NULL, "OK", OSRF_STATUS_OK );
+
+		// Size the result, raw and escaped, as we serialize it
+		size_t data_start;
+		size_t extra_size = 0;
+		size_t raw_size = osrfMessageResultToBuffer( payload, data, buf,
+			&data_start, &extra_size );
+		osrfMessageFree( payload );
+
 		size_t data_size = raw_size + extra_size;
 		size_t chunk_size = OSRF_MSG_CHUNK_SIZE;
 
@@ -1380,31 +1975,24 @@ int osrfAppRequestRespondComplete(
 			// chunking -- response message exceeds max message size.
 			// break it up into chunks for partial delivery
 
-			osrfSendChunkedResult(ses, requestId, json, raw_size, chunk_size);
-			osrfAppSessionSendBatch( ses, &status, 1 );
+			osrfSendChunkedResult(ses, requestId,
+				OSRF_BUFFER_C_STR( buf ) + data_start, raw_size, chunk_size);
+			buffer_reset( buf );
+			OSRF_BUFFER_ADD_CHAR( buf, '[' );
 
 		} else {
 			// message doesn't need to be chunked
-			osrfMessage* payload = osrf_message_init( RESULT, requestId, 1 );
-			osrf_message_set_status_info( payload, NULL, "OK", OSRF_STATUS_OK );
-
-			osrf_message_set_result_content( payload, json );
-
-			osrfMessage* ms[2];
-			ms[0] = payload;
-			ms[1] = status;
-
-			osrfAppSessionSendBatch( ses, ms, 2 );
-
-			osrfMessageFree( payload );
+			OSRF_BUFFER_ADD_CHAR( buf, ',' );
 		}
+	}
 
-		free(json);
+	osrfMessageToBuffer( status, buf );
+	OSRF_BUFFER_ADD_CHAR( buf, ']' );
 
-	} else {
-		osrfAppSessionSendBatch( ses, &status, 1 );
-	}
+	if( !prepare_to_send( ses, status ))
+		osrfSendTransportPayload( ses, OSRF_BUFFER_C_STR( buf ));
 
+	buffer_free( buf );
 	osrfMessageFree( status );
 
 	return 0;
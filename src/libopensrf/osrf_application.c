@@ -1,4 +1,5 @@
 #include <opensrf/osrf_application.h>
+#include <opensrf/osrf_prefork.h>
 
 /**
 	@file osrf_application.c
@@ -46,6 +47,8 @@
 #define OSRF_SYSMETHOD_INTROSPECT_ALL_ATOMIC    "opensrf.system.method.all.atomic"
 #define OSRF_SYSMETHOD_ECHO                     "opensrf.system.echo"
 #define OSRF_SYSMETHOD_ECHO_ATOMIC              "opensrf.system.echo.atomic"
+#define OSRF_SYSMETHOD_STATS                    "opensrf.system.stats"
+#define OSRF_SYSMETHOD_STATS_ATOMIC             "opensrf.system.stats.atomic"
 /*@}*/
 
 /**
@@ -111,6 +114,7 @@ static void _osrfAppSetIntrospectMethod( osrfMethodContext* ctx, const osrfMetho
 static int osrfAppIntrospect( osrfMethodContext* ctx );
 static int osrfAppIntrospectAll( osrfMethodContext* ctx );
 static int osrfAppEcho( osrfMethodContext* ctx );
+static int osrfAppStats( osrfMethodContext* ctx );
 static void osrfMethodFree( char* name, void* p );
 static void osrfAppFree( char* name, void* p );
 
@@ -503,6 +507,20 @@ static void register_system_methods( osrfApplication* app ) {
 		"Echos all data sent to the server back to the client. PARAMS([a, b, ...])",
 		0, OSRF_METHOD_SYSTEM | OSRF_METHOD_STREAMING | OSRF_METHOD_ATOMIC,
 		NULL );
+
+	register_method(
+		app, OSRF_SYSMETHOD_STATS, NULL,
+		"Returns the listener's metrics: backlog, time in backlog, and per-child "
+		"request counts and service times. PARAMS()",
+		0, OSRF_METHOD_SYSTEM | OSRF_METHOD_STREAMING,
+		NULL );
+
+	register_method(
+		app, OSRF_SYSMETHOD_STATS, NULL,
+		"Returns the listener's metrics: backlog, time in backlog, and per-child "
+		"request counts and service times. PARAMS()",
+		0, OSRF_METHOD_SYSTEM | OSRF_METHOD_STREAMING | OSRF_METHOD_ATOMIC,
+		NULL );
 }
 
 /**
@@ -681,21 +699,56 @@ static int flush_responses( osrfAppSession* ses, growing_buffer* outbuf ) {
 }
 
 /**
-	@brief Add a message to an output buffer.
+	@brief Begin a new message in an output buffer.
 	@param outbuf Pointer to the output buffer.
-	@param msg Pointer to the message to be added, in the form of a JSON string.
+	@return The offset within the buffer at which the new message begins, counting the
+		bracket or comma that precedes it.
 
 	Since the output buffer is in the form of a JSON array, prepend a left bracket to the
 	first message, and a comma to subsequent ones.
 
 	Used only by servers to respond to clients.
 */
-static inline void append_msg( growing_buffer* outbuf, const char* msg ) {
-	if( outbuf && msg ) {
-		char prefix = buffer_length( outbuf ) > 0 ? ',' : '[';
-		buffer_add_char( outbuf, prefix );
-		buffer_add( outbuf, msg );
+static inline size_t start_msg( growing_buffer* outbuf ) {
+	size_t mark = buffer_length( outbuf );
+	buffer_add_char( outbuf, mark > 0 ? ',' : '[' );
+	return mark;
+}
+
+/**
+	@brief Send the messages in an output buffer that precede a given message.
+	@param ses Pointer to the current application session.
+	@param outbuf Pointer to the output buffer.
+	@param mark Offset of the comma that precedes the message to be kept, as returned by
+		start_msg().
+	@return Zero if successful, or -1 if not.
+
+	Like flush_responses(), except that the message at @a mark, and anything after it,
+	stays behind as the start of the next batch.  We close the JSON array at @a mark just
+	long enough to send what's ahead of it, and then slide the rest down to the front.
+
+	Used only by servers to respond to clients.
+*/
+static int flush_responses_before( osrfAppSession* ses, growing_buffer* outbuf, size_t mark ) {
+
+	osrf_app_session_queue_wait( ses, 0, NULL );
+
+	int rc = 0;
+	char saved[ 2 ] = { outbuf->buf[ mark ], outbuf->buf[ mark + 1 ] };
+	outbuf->buf[ mark ] = ']';
+	outbuf->buf[ mark + 1 ] = '\0';
+	if( osrfSendTransportPayload( ses, OSRF_BUFFER_C_STR( outbuf ))) {
+		osrfLogError( OSRF_LOG_MARK, "Unable to flush response buffer" );
+		rc = -1;
 	}
+	outbuf->buf[ mark ] = saved[ 0 ];
+	outbuf->buf[ mark + 1 ] = saved[ 1 ];
+
+	size_t len = outbuf->n_used - mark;
+	memmove( outbuf->buf, outbuf->buf + mark, len + 1 );  // including the terminal nul
+	outbuf->buf[ 0 ] = '[';
+	outbuf->n_used = len;
+	return rc;
 }
 
 /**
@@ -713,6 +766,11 @@ static inline void append_msg( growing_buffer* outbuf, const char* msg ) {
 	If the method is not atomic, translate the message into JSON and append it to a buffer,
 	flushing the buffer as needed to avoid overflow.  If @a complete is true, append
 	a STATUS message (as JSON) to the buffer and flush the buffer.
+
+	The RESULT message goes straight into the output buffer, in a single pass over the
+	response that also tallies how much the response will grow when escaped for XML.  A
+	response too big for one message is sent in chunks from where it lies, and then dropped
+	from the buffer.
 */
 static int _osrfAppRespond( osrfMethodContext* ctx, const jsonObject* data, int complete ) {
 	if(!(ctx && ctx->method)) return -1;
@@ -732,57 +790,49 @@ static int _osrfAppRespond( osrfMethodContext* ctx, const jsonObject* data, int
 		osrfLogDebug( OSRF_LOG_MARK,
 			"Adding responses to stash for method %s", ctx->method->name );
 
-		if( data ) {
-            char* data_str = jsonObjectToJSON(data); // free me (below)
-            size_t raw_size = strlen(data_str);
-            size_t extra_size = osrfXmlEscapingLength(data_str);
-            size_t data_size = raw_size + extra_size;
-            size_t chunk_size = ctx->method->max_chunk_size;
+		growing_buffer* outbuf = ctx->session->outbuf;
 
-            if (data_size > chunk_size) // calculate an escape-scaled chunk size
-                chunk_size = ((double)raw_size / (double)data_size) * (double)chunk_size;
-
-            if (chunk_size > 0 && chunk_size < raw_size) {
-                // chunking -- response message exceeds max message size.
-                // break it up into chunks for partial delivery
-
-                // but first, send out any any messages that may have
-                // been queued for bundling
-                if( flush_responses( ctx->session, ctx->session->outbuf ))
-                    return -1;
+		if( data ) {
+			// Serialize an OSRF message, with the response, into the output buffer
+			osrfMessage* msg = osrf_message_init( RESULT, ctx->request, 1 );
+			osrf_message_set_status_info( msg, NULL, "OK", OSRF_STATUS_OK );
+
+			size_t mark = start_msg( outbuf );
+			size_t data_start;
+			size_t extra_size = 0;    // Tallied as we go; no need to scan the JSON again
+			size_t raw_size = osrfMessageResultToBuffer( msg, data, outbuf,
+				&data_start, &extra_size );
+			size_t msg_size = buffer_length( outbuf ) - mark - 1;
+			osrfMessageFree( msg );
+
+			size_t data_size = raw_size + extra_size;
+			size_t chunk_size = ctx->method->max_chunk_size;
+
+			if (data_size > chunk_size) // calculate an escape-scaled chunk size
+				chunk_size = ((double)raw_size / (double)data_size) * (double)chunk_size;
+
+			if (chunk_size > 0 && chunk_size < raw_size) {
+				// chunking -- response message exceeds max message size.
+				// break it up into chunks for partial delivery
+
+				// but first, send out any any messages that may have
+				// been queued for bundling
+				if( mark > 0 ) {
+					if( flush_responses_before( ctx->session, outbuf, mark ))
+						return -1;
+					data_start -= mark;
+				}
 
 				osrfSendChunkedResult(ctx->session, ctx->request,
-									  data_str, raw_size, chunk_size);
-
-            } else {
-
-                // bundling -- message body (may be) too small for single
-                // delivery.  prepare message for bundling.
-
-                // Create an OSRF message
-                osrfMessage* msg = osrf_message_init( RESULT, ctx->request, 1 );
-                osrf_message_set_status_info( msg, NULL, "OK", OSRF_STATUS_OK );
-                osrf_message_set_result( msg, data );
-
-                // Serialize the OSRF message into JSON text
-                jsonObject* msg_jsonobj = osrfMessageToJSON( msg );
-                char* json = jsonObjectToJSON( msg_jsonobj );
-                jsonObjectFree( msg_jsonobj );
-                osrfMessageFree( msg );
-
-                // If the new message would overflow the buffer, flush the output buffer first
-                int len_so_far = buffer_length( ctx->session->outbuf );
-                if( len_so_far && (strlen( json ) + len_so_far + 3 >= ctx->method->max_bundle_size )) {
-                    if( flush_responses( ctx->session, ctx->session->outbuf ))
-                        return -1;
-                }
-
-                // Append the JSON text to the output buffer
-                append_msg( ctx->session->outbuf, json );
-                free( json );
-            }
-
-            free(data_str);
+					OSRF_BUFFER_C_STR( outbuf ) + data_start, raw_size, chunk_size);
+				buffer_reset( outbuf );
+
+			} else if( mark && ( msg_size + mark + 3 >= ctx->method->max_bundle_size )) {
+				// bundling -- but the new message would overflow the
+				// buffer, so send what was there before it
+				if( flush_responses_before( ctx->session, outbuf, mark ))
+					return -1;
+			}
 		}
 
 		if(complete) {
@@ -791,19 +841,14 @@ static int _osrfAppRespond( osrfMethodContext* ctx, const jsonObject* data, int
 			osrf_message_set_status_info( status_msg, "osrfConnectStatus", "Request Complete",
 				OSRF_STATUS_COMPLETE );
 
-			// Serialize the STATUS message into JSON text
-			jsonObject* status_msg_jsonobj = osrfMessageToJSON( status_msg );
-			char* json = jsonObjectToJSON( status_msg_jsonobj );
-			jsonObjectFree( status_msg_jsonobj );
-			osrfMessageFree( status_msg );
-
 			// Add the STATUS message to the output buffer.
 			// It's short, so don't worry about avoiding overflow.
-			append_msg( ctx->session->outbuf, json );
-			free( json );
+			start_msg( outbuf );
+			osrfMessageToBuffer( status_msg, outbuf );
+			osrfMessageFree( status_msg );
 
 			// Flush the output buffer, sending any accumulated messages.
-			if( flush_responses( ctx->session, ctx->session->outbuf ))
+			if( flush_responses( ctx->session, outbuf ))
 				return -1;
 		}
 	}
@@ -924,6 +969,11 @@ static int _osrfAppRunSystemMethod(osrfMethodContext* ctx) {
 		return osrfAppEcho(ctx);
 	}
 
+	if( !strcmp(ctx->method->name, OSRF_SYSMETHOD_STATS ) ||
+			!strcmp(ctx->method->name, OSRF_SYSMETHOD_STATS_ATOMIC )) {
+		return osrfAppStats(ctx);
+	}
+
 	osrfAppRequestRespondException( ctx->session,
 			ctx->request, "System method implementation not found");
 
@@ -1016,6 +1066,32 @@ static int osrfAppEcho( osrfMethodContext* ctx ) {
 	return 1;
 }
 
+/**
+	@brief Run the stats method.
+	@param ctx Pointer to the method context.
+	@return -1 if the method context is invalid or corrupted; otherwise 1.
+
+	Send the client the metrics of the listener that spawned this server, or an exception
+	if this server wasn't spawned by a prefork listener.
+*/
+static int osrfAppStats( osrfMethodContext* ctx ) {
+	if( osrfMethodVerifyContext( ctx ) < 0 ) {
+		osrfLogError( OSRF_LOG_MARK,  "osrfAppStats: Received invalid method context" );
+		return -1;
+	}
+
+	jsonObject* stats = osrf_prefork_stats();
+	if( !stats ) {
+		osrfAppRequestRespondException( ctx->session,
+			ctx->request, "Listener statistics are not available" );
+		return 0;
+	}
+
+	osrfAppRespond(ctx, stats);
+	jsonObjectFree(stats);
+	return 1;
+}
+
 /**
 	@brief Perform a series of sanity tests on an osrfMethodContext.
 	@param ctx Pointer to the osrfMethodContext to be checked.
@@ -0,0 +1,1059 @@
+/**
+	@file osrf_cbor.c
+	@brief Translate message bodies between JSON and base64-encoded CBOR.
+
+	Encoding scans the JSON and writes the CBOR as it goes, so there's no jsonObject tree
+	in between.  Decoding builds a jsonObject tree in a jsonArena, the same tree that
+	jsonParseArena() would build from the JSON.
+
+	The encoder gives up, rather than change anything in transit, on JSON that it can't
+	represent exactly: numbers with exponents or more than CBOR_MAX_DIGITS digits, negative
+	zeros, and class hints other than the usual {"__c":name,"__p":data}.  The calling code
+	then sends the JSON as it is.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <opensrf/osrf_cbor.h>
+
+/* CBOR major types, in the high three bits of the initial byte */
+#define CBOR_UINT     0x00
+#define CBOR_NEGINT   0x20
+#define CBOR_BYTES    0x40
+#define CBOR_TEXT     0x60
+#define CBOR_ARRAY    0x80
+#define CBOR_MAP      0xa0
+#define CBOR_TAG      0xc0
+#define CBOR_SIMPLE   0xe0
+
+/* Low five bits of the initial byte for a container of indefinite length */
+#define CBOR_INDEFINITE 31
+
+#define CBOR_FALSE    0xf4
+#define CBOR_TRUE     0xf5
+#define CBOR_NULL     0xf6
+#define CBOR_BREAK    0xff
+
+/** Tag for a decimal fraction: [ exponent, mantissa ] */
+#define CBOR_TAG_DECIMAL 4
+/** Tag for an object with a type name: [ name, data ] */
+#define CBOR_TAG_OBJECT  27
+
+/** How many digits a number may have and still fit into a CBOR integer or decimal fraction */
+#define CBOR_MAX_DIGITS 18
+
+/** How deeply arrays and maps may nest in CBOR that we decode */
+#define CBOR_MAX_DEPTH 1000
+
+/** @brief The state of a translation from JSON to CBOR. */
+typedef struct {
+	const char* p;             /**< next character of JSON */
+	growing_buffer* buf;       /**< where the CBOR goes */
+	growing_buffer* scratch;   /**< for strings that have escapes to translate */
+	int depth;                 /**< how many arrays and objects are open */
+} Encoder;
+
+/** @brief The state of a translation from CBOR to a jsonObject tree. */
+typedef struct {
+	const unsigned char* p;    /**< next byte to decode */
+	const unsigned char* end;  /**< just past the last byte */
+	jsonArena* arena;          /**< where to put the jsonObjects */
+	void** stack;              /**< members of the open arrays and maps */
+	size_t stack_top;          /**< number of entries in use on the stack */
+	size_t stack_size;         /**< number of entries allocated for the stack */
+	int depth;                 /**< how many arrays and maps are open */
+} Decoder;
+
+static void put_head( growing_buffer* buf, unsigned char major, uint64_t arg );
+static void put_text( growing_buffer* buf, const char* str, size_t len );
+static int encode_value( Encoder* enc );
+static int encode_array( Encoder* enc );
+static int encode_object( Encoder* enc );
+static int encode_number( Encoder* enc );
+static int encode_keyword( Encoder* enc, const char* keyword, unsigned char byte );
+static const char* scan_string( Encoder* enc, size_t* len );
+static const char* unescape( const char* p, growing_buffer* buf );
+static const char* skip_space( const char* p );
+
+static int get_head( Decoder* dec, unsigned char* major, uint64_t* arg, int* indefinite );
+static jsonObject* decode_item( Decoder* dec );
+static jsonObject* decode_array( Decoder* dec, uint64_t count, int indefinite );
+static jsonObject* decode_map( Decoder* dec, uint64_t count, int indefinite );
+static jsonObject* decode_tag( Decoder* dec, uint64_t tag );
+static const char* decode_key( Decoder* dec );
+static int decode_int( Decoder* dec, int* negative, uint64_t* magnitude );
+static jsonObject* new_node( Decoder* dec, int type );
+static jsonObject* new_number( Decoder* dec, const char* text );
+static void stack_push( Decoder* dec, void* item );
+static void* arena_alloc( void* arena, size_t size );
+
+static size_t base64_encode( const unsigned char* data, size_t len, char* out );
+static unsigned char* base64_decode( const char* text, size_t* len );
+
+/**
+	@brief Translate JSON into CBOR.
+	@param buf Pointer to a growing_buffer to which the CBOR will be appended.
+	@param json The JSON, as a nul-terminated string.
+	@return Zero if successful, or -1 if the JSON is invalid or can't be translated exactly.
+
+	On failure, @a buf is left as it was.
+*/
+int osrfCborFromJSON( growing_buffer* buf, const char* json ) {
+	if( !buf || !json )
+		return -1;
+
+	Encoder enc;
+	enc.p = skip_space( json );
+	enc.buf = buf;
+	enc.scratch = NULL;
+	enc.depth = 0;
+
+	size_t start = buffer_length( buf );
+	int rc = encode_value( &enc );
+	if( enc.scratch )
+		buffer_free( enc.scratch );
+
+	if( rc || *skip_space( enc.p ) ) {
+		buf->n_used = start;
+		buf->buf[ start ] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+/**
+	@brief Translate JSON into a message body of base64-encoded CBOR.
+	@param json The JSON, as a nul-terminated string.
+	@return A newly allocated body, starting with OSRF_CBOR_BODY_PREFIX; or NULL if the
+		JSON can't be translated, or the result wouldn't be any shorter.
+
+	The calling code is responsible for freeing the result.
+*/
+char* osrfCborBodyFromJSON( const char* json ) {
+	if( !json )
+		return NULL;
+
+	growing_buffer* cbor = buffer_init( 4096 );
+	if( osrfCborFromJSON( cbor, json ) ) {
+		buffer_free( cbor );
+		return NULL;
+	}
+
+	size_t prefix_len = sizeof( OSRF_CBOR_BODY_PREFIX ) - 1;
+	size_t body_len = prefix_len + ( cbor->n_used + 2 ) / 3 * 4;
+	if( body_len >= strlen( json ) ) {
+		buffer_free( cbor );
+		return NULL;
+	}
+
+	char* body = safe_malloc( body_len + 1 );
+	memcpy( body, OSRF_CBOR_BODY_PREFIX, prefix_len );
+	base64_encode( (unsigned char*) cbor->buf, cbor->n_used, body + prefix_len );
+	body[ body_len ] = '\0';
+	buffer_free( cbor );
+	return body;
+}
+
+/**
+	@brief Determine whether a message body is CBOR.
+	@param body The message body.
+	@return 1 if it starts with OSRF_CBOR_BODY_PREFIX, or 0 if not.
+*/
+int osrfCborIsBody( const char* body ) {
+	return body && !strncmp( body, OSRF_CBOR_BODY_PREFIX, sizeof( OSRF_CBOR_BODY_PREFIX ) - 1 );
+}
+
+/**
+	@brief Translate a message body of base64-encoded CBOR into a jsonObject tree.
+	@param arena Pointer to the jsonArena in which to build the tree.
+	@param body The message body, starting with OSRF_CBOR_BODY_PREFIX.
+	@return Pointer to the root of the tree, or NULL if the body isn't valid.
+*/
+jsonObject* osrfCborParseBody( jsonArena* arena, const char* body ) {
+	if( !arena || !osrfCborIsBody( body ) )
+		return NULL;
+
+	size_t len;
+	unsigned char* data = base64_decode( body + sizeof( OSRF_CBOR_BODY_PREFIX ) - 1, &len );
+	if( !data ) {
+		osrfLogWarning( OSRF_LOG_MARK, "Invalid base64 in CBOR message body" );
+		return NULL;
+	}
+
+	jsonObject* obj = osrfCborParse( arena, data, len );
+	free( data );
+	return obj;
+}
+
+/**
+	@brief Translate CBOR into a jsonObject tree.
+	@param arena Pointer to the jsonArena in which to build the tree.
+	@param data Pointer to the CBOR.
+	@param len Length of the CBOR in bytes.
+	@return Pointer to the root of the tree, or NULL if the CBOR isn't valid, or uses
+		something (such as floating point) that the encoder never does.
+
+	Tagged objects get class names, just as class hints do when jsonParseArena() decodes them.
+	The tree lives in the arena, and mustn't be freed with jsonObjectFree().
+*/
+jsonObject* osrfCborParse( jsonArena* arena, const unsigned char* data, size_t len ) {
+	if( !arena || !data )
+		return NULL;
+
+	Decoder dec;
+	dec.p = data;
+	dec.end = data + len;
+	dec.arena = arena;
+	dec.stack = NULL;
+	dec.stack_top = 0;
+	dec.stack_size = 0;
+	dec.depth = 0;
+
+	jsonObject* obj = decode_item( &dec );
+	free( dec.stack );
+
+	if( obj && dec.p != dec.end )
+		obj = NULL;             // Trailing junk
+	if( !obj )
+		osrfLogWarning( OSRF_LOG_MARK, "Invalid CBOR in message body" );
+	return obj;
+}
+
+/**
+	@brief Append the initial byte of a CBOR item, and its argument, to a growing_buffer.
+	@param buf Pointer to the growing_buffer.
+	@param major The major type, already in the high three bits.
+	@param arg The argument: a length, a count, a tag, or an integer value.
+*/
+static void put_head( growing_buffer* buf, unsigned char major, uint64_t arg ) {
+	unsigned char head[ 9 ];
+	size_t len;
+
+	if( arg < 24 ) {
+		head[ 0 ] = major | (unsigned char) arg;
+		len = 1;
+	} else if( arg <= 0xff ) {
+		head[ 0 ] = major | 24;
+		len = 2;
+	} else if( arg <= 0xffff ) {
+		head[ 0 ] = major | 25;
+		len = 3;
+	} else if( arg <= 0xffffffff ) {
+		head[ 0 ] = major | 26;
+		len = 5;
+	} else {
+		head[ 0 ] = major | 27;
+		len = 9;
+	}
+
+	// The argument follows in network byte order
+	size_t i;
+	for( i = len - 1; i > 0; --i ) {
+		head[ i ] = (unsigned char) arg;
+		arg >>= 8;
+	}
+
+	buffer_add_n( buf, (char*) head, len );
+}
+
+/**
+	@brief Append a CBOR text string to a growing_buffer.
+	@param buf Pointer to the growing_buffer.
+	@param str The text.
+	@param len Length of the text in bytes.
+*/
+static void put_text( growing_buffer* buf, const char* str, size_t len ) {
+	put_head( buf, CBOR_TEXT, len );
+	buffer_add_n( buf, str, len );
+}
+
+/**
+	@brief Translate a JSON value, with whatever it contains.
+	@param enc Pointer to the Encoder, positioned at the value.
+	@return Zero if successful, or -1 if we can't translate it.
+*/
+static int encode_value( Encoder* enc ) {
+	switch( *enc->p ) {
+		case '[' :
+			return encode_array( enc );
+		case '{' :
+			return encode_object( enc );
+		case '"' : {
+			size_t len;
+			const char* str = scan_string( enc, &len );
+			if( !str )
+				return -1;
+			put_text( enc->buf, str, len );
+			return 0;
+		}
+		case 't' :
+			return encode_keyword( enc, "true", CBOR_TRUE );
+		case 'f' :
+			return encode_keyword( enc, "false", CBOR_FALSE );
+		case 'n' :
+			return encode_keyword( enc, "null", CBOR_NULL );
+		default :
+			return encode_number( enc );
+	}
+}
+
+/**
+	@brief Translate a JSON array into a CBOR array of indefinite length.
+	@param enc Pointer to the Encoder, positioned at the left bracket.
+	@return Zero if successful, or -1 if we can't translate it.
+*/
+static int encode_array( Encoder* enc ) {
+	if( ++enc->depth > CBOR_MAX_DEPTH )
+		return -1;
+
+	OSRF_BUFFER_ADD_CHAR( enc->buf, (char) ( CBOR_ARRAY | CBOR_INDEFINITE ) );
+	enc->p = skip_space( enc->p + 1 );
+	if( ']' != *enc->p ) {
+		for( ;; ) {
+			if( encode_value( enc ) )
+				return -1;
+			enc->p = skip_space( enc->p );
+			if( ']' == *enc->p )
+				break;
+			else if( ',' != *enc->p )
+				return -1;
+			enc->p = skip_space( enc->p + 1 );
+		}
+	}
+
+	++enc->p;
+	OSRF_BUFFER_ADD_CHAR( enc->buf, (char) CBOR_BREAK );
+	--enc->depth;
+	return 0;
+}
+
+/**
+	@brief Translate a JSON object into a CBOR map, or a class hint into a tagged array.
+	@param enc Pointer to the Encoder, positioned at the left brace.
+	@return Zero if successful, or -1 if we can't translate it.
+
+	A class hint is an object whose first key is the class key, and whose only other key
+	is the data key.  It becomes tag 27 on an array of the class name and the data.  We
+	don't translate a class key anywhere else, nor a class name that isn't a string.
+*/
+static int encode_object( Encoder* enc ) {
+	if( ++enc->depth > CBOR_MAX_DEPTH )
+		return -1;
+
+	enc->p = skip_space( enc->p + 1 );
+	if( '}' == *enc->p ) {
+		++enc->p;
+		put_head( enc->buf, CBOR_MAP, 0 );
+		--enc->depth;
+		return 0;
+	}
+
+	size_t len;
+	int first = 1;
+	int is_class = 0;
+	for( ;; ) {
+		if( '"' != *enc->p )
+			return -1;
+		const char* key = scan_string( enc, &len );
+		if( !key )
+			return -1;
+		int is_class_key = sizeof( JSON_CLASS_KEY ) - 1 == len
+			&& !memcmp( key, JSON_CLASS_KEY, len );
+
+		enc->p = skip_space( enc->p );
+		if( ':' != *enc->p )
+			return -1;
+		enc->p = skip_space( enc->p + 1 );
+
+		if( first && is_class_key ) {
+			if( '"' != *enc->p )
+				return -1;
+			const char* name = scan_string( enc, &len );
+			if( !name )
+				return -1;
+			put_head( enc->buf, CBOR_TAG, CBOR_TAG_OBJECT );
+			put_head( enc->buf, CBOR_ARRAY, 2 );
+			put_text( enc->buf, name, len );
+
+			// Next comes the data key, and then the data
+			enc->p = skip_space( enc->p );
+			if( ',' != *enc->p )
+				return -1;
+			enc->p = skip_space( enc->p + 1 );
+			if( '"' != *enc->p || !( key = scan_string( enc, &len ) )
+					|| sizeof( JSON_DATA_KEY ) - 1 != len || memcmp( key, JSON_DATA_KEY, len ) )
+				return -1;
+			enc->p = skip_space( enc->p );
+			if( ':' != *enc->p )
+				return -1;
+			enc->p = skip_space( enc->p + 1 );
+			is_class = 1;
+		} else if( is_class_key )
+			return -1;
+		else {
+			if( first )
+				OSRF_BUFFER_ADD_CHAR( enc->buf, (char) ( CBOR_MAP | CBOR_INDEFINITE ) );
+			put_text( enc->buf, key, len );
+		}
+		first = 0;
+
+		if( encode_value( enc ) )
+			return -1;
+
+		enc->p = skip_space( enc->p );
+		if( '}' == *enc->p )
+			break;
+		else if( ',' != *enc->p || is_class )
+			return -1;
+		enc->p = skip_space( enc->p + 1 );
+	}
+
+	++enc->p;
+	if( !is_class )
+		OSRF_BUFFER_ADD_CHAR( enc->buf, (char) CBOR_BREAK );
+	--enc->depth;
+	return 0;
+}
+
+/**
+	@brief Translate a JSON number into a CBOR integer or decimal fraction.
+	@param enc Pointer to the Encoder, positioned at the number.
+	@return Zero if successful, or -1 if we can't translate it.
+
+	We take only plain integers and decimals, such as -12 and 25.00, whose digits will
+	come back as they were.
+*/
+static int encode_number( Encoder* enc ) {
+	const char* p = enc->p;
+	int negative = 0;
+	if( '-' == *p ) {
+		negative = 1;
+		++p;
+	}
+
+	// No leading zeros, since we couldn't restore them
+	if( !isdigit( (unsigned char) *p ) || ( '0' == p[ 0 ] && isdigit( (unsigned char) p[ 1 ] ) ) )
+		return -1;
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int scale = -1;       // Digits after the decimal point, or -1 if there's no point
+	for( ;; ++p ) {
+		if( isdigit( (unsigned char) *p ) ) {
+			if( ++digits > CBOR_MAX_DIGITS )
+				return -1;
+			mantissa = mantissa * 10 + ( *p - '0' );
+			if( scale >= 0 )
+				++scale;
+		} else if( '.' == *p && scale < 0 )
+			scale = 0;
+		else
+			break;
+	}
+
+	// Nothing after a decimal point; an exponent; a negative zero
+	if( 0 == scale || 'e' == *p || 'E' == *p || isalpha( (unsigned char) *p )
+			|| ( negative && 0 == mantissa ) )
+		return -1;
+	enc->p = p;
+
+	if( scale > 0 ) {
+		put_head( enc->buf, CBOR_TAG, CBOR_TAG_DECIMAL );
+		put_head( enc->buf, CBOR_ARRAY, 2 );
+		put_head( enc->buf, CBOR_NEGINT, scale - 1 );    // The exponent is -scale
+	}
+
+	if( negative )
+		put_head( enc->buf, CBOR_NEGINT, mantissa - 1 );
+	else
+		put_head( enc->buf, CBOR_UINT, mantissa );
+	return 0;
+}
+
+/**
+	@brief Translate true, false, or null.
+	@param enc Pointer to the Encoder, positioned at the keyword.
+	@param keyword The keyword we expect.
+	@param byte The CBOR for it.
+	@return Zero if successful, or -1 if the keyword isn't there.
+*/
+static int encode_keyword( Encoder* enc, const char* keyword, unsigned char byte ) {
+	size_t len = strlen( keyword );
+	if( strncmp( enc->p, keyword, len ) || isalnum( (unsigned char) enc->p[ len ] ) )
+		return -1;
+	enc->p += len;
+	OSRF_BUFFER_ADD_CHAR( enc->buf, (char) byte );
+	return 0;
+}
+
+/**
+	@brief Scan a JSON string, translating any escapes.
+	@param enc Pointer to the Encoder, positioned at the opening quotation mark.
+	@param len Pointer to a variable to receive the length of the string.
+	@return Pointer to the string, or NULL if it's invalid.
+
+	The string is not nul-terminated.  Without escapes, it's in the JSON itself.  With
+	them, it's in the scratch buffer, good until the next call.  Either way, the Encoder
+	ends up just past the closing quotation mark.
+
+	The escapes come out just as the JSON parser would make them.
+*/
+static const char* scan_string( Encoder* enc, size_t* len ) {
+	const char* start = enc->p + 1;
+	const char* p = start;
+	while( '"' != *p && '\\' != *p ) {
+		if( !*p )
+			return NULL;
+		++p;
+	}
+
+	if( '"' == *p ) {
+		*len = p - start;
+		enc->p = p + 1;
+		return start;
+	}
+
+	if( enc->scratch )
+		buffer_reset( enc->scratch );
+	else
+		enc->scratch = buffer_init( 64 );
+	buffer_add_n( enc->scratch, start, p - start );
+
+	while( '"' != *p ) {
+		if( '\\' == *p ) {
+			if( !( p = unescape( p, enc->scratch ) ) )
+				return NULL;
+		} else if( !*p )
+			return NULL;
+		else {
+			const char* run = p;
+			while( *p && '"' != *p && '\\' != *p )
+				++p;
+			buffer_add_n( enc->scratch, run, p - run );
+		}
+	}
+
+	*len = enc->scratch->n_used;
+	enc->p = p + 1;
+	return enc->scratch->buf;
+}
+
+/**
+	@brief Translate an escape sequence in a JSON string.
+	@param p Pointer to the backslash.
+	@param buf Pointer to the growing_buffer to receive the translation.
+	@return Pointer just past the escape sequence, or NULL if it's invalid.
+
+	Each \\u sequence becomes the UTF-8 for its own value, surrogates included, and an
+	unknown escape becomes the escaped character -- as in the JSON parser.
+*/
+static const char* unescape( const char* p, growing_buffer* buf ) {
+	char c = p[ 1 ];
+	switch( c ) {
+		case 'b' : c = '\b'; break;
+		case 'f' : c = '\f'; break;
+		case 'n' : c = '\n'; break;
+		case 'r' : c = '\r'; break;
+		case 't' : c = '\t'; break;
+		case '\0' : return NULL;
+		case 'u' : {
+			unsigned int ucs = 0;
+			int i;
+			for( i = 2; i < 6; ++i ) {
+				char h = p[ i ];
+				if( !isxdigit( (unsigned char) h ) )
+					return NULL;
+				ucs = ( ucs << 4 ) | ( isdigit( (unsigned char) h ) ? h - '0' : ( h | 0x20 ) - 'a' + 10 );
+			}
+
+			if( 0 == ucs )
+				return NULL;            // The JSON parser won't have a nul
+			else if( ucs < 0x80 )
+				OSRF_BUFFER_ADD_CHAR( buf, (char) ucs );
+			else if( ucs < 0x800 ) {
+				OSRF_BUFFER_ADD_CHAR( buf, (char) ( 0xc0 | ( ucs >> 6 ) ) );
+				OSRF_BUFFER_ADD_CHAR( buf, (char) ( 0x80 | ( ucs & 0x3f ) ) );
+			} else {
+				OSRF_BUFFER_ADD_CHAR( buf, (char) ( 0xe0 | ( ucs >> 12 ) ) );
+				OSRF_BUFFER_ADD_CHAR( buf, (char) ( 0x80 | ( ( ucs >> 6 ) & 0x3f ) ) );
+				OSRF_BUFFER_ADD_CHAR( buf, (char) ( 0x80 | ( ucs & 0x3f ) ) );
+			}
+			return p + 6;
+		}
+		default : break;
+	}
+
+	OSRF_BUFFER_ADD_CHAR( buf, c );
+	return p + 2;
+}
+
+/**
+	@param p Pointer into the JSON.
+	@return Pointer to the first character at or after @a p that isn't white space.
+*/
+static const char* skip_space( const char* p ) {
+	while( isspace( (unsigned char) *p ) )
+		++p;
+	return p;
+}
+
+/**
+	@brief Decode the initial byte of a CBOR item, and its argument.
+	@param dec Pointer to the Decoder.
+	@param major Pointer to a variable to receive the major type.
+	@param arg Pointer to a variable to receive the argument.
+	@param indefinite Pointer to a variable to receive a boolean: true for an indefinite length.
+	@return Zero if successful, or -1 if we run out of input or the byte is malformed.
+*/
+static int get_head( Decoder* dec, unsigned char* major, uint64_t* arg, int* indefinite ) {
+	if( dec->p >= dec->end )
+		return -1;
+
+	unsigned char initial = *dec->p++;
+	unsigned char info = initial & 0x1f;
+	*major = initial & 0xe0;
+	*indefinite = 0;
+
+	if( info < 24 ) {
+		*arg = info;
+		return 0;
+	} else if( CBOR_INDEFINITE == info ) {
+		*arg = 0;
+		*indefinite = 1;
+		return 0;
+	} else if( info > 27 )
+		return -1;
+
+	size_t len = (size_t) 1 << ( info - 24 );
+	if( (size_t) ( dec->end - dec->p ) < len )
+		return -1;
+
+	uint64_t value = 0;
+	size_t i;
+	for( i = 0; i < len; ++i )
+		value = ( value << 8 ) | *dec->p++;
+	*arg = value;
+	return 0;
+}
+
+/**
+	@brief Decode one CBOR item, with whatever it contains.
+	@param dec Pointer to the Decoder.
+	@return Pointer to a jsonObject for the item, or NULL if it's invalid or unsupported.
+*/
+static jsonObject* decode_item( Decoder* dec ) {
+	unsigned char major;
+	uint64_t arg;
+	int indefinite;
+	char num[ 32 ];
+
+	if( dec->p >= dec->end )
+		return NULL;
+	unsigned char initial = *dec->p;
+	if( get_head( dec, &major, &arg, &indefinite ) )
+		return NULL;
+
+	switch( major ) {
+		case CBOR_UINT :
+			snprintf( num, sizeof( num ), "%" PRIu64, arg );
+			return new_number( dec, num );
+		case CBOR_NEGINT :
+			if( arg > INT64_MAX )
+				return NULL;
+			snprintf( num, sizeof( num ), "-%" PRIu64, arg + 1 );
+			return new_number( dec, num );
+		case CBOR_TEXT : {
+			if( indefinite || arg > (uint64_t) ( dec->end - dec->p ) )
+				return NULL;
+			jsonObject* obj = new_node( dec, JSON_STRING );
+			obj->value.s = jsonArenaStrndup( dec->arena, (const char*) dec->p, arg );
+			dec->p += arg;
+			return obj;
+		}
+		case CBOR_ARRAY :
+			return decode_array( dec, arg, indefinite );
+		case CBOR_MAP :
+			return decode_map( dec, arg, indefinite );
+		case CBOR_TAG :
+			return indefinite ? NULL : decode_tag( dec, arg );
+		case CBOR_SIMPLE : {
+			jsonObject* obj = NULL;
+			if( CBOR_NULL == initial )
+				obj = new_node( dec, JSON_NULL );
+			else if( CBOR_TRUE == initial || CBOR_FALSE == initial ) {
+				obj = new_node( dec, JSON_BOOL );
+				obj->value.b = CBOR_TRUE == initial;
+			}
+			return obj;                 // Floating point, undefined, break, etc.
+		}
+		default :
+			return NULL;                // Byte strings
+	}
+}
+
+/**
+	@brief Decode the members of a CBOR array, and build a JSON_ARRAY for them.
+	@param dec Pointer to the Decoder.
+	@param count How many members there are, if the length is definite.
+	@param indefinite Boolean; true if the array runs until a break.
+	@return Pointer to the JSON_ARRAY, or NULL upon error.
+*/
+static jsonObject* decode_array( Decoder* dec, uint64_t count, int indefinite ) {
+	if( ++dec->depth > CBOR_MAX_DEPTH )
+		return NULL;
+
+	size_t base = dec->stack_top;
+	uint64_t i;
+	for( i = 0; indefinite || i < count; ++i ) {
+		if( dec->p >= dec->end )
+			return NULL;
+		if( indefinite && CBOR_BREAK == *dec->p ) {
+			++dec->p;
+			break;
+		}
+		jsonObject* obj = decode_item( dec );
+		if( !obj )
+			return NULL;
+		stack_push( dec, obj );
+	}
+	--dec->depth;
+
+	size_t n = dec->stack_top - base;
+	jsonObject* array = new_node( dec, JSON_ARRAY );
+	osrfList* list = jsonArenaAlloc( dec->arena, sizeof( osrfList ) );
+	list->arrlist = jsonArenaAlloc( dec->arena, ( n + 1 ) * sizeof( void* ) );
+	list->size = n;
+	list->arrsize = n;
+	list->freeItem = NULL;
+
+	for( i = 0; i < n; ++i ) {
+		jsonObject* obj = dec->stack[ base + i ];
+		obj->parent = array;
+		list->arrlist[ i ] = obj;
+	}
+
+	array->value.l = list;
+	array->size = n;
+	dec->stack_top = base;
+	return array;
+}
+
+/**
+	@brief Decode the keys and values of a CBOR map, and build a JSON_HASH for them.
+	@param dec Pointer to the Decoder.
+	@param count How many pairs there are, if the length is definite.
+	@param indefinite Boolean; true if the map runs until a break.
+	@return Pointer to the JSON_HASH, or NULL upon error, including a duplicate key.
+*/
+static jsonObject* decode_map( Decoder* dec, uint64_t count, int indefinite ) {
+	if( ++dec->depth > CBOR_MAX_DEPTH )
+		return NULL;
+
+	size_t base = dec->stack_top;
+	uint64_t i;
+	for( i = 0; indefinite || i < count; ++i ) {
+		if( dec->p >= dec->end )
+			return NULL;
+		if( indefinite && CBOR_BREAK == *dec->p ) {
+			++dec->p;
+			break;
+		}
+		const char* key = decode_key( dec );
+		if( !key )
+			return NULL;
+		stack_push( dec, (void*) key );
+		jsonObject* obj = decode_item( dec );
+		if( !obj )
+			return NULL;
+		stack_push( dec, obj );
+	}
+	--dec->depth;
+
+	void** pairs = dec->stack + base;
+	size_t n = ( dec->stack_top - base ) / 2;
+	dec->stack_top = base;
+
+	osrfHash* members = osrfHashFromPairs( arena_alloc, dec->arena, pairs, n );
+	if( !members )
+		return NULL;
+
+	jsonObject* hash = new_node( dec, JSON_HASH );
+	for( i = 0; i < n; ++i )
+		( (jsonObject*) pairs[ 2 * i + 1 ] )->parent = hash;
+	hash->value.h = members;
+	hash->size = n;
+	return hash;
+}
+
+/**
+	@brief Decode a tagged CBOR item.
+	@param dec Pointer to the Decoder, positioned just past the tag.
+	@param tag The tag.
+	@return Pointer to a jsonObject for the item, or NULL for an invalid or unknown tag.
+
+	Tag 27 gives the data a class name.  Tag 4 is a decimal fraction, which we turn back
+	into the digits of a JSON number.
+*/
+static jsonObject* decode_tag( Decoder* dec, uint64_t tag ) {
+	unsigned char major;
+	uint64_t arg;
+	int indefinite;
+
+	if( ( tag != CBOR_TAG_OBJECT && tag != CBOR_TAG_DECIMAL )
+			|| get_head( dec, &major, &arg, &indefinite )
+			|| major != CBOR_ARRAY || indefinite || arg != 2 )
+		return NULL;
+
+	if( CBOR_TAG_OBJECT == tag ) {
+		if( get_head( dec, &major, &arg, &indefinite )
+				|| major != CBOR_TEXT || indefinite || arg > (uint64_t) ( dec->end - dec->p ) )
+			return NULL;
+		const char* name = (const char*) dec->p;
+		dec->p += arg;
+
+		jsonObject* obj = decode_item( dec );
+		if( obj )
+			obj->classname = jsonArenaStrndup( dec->arena, name, arg );
+		return obj;
+	}
+
+	int exp_negative, negative;
+	uint64_t exponent, mantissa;
+	if( decode_int( dec, &exp_negative, &exponent ) || decode_int( dec, &negative, &mantissa )
+			|| exponent > 64 )
+		return NULL;
+
+	// Write the digits, then either pad them with zeros or slip in a decimal point
+	char digits[ 32 ];
+	char num[ 128 ];
+	int len = snprintf( digits, sizeof( digits ), "%" PRIu64, mantissa );
+	char* p = num;
+	if( negative )
+		*p++ = '-';
+
+	if( !exp_negative ) {
+		memcpy( p, digits, len );
+		memset( p + len, '0', exponent );
+		p[ len + exponent ] = '\0';
+	} else {
+		// Pad with leading zeros so that there's at least one digit before the point
+		char padded[ 96 ];
+		int scale = (int) exponent;
+		int pad = scale + 1 > len ? scale + 1 - len : 0;
+		memset( padded, '0', pad );
+		memcpy( padded + pad, digits, len + 1 );
+		int whole = pad + len - scale;
+		memcpy( p, padded, whole );
+		p += whole;
+		*p++ = '.';
+		strcpy( p, padded + whole );
+	}
+	return new_number( dec, num );
+}
+
+/**
+	@brief Decode a map key, which must be a text string.
+	@param dec Pointer to the Decoder.
+	@return Pointer to a nul-terminated copy of the key, or NULL upon error.
+
+	Share the key from the intern table if we can, as jsonParseArena() does.
+*/
+static const char* decode_key( Decoder* dec ) {
+	unsigned char major;
+	uint64_t len;
+	int indefinite;
+
+	if( get_head( dec, &major, &len, &indefinite )
+			|| major != CBOR_TEXT || indefinite || len > (uint64_t) ( dec->end - dec->p ) )
+		return NULL;
+
+	const char* text = (const char*) dec->p;
+	dec->p += len;
+
+	if( jsonInternKeys() && len < 64 ) {
+		char key[ 64 ];
+		memcpy( key, text, len );
+		key[ len ] = '\0';
+		const char* shared = osrfHashIntern( key );
+		if( shared )
+			return shared;
+	}
+	return jsonArenaStrndup( dec->arena, text, len );
+}
+
+/**
+	@brief Decode a CBOR integer, as found within a decimal fraction.
+	@param dec Pointer to the Decoder.
+	@param negative Pointer to a variable to receive a boolean: true if the integer is negative.
+	@param magnitude Pointer to a variable to receive the absolute value.
+	@return Zero if successful, or -1 if the next item isn't an integer we can handle.
+*/
+static int decode_int( Decoder* dec, int* negative, uint64_t* magnitude ) {
+	unsigned char major;
+	uint64_t arg;
+	int indefinite;
+
+	if( get_head( dec, &major, &arg, &indefinite ) || indefinite )
+		return -1;
+	if( CBOR_UINT == major ) {
+		*negative = 0;
+		*magnitude = arg;
+	} else if( CBOR_NEGINT == major && arg < UINT64_MAX ) {
+		*negative = 1;
+		*magnitude = arg + 1;
+	} else
+		return -1;
+	return 0;
+}
+
+/**
+	@param dec Pointer to the Decoder.
+	@param type The type of jsonObject to create.
+	@return Pointer to a new jsonObject in the arena, with no value, class name, or parent.
+*/
+static jsonObject* new_node( Decoder* dec, int type ) {
+	jsonObject* obj = jsonArenaAlloc( dec->arena, sizeof( jsonObject ) );
+	obj->size = 0;
+	obj->classname = NULL;
+	obj->type = type;
+	obj->parent = NULL;
+	obj->value.s = NULL;
+	return obj;
+}
+
+/**
+	@param dec Pointer to the Decoder.
+	@param text The number, as it would appear in JSON.
+	@return Pointer to a new JSON_NUMBER in the arena.
+*/
+static jsonObject* new_number( Decoder* dec, const char* text ) {
+	jsonObject* obj = new_node( dec, JSON_NUMBER );
+	obj->value.s = jsonArenaStrndup( dec->arena, text, strlen( text ) );
+	return obj;
+}
+
+/**
+	@brief Push a pointer onto the decoder's stack, growing the stack if necessary.
+	@param dec Pointer to the Decoder.
+	@param item The pointer to push.
+*/
+static void stack_push( Decoder* dec, void* item ) {
+	if( dec->stack_top == dec->stack_size ) {
+		dec->stack_size = dec->stack_size ? dec->stack_size * 2 : 64;
+		void** stack = realloc( dec->stack, dec->stack_size * sizeof( void* ) );
+		if( !stack ) {
+			osrfLogError( OSRF_LOG_MARK, "Out of Memory" );
+			exit( 99 );
+		}
+		dec->stack = stack;
+	}
+	dec->stack[ dec->stack_top++ ] = item;
+}
+
+/**
+	@brief Allocate memory from a jsonArena, on behalf of osrfHashFromPairs().
+	@param arena Pointer to the jsonArena, cast to a void pointer.
+	@param size How many bytes are needed.
+	@return Pointer to the memory.
+*/
+static void* arena_alloc( void* arena, size_t size ) {
+	return jsonArenaAlloc( (jsonArena*) arena, size );
+}
+
+static const char base64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+	@brief Encode binary data in base64, with padding.
+	@param data Pointer to the data.
+	@param len Length of the data in bytes.
+	@param out Pointer to a buffer big enough for the result: 4 bytes for every 3 of input,
+		rounded up.  No terminal nul is added.
+	@return Length of the result.
+*/
+static size_t base64_encode( const unsigned char* data, size_t len, char* out ) {
+	char* p = out;
+	size_t i;
+	for( i = 0; i + 2 < len; i += 3 ) {
+		uint32_t n = ( data[ i ] << 16 ) | ( data[ i + 1 ] << 8 ) | data[ i + 2 ];
+		*p++ = base64_chars[ n >> 18 ];
+		*p++ = base64_chars[ ( n >> 12 ) & 0x3f ];
+		*p++ = base64_chars[ ( n >> 6 ) & 0x3f ];
+		*p++ = base64_chars[ n & 0x3f ];
+	}
+
+	if( i < len ) {
+		uint32_t n = data[ i ] << 16;
+		if( i + 1 < len )
+			n |= data[ i + 1 ] << 8;
+		*p++ = base64_chars[ n >> 18 ];
+		*p++ = base64_chars[ ( n >> 12 ) & 0x3f ];
+		*p++ = i + 1 < len ? base64_chars[ ( n >> 6 ) & 0x3f ] : '=';
+		*p++ = '=';
+	}
+	return p - out;
+}
+
+/**
+	@brief Decode base64 text.
+	@param text The text, nul-terminated, with padding and without whitespace.
+	@param len Pointer to a variable to receive the length of the result.
+	@return A newly allocated buffer holding the result, or NULL if the text isn't valid.
+
+	The calling code is responsible for freeing the result.
+*/
+static unsigned char* base64_decode( const char* text, size_t* len ) {
+	static signed char values[ 256 ];
+	if( !values[ 0 ] ) {
+		memset( values, -1, sizeof( values ) );
+		int i;
+		for( i = 0; i < 64; ++i )
+			values[ (unsigned char) base64_chars[ i ] ] = i;
+	}
+
+	size_t text_len = strlen( text );
+	if( text_len % 4 )
+		return NULL;
+
+	size_t pad = 0;
+	if( text_len && '=' == text[ text_len - 1 ] )
+		pad = '=' == text[ text_len - 2 ] ? 2 : 1;
+
+	unsigned char* data = safe_malloc( text_len / 4 * 3 + 1 );
+	unsigned char* p = data;
+	size_t i;
+	for( i = 0; i < text_len; i += 4 ) {
+		int a = values[ (unsigned char) text[ i ] ];
+		int b = values[ (unsigned char) text[ i + 1 ] ];
+		int c = values[ (unsigned char) text[ i + 2 ] ];
+		int d = values[ (unsigned char) text[ i + 3 ] ];
+
+		if( i + 4 == text_len && pad ) {
+			// The last group: one or two of the characters are padding
+			if( a < 0 || b < 0 || ( 1 == pad && c < 0 ) ) {
+				free( data );
+				return NULL;
+			}
+			*p++ = ( a << 2 ) | ( b >> 4 );
+			if( 1 == pad )
+				*p++ = ( ( b & 0x0f ) << 4 ) | ( c >> 2 );
+			break;
+		}
+
+		if( ( a | b | c | d ) < 0 ) {
+			free( data );
+			return NULL;
+		}
+		uint32_t n = ( a << 18 ) | ( b << 12 ) | ( c << 6 ) | d;
+		*p++ = n >> 16;
+		*p++ = ( n >> 8 ) & 0xff;
+		*p++ = n & 0xff;
+	}
+
+	*len = p - data;
+	return data;
+}
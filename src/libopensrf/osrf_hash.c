@@ -1,6 +1,6 @@
 /**
 	@file osrf_hash.c
-	@brief A hybrid between a hash table and a doubly linked list.
+	@brief A hybrid between a hash table and a list.
 */
 
 /*
@@ -18,139 +18,210 @@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
 GNU General Public License for more details.
 */
 
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 #include <opensrf/osrf_hash.h>
 
 /**
 	@brief A node storing a single item within an osrfHash.
 */
 struct _osrfHashNodeStruct {
-	/** @brief String containing the key for the item */
+	/** @brief String containing the key for the item, or NULL if the item was removed */
 	char* key;
 	/** @brief Pointer to the stored item data */
 	void* item;
-	/** @brief Pointer to the next node in a doubly linked list */
-	struct _osrfHashNodeStruct* prev;
-	/** @brief Pointer to the previous node in a doubly linked list */
-	struct _osrfHashNodeStruct* next;
+	/** @brief Hash value of the key, so that most mismatches cost no strcmp() */
+	unsigned int hash : 31;
+	/** @brief True if the key is shared from the intern table, and so isn't ours to free */
+	unsigned int interned : 1;
+	/** @brief Sequence number; nodes added later have higher ones */
+	unsigned int seq;
 };
 typedef struct _osrfHashNodeStruct osrfHashNode;
 
 /**
 	@brief osrfHash structure
 
-	An osrfHash is partly a key/value store based on a hash table, and partly a linear
-	structure implemented as a linked list.
+	An osrfHash keeps its nodes in a single array, in the sequence in which the keys were
+	added.  That array supports sequential traversal.
 
-	The hash table is an array of pointers, managed by an osrfList.  Each pointer in that array
-	points to another layer of osrfList, which stores pointers to osrfHashNodes for keys that
-	hash to the same value.
+	Most hashes -- the members of a typical JSON object, for instance -- hold only a handful
+	of items.  For those, the array is all there is: a lookup scans it, comparing the cached
+	hash values first so that it seldom needs a strcmp().
 
-	Besides residing in this hash table structure, each osrfHashNode resides in a doubly
-	linked list that includes all the osrfHashNodes in the osrfHash (except for any nodes
-	that have been logically deleted).  New nodes are added to the end of the list.
+	Once the array grows beyond OSRF_HASH_SMALL_SIZE nodes, we add an open-addressed table
+	of slots, each holding the array index of a node, or -1 if empty.  A lookup starts at the
+	slot selected by the low bits of the hash value and probes forward until it finds the key
+	or an empty slot.  The table doubles whenever it's three quarters full.
 
-	The hash table supports lookups based on a key.
-
-	The linked list supports sequential traversal, reflecting the sequence in which the nodes
-	were added.
+	A removed node stays in the array, and in its slot, with a NULL key, so that an iterator
+	parked on it can still find its way to the next node.  Removed nodes drop out of the
+	table the next time we rebuild it, and out of the array the next time the array fills
+	up, if they make up half of it.  Iterators find their place again by sequence number.
 */
 struct _osrfHashStruct {
-	/** @brief Pointer to the osrfList used as a hash table */
-	osrfList* hash;
+	/** @brief Array of nodes, including any removed ones */
+	osrfHashNode* nodes;
+	/** @brief How many nodes are in use in the array */
+	unsigned int node_count;
+	/** @brief How many nodes the array has room for */
+	unsigned int node_alloc;
+	/** @brief Table of node indexes, or NULL if we're still scanning */
+	int* slots;
+	/** @brief Number of slots in the table, minus one */
+	unsigned int slot_mask;
+	/** @brief How many slots are occupied, including those of removed nodes */
+	unsigned int slots_used;
+	/** @brief Sequence number for the next node to be added */
+	unsigned int next_seq;
 	/** @brief Callback function for freeing stored items */
 	void (*freeItem) (char* key, void* item);
 	/** @brief How many items are in the osrfHash */
 	unsigned int size;
-	/** @brief Pointer to the first node in the linked list */
-	osrfHashNode* first_key;
-	/** @brief Pointer to the last node in the linked list */
-	osrfHashNode* last_key;
+	/** @brief Boolean; true if new keys are to be taken from the intern table */
+	int intern_keys;
 };
 
 /**
-	@brief Maintains a position in an osrfHash, for traversing the linked list
+	@brief Maintains a position in an osrfHash, for traversing the nodes in order
 */
 struct _osrfHashIteratorStruct {
 	/** @brief Pointer to the associated osrfHash */
 	osrfHash* hash;
-	/** @brief Pointer to the current osrfHashNode (the one previously returned, if any) */
-	osrfHashNode* curr_node;
+	/** @brief Index of the current node (the one previously returned), or -1 */
+	int curr_node;
+	/** @brief Sequence number of the current node, in case the array has been compacted */
+	unsigned int curr_seq;
 };
 
 /**
-	@brief How many slots in the hash table.
+	@brief How many slots in the smallest hash table.
 
-	Must be a power of 2, or the hashing algorithm won't work properly.
+	Must be a power of 2, as must every table size, so that we can select a slot by masking.
 */
-/* 0x100 is a good size for small hashes */
-//#define OSRF_HASH_LIST_SIZE 0x100  /* size of the main hash list */
-#define OSRF_HASH_LIST_SIZE 0x10  /* size of the main hash list */
+#define OSRF_HASH_MIN_SLOTS 32
 
+/**
+	@brief How many nodes we search by scanning, before we build a hash table.
+
+	With the hash values cached in the nodes, a scan of this many costs less than probing
+	the table would.
+*/
+#define OSRF_HASH_SMALL_SIZE 16
 
-/* used internally */
 /**
-	@brief Free an osrfHashNode, and its cargo, from within a given osrfHash.
-	@param h Pointer to the osrfHash
-	@param n Pointer to the osrfHashNode
+	@name Intern table limits
+	@brief Bounds on what osrfHashIntern() will take on.
+
+	Interned strings are never freed, so we intern only short strings, and only so many of
+	them.  Keys that look like data -- long ones, or ones that just keep coming -- get
+	private copies as usual once the table is full.
+*/
+/*@{*/
+#define OSRF_INTERN_MAX_LEN 64
+#define OSRF_INTERN_MAX_COUNT 65536
+/*@}*/
 
-	If there is a callback function for freeing the item, call it.
+/**
+	@brief The intern table: one copy of each interned string, keyed by itself.
 
-	We use this macro only when freeing an entire osrfHash.
+	It's an ordinary osrfHash, except that each item is the node's own key.  Unlike other
+	osrfHashes it is shared by every thread in the process, so it is guarded by
+	intern_lock.
 */
-#define OSRF_HASH_NODE_FREE(h, n) \
-	if(h && n) { \
-		if(h->freeItem && n->key) h->freeItem(n->key, n->item);\
-		free(n->key); free(n); \
-}
+static osrfHash* intern_table = NULL;
+
+/** @brief Total bytes of string held in the intern table */
+static size_t intern_bytes = 0;
+
+/** @brief Guards the intern table and its byte count */
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_key( const char* key );
+static osrfHashNode* find_item( const osrfHash* hash, const char* key, unsigned int h );
+static osrfHashNode* add_node( osrfHash* hash, char* key, unsigned int h, void* item );
+static unsigned int table_size( unsigned int count );
+static void make_table( osrfHash* hash );
+static void add_slot( osrfHash* hash, int index );
+static void compact( osrfHash* hash );
+static void unlink_node( osrfHash* hash, osrfHashNode* node );
+static int next_node( const osrfHash* hash, int index );
+static int find_position( const osrfHashIterator* itr );
+static char* intern_key( const char* key, unsigned int h );
 
 /**
 	@brief Create and initialize a new (and empty) osrfHash.
 	@return Pointer to the newly created osrfHash.
 
+	The array of nodes isn't allocated until we need it, so an empty osrfHash is cheap.
+
 	The calling code is responsible for freeing the osrfHash.
 */
 osrfHash* osrfNewHash() {
 	osrfHash* hash;
 	OSRF_MALLOC(hash, sizeof(osrfHash));
-	hash->hash		= osrfNewListSize( OSRF_HASH_LIST_SIZE );
-	hash->first_key = NULL;
-	hash->last_key  = NULL;
+	hash->nodes      = NULL;
+	hash->node_count = 0;
+	hash->node_alloc = 0;
+	hash->slots      = NULL;
+	hash->slot_mask  = 0;
+	hash->slots_used = 0;
+	hash->next_seq   = 0;
+	hash->freeItem   = NULL;
+	hash->size       = 0;
+	hash->intern_keys = 0;
 	return hash;
 }
 
-static osrfHashNode* osrfNewHashNode(char* key, void* item);
+/**
+	@brief Scramble the bits of a 64-bit number.
+	@param x The number to be scrambled.
+	@return The scrambled number.
 
-/*
-static unsigned int osrfHashMakeKey(char* str) {
-	if(!str) return 0;
-	unsigned int len = strlen(str);
-	unsigned int h = len;
-	unsigned int i = 0;
-	for(i = 0; i < len; str++, i++)
-		h = ((h << 5) ^ (h >> 27)) ^ (*str);
-	return (h & (OSRF_HASH_LIST_SIZE-1));
-}
+	This is the finalizer of the SplitMix64 generator.  Every input bit affects every
+	output bit, so that the low bits we use for slot selection depend on the whole key.
 */
+static inline uint64_t mix_bits( uint64_t x ) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
 
-/* macro version of the above function */
 /**
 	@brief Hashing algorithm: derive a mangled number from a string.
-	@param str Pointer to the string to be hashed.
-	@param num A numeric variable to receive the resulting value.
+	@param key Pointer to the string to be hashed.
+	@return The hash value, in 31 bits.
 
-	This macro implements an algorithm proposed by Donald E. Knuth
-	in The Art of Computer Programming Volume 3 (more or less..)
+	We pack the string into 64-bit words and stir each one into the running value with a
+	multiply and a shift, all in a single pass that finds the end of the string as it
+	goes.  The last, partial word gets the length in its top byte, and a thorough
+	scrambling by mix_bits().
+
+	We keep 31 bits, and cache them in the node.  The low bits select a slot.
 */
-#define OSRF_HASH_MAKE_KEY(str,num) \
-   do {\
-      const char* k__ = str;\
-      unsigned int len__ = strlen(k__); \
-      unsigned int h__ = len__;\
-      unsigned int i__ = 0;\
-      for(i__ = 0; i__ < len__; k__++, i__++)\
-         h__ = ((h__ << 5) ^ (h__ >> 27)) ^ (*k__);\
-      num = (h__ & (OSRF_HASH_LIST_SIZE-1));\
-   } while(0)
+static unsigned int hash_key( const char* key ) {
+	const unsigned char* p = (const unsigned char*) key;
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	uint64_t word = 0;
+	int n = 0;
+
+	for( ; *p; ++p ) {
+		word = ( word << 8 ) | *p;
+		if( ++n == 8 ) {
+			h = ( h ^ word ) * 0xbf58476d1ce4e5b9ULL;
+			h ^= h >> 29;
+			word = 0;
+			n = 0;
+		}
+	}
+
+	h = mix_bits( h ^ word ^ ( (uint64_t) ( p - (const unsigned char*) key ) << 56 ) );
+	return (unsigned int) ( h ^ ( h >> 32 ) ) & 0x7fffffff;
+}
 
 /**
 	@brief Install a callback function for freeing a stored item.
@@ -166,73 +237,177 @@ void osrfHashSetCallback( osrfHash* hash, void (*callback) (char* key, void* ite
 	if( hash ) hash->freeItem = callback;
 }
 
-/* Returns a pointer to the item's node if found; otherwise returns NULL. */
 /**
 	@brief Search for a given key in an osrfHash.
 	@param hash Pointer to the osrfHash.
 	@param key The key to be sought.
-	@param bucketkey Pointer through which we can report which slot the item belongs in.
+	@param h The hash value of the key, from hash_key().
 	@return A pointer to the osrfHashNode where the item resides; or NULL, if it isn't there.
 
-	If the bucketkey parameter is not NULL, we update the index of the hash bucket where the
-	item belongs (whether or not we actually found it).  In some cases this feedback enables the
-	calling function to avoid hashing the same key twice.
+	Removed nodes have a NULL key, so they never match.  When the key we're looking for is
+	the very string stored in the node, as with interned keys, we don't need strcmp().
 */
-static osrfHashNode* find_item( const osrfHash* hash,
-		const char* key, unsigned int* bucketkey ) {
+static osrfHashNode* find_item( const osrfHash* hash, const char* key, unsigned int h ) {
 
-	// Find the sub-list in the hash table
+	osrfHashNode* node;
 
-	if( hash->size < 6 && !bucketkey )
-	{
-		// For only a few entries, when we don't need to identify
-		// the hash bucket, it's probably faster to search the
-		// linked list instead of hashing
+	if( hash->slots ) {
+		// The table is never more than three quarters full, so we'll hit an empty slot.
+		unsigned int i = h & hash->slot_mask;
+		int index;
+		while( ( index = hash->slots[ i ] ) >= 0 ) {
+			node = hash->nodes + index;
+			if( node->hash == h && node->key && ( node->key == key || !strcmp( node->key, key ) ) )
+				return node;
+			i = ( i + 1 ) & hash->slot_mask;
+		}
+		return NULL;
+	}
 
-		osrfHashNode* currnode = hash->first_key;
-		while( currnode && strcmp( currnode->key, key ) )
-			 currnode = currnode->next;
+	// With only a few entries, scanning the array is faster than probing a table
 
-		return currnode;
+	osrfHashNode* end = hash->nodes + hash->node_count;
+	for( node = hash->nodes; node < end; ++node ) {
+		if( node->hash == h && node->key && ( node->key == key || !strcmp( node->key, key ) ) )
+			return node;
 	}
 
-	unsigned int i = 0;
-	OSRF_HASH_MAKE_KEY(key,i);
+	return NULL;
+}
+
+/**
+	@brief Append a new node to an osrfHash.
+	@param hash Pointer to the osrfHash.
+	@param key The key, already copied; the osrfHash takes ownership of it unless the
+		key is interned.
+	@param h The hash value of the key.
+	@param item A pointer to the item associated with the key.
+	@return A pointer to the new node.
 
-	// If asked, report which slot the key hashes to
-	if( bucketkey ) *bucketkey = i;
+	When the array is full, we first squeeze out the removed nodes, if there are enough of
+	them to be worth it; otherwise we double the array.  If this node puts the array over
+	OSRF_HASH_SMALL_SIZE, or the table over three quarters full, (re)build the table.
+*/
+static osrfHashNode* add_node( osrfHash* hash, char* key, unsigned int h, void* item ) {
 
-	osrfList* list = OSRF_LIST_GET_INDEX( hash->hash, i );
-	if( !list ) { return NULL; }
+	if( hash->node_count == hash->node_alloc ) {
+		if( hash->node_count && hash->node_count - hash->size >= hash->node_count / 2 )
+			compact( hash );
+	}
 
-	// Search the sub-list
+	if( hash->node_count == hash->node_alloc ) {
+		unsigned int alloc = hash->node_alloc ? hash->node_alloc * 2 : 4;
+		osrfHashNode* nodes = realloc( hash->nodes, alloc * sizeof( osrfHashNode ) );
+		if( !nodes ) {
+			osrfLogError( OSRF_LOG_MARK, "Out of Memory" );
+			exit( 99 );
+		}
+		hash->nodes = nodes;
+		hash->node_alloc = alloc;
+	}
 
-	int k;
-	osrfHashNode* node = NULL;
-	for( k = 0; k < list->size; k++ ) {
-		node = OSRF_LIST_GET_INDEX(list, k);
-		if( node && node->key && !strcmp(node->key, key) )
-			return node;
+	// Sequence numbers must keep increasing through the array.  If we ever run out of
+	// them, start over.  (An iterator that lives through four billion insertions may
+	// lose its place.)
+	if( hash->next_seq == UINT_MAX ) {
+		unsigned int i;
+		for( i = 0; i < hash->node_count; ++i )
+			hash->nodes[ i ].seq = i;
+		hash->next_seq = hash->node_count;
 	}
 
-	return NULL;
+	int index = hash->node_count++;
+	osrfHashNode* node = hash->nodes + index;
+	node->key  = key;
+	node->item = item;
+	node->hash = h;
+	node->interned = 0;
+	node->seq  = hash->next_seq++;
+	hash->size++;
+
+	if( hash->slots ) {
+		if( ( hash->slots_used + 1 ) * 4 > ( hash->slot_mask + 1 ) * 3 )
+			make_table( hash );
+		else
+			add_slot( hash, index );
+	} else if( hash->node_count > OSRF_HASH_SMALL_SIZE )
+		make_table( hash );
+
+	return node;
 }
 
 /**
-	@brief Create and populate a new osrfHashNode.
-	@param key The key string.
-	@param item A pointer to the item associated with the key.
-	@return A pointer to the newly created node.
+	@brief Choose a table size for a given number of items.
+	@param count How many items the table is to hold.
+	@return A power of 2, big enough to hold @a count items with room to spare.
+
+	We leave the table no more than five eighths full, so that it has room to grow before
+	it reaches three quarters full and needs rebuilding.
+*/
+static unsigned int table_size( unsigned int count ) {
+	unsigned int slots = OSRF_HASH_MIN_SLOTS;
+	while( slots * 5 < count * 8 )
+		slots <<= 1;
+	return slots;
+}
+
+/**
+	@brief Build a new table for the live nodes in an osrfHash, replacing any old one.
+	@param hash Pointer to the osrfHash.
+
+	Removed nodes are left out, freeing up the slots they occupied.
 */
-static osrfHashNode* osrfNewHashNode(char* key, void* item) {
-	if(!(key && item)) return NULL;
-	osrfHashNode* n;
-	OSRF_MALLOC(n, sizeof(osrfHashNode));
-	n->key = strdup(key);
-	n->item = item;
-	n->prev = NULL;
-	n->prev = NULL;
-	return n;
+static void make_table( osrfHash* hash ) {
+	unsigned int slots = table_size( hash->size );
+
+	free( hash->slots );
+	hash->slots = safe_malloc( slots * sizeof( int ) );
+	memset( hash->slots, -1, slots * sizeof( int ) );
+	hash->slot_mask = slots - 1;
+	hash->slots_used = 0;
+
+	int i;
+	for( i = 0; i < hash->node_count; ++i )
+		if( hash->nodes[ i ].key )
+			add_slot( hash, i );
+}
+
+/**
+	@brief Enter a node into the table.
+	@param hash Pointer to the osrfHash.
+	@param index Index of the node in the array.
+
+	The caller is responsible for making sure that there's room.
+*/
+static void add_slot( osrfHash* hash, int index ) {
+	unsigned int i = hash->nodes[ index ].hash & hash->slot_mask;
+	while( hash->slots[ i ] >= 0 )
+		i = ( i + 1 ) & hash->slot_mask;
+	hash->slots[ i ] = index;
+	hash->slots_used++;
+}
+
+/**
+	@brief Squeeze the removed nodes out of the array.
+	@param hash Pointer to the osrfHash.
+
+	The surviving nodes keep their order, and their sequence numbers, but most of them move
+	to new indexes, so we rebuild the table.
+*/
+static void compact( osrfHash* hash ) {
+	unsigned int i;
+	unsigned int j = 0;
+	for( i = 0; i < hash->node_count; ++i ) {
+		if( hash->nodes[ i ].key ) {
+			if( i != j )
+				hash->nodes[ j ] = hash->nodes[ i ];
+			++j;
+		}
+	}
+	hash->node_count = j;
+
+	if( hash->slots )
+		make_table( hash );
 }
 
 /**
@@ -256,10 +431,9 @@ static osrfHashNode* osrfNewHashNode(char* key, void* item) {
 void* osrfHashSet( osrfHash* hash, void* item, const char* key, ... ) {
 	if(!(hash && item && key )) return NULL;
 
-	unsigned int bucketkey;
-
 	VA_LIST_TO_STRING(key);
-	osrfHashNode* node = find_item( hash, VA_BUF, &bucketkey );
+	unsigned int h = hash_key( VA_BUF );
+	osrfHashNode* node = find_item( hash, VA_BUF, h );
 	if( node ) {
 
 		// We already have an item for this key.  Update it in place.
@@ -275,29 +449,160 @@ void* osrfHashSet( osrfHash* hash, void* item, const char* key, ... ) {
 		return olditem;
 	}
 
-	// There is no entry for this key.  Create a new one.
-	osrfList* bucket;
-	if( !(bucket = OSRF_LIST_GET_INDEX(hash->hash, bucketkey)) ) {
-		bucket = osrfNewList();
-		osrfListSet( hash->hash, bucket, bucketkey );
-	}
+	// There is no entry for this key.  Create a new one at the end.
+	char* interned = hash->intern_keys ? intern_key( VA_BUF, h ) : NULL;
+	node = add_node( hash, interned ? interned : strdup( VA_BUF ), h, item );
+	if( interned )
+		node->interned = 1;
+	return NULL;
+}
 
-	node = osrfNewHashNode(VA_BUF, item);
-	osrfListPushFirst( bucket, node );
+/**
+	@brief Arrange for an osrfHash to share its keys through the intern table.
+	@param hash Pointer to the osrfHash.
+	@param intern_keys Boolean; true to intern the keys of new entries, false to copy them.
 
-	hash->size++;
+	Interning pays off for hashes that are created by the thousand with the same few keys
+	-- the members of JSON objects, for example.  Identical keys share a single copy, and
+	lookups with that copy in hand skip the string comparison.  It doesn't pay for hashes
+	keyed by ever-changing data such as session IDs, which would only fill the table.
+
+	Keys already in the osrfHash are unaffected.
+*/
+void osrfHashSetInternKeys( osrfHash* hash, int intern_keys ) {
+	if( hash ) hash->intern_keys = intern_keys;
+}
+
+/**
+	@brief Find or add the shared copy of a string in the intern table.
+	@param s The string to intern.
+	@return A pointer to the shared copy, or NULL if the string is too long, or the table is full.
 
-	// Add the new hash node to the end of the linked list
+	The shared copies live as long as the process.  Don't free or modify them.
 
-	if( NULL == hash->first_key )
-		hash->first_key = hash->last_key = node;
+	Any thread may call this function; the intern table is shared, and guarded by a mutex.
+*/
+const char* osrfHashIntern( const char* s ) {
+	if( !s ) return NULL;
+	return intern_key( s, hash_key( s ) );
+}
+
+/**
+	@brief Report on the contents of the intern table.
+	@param count Pointer to a variable to receive the number of strings interned; may be NULL.
+	@param bytes Pointer to a variable to receive the bytes of string interned; may be NULL.
+*/
+void osrfHashInternStats( unsigned long* count, unsigned long* bytes ) {
+	pthread_mutex_lock( &intern_lock );
+	if( count ) *count = intern_table ? intern_table->size : 0;
+	if( bytes ) *bytes = intern_bytes;
+	pthread_mutex_unlock( &intern_lock );
+}
+
+/**
+	@brief Find or add the shared copy of a string whose hash value we already know.
+	@param key The string to intern.
+	@param h The hash value of @a key, from hash_key().
+	@return A pointer to the shared copy, or NULL if we won't intern this string.
+
+	The lookup and the insertion happen under intern_lock, so that two threads interning
+	the same string get the same copy, and neither sees the table while the other is
+	rebuilding it.  The copies themselves are never freed or moved, so they may be used
+	without the lock.
+*/
+static char* intern_key( const char* key, unsigned int h ) {
+	char* copy = NULL;
+	pthread_mutex_lock( &intern_lock );
+
+	if( !intern_table )
+		intern_table = osrfNewHash();
+
+	osrfHashNode* node = find_item( intern_table, key, h );
+	if( node )
+		copy = node->key;
 	else {
-		node->prev = hash->last_key;
-		hash->last_key->next = node;
-		hash->last_key = node;
+		size_t len = strlen( key );
+		if( len <= OSRF_INTERN_MAX_LEN && intern_table->size < OSRF_INTERN_MAX_COUNT ) {
+			copy = strdup( key );
+			add_node( intern_table, copy, h, copy );
+			intern_bytes += len + 1;
+		}
 	}
 
-	return NULL;
+	pthread_mutex_unlock( &intern_lock );
+	return copy;
+}
+
+/**
+	@brief Build a complete osrfHash in memory supplied by the caller.
+	@param alloc Callback function that allocates memory.
+	@param ctx Context pointer, passed through to @a alloc.
+	@param pairs Array of 2 * @a count pointers: each key, followed by its item.
+	@param count How many key/item pairs there are.
+	@return Pointer to the new osrfHash, or NULL if a key occurs more than once.
+
+	This is for callers such as jsonParseArena() that know all the entries up front and want
+	to put everything in a single region instead of making a malloc() per node and per key.
+	Every piece of the osrfHash -- the nodes and the table, if any -- comes from @a alloc,
+	and the keys are used in place rather than copied, so they must live at least as long
+	as the osrfHash.  The entries are iterated in the order given.
+
+	Such an osrfHash is read-only.  Fetch from it and iterate over it at will, but don't
+	store into it, remove from it, or free it with osrfHashFree().  It goes away when the
+	caller releases the memory that @a alloc handed out.
+*/
+osrfHash* osrfHashFromPairs( void* (*alloc)( void* ctx, size_t size ), void* ctx,
+		void** pairs, unsigned int count ) {
+	if( !alloc ) return NULL;
+
+	osrfHash* hash = alloc( ctx, sizeof( osrfHash ) );
+	hash->freeItem   = NULL;
+	hash->size       = 0;
+	hash->node_count = 0;
+	hash->node_alloc = count;
+	hash->nodes      = alloc( ctx, ( count + 1 ) * sizeof( osrfHashNode ) );
+	hash->slots      = NULL;
+	hash->slot_mask  = 0;
+	hash->slots_used = 0;
+	hash->next_seq   = 0;
+	hash->intern_keys = 0;
+
+	// Since the array is already big enough, add_node() won't try to grow
+	// it; and with a table already in place, big enough for everything, it
+	// won't try to build one.
+	unsigned int i;
+	if( count > OSRF_HASH_SMALL_SIZE ) {
+		unsigned int slots = table_size( count );
+		hash->slots = alloc( ctx, slots * sizeof( int ) );
+		memset( hash->slots, -1, slots * sizeof( int ) );
+		hash->slot_mask = slots - 1;
+	}
+
+	for( i = 0; i < count; ++i ) {
+		char* key = pairs[ 2 * i ];
+		unsigned int h = hash_key( key );
+		if( find_item( hash, key, h ) )
+			return NULL;     // Duplicate key
+		add_node( hash, key, h, pairs[ 2 * i + 1 ] );
+	}
+
+	return hash;
+}
+
+/**
+	@brief Logically delete a node.
+	@param hash Pointer to the osrfHash that owns the node.
+	@param node Pointer to the node.
+
+	Free the key and forget the item, but leave the node in place, so that an iterator
+	parked here can find its way to the next node.
+*/
+static void unlink_node( osrfHash* hash, osrfHashNode* node ) {
+	if( !node->interned )
+		free(node->key);
+	node->key = NULL;
+	node->item = NULL;
+	hash->size--;
 }
 
 /**
@@ -318,21 +623,17 @@ void* osrfHashSet( osrfHash* hash, void* item, const char* key, ... ) {
 
 	Note: the osrfHashNode for the removed item is logically deleted so that subsequent searches
 	and traversals will ignore it.  However it is physically left in place so that an
-	osrfHashIterator pointing to it can advance to the next node.  The downside of this
-	design is that, if a lot of items are removed, the accumulation of logically deleted nodes
-	will slow down searches.  In addition, the memory used by a logically deleted osrfHashNode
-	remains allocated until the entire osrfHashNode is freed.
+	osrfHashIterator pointing to it can advance to the next node.  It's cleared away later,
+	when the osrfHash next rebuilds its table or runs out of room in its array.
 */
 void* osrfHashRemove( osrfHash* hash, const char* key, ... ) {
 	if(!(hash && key )) return NULL;
 
 	VA_LIST_TO_STRING(key);
 
-	osrfHashNode* node = find_item( hash, VA_BUF, NULL );
+	osrfHashNode* node = find_item( hash, VA_BUF, hash_key( VA_BUF ) );
 	if( !node ) return NULL;
 
-	hash->size--;
-
 	void* item = NULL;  // to be returned
 	if( hash->freeItem )
 		hash->freeItem( node->key, node->item );
@@ -340,24 +641,7 @@ void* osrfHashRemove( osrfHash* hash, const char* key, ... ) {
 		item = node->item;
 
 	// Mark the node as logically deleted
-
-	free(node->key);
-	node->key = NULL;
-	node->item = NULL;
-
-	// Make the node unreachable from the rest of the linked list.
-	// We leave the next and prev pointers in place so that an
-	// iterator parked here can find its way to an adjacent node.
-
-	if( node->prev )
-		node->prev->next = node->next;
-	else
-		hash->first_key = node->next;
-
-	if( node->next )
-		node->next->prev = node->prev;
-	else
-		hash->last_key = node->prev;
+	unlink_node( hash, node );
 
 	return item;
 }
@@ -368,7 +652,7 @@ void* osrfHashRemove( osrfHash* hash, const char* key, ... ) {
 	@param key A printf-style format string to be expanded into the key for the item.
 		Subsequent parameters, if any, will be formatted and inserted into the expanded key.
 	@return Pointer to the extracted item, if any (see discussion).
-	
+
 	osrfHashRemove removes a specified entry without destroying it, and returns a pointer
 	to it.  If either of its first two parameters is NULL, or if no entry is present for the specified key, it returns NULL.
 
@@ -380,30 +664,13 @@ void* osrfHashExtract( osrfHash* hash, const char* key, ... ) {
 
 	VA_LIST_TO_STRING(key);
 
-	osrfHashNode* node = find_item( hash, VA_BUF, NULL );
+	osrfHashNode* node = find_item( hash, VA_BUF, hash_key( VA_BUF ) );
 	if( !node ) return NULL;
 
-	hash->size--;
-
 	void* item = node->item;  // to be returned
 
 	// Mark the node as logically deleted
-	free(node->key);
-	node->key = NULL;
-	node->item = NULL;
-
-	// Make the node unreachable from the rest of the linked list.
-	// We leave the next and prev pointers in place so that an
-	// iterator parked here can find its way to an adjacent node.
-	if( node->prev )
-		node->prev->next = node->next;
-	else
-		hash->first_key = node->next;
-
-	if( node->next )
-		node->next->prev = node->prev;
-	else
-		hash->last_key = node->prev;
+	unlink_node( hash, node );
 
 	return item;
 }
@@ -417,7 +684,7 @@ void* osrfHashExtract( osrfHash* hash, const char* key, ... ) {
 void* osrfHashGet( osrfHash* hash, const char* key ) {
 	if(!(hash && key )) return NULL;
 
-	osrfHashNode* node = find_item( hash, key, NULL );
+	osrfHashNode* node = find_item( hash, key, hash_key( key ) );
 	if( !node ) return NULL;
 	return node->item;
 }
@@ -433,7 +700,7 @@ void* osrfHashGetFmt( osrfHash* hash, const char* key, ... ) {
 	if(!(hash && key )) return NULL;
 	VA_LIST_TO_STRING(key);
 
-	osrfHashNode* node = find_item( hash, (char*) VA_BUF, NULL );
+	osrfHashNode* node = find_item( hash, VA_BUF, hash_key( VA_BUF ) );
 	if( !node ) return NULL;
 	return node->item;
 }
@@ -454,17 +721,13 @@ void* osrfHashGetFmt( osrfHash* hash, const char* key, ... ) {
 osrfStringArray* osrfHashKeys( osrfHash* hash ) {
 	if(!hash) return NULL;
 
-	osrfHashNode* node;
 	osrfStringArray* strings = osrfNewStringArray( hash->size );
 
-	// Add every key on the linked list
+	// Add every key that hasn't been removed
 
-	node = hash->first_key;
-	while( node ) {
-		if( node->key )  // should always be true
-			osrfStringArrayAdd( strings, node->key );
-		node = node->next;
-	}
+	int i;
+	for( i = next_node( hash, -1 ); i >= 0; i = next_node( hash, i ) )
+		osrfStringArrayAdd( strings, hash->nodes[ i ].key );
 
 	return strings;
 }
@@ -492,25 +755,65 @@ unsigned long osrfHashGetCount( osrfHash* hash ) {
 void osrfHashFree( osrfHash* hash ) {
 	if(!hash) return;
 
-	int i, j;
-	osrfList* list;
-	osrfHashNode* node;
-
-	for( i = 0; i != hash->hash->size; i++ ) {
-		if( ( list = OSRF_LIST_GET_INDEX( hash->hash, i )) ) {
-			for( j = 0; j != list->size; j++ ) {
-				if( (node = OSRF_LIST_GET_INDEX( list, j )) ) {
-					OSRF_HASH_NODE_FREE(hash, node);
-				}
-			}
-			osrfListFree(list);
+	int i;
+	for( i = 0; i < hash->node_count; i++ ) {
+		osrfHashNode* node = hash->nodes + i;
+		if( node->key ) {
+			if( hash->freeItem )
+				hash->freeItem( node->key, node->item );
+			if( !node->interned )
+				free( node->key );
 		}
 	}
 
-	osrfListFree(hash->hash);
+	free(hash->nodes);
+	free(hash->slots);
 	free(hash);
 }
 
+/**
+	@brief Find the next node that hasn't been removed.
+	@param hash Pointer to the osrfHash.
+	@param index Index of the node to start after, or -1 to start at the beginning.
+	@return Index of the next live node, or -1 if there isn't one.
+*/
+static int next_node( const osrfHash* hash, int index ) {
+	for( ++index; index < hash->node_count; ++index )
+		if( hash->nodes[ index ].key )
+			return index;
+	return -1;
+}
+
+/**
+	@brief Find the current position of an osrfHashIterator.
+	@param itr Pointer to the osrfHashIterator.
+	@return Index of the node where the iterator is positioned; or, if that node has since
+		been squeezed out of the array, the index of the last node before it; or -1.
+
+	Usually the node is right where we left it.  If the array has been compacted since, we
+	look for it by its sequence number.
+*/
+static int find_position( const osrfHashIterator* itr ) {
+	const osrfHash* hash = itr->hash;
+	int index = itr->curr_node;
+	if( index < 0 )
+		return -1;
+	if( index < hash->node_count && hash->nodes[ index ].seq == itr->curr_seq )
+		return index;
+
+	// Binary search for the first node with a higher sequence number
+	unsigned int low = 0;
+	unsigned int high = hash->node_count;
+	while( low < high ) {
+		unsigned int mid = low + ( high - low ) / 2;
+		if( hash->nodes[ mid ].seq <= itr->curr_seq )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return (int) low - 1;
+}
+
 /**
 	@brief Create and initialize an osrfHashIterator for a given osrfHash.
 	@param hash Pointer to the osrfHash with which the iterator will be associated.
@@ -526,7 +829,8 @@ osrfHashIterator* osrfNewHashIterator( osrfHash* hash ) {
 	osrfHashIterator* itr;
 	OSRF_MALLOC(itr, sizeof(osrfHashIterator));
 	itr->hash = hash;
-	itr->curr_node = NULL;
+	itr->curr_node = -1;
+	itr->curr_seq = 0;
 	return itr;
 }
 
@@ -540,17 +844,16 @@ osrfHashIterator* osrfNewHashIterator( osrfHash* hash ) {
 void* osrfHashIteratorNext( osrfHashIterator* itr ) {
 	if(!(itr && itr->hash)) return NULL;
 
-	// Advance to the next node in the linked list
+	// Advance to the next node in the array.  Having run off the end, we're back
+	// where we started, so the next call will begin again with the first node.
 
-	if( NULL == itr->curr_node )
-		itr->curr_node = itr->hash->first_key;
-	else
-		itr->curr_node = itr->curr_node->next;
-
-	if( itr->curr_node )
-		return itr->curr_node->item;
-	else
+	itr->curr_node = next_node( itr->hash, find_position( itr ) );
+	if( itr->curr_node < 0 )
 		return NULL;
+
+	osrfHashNode* node = itr->hash->nodes + itr->curr_node;
+	itr->curr_seq = node->seq;
+	return node->item;
 }
 
 /**
@@ -563,8 +866,13 @@ void* osrfHashIteratorNext( osrfHashIterator* itr ) {
 	unless there has been a call to osrfHashIteratorReset() in the meanwhile.
 */
 const char* osrfHashIteratorKey( const osrfHashIterator* itr ) {
-	if( itr && itr->curr_node )
-		return itr->curr_node->key;
+	if( !itr || itr->curr_node < 0 )
+		return NULL;
+
+	// If the current node has been squeezed out, it was removed, and has no key.
+	int index = find_position( itr );
+	if( index >= 0 && itr->hash->nodes[ index ].seq == itr->curr_seq )
+		return itr->hash->nodes[ index ].key;
 	else
 		return NULL;
 }
@@ -587,7 +895,7 @@ void osrfHashIteratorFree( osrfHashIterator* itr ) {
 */
 void osrfHashIteratorReset( osrfHashIterator* itr ) {
 	if(!itr) return;
-	itr->curr_node = NULL;
+	itr->curr_node = -1;
 }
 
 
@@ -601,8 +909,6 @@ void osrfHashIteratorReset( osrfHashIterator* itr ) {
 int osrfHashIteratorHasNext( osrfHashIterator* itr ) {
 	if( !itr || !itr->hash )
 		return 0;
-	else if( itr->curr_node )
-		return itr->curr_node->next ? 1 : 0;
 	else
-		return itr->hash->first_key ? 1 : 0;
+		return next_node( itr->hash, find_position( itr ) ) >= 0 ? 1 : 0;
 }
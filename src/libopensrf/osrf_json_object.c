@@ -22,12 +22,19 @@ GNU General Public License for more details.
 	we can take one from the free list, if one is available, instead of calling
 	malloc().  Likewise when we free a jsonObject, we can stick it on the free list
 	for potential reuse instead of calling free().
+
+	Each thread has a free list of its own, so that threads needn't take turns with it.
+	A list longer than the cap set by jsonSetFreeListCap() hands half of itself over to a
+	depot shared by all threads; a thread whose list runs dry takes a batch back from the
+	depot before falling back on malloc().  Only the depot needs a lock, and we take it
+	once per batch, not once per jsonObject.
 */
 
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <opensrf/log.h>
 #include <opensrf/osrf_json.h>
 #include <opensrf/osrf_utf8.h>
@@ -64,53 +71,501 @@ GNU General Public License for more details.
 	if( newtype == JSON_HASH && _obj_->value.h == NULL ) {	\
 		_obj_->value.h = osrfNewHash();		\
 		osrfHashSetCallback( _obj_->value.h, _jsonFreeHashItem ); \
+		osrfHashSetInternKeys( _obj_->value.h, internKeys ); \
 	} else if( newtype == JSON_ARRAY && _obj_->value.l == NULL ) {	\
 		_obj_->value.l = osrfNewList();		\
 		_obj_->value.l->freeItem = _jsonFreeListItem;\
 	}
 
-/** Count of the times we put a freed jsonObject on the free list instead of calling free() */
-static int unusedObjCapture = 0;
-/** Count of the times we reused a jsonObject from the free list instead of calling malloc() */
-static int unusedObjRelease = 0;
-/** Count of the times we allocated a jsonObject with malloc() */
-static int mallocObjCreate = 0;
-/** Number of unused jsonObjects currently on the free list */
-static int currentListLen = 0;
+/** Default for the most unused jsonObjects a thread keeps on its own free list */
+#define JSON_FREE_LIST_CAP 4096
+
+/** Most batches of unused jsonObjects to hold in the depot; the rest go back to the heap */
+#define JSON_DEPOT_MAX_BATCHES 64
 
 /**
 	Union overlaying a jsonObject with a pointer.  When the jsonObject is not in use as a
 	jsonObject, we use the overlaid pointer to maintain a linked list of unused jsonObjects.
+
+	The first jsonObject of a batch in the depot also records the next batch and the length
+	of its own.
 */
 union unusedObjUnion{
 
 	union unusedObjUnion* next;
+	struct {
+		union unusedObjUnion* next;          /**< Same as the next above */
+		union unusedObjUnion* next_batch;    /**< First jsonObject of the next batch */
+		unsigned long count;                 /**< Number of jsonObjects in this batch */
+	} batch;
 	jsonObject obj;
 };
 typedef union unusedObjUnion unusedObj;
 
-/** Pointer to the head of the free list */
-static unusedObj* freeObjList = NULL;
+/** A thread's own free list of jsonObjects, with the counts behind jsonObjectGetPoolStats() */
+typedef struct {
+	unusedObj* head;          /**< Head of the free list */
+	unsigned long length;     /**< Number of unused jsonObjects currently on the free list */
+	unsigned long hits;       /**< Times we reused a jsonObject instead of calling malloc() */
+	unsigned long misses;     /**< Times we allocated a jsonObject with malloc() */
+	unsigned long captures;   /**< Times we kept a freed jsonObject instead of calling free() */
+	int registered;           /**< Boolean; true once we'll hear about the thread's exit */
+} objPool;
+
+/**
+	The calling thread's free list.  The initial-exec model spares us a call to
+	__tls_get_addr() every time we touch it, which would cost as much as the free list saves.
+*/
+static __thread objPool pool __attribute__(( tls_model( "initial-exec" ))) =
+	{ NULL, 0, 0, 0, 0, 0 };
+
+/** Most unused jsonObjects a thread keeps to itself (see jsonSetFreeListCap()) */
+static unsigned long freeListCap = JSON_FREE_LIST_CAP;
+
+/** Guards the depot and its counts */
+static pthread_mutex_t depotLock = PTHREAD_MUTEX_INITIALIZER;
+/** First jsonObject of the most recently deposited batch */
+static unusedObj* depot = NULL;
+/** Number of batches in the depot */
+static unsigned long depotBatches = 0;
+/** Number of jsonObjects in the depot, all batches together */
+static unsigned long depotLength = 0;
+
+/** For flushing a thread's free list into the depot when the thread exits */
+static pthread_key_t poolKey;
+static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static jsonObject* new_json_object( void );
+static void recycle_json_object( jsonObject* o );
+static void deposit_batch( unusedObj* batch, unsigned long count );
+static void free_chain( unusedObj* obj );
+static void make_pool_key( void );
+static void pool_thread_exit( void* p );
+
+/** Boolean; true if the keys of JSON_HASHes are to be shared through the intern table */
+static int internKeys = 0;
 
 static void add_json_to_buffer( const jsonObject* obj,
 	growing_buffer * buf, int do_classname, int second_pass );
+static void add_decoded_json_to_buffer( const jsonObject* obj, growing_buffer* buf,
+	const char* classname, size_t* xml_extra );
+
+/**
+	@brief Turn key interning on or off for JSON_HASHes created from now on.
+	@param intern Boolean; true to intern keys, false to give each hash its own copies.
+
+	With interning on, every JSON_HASH that has a key "id", for example, points to the same
+	"id" (see osrfHashIntern()).  A drone holding a few thousand rows of a result set, all
+	with the same column names, then stores each name once instead of once per row.  The
+	jsonArena parser likewise points to the interned keys instead of copying them into the
+	arena.
+
+	The interned keys are never freed, so this setting is meant for processes whose keys
+	come from a fixed vocabulary -- class and column names -- and not from the data.
+*/
+void jsonSetInternKeys( int intern ) {
+	internKeys = intern ? 1 : 0;
+}
+
+/**
+	@brief Report whether key interning is turned on.
+	@return 1 if it is, or 0 if it isn't.
+*/
+int jsonInternKeys( void ) {
+	return internKeys;
+}
 
 /**
 	@brief Return all jsonObjects in the free list to the heap.
 
-	Reclaims memory occupied by unused jsonObjects in the free list.  It is never really
-	necessary to call this function, assuming that we don't run out of memory.  However
-	it might be worth calling if we have built and destroyed a lot of jsonObjects that
-	we don't expect to need again, in order to reduce our memory footprint.
+	Reclaims memory occupied by unused jsonObjects in the calling thread's free list, and
+	in the depot shared by all threads.  It is never really necessary to call this
+	function, assuming that we don't run out of memory.  However it might be worth calling
+	if we have built and destroyed a lot of jsonObjects that we don't expect to need again,
+	in order to reduce our memory footprint.
+
+	Other threads' free lists are theirs to manage.
 */
 void jsonObjectFreeUnused( void ) {
 
-	unusedObj* temp;
-	while( freeObjList ) {
-		temp = freeObjList->next;
-		free( freeObjList );
-		freeObjList = temp;
+	free_chain( pool.head );
+	pool.head = NULL;
+	pool.length = 0;
+
+	pthread_mutex_lock( &depotLock );
+	unusedObj* batch = depot;
+	__atomic_store_n( &depot, NULL, __ATOMIC_RELAXED );
+	depotBatches = 0;
+	depotLength = 0;
+	pthread_mutex_unlock( &depotLock );
+
+	while( batch ) {
+		unusedObj* next_batch = batch->batch.next_batch;
+		free_chain( batch );
+		batch = next_batch;
+	}
+}
+
+/**
+	@brief Set the most unused jsonObjects that a thread may keep on its own free list.
+	@param cap The new limit.  Zero turns off recycling: jsonObjectFree() frees everything.
+
+	When a thread's free list grows past the cap, half of it goes to the depot, where
+	other threads can get at it.  A cap large enough to hold the jsonObjects of a typical
+	request keeps the depot, and its lock, out of the way.
+
+	The cap applies to all threads.  Set it before starting any that use jsonObjects.
+*/
+void jsonSetFreeListCap( unsigned long cap ) {
+	freeListCap = cap;
+}
+
+/**
+	@brief Report how well the free list is working, as seen by the calling thread.
+	@param stats Pointer to a jsonObjectPoolStats to be filled in.
+
+	The hits and misses are counted since the thread started, and the lengths are as of
+	now.
+*/
+void jsonObjectGetPoolStats( jsonObjectPoolStats* stats ) {
+	if( !stats )
+		return;
+
+	stats->hits = pool.hits;
+	stats->misses = pool.misses;
+	stats->length = pool.length;
+
+	pthread_mutex_lock( &depotLock );
+	stats->depot = depotLength;
+	pthread_mutex_unlock( &depotLock );
+}
+
+/**
+	@brief Get a jsonObject to initialize, preferably one that has been used before.
+	@return Pointer to the jsonObject, with nothing in it.
+
+	Try the calling thread's free list first, and then the depot.  Only if they're both
+	empty do we call malloc().
+*/
+static jsonObject* new_json_object( void ) {
+
+	objPool* p = &pool;
+
+	if( !p->head && __atomic_load_n( &depot, __ATOMIC_RELAXED )) {
+		// Our list is empty, but the depot may have some we can use.  Take a batch.
+		// (We peek at the depot without the lock, so as not to take the lock for
+		// nothing; we look again once we have it.)
+		pthread_mutex_lock( &depotLock );
+		unusedObj* batch = depot;
+		if( batch ) {
+			__atomic_store_n( &depot, batch->batch.next_batch, __ATOMIC_RELAXED );
+			--depotBatches;
+			depotLength -= batch->batch.count;
+			p->head = batch;
+			p->length = batch->batch.count;
+		}
+		pthread_mutex_unlock( &depotLock );
+	}
+
+	jsonObject* o;
+	if( p->head ) {
+		o = (jsonObject*) p->head;
+		p->head = p->head->next;
+		p->hits++;
+		p->length--;
+	} else {
+		OSRF_MALLOC( o, sizeof(jsonObject) );
+		p->misses++;
+	}
+
+	return o;
+}
+
+/**
+	@brief Keep an emptied jsonObject for reuse, or free it.
+	@param o Pointer to the jsonObject, which no longer owns anything.
+
+	Stick it onto the calling thread's free list.  If that makes the list too long, move
+	half of it to the depot.
+*/
+static void recycle_json_object( jsonObject* o ) {
+
+	objPool* p = &pool;
+
+	if( 0 == freeListCap ) {
+		free( o );
+		return;
+	}
+
+	if( !p->registered ) {
+		// Arrange to hand over our free list if the thread exits
+		pthread_once( &poolKeyOnce, make_pool_key );
+		pthread_setspecific( poolKey, p );
+		p->registered = 1;
+	}
+
+	unusedObj* unused = (unusedObj*) o;
+	unused->next = p->head;
+	p->head = unused;
+	p->length++;
+	p->captures++;
+
+	if( p->length > freeListCap ) {
+		// Split off the older half, and send it to the depot
+		unsigned long keep = freeListCap / 2;
+		unusedObj* last = p->head;
+		unsigned long i;
+		for( i = 1; i < keep; ++i )
+			last = last->next;
+
+		unusedObj* batch;
+		if( keep ) {
+			batch = last->next;
+			last->next = NULL;
+		} else {
+			batch = p->head;
+			p->head = NULL;
+		}
+		deposit_batch( batch, p->length - keep );
+		p->length = keep;
+	}
+
+	if (p->captures > 1 && !(p->captures % 1000))
+		osrfLogDebug( OSRF_LOG_MARK, "Objects malloc()'d: %lu, "
+			"Reusable objects captured: %lu, Objects reused: %lu, "
+			"Current List Length: %lu",
+			p->misses, p->captures, p->hits, p->length );
+}
+
+/**
+	@brief Add a batch of unused jsonObjects to the depot.
+	@param batch Pointer to the first jsonObject in a NULL-terminated chain of them.
+	@param count Number of jsonObjects in the chain.
+
+	If the depot is full, return the batch to the heap instead.
+*/
+static void deposit_batch( unusedObj* batch, unsigned long count ) {
+
+	if( !batch )
+		return;
+
+	pthread_mutex_lock( &depotLock );
+	if( depotBatches < JSON_DEPOT_MAX_BATCHES ) {
+		batch->batch.count = count;
+		batch->batch.next_batch = depot;
+		__atomic_store_n( &depot, batch, __ATOMIC_RELAXED );
+		++depotBatches;
+		depotLength += count;
+		batch = NULL;
+	}
+	pthread_mutex_unlock( &depotLock );
+
+	free_chain( batch );
+}
+
+/**
+	@brief Free a NULL-terminated chain of unused jsonObjects.
+	@param obj Pointer to the first jsonObject in the chain; may be NULL.
+*/
+static void free_chain( unusedObj* obj ) {
+	while( obj ) {
+		unusedObj* next = obj->next;
+		free( obj );
+		obj = next;
+	}
+}
+
+/**
+	@brief Create the thread-specific key whose destructor flushes a thread's free list.
+
+	Called once, through pthread_once().
+*/
+static void make_pool_key( void ) {
+	pthread_key_create( &poolKey, pool_thread_exit );
+}
+
+/**
+	@brief Hand over the free list of an exiting thread to the depot.
+	@param p Pointer to the thread's objPool.
+*/
+static void pool_thread_exit( void* p ) {
+	objPool* exiting = (objPool*) p;
+	deposit_batch( exiting->head, exiting->length );
+	exiting->head = NULL;
+	exiting->length = 0;
+	exiting->registered = 0;
+}
+
+/** Default size of the blocks in a jsonArena */
+#define JSON_ARENA_BLOCK_SIZE (16 * 1024)
+
+/** Round a size up so that everything in a jsonArena is suitably aligned */
+#define JSON_ARENA_ALIGN(n) ( ( (n) + sizeof( double ) - 1 ) & ~( sizeof( double ) - 1 ) )
+
+/**
+	@brief One block of memory in a jsonArena.
+
+	The usable memory follows the header, starting at JSON_ARENA_ALIGN( sizeof( jsonArenaBlock ) ).
+*/
+typedef struct _jsonArenaBlock {
+	struct _jsonArenaBlock* next;  /**< Next (older) block in the list */
+	size_t size;                   /**< Usable bytes in this block */
+	size_t used;                   /**< Bytes already handed out */
+} jsonArenaBlock;
+
+/**
+	@brief A list of blocks, of which the first is the one we're carving up.
+*/
+struct _jsonArenaStruct {
+	jsonArenaBlock* blocks;        /**< Most recently started block first */
+	size_t block_size;             /**< Usable size of a normal block */
+	size_t in_use;                 /**< Total bytes handed out since the last reset */
+};
+
+static jsonArenaBlock* arena_new_block( size_t size );
+
+/**
+	@brief Create a new, empty jsonArena.
+	@param block_size Size of the blocks to allocate, or zero for the default.
+	@return Pointer to the new jsonArena.
+
+	The first block is allocated right away, so that a small tree needs no further calls
+	to malloc().
+
+	The calling code is responsible for freeing the jsonArena by calling jsonArenaFree().
+*/
+jsonArena* jsonNewArena( size_t block_size ) {
+	jsonArena* arena;
+	OSRF_MALLOC( arena, sizeof( jsonArena ) );
+	arena->block_size = block_size ? JSON_ARENA_ALIGN( block_size ) : JSON_ARENA_BLOCK_SIZE;
+	arena->blocks = arena_new_block( arena->block_size );
+	arena->in_use = 0;
+	return arena;
+}
+
+/**
+	@brief Allocate a block of the requested size, with a header.
+	@param size Usable size of the block.
+	@return Pointer to the new block.
+
+	We call malloc() rather than safe_malloc(), because there's no point in zeroing memory
+	that we're about to overwrite.
+*/
+static jsonArenaBlock* arena_new_block( size_t size ) {
+	jsonArenaBlock* block = malloc( JSON_ARENA_ALIGN( sizeof( jsonArenaBlock ) ) + size );
+	if( !block ) {
+		osrfLogError( OSRF_LOG_MARK, "Out of Memory" );
+		exit( 99 );
+	}
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+/**
+	@brief Carve a chunk of memory out of a jsonArena.
+	@param arena Pointer to the jsonArena.
+	@param size How many bytes are needed.
+	@return Pointer to the memory, aligned for any of the types in a jsonObject.
+
+	The memory is not initialized.  It remains valid until the next call to jsonArenaReset()
+	or jsonArenaFree(); don't free() it.
+
+	A request too big to share a block with others gets a block of its own, slipped in
+	behind the current block so that we can keep filling the latter.
+*/
+void* jsonArenaAlloc( jsonArena* arena, size_t size ) {
+	size = JSON_ARENA_ALIGN( size );
+	jsonArenaBlock* block = arena->blocks;
+
+	if( block->size - block->used < size ) {
+		if( size > arena->block_size / 4 ) {
+			jsonArenaBlock* big = arena_new_block( size );
+			big->next = block->next;
+			block->next = big;
+			block = big;
+		} else {
+			block = arena_new_block( arena->block_size );
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+	}
+
+	void* p = (char*) block + JSON_ARENA_ALIGN( sizeof( jsonArenaBlock ) ) + block->used;
+	block->used += size;
+	arena->in_use += size;
+	return p;
+}
+
+/**
+	@brief Copy a string, or the first part of one, into a jsonArena.
+	@param arena Pointer to the jsonArena.
+	@param s Pointer to the characters to be copied.
+	@param len How many characters to copy.
+	@return Pointer to the nul-terminated copy.
+*/
+char* jsonArenaStrndup( jsonArena* arena, const char* s, size_t len ) {
+	char* copy = jsonArenaAlloc( arena, len + 1 );
+	memcpy( copy, s, len );
+	copy[ len ] = '\0';
+	return copy;
+}
+
+/**
+	@brief Report how much memory has been handed out from a jsonArena.
+	@param arena Pointer to the jsonArena.
+	@return The number of bytes allocated since the arena was created or last reset.
+*/
+size_t jsonArenaUsed( const jsonArena* arena ) {
+	return arena ? arena->in_use : 0;
+}
+
+/**
+	@brief Release everything allocated from a jsonArena, but keep the arena for reuse.
+	@param arena Pointer to the jsonArena.
+
+	We keep one normal-sized block so that the next tree can start without a malloc(), and
+	give the rest back to the heap, so that one huge message doesn't pin its memory forever.
+*/
+void jsonArenaReset( jsonArena* arena ) {
+	if( !arena )
+		return;
+
+	jsonArenaBlock* keep = NULL;
+	jsonArenaBlock* block = arena->blocks;
+	while( block ) {
+		jsonArenaBlock* next = block->next;
+		if( !keep && block->size == arena->block_size )
+			keep = block;
+		else
+			free( block );
+		block = next;
+	}
+
+	if( !keep )
+		keep = arena_new_block( arena->block_size );
+	keep->next = NULL;
+	keep->used = 0;
+	arena->blocks = keep;
+	arena->in_use = 0;
+}
+
+/**
+	@brief Free a jsonArena and everything allocated from it.
+	@param arena Pointer to the jsonArena.
+*/
+void jsonArenaFree( jsonArena* arena ) {
+	if( !arena )
+		return;
+
+	jsonArenaBlock* block = arena->blocks;
+	while( block ) {
+		jsonArenaBlock* next = block->next;
+		free( block );
+		block = next;
 	}
+	free( arena );
 }
 
 /**
@@ -125,19 +580,9 @@ void jsonObjectFreeUnused( void ) {
 */
 jsonObject* jsonNewObject(const char* data) {
 
-	jsonObject* o;
-
 	// Allocate a jsonObject; from the free list if possible,
 	// or from the heap if necessary.
-	if( freeObjList ) {
-		o = (jsonObject*) freeObjList;
-		freeObjList = freeObjList->next;
-        unusedObjRelease++;
-        currentListLen--;
-	} else {
-		OSRF_MALLOC( o, sizeof(jsonObject) );
-        mallocObjCreate++;
-    }
+	jsonObject* o = new_json_object();
 
 	o->size = 0;
 	o->classname = NULL;
@@ -167,17 +612,7 @@ jsonObject* jsonNewObject(const char* data) {
  */
 jsonObject* jsonNewObjectFmt(const char* data, ...) {
 
-	jsonObject* o;
-
-	if( freeObjList ) {
-		o = (jsonObject*) freeObjList;
-		freeObjList = freeObjList->next;
-        unusedObjRelease++;
-        currentListLen--;
-	} else {
-		OSRF_MALLOC( o, sizeof(jsonObject) );
-        mallocObjCreate++;
-    }
+	jsonObject* o = new_json_object();
 
 	o->size = 0;
 	o->classname = NULL;
@@ -296,18 +731,7 @@ void jsonObjectFree( jsonObject* o ) {
 
 	// Stick the old jsonObject onto a free list
 	// for potential reuse
-	
-	unusedObj* unused = (unusedObj*) o;
-	unused->next = freeObjList;
-	freeObjList = unused;
-
-    unusedObjCapture++;
-    currentListLen++;
-    if (unusedObjCapture > 1 && !(unusedObjCapture % 1000))
-        osrfLogDebug( OSRF_LOG_MARK, "Objects malloc()'d: %d, "
-			"Reusable objects captured: %d, Objects reused: %d, "
-			"Current List Length: %d",
-			mallocObjCreate, unusedObjCapture, unusedObjRelease, currentListLen );
+	recycle_json_object( o );
 }
 
 /**
@@ -576,6 +1000,118 @@ static void add_json_to_buffer( const jsonObject* obj,
 	}
 }
 
+/**
+	@brief Append the JSON for a jsonObject to a growing_buffer, decoding class hints.
+	@param obj Pointer to the jsonObject to be translated.
+	@param buf Pointer to the growing_buffer that will receive the JSON.
+	@param xml_extra Pointer to a running total of how much longer the JSON will get when
+		escaped for XML, as osrfXmlEscapingLength() would report it; may be NULL.
+
+	The result is the same as that of jsonObjectToJSON( jsonObjectDecodeClass( obj ) ),
+	but without building the decoded copy, and without a separate string to copy out of.
+	It's meant for code such as the osrfMessage serializer, which used to decode a
+	response into a new tree only to translate the tree into JSON and throw it away.
+
+	If @a xml_extra is not NULL, we add to it as we go, so that the caller can tell how big
+	the JSON will be in a transport message without scanning it again.  Its raw length is
+	just how much the buffer grew.
+
+	A NULL @a obj is translated as null.
+*/
+void jsonObjectDecodeToBuffer( const jsonObject* obj, growing_buffer* buf,
+		size_t* xml_extra ) {
+	if( buf ) {
+		size_t extra = 0;
+		add_decoded_json_to_buffer( obj, buf, NULL, &extra );
+		if( xml_extra )
+			*xml_extra += extra;
+	}
+}
+
+/**
+	@brief Append the JSON for a jsonObject to a growing_buffer, decoding class hints.
+	@param obj Pointer to the jsonObject to be translated.
+	@param buf Pointer to the growing_buffer that will receive the JSON.
+	@param classname A class name imposed by an enclosing class hint, or NULL.
+	@param xml_extra Pointer to a running total of the XML escaping the JSON will need.
+
+	This mirrors jsonObjectDecodeClass() followed by add_json_to_buffer().  A JSON_HASH with
+	a JSON_CLASS_KEY member stands for its JSON_DATA_KEY member, under the class it names;
+	or for a null, if it has no JSON_DATA_KEY member.  The outermost class hint wins.
+
+	Every double quote we write counts toward @a xml_extra, as do the special characters in
+	strings, keys, and class names.  Numbers, booleans and nulls never need escaping.
+*/
+static void add_decoded_json_to_buffer( const jsonObject* obj, growing_buffer* buf,
+		const char* classname, size_t* xml_extra ) {
+
+	if( obj && JSON_HASH == obj->type ) {
+		const jsonObject* class_obj = jsonObjectGetKeyConst( obj, JSON_CLASS_KEY );
+		if( class_obj ) {
+			const jsonObject* data = jsonObjectGetKeyConst( obj, JSON_DATA_KEY );
+			if( data )
+				add_decoded_json_to_buffer( data, buf,
+					classname ? classname : jsonObjectGetString( class_obj ), xml_extra );
+			else
+				OSRF_BUFFER_ADD( buf, "null" );
+			return;
+		}
+	}
+
+	if( !classname && obj )
+		classname = obj->classname;
+
+	if( classname ) {
+		OSRF_BUFFER_ADD( buf, "{\"" );
+		OSRF_BUFFER_ADD( buf, JSON_CLASS_KEY );
+		OSRF_BUFFER_ADD( buf, "\":\"" );
+		OSRF_BUFFER_ADD( buf, classname );
+		OSRF_BUFFER_ADD( buf, "\",\"" );
+		OSRF_BUFFER_ADD( buf, JSON_DATA_KEY );
+		OSRF_BUFFER_ADD( buf, "\":" );
+		*xml_extra += 6 * OSRF_XML_EXTRA_QUOTE + osrfXmlEscapingLength( classname );
+	}
+
+	if( !obj )
+		OSRF_BUFFER_ADD( buf, "null" );
+	else if( JSON_STRING == obj->type ) {
+		OSRF_BUFFER_ADD_CHAR( buf, '"' );
+		buffer_append_utf8_xml( buf, obj->value.s, xml_extra );
+		OSRF_BUFFER_ADD_CHAR( buf, '"' );
+		*xml_extra += 2 * OSRF_XML_EXTRA_QUOTE;
+	} else if( JSON_ARRAY == obj->type ) {
+		OSRF_BUFFER_ADD_CHAR( buf, '[' );
+		unsigned long i;
+		for( i = 0; i < obj->size; ++i ) {
+			if( i > 0 )
+				OSRF_BUFFER_ADD_CHAR( buf, ',' );
+			add_decoded_json_to_buffer( OSRF_LIST_GET_INDEX( obj->value.l, i ), buf,
+				NULL, xml_extra );
+		}
+		OSRF_BUFFER_ADD_CHAR( buf, ']' );
+	} else if( JSON_HASH == obj->type ) {
+		OSRF_BUFFER_ADD_CHAR( buf, '{' );
+		osrfHashIterator* itr = osrfNewHashIterator( obj->value.h );
+		jsonObject* item;
+		int i = 0;
+		while( (item = osrfHashIteratorNext( itr )) ) {
+			if( i++ > 0 )
+				OSRF_BUFFER_ADD_CHAR( buf, ',' );
+			OSRF_BUFFER_ADD_CHAR( buf, '"' );
+			buffer_append_utf8_xml( buf, osrfHashIteratorKey( itr ), xml_extra );
+			OSRF_BUFFER_ADD( buf, "\":" );
+			*xml_extra += 2 * OSRF_XML_EXTRA_QUOTE;
+			add_decoded_json_to_buffer( item, buf, NULL, xml_extra );
+		}
+		osrfHashIteratorFree( itr );
+		OSRF_BUFFER_ADD_CHAR( buf, '}' );
+	} else
+		add_json_to_buffer( obj, buf, 0, 0 );    // A number, boolean, or null
+
+	if( classname )
+		OSRF_BUFFER_ADD_CHAR( buf, '}' );
+}
+
 /**
 	@brief Translate a jsonObject into a JSON string, without expanding class names.
 	@param obj Pointer to the jsonObject to be translated.
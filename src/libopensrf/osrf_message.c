@@ -3,6 +3,11 @@
 	@brief Implementation of osrfMessage.
 */
 
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
 /* libxml stuff for the config reader */
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
@@ -12,8 +17,34 @@
 
 #include <opensrf/osrf_message.h>
 #include "opensrf/osrf_stack.h"
+#include "opensrf/osrf_utf8.h"
+#include "opensrf/osrf_cbor.h"
 
 static osrfMessage* deserialize_one_message( const jsonObject* message );
+static jsonObject* parse_messages( const char* string );
+static void make_arena_key( void );
+static void add_message_to_buffer( const osrfMessage* msg, const jsonObject* content,
+		growing_buffer* buf, size_t* content_start, size_t* content_end,
+		size_t* content_xml_extra );
+static void add_string_member( growing_buffer* buf, const char* key, const char* value );
+static void add_class_open( growing_buffer* buf, const char* classname );
+
+/**
+	@brief Scratch space for parsing inbound messages.
+
+	deserialize_one_message() copies whatever it keeps, so the parsed JSON is thrown away
+	as soon as the messages are built.  We parse it into this arena, and reset the arena
+	afterwards, rather than build and free a jsonObject tree on the heap every time.
+
+	Each thread has an arena of its own, so that threads may deserialize messages at the
+	same time.  Nothing built in the arena may outlive the deserialization that built it,
+	because the next one, in the same thread, reuses the memory.
+*/
+static __thread jsonArena* message_arena = NULL;
+
+/** For freeing a thread's message arena when the thread exits */
+static pthread_key_t arenaKey;
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
 
 static char default_locale[17] = "en-US\0\0\0\0\0\0\0\0\0\0\0\0";
 static char* current_locale = NULL;
@@ -44,6 +75,8 @@ osrfMessage* osrf_message_init( enum M_TYPE type, int thread_trace, int protocol
 	msg->sender_locale          = NULL;
 	msg->sender_tz              = NULL;
 	msg->sender_ingress         = NULL;
+	msg->accept_cbor            = 0;
+	msg->accept_raw_chunks      = 0;
 
 	return msg;
 }
@@ -355,18 +388,19 @@ void osrfMessageFree( osrfMessage* msg ) {
 char* osrfMessageSerializeBatch( osrfMessage* msgs [], int count ) {
 	if( !msgs ) return NULL;
 
-	jsonObject* wrapper = jsonNewObjectType(JSON_ARRAY);
+	growing_buffer* buf = buffer_init( 256 );
+	OSRF_BUFFER_ADD_CHAR( buf, '[' );
 
 	int i = 0;
 	while( (i < count) && msgs[i] ) {
-		jsonObjectPush(wrapper, osrfMessageToJSON( msgs[i] ));
+		if( i > 0 )
+			OSRF_BUFFER_ADD_CHAR( buf, ',' );
+		osrfMessageToBuffer( msgs[i], buf );
 		++i;
 	}
 
-	char* j = jsonObjectToJSON(wrapper);
-	jsonObjectFree(wrapper);
-
-	return j;
+	OSRF_BUFFER_ADD_CHAR( buf, ']' );
+	return buffer_release( buf );
 }
 
 
@@ -384,18 +418,12 @@ char* osrfMessageSerializeBatch( osrfMessage* msgs [], int count ) {
 char* osrf_message_serialize(const osrfMessage* msg) {
 
 	if( msg == NULL ) return NULL;
-	char* j = NULL;
 
-	jsonObject* json = osrfMessageToJSON( msg );
-
-	if(json) {
-		jsonObject* wrapper = jsonNewObjectType(JSON_ARRAY);
-		jsonObjectPush(wrapper, json);
-		j = jsonObjectToJSON(wrapper);
-		jsonObjectFree(wrapper);
-	}
-
-	return j;
+	growing_buffer* buf = buffer_init( 256 );
+	OSRF_BUFFER_ADD_CHAR( buf, '[' );
+	osrfMessageToBuffer( msg, buf );
+	OSRF_BUFFER_ADD_CHAR( buf, ']' );
+	return buffer_release( buf );
 }
 
 
@@ -409,6 +437,8 @@ char* osrf_message_serialize(const osrfMessage* msg) {
 	- "locale"
 	- "tz"
 	- "ingress"
+	- "accept_encoding" (only if the sender can read CBOR message bodies)
+	- "accept_chunking" (only if the sender can read raw chunks)
 	- "type"
 	- "payload" (only for STATUS, REQUEST, and RESULT messages)
 
@@ -456,6 +486,12 @@ jsonObject* osrfMessageToJSON( const osrfMessage* msg ) {
 	if (msg->protocol > 0) 
 		jsonObjectSetKey(json, "api_level", jsonNewNumberObject(msg->protocol));
 
+	if (msg->accept_cbor)
+		jsonObjectSetKey(json, "accept_encoding", jsonNewObject("cbor"));
+
+	if (msg->accept_raw_chunks)
+		jsonObjectSetKey(json, "accept_chunking", jsonNewObject("raw"));
+
 	switch(msg->m_type) {
 
 		case CONNECT:
@@ -507,6 +543,209 @@ jsonObject* osrfMessageToJSON( const osrfMessage* msg ) {
 	return json;
 }
 
+/**
+	@brief Append the JSON for an osrfMessage to a growing_buffer.
+	@param msg Pointer to the osrfMessage to be translated.
+	@param buf Pointer to the growing_buffer that will receive the JSON.
+
+	The JSON is the same as jsonObjectToJSON( osrfMessageToJSON( msg ) ) would produce, but
+	we write it directly, without building a jsonObject tree for the message, or copying
+	the parameters or the result into one.
+*/
+void osrfMessageToBuffer( const osrfMessage* msg, growing_buffer* buf ) {
+	if( msg && buf )
+		add_message_to_buffer( msg, msg->_result_content, buf, NULL, NULL, NULL );
+}
+
+/**
+	@brief Append the JSON for a RESULT message to a growing_buffer, taking the result from
+		elsewhere.
+	@param msg Pointer to an osrfMessage supplying everything but the result.
+	@param result Pointer to the result, or NULL.
+	@param buf Pointer to the growing_buffer that will receive the JSON.
+	@param result_start Pointer to a variable to receive the offset within @a buf at which
+		the JSON for the result begins; may be NULL.
+	@param xml_extra Pointer to a variable to which we add how much longer the JSON for the
+		result will get when escaped for XML; may be NULL.
+	@return The length of the JSON for the result.
+
+	This is for servers returning results.  Instead of copying each result into an
+	osrfMessage with osrf_message_set_result(), and then translating the message, they
+	can translate the result straight into the outbound buffer.  The offset and lengths
+	enable them to decide whether the result is too big to send in one piece, and if so,
+	to find the JSON for it to chop up -- all without another pass over it.
+*/
+size_t osrfMessageResultToBuffer( const osrfMessage* msg, const jsonObject* result,
+		growing_buffer* buf, size_t* result_start, size_t* xml_extra ) {
+	if( !( msg && buf ) )
+		return 0;
+
+	size_t start = buffer_length( buf );
+	size_t end = start;
+	add_message_to_buffer( msg, result, buf, &start, &end, xml_extra );
+
+	if( result_start )
+		*result_start = start;
+	return end - start;
+}
+
+/**
+	@brief Append the JSON for an osrfMessage to a growing_buffer.
+	@param msg Pointer to the osrfMessage to be translated.
+	@param content Pointer to the result, for a RESULT message (may be NULL).
+	@param buf Pointer to the growing_buffer that will receive the JSON.
+	@param content_start Pointer to a variable to receive the offset at which the JSON for
+		the result begins; may be NULL.  Untouched unless this is a RESULT message.
+	@param content_end Pointer to a variable to receive the offset just past the JSON for
+		the result; may be NULL.  Untouched unless this is a RESULT message.
+	@param content_xml_extra Pointer to a variable to which we add the XML escaping length
+		of the JSON for the result; may be NULL.  Untouched unless this is a RESULT message.
+
+	This function mirrors osrfMessageToJSON(), key for key.  Keep them in step.
+*/
+static void add_message_to_buffer( const osrfMessage* msg, const jsonObject* content,
+		growing_buffer* buf, size_t* content_start, size_t* content_end,
+		size_t* content_xml_extra ) {
+
+	char sc[ 32 ];
+
+	add_class_open( buf, "osrfMessage" );
+	snprintf( sc, sizeof( sc ), "%d", msg->thread_trace );
+	OSRF_BUFFER_ADD_CHAR( buf, '{' );
+	add_string_member( buf, "threadTrace", sc );
+
+	OSRF_BUFFER_ADD_CHAR( buf, ',' );
+	if( msg->sender_locale != NULL )
+		add_string_member( buf, "locale", msg->sender_locale );
+	else if( current_locale != NULL )
+		add_string_member( buf, "locale", current_locale );
+	else
+		add_string_member( buf, "locale", default_locale );
+
+	if( msg->sender_tz != NULL ) {
+		OSRF_BUFFER_ADD_CHAR( buf, ',' );
+		add_string_member( buf, "tz", msg->sender_tz );
+	}
+
+	if( msg->sender_ingress != NULL ) {
+		OSRF_BUFFER_ADD_CHAR( buf, ',' );
+		add_string_member( buf, "ingress", msg->sender_ingress );
+	}
+
+	if( msg->protocol > 0 ) {
+		snprintf( sc, sizeof( sc ), "%d", msg->protocol );
+		OSRF_BUFFER_ADD( buf, ",\"api_level\":" );
+		OSRF_BUFFER_ADD( buf, sc );
+	}
+
+	if( msg->accept_cbor ) {
+		OSRF_BUFFER_ADD_CHAR( buf, ',' );
+		add_string_member( buf, "accept_encoding", "cbor" );
+	}
+
+	if( msg->accept_raw_chunks ) {
+		OSRF_BUFFER_ADD_CHAR( buf, ',' );
+		add_string_member( buf, "accept_chunking", "raw" );
+	}
+
+	OSRF_BUFFER_ADD_CHAR( buf, ',' );
+	switch( msg->m_type ) {
+
+		case CONNECT:
+			add_string_member( buf, "type", "CONNECT" );
+			break;
+
+		case DISCONNECT:
+			add_string_member( buf, "type", "DISCONNECT" );
+			break;
+
+		case STATUS:
+			add_string_member( buf, "type", "STATUS" );
+			OSRF_BUFFER_ADD( buf, ",\"payload\":" );
+			add_class_open( buf, msg->status_name );
+			OSRF_BUFFER_ADD_CHAR( buf, '{' );
+			add_string_member( buf, "status", msg->status_text );
+			snprintf( sc, sizeof( sc ), "%d", msg->status_code );
+			OSRF_BUFFER_ADD_CHAR( buf, ',' );
+			add_string_member( buf, "statusCode", sc );
+			OSRF_BUFFER_ADD_CHAR( buf, '}' );
+			if( msg->status_name )
+				OSRF_BUFFER_ADD_CHAR( buf, '}' );
+			break;
+
+		case REQUEST:
+			add_string_member( buf, "type", "REQUEST" );
+			OSRF_BUFFER_ADD( buf, ",\"payload\":" );
+			add_class_open( buf, "osrfMethod" );
+			OSRF_BUFFER_ADD_CHAR( buf, '{' );
+			add_string_member( buf, "method", msg->method_name );
+			OSRF_BUFFER_ADD( buf, ",\"params\":" );
+			jsonObjectDecodeToBuffer( msg->_params, buf, NULL );
+			OSRF_BUFFER_ADD( buf, "}}" );
+			break;
+
+		case RESULT: {
+			add_string_member( buf, "type", "RESULT" );
+			OSRF_BUFFER_ADD( buf, ",\"payload\":" );
+			const char* cname = "osrfResult";
+			if( msg->status_code == OSRF_STATUS_PARTIAL ) {
+				cname = "osrfResultPartial";
+			} else if( msg->status_code == OSRF_STATUS_NOCONTENT ) {
+				cname = "osrfResultPartialComplete";
+			}
+			add_class_open( buf, cname );
+			OSRF_BUFFER_ADD_CHAR( buf, '{' );
+			add_string_member( buf, "status", msg->status_text );
+			snprintf( sc, sizeof( sc ), "%d", msg->status_code );
+			OSRF_BUFFER_ADD_CHAR( buf, ',' );
+			add_string_member( buf, "statusCode", sc );
+			OSRF_BUFFER_ADD( buf, ",\"content\":" );
+			if( content_start )
+				*content_start = buffer_length( buf );
+			jsonObjectDecodeToBuffer( content, buf, content_xml_extra );
+			if( content_end )
+				*content_end = buffer_length( buf );
+			OSRF_BUFFER_ADD( buf, "}}" );
+			break;
+		}
+	}
+
+	OSRF_BUFFER_ADD( buf, "}}" );
+}
+
+/**
+	@brief Append a key and a string value, as a member of a JSON object, to a growing_buffer.
+	@param buf Pointer to the growing_buffer.
+	@param key The key, which must need no escaping.
+	@param value The value, or NULL for a JSON null.
+*/
+static void add_string_member( growing_buffer* buf, const char* key, const char* value ) {
+	OSRF_BUFFER_ADD_CHAR( buf, '"' );
+	OSRF_BUFFER_ADD( buf, key );
+	OSRF_BUFFER_ADD( buf, "\":" );
+	if( value ) {
+		OSRF_BUFFER_ADD_CHAR( buf, '"' );
+		buffer_append_utf8( buf, value );
+		OSRF_BUFFER_ADD_CHAR( buf, '"' );
+	} else
+		OSRF_BUFFER_ADD( buf, "null" );
+}
+
+/**
+	@brief Open the extra layer of JSON_HASH that carries a class name.
+	@param buf Pointer to the growing_buffer.
+	@param classname The class name, or NULL for none, in which case we add nothing.
+
+	The caller must close the layer, if any, with a right brace.
+*/
+static void add_class_open( growing_buffer* buf, const char* classname ) {
+	if( classname ) {
+		OSRF_BUFFER_ADD( buf, "{\"" JSON_CLASS_KEY "\":\"" );
+		OSRF_BUFFER_ADD( buf, classname );
+		OSRF_BUFFER_ADD( buf, "\",\"" JSON_DATA_KEY "\":" );
+	}
+}
+
 /**
 	@brief Translate a JSON array into an osrfList of osrfMessages.
 	@param string The JSON string to be translated.
@@ -543,7 +782,7 @@ osrfList* osrfMessageDeserialize( const char* string, osrfList* list ) {
 	}
 	
 	// Parse the JSON
-	jsonObject* json = jsonParse(string);
+	jsonObject* json = parse_messages(string);
 	if(!json) {
 		osrfLogWarning( OSRF_LOG_MARK,
 				"osrfMessageDeserialize() unable to parse data: \n%s\n", string);
@@ -572,7 +811,7 @@ osrfList* osrfMessageDeserialize( const char* string, osrfList* list ) {
 		}
 	}
 
-	jsonObjectFree( json );
+	jsonArenaReset( message_arena );
 	return list;
 }
 
@@ -591,10 +830,9 @@ osrfList* osrfMessageDeserialize( const char* string, osrfList* list ) {
 int osrf_message_deserialize(const char* string, osrfMessage* msgs[], int count) {
 
 	if(!string || !msgs || count <= 0) return 0;
-	int numparsed = 0;
 
 	// Parse the JSON
-	jsonObject* json = jsonParse(string);
+	jsonObject* json = parse_messages(string);
 
 	if(!json) {
 		osrfLogWarning( OSRF_LOG_MARK,
@@ -602,6 +840,27 @@ int osrf_message_deserialize(const char* string, osrfMessage* msgs[], int count)
 		return 0;
 	}
 
+	int numparsed = osrfMessageDeserializeJSON( json, msgs, count );
+
+	jsonArenaReset( message_arena );
+	return numparsed;
+}
+
+/**
+	@brief Translate an already parsed JSON array into an array of osrfMessages.
+	@param json Pointer to the JSON array.
+	@param msgs Pointer to an array of pointers to osrfMessage, to receive the results.
+	@param count How many slots are available in the @a msgs array.
+	@return The number of osrfMessages created.
+
+	Like osrf_message_deserialize(), but for JSON that has already been parsed, such as the
+	body_json of a transport_message.  The osrfMessages don't depend on @a json afterwards.
+*/
+int osrfMessageDeserializeJSON( const jsonObject* json, osrfMessage* msgs[], int count ) {
+
+	if( !json || !msgs || count <= 0 ) return 0;
+	int numparsed = 0;
+
 	// Traverse the JSON_ARRAY, turning each element into an osrfMessage
 	int x;
 	for( x = 0; x < json->size && x < count; x++ ) {
@@ -614,10 +873,47 @@ int osrf_message_deserialize(const char* string, osrfMessage* msgs[], int count)
 		}
 	}
 
-	jsonObjectFree( json );
 	return numparsed;
 }
 
+/**
+	@brief Parse a JSON string of messages into the message arena.
+	@param string The JSON string to be parsed, or a CBOR message body.
+	@return Pointer to the resulting jsonObject, or NULL if the string isn't valid JSON.
+
+	A CBOR message body (see osrf_cbor.h) is decoded into the same tree as its JSON would be.
+
+	The result lives only until the next call to jsonArenaReset( message_arena ), which the
+	calling code must make once it is finished with the result.  If the parse fails, we
+	reset the arena here.
+
+	The first call in each thread creates the thread's arena.
+*/
+static jsonObject* parse_messages( const char* string ) {
+	if( !message_arena ) {
+		message_arena = jsonNewArena( 0 );
+		pthread_once( &arenaKeyOnce, make_arena_key );
+		pthread_setspecific( arenaKey, message_arena );
+	}
+
+	jsonObject* json;
+	if( osrfCborIsBody( string ))
+		json = osrfCborParseBody( message_arena, string );
+	else
+		json = jsonParseArena( message_arena, string );
+	if( !json )
+		jsonArenaReset( message_arena );
+	return json;
+}
+
+/**
+	@brief Create the thread-specific key whose destructor frees a thread's message arena.
+
+	Called once, through pthread_once().
+*/
+static void make_arena_key( void ) {
+	pthread_key_create( &arenaKey, (void (*)( void* )) jsonArenaFree );
+}
 
 /**
 	@brief Translate a jsonObject into a single osrfMessage.
@@ -696,6 +992,14 @@ static osrfMessage* deserialize_one_message( const jsonObject* obj ) {
 		osrf_message_set_tz(msg, jsonObjectGetString(tmp));
 	}
 
+	const char* encoding = jsonObjectGetString( jsonObjectGetKeyConst( obj, "accept_encoding" ));
+	if( encoding && !strcmp( encoding, "cbor" ))
+		msg->accept_cbor = 1;
+
+	const char* chunking = jsonObjectGetString( jsonObjectGetKeyConst( obj, "accept_chunking" ));
+	if( chunking && !strcmp( chunking, "raw" ))
+		msg->accept_raw_chunks = 1;
+
 	tmp = jsonObjectGetKeyConst( obj, "payload" );
 	if(tmp) {
 		// Get method name and parameters for a REQUEST
@@ -760,3 +1064,73 @@ const jsonObject* osrfMessageGetResult( osrfMessage* msg ) {
 	if(msg) return msg->_result_content;
 	return NULL;
 }
+
+/**
+	@brief Build the body of a message carrying a raw chunk of a result.
+	@param buf Pointer to the growing_buffer to receive the body.
+	@param request_id The request ID of the request being answered.
+	@param offset Where the chunk begins within the JSON for the result.
+	@param data Pointer to the chunk.
+	@param len Length of the chunk.
+
+	Unlike a partial RESULT message, a raw chunk carries its slice of the JSON as is, not
+	escaped into a JSON string inside another layer of JSON.  The offset and length let the
+	receiving end tell whether it has everything, in order.
+
+	The chunk must not end in the middle of a UTF-8 character.
+*/
+void osrfMessageRawChunkToBuffer( growing_buffer* buf, int request_id, size_t offset,
+		const char* data, size_t len ) {
+	buffer_fadd( buf, OSRF_RAW_CHUNK_PREFIX "%d:%lu:%lu:", request_id,
+		(unsigned long) offset, (unsigned long) len );
+	buffer_add_n( buf, data, len );
+}
+
+/**
+	@brief Determine whether a message body is a raw chunk of a result.
+	@param body Pointer to the message body.
+	@return 1 if it is, or 0 if it isn't.
+*/
+int osrfMessageIsRawChunk( const char* body ) {
+	return body && !strncmp( body, OSRF_RAW_CHUNK_PREFIX, sizeof( OSRF_RAW_CHUNK_PREFIX ) - 1 );
+}
+
+/**
+	@brief Take apart the body of a message carrying a raw chunk of a result.
+	@param body Pointer to the message body.
+	@param request_id Pointer to a variable to receive the request ID.
+	@param offset Pointer to a variable to receive the offset of the chunk.
+	@param data Pointer to a variable to receive a pointer to the chunk, within @a body.
+	@param len Pointer to a variable to receive the length of the chunk.
+	@return 0 if successful, or -1 if the body is not a valid raw chunk.
+
+	The length in the header must match the length of what follows it.
+*/
+int osrfMessageParseRawChunk( const char* body, int* request_id, size_t* offset,
+		const char** data, size_t* len ) {
+	if( !osrfMessageIsRawChunk( body ) )
+		return -1;
+
+	const char* p = body + sizeof( OSRF_RAW_CHUNK_PREFIX ) - 1;
+	unsigned long fields[ 3 ];
+	int i;
+	for( i = 0; i < 3; ++i ) {
+		char* end;
+		if( !isdigit( (unsigned char) *p ) )
+			return -1;
+		errno = 0;
+		fields[ i ] = strtoul( p, &end, 10 );
+		if( errno || ':' != *end )
+			return -1;
+		p = end + 1;
+	}
+
+	if( fields[ 0 ] > INT_MAX || strlen( p ) != fields[ 2 ] )
+		return -1;
+
+	*request_id = (int) fields[ 0 ];
+	*offset = fields[ 1 ];
+	*data = p;
+	*len = fields[ 2 ];
+	return 0;
+}
@@ -16,13 +16,36 @@ GNU General Public License for more details.
 /**
 	@file osrf_parse_json.c
 	@brief  Recursive descent parser for JSON.
+
+	Also a jsonBuilder, which builds the same trees from the callbacks of a push parser.
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+/** Build an AVX2 version of the string scan, to be used if the CPU supports it. */
+#define JSON_SPAN_AVX2
+#endif
 #include <opensrf/osrf_json.h>
+#include <opensrf/jsonpush.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+/** Exempt a function from AddressSanitizer's checks (see json_string_span_sse2()). */
+#define JSON_NO_SANITIZE_ADDRESS __attribute__(( no_sanitize_address ))
+#else
+#define JSON_NO_SANITIZE_ADDRESS
+#endif
+
+/** True for the characters that json_string_span() stops at. */
+#define JSON_STRING_SPECIAL(c) ( '"' == (c) || '\\' == (c) || '\0' == (c) )
 
 /**
 	@brief A collection of things the parser uses to keep track of what it's doing.
@@ -32,8 +55,32 @@ typedef struct {
 	size_t index;             /**< index into input buffer */
 	const char* buff;         /**< client's buffer holding current chunk of input */
 	int decode;               /**< boolean; true if we are decoding class hints */
+	jsonArena* arena;         /**< where to put the jsonObjects; NULL for the heap */
+	void** stack;             /**< for an arena: members of the open arrays and hashes */
+	size_t stack_top;         /**< number of entries in use on the stack */
+	size_t stack_size;        /**< number of entries allocated for the stack */
 } Parser;
 
+/**
+	@brief Builds a jsonObject tree in a jsonArena from JSON that arrives a piece at a time.
+
+	A JSONPushParser does the tokenizing, and calls back to add nodes.  As with the
+	recursive descent parser, the members of each open array or hash are piled on a stack
+	until it closes.  A second stack remembers where each open array or hash begins.
+*/
+struct jsonBuilderStruct {
+	Parser parser;            /**< the arena, and the stack of pending members */
+	JSONPushParser* push;     /**< tokenizes the input and calls us back */
+	size_t* frames;           /**< stack index of the first member of each open container */
+	size_t depth;             /**< number of containers now open */
+	size_t frames_size;       /**< number of entries allocated for frames */
+	jsonObject* result;       /**< the complete value, once we have it */
+	int error;                /**< boolean; true if the input isn't valid JSON */
+};
+
+/** How many hash keys we check for duplicates as we go; the osrfHash checks the rest. */
+#define JSON_ARENA_SCAN_KEYS 8
+
 /**
 	@brief A small buffer for building Unicode byte sequences.
 
@@ -49,7 +96,7 @@ typedef struct {
 	unsigned char buff[ 4 ];
 } Unibuff;
 
-static jsonObject* parse_it( const char* s, int decode );
+static jsonObject* parse_it( const char* s, int decode, jsonArena* arena );
 
 static jsonObject* get_json_node( Parser* parser, char firstc );
 static const char* get_string( Parser* parser );
@@ -57,6 +104,23 @@ static jsonObject* get_number( Parser* parser, char firstc );
 static jsonObject* get_array( Parser* parser );
 static jsonObject* get_hash( Parser* parser );
 static jsonObject* get_decoded_hash( Parser* parser );
+static jsonObject* get_arena_array( Parser* parser );
+static jsonObject* get_arena_hash( Parser* parser );
+static jsonObject* build_arena_array( Parser* parser, size_t base );
+static jsonObject* build_arena_hash( Parser* parser, size_t base );
+static jsonObject* new_arena_node( Parser* parser, int type );
+static void* arena_alloc( void* arena, size_t size );
+static void stack_push( Parser* parser, void* item );
+static const jsonObject* find_member( void** pairs, size_t count, const char* key );
+static int build_value( jsonBuilder* builder, jsonObject* obj );
+static int build_string( void* blob, const char* str );
+static int build_number( void* blob, const char* str );
+static int build_begin( void* blob );
+static int build_end_array( void* blob );
+static int build_key( void* blob, const char* key );
+static int build_end_obj( void* blob );
+static int build_bool( void* blob, int b );
+static int build_null( void* blob );
 static jsonObject* get_null( Parser* parser );
 static jsonObject* get_true( Parser* parser );
 static jsonObject* get_false( Parser* parser );
@@ -66,6 +130,19 @@ static char skip_white_space( Parser* parser );
 static inline void parser_ungetc( Parser* parser );
 static inline char parser_nextc( Parser* parser );
 static void report_error( Parser* parser, char badchar, const char* err );
+static inline size_t json_string_span( const char* s );
+static size_t json_string_span_vector( const char* s );
+static void pick_string_span( void );
+static size_t json_string_span_sse2( const char* s );
+#ifdef JSON_SPAN_AVX2
+static size_t json_string_span_avx2( const char* s );
+#endif
+
+/** The version of json_string_span_vector() that suits this CPU, once we've looked. */
+static size_t (*string_span)( const char* ) = json_string_span_sse2;
+
+/** Makes sure that we look at the CPU only once, whatever the threads are doing. */
+static pthread_once_t string_span_once = PTHREAD_ONCE_INIT;
 
 /* ------------------------------------- */
 
@@ -83,7 +160,7 @@ static void report_error( Parser* parser, char badchar, const char* err );
 	The calling code is responsible for freeing the resulting jsonObject.
 */
 jsonObject* jsonParse( const char* str ) {
-	return parse_it( str, 1 );
+	return parse_it( str, 1, NULL );
 }
 
 /**
@@ -97,7 +174,7 @@ jsonObject* jsonParse( const char* str ) {
 	The calling code is responsible for freeing the resulting jsonObject.
 */
 jsonObject* jsonParseRaw( const char* s ) {
-	return parse_it( s, 0 );
+	return parse_it( s, 0, NULL );
 }
 
 /**
@@ -115,19 +192,169 @@ jsonObject* jsonParseFmt( const char* str, ... ) {
 	if( !str )
 		return NULL;
 	VA_LIST_TO_STRING( str );
-	return parse_it( VA_BUF, 0 );
+	return parse_it( VA_BUF, 0, NULL );
+}
+
+/**
+	@brief Parse a JSON string into a jsonArena, with decoding of classname hints.
+	@param arena Pointer to the jsonArena that will hold the results.
+	@param str Pointer to the JSON string to parse.
+	@return A pointer to the resulting JSON object, or NULL on error.
+
+	This function is similar to jsonParse(), except that every part of the resulting tree
+	-- the jsonObjects, the osrfLists and osrfHashes that hold their members, the keys, the
+	strings, and the class names -- is carved out of @a arena.  Instead of hundreds of small
+	calls to malloc() and free() for a large tree, there are a few for the arena's blocks.
+
+	The tree is read-only.  Look things up, iterate, clone, or serialize as usual, but don't
+	add, remove, or change any members, and don't call jsonObjectFree() on any part of it.
+	To keep a piece of it, take a copy with jsonObjectClone() or jsonObjectDecodeClass().
+
+	The tree lives until the next call to jsonArenaReset() or jsonArenaFree() for @a arena.
+	So does any debris from a failed parse.
+*/
+jsonObject* jsonParseArena( jsonArena* arena, const char* str ) {
+	if( !arena )
+		return NULL;
+	return parse_it( str, 1, arena );
+}
+
+/**
+	@brief Create a jsonBuilder, to parse JSON into a jsonArena a piece at a time.
+	@param arena Pointer to the jsonArena that will hold the results.
+	@return Pointer to the new jsonBuilder, or NULL if @a arena is NULL.
+
+	Where jsonParseArena() needs the whole JSON string at once, a jsonBuilder takes it in
+	whatever pieces it arrives in -- such as the character data of an XML element, as the
+	XML parser reports it -- and builds the tree as it goes.  By the time the last piece
+	arrives, nearly all the work is done.
+
+	1. Pass each piece to jsonBuilderPush().
+	2. Call jsonBuilderFinish() to get the tree.
+	3. Call jsonBuilderReset() to start on another JSON string.
+
+	Class hints are decoded, and the resulting tree has the same shape and the same
+	restrictions as one from jsonParseArena().
+
+	The calling code is responsible for freeing the jsonBuilder by calling jsonBuilderFree().
+*/
+jsonBuilder* jsonNewBuilder( jsonArena* arena ) {
+	if( !arena )
+		return NULL;
+
+	static const JSONHandlerMap map = {
+		build_string,
+		build_number,
+		build_begin,
+		build_end_array,
+		build_begin,
+		build_key,
+		build_end_obj,
+		build_bool,
+		build_null,
+		NULL,             // No need to hear about the end of the JSON
+		NULL              // Let the push parser log its own errors
+	};
+
+	jsonBuilder* builder = safe_malloc( sizeof( jsonBuilder ) );
+	builder->parser.str_buf = NULL;
+	builder->parser.index = 0;
+	builder->parser.buff = NULL;
+	builder->parser.decode = 1;
+	builder->parser.arena = arena;
+	builder->parser.stack = NULL;
+	builder->parser.stack_top = 0;
+	builder->parser.stack_size = 0;
+	builder->push = jsonNewPushParser( &map, builder );
+	builder->frames = NULL;
+	builder->depth = 0;
+	builder->frames_size = 0;
+	builder->result = NULL;
+	builder->error = 0;
+	return builder;
+}
+
+/**
+	@brief Feed a piece of a JSON string to a jsonBuilder.
+	@param builder Pointer to the jsonBuilder.
+	@param str Pointer to the next piece of the JSON string.
+	@param len Length of the piece.
+	@return 0 if successful, or 1 if the JSON is invalid, now or earlier.
+
+	Once the JSON has proven invalid, further pieces are ignored.
+*/
+int jsonBuilderPush( jsonBuilder* builder, const char* str, size_t len ) {
+	if( !builder || builder->error )
+		return 1;
+	if( jsonPush( builder->push, str, len ) )
+		builder->error = 1;
+	return builder->error;
+}
+
+/**
+	@brief Tell a jsonBuilder that the JSON string is complete, and get the result.
+	@param builder Pointer to the jsonBuilder.
+	@return Pointer to the resulting jsonObject, or NULL if the JSON is invalid or empty.
+
+	The tree lives in the jsonArena, on the same terms as one from jsonParseArena().
+*/
+jsonObject* jsonBuilderFinish( jsonBuilder* builder ) {
+	if( !builder || builder->error )
+		return NULL;
+	if( jsonPushParserFinish( builder->push ) ) {
+		builder->error = 1;
+		return NULL;
+	}
+	return builder->result;
+}
+
+/**
+	@brief Make a jsonBuilder ready to start on another JSON string.
+	@param builder Pointer to the jsonBuilder.
+	@param arena Pointer to the jsonArena for the next tree, or NULL to keep using the
+		current one.
+
+	Whatever the jsonBuilder was in the middle of, if anything, is abandoned.  Whatever it
+	put in the old jsonArena stays there until the arena itself is reset or freed.
+*/
+void jsonBuilderReset( jsonBuilder* builder, jsonArena* arena ) {
+	if( !builder )
+		return;
+	jsonPushParserReset( builder->push );
+	if( arena )
+		builder->parser.arena = arena;
+	builder->parser.stack_top = 0;
+	builder->depth = 0;
+	builder->result = NULL;
+	builder->error = 0;
+}
+
+/**
+	@brief Free a jsonBuilder.
+	@param builder Pointer to the jsonBuilder to be freed.
+
+	The jsonArena is not freed, and neither is anything in it.
+*/
+void jsonBuilderFree( jsonBuilder* builder ) {
+	if( !builder )
+		return;
+	jsonPushParserFree( builder->push );
+	free( builder->parser.stack );
+	free( builder->frames );
+	free( builder );
 }
 
 /**
 	@brief Parse a JSON string into a jsonObject.
 	@param s Pointer to the string to be parsed.
 	@param decode A boolean; true means decode class hints, false means don't.
+	@param arena Pointer to a jsonArena to hold the results, or NULL to use the heap.
 	@return Pointer to the newly created jsonObject.
 
 	Set up a Parser.  Call get_json_node() to do the real work, then make sure that there's
 	nothing but white space at the end.
 */
-static jsonObject* parse_it( const char* s, int decode ) {
+static jsonObject* parse_it( const char* s, int decode, jsonArena* arena ) {
 
 	if( !s || !*s )
 		return NULL;    // Nothing to parse
@@ -138,6 +365,10 @@ static jsonObject* parse_it( const char* s, int decode ) {
 	parser.index = 0;
 	parser.buff = s;
 	parser.decode = decode;
+	parser.arena = arena;
+	parser.stack = NULL;
+	parser.stack_top = 0;
+	parser.stack_size = 0;
 
 	jsonObject* obj = get_json_node( &parser, skip_white_space( &parser ) );
 
@@ -145,11 +376,13 @@ static jsonObject* parse_it( const char* s, int decode ) {
 	char c;
 	if( obj && (c = skip_white_space( &parser )) ) {
 		report_error( &parser, c, "Extra material follows JSON string" );
-		jsonObjectFree( obj );
+		if( !arena )
+			jsonObjectFree( obj );
 		obj = NULL;
 	}
 
 	buffer_free( parser.str_buf );
+	free( parser.stack );
 	return obj;
 }
 
@@ -172,15 +405,23 @@ static jsonObject* get_json_node( Parser* parser, char firstc ) {
 	// Branch on the first character
 	if( '"' == firstc ) {
 		const char* str = get_string( parser );
-		if( str ) {
+		if( str && parser->arena ) {
+			obj = new_arena_node( parser, JSON_STRING );
+			obj->value.s = jsonArenaStrndup( parser->arena, str, parser->str_buf->n_used );
+		} else if( str ) {
 			obj = jsonNewObject( NULL );
 			obj->type = JSON_STRING;
 			obj->value.s = strdup( str );
 		}
 	} else if( '[' == firstc ) {
-		obj = get_array( parser );
+		if( parser->arena )
+			obj = get_arena_array( parser );
+		else
+			obj = get_array( parser );
 	} else if( '{' == firstc ) {
-		if( parser->decode )
+		if( parser->arena )
+			obj = get_arena_hash( parser );
+		else if( parser->decode )
 			obj = get_decoded_hash( parser );
 		else
 			obj = get_hash( parser );
@@ -215,6 +456,10 @@ static jsonObject* get_json_node( Parser* parser, char firstc ) {
 
 	Return the string we have built, without the enclosing quotation marks, in
 	parser->str_buf.  In case of error, log an error message.
+
+	Runs of characters with nothing to translate are found by json_string_span() and
+	copied in bulk; only the quotation marks, escapes and terminal nul go through the
+	switch below one at a time.
 */
 static const char* get_string( Parser* parser ) {
 
@@ -227,6 +472,13 @@ static const char* get_string( Parser* parser ) {
 
 	// Collect the characters.
 	for( ;; ) {
+		const char* run = parser->buff + parser->index;
+		size_t len = json_string_span( run );
+		if( len ) {
+			OSRF_BUFFER_ADD_N( gb, run, len );
+			parser->index += len;
+		}
+
 		char c = parser_nextc( parser );
 		if( '"' == c )
 			break;
@@ -309,21 +561,29 @@ static jsonObject* get_number( Parser* parser, char firstc ) {
 		}
 	}
 
-	char* s = buffer_data( gb );
-	if( ! jsonIsNumeric( s ) ) {
-		char* temp = jsonScrubNumber( s );
-		free( s );
-		s = temp;
-		if( !s ) {
+	char* scrubbed = NULL;
+	if( ! jsonIsNumeric( OSRF_BUFFER_C_STR( gb ) ) ) {
+		scrubbed = jsonScrubNumber( OSRF_BUFFER_C_STR( gb ) );
+		if( !scrubbed ) {
 			report_error( parser, parser->buff[ parser->index - 1 ],
 					"Invalid numeric format" );
 			return NULL;
 		}
 	}
 
-	jsonObject* obj = jsonNewObject( NULL );
-	obj->type = JSON_NUMBER;
-	obj->value.s = s;
+	jsonObject* obj;
+	if( parser->arena ) {
+		obj = new_arena_node( parser, JSON_NUMBER );
+		if( scrubbed ) {
+			obj->value.s = jsonArenaStrndup( parser->arena, scrubbed, strlen( scrubbed ) );
+			free( scrubbed );
+		} else
+			obj->value.s = jsonArenaStrndup( parser->arena, gb->buf, gb->n_used );
+	} else {
+		obj = jsonNewObject( NULL );
+		obj->type = JSON_NUMBER;
+		obj->value.s = scrubbed ? scrubbed : buffer_data( gb );
+	}
 
 	return obj;
 }
@@ -565,6 +825,412 @@ static jsonObject* get_decoded_hash( Parser* parser ) {
 	return hash;
 }
 
+/**
+	@brief Parse an array into a jsonArena, and create a JSON_ARRAY for it.
+	@param parser Pointer to a Parser.
+	@return Pointer to a newly created jsonObject of type JSON_ARRAY, or NULL upon error.
+
+	Like get_array(), except that we don't know how big the array is until we reach the
+	closing bracket.  Rather than grow an osrfList a piece at a time, we pile the members on
+	the parser's stack, and then give the osrfList a right-sized copy of them.
+*/
+static jsonObject* get_arena_array( Parser* parser ) {
+
+	size_t base = parser->stack_top;
+
+	char c = skip_white_space( parser );
+	if( ']' != c ) {
+		for( ;; ) {
+			jsonObject* obj = get_json_node( parser, c );
+			if( !obj ) {
+				parser->stack_top = base;
+				return NULL;         // Failed to get anything
+			}
+			stack_push( parser, obj );
+
+			// Look for a comma or right bracket
+			c = skip_white_space( parser );
+			if( ']' == c )
+				break;
+			else if( c != ',' ) {
+				report_error( parser, c, "Expected comma or bracket in array; didn't find it\n" );
+				parser->stack_top = base;
+				return NULL;
+			}
+			c = skip_white_space( parser );
+		}
+	}
+
+	return build_arena_array( parser, base );
+}
+
+/**
+	@brief Parse a hash (JSON object) into a jsonArena, and create a JSON_HASH for it.
+	@param parser Pointer to a Parser.
+	@return Pointer to a newly created jsonObject, or NULL upon error.
+
+	Like get_hash(), or get_decoded_hash() if we're decoding class hints.  We pile the keys
+	and values on the parser's stack until we reach the closing brace.  Then either we hand
+	them to osrfHashFromPairs() to build a complete osrfHash in one go, or, if the hash is a
+	class hint, we return the data node and never build the hash at all.
+
+	The first few keys are checked for duplicates as they arrive, so that the error message
+	points at the culprit.  Beyond that, osrfHashFromPairs() finds them more cheaply.
+*/
+static jsonObject* get_arena_hash( Parser* parser ) {
+
+	size_t base = parser->stack_top;
+
+	char c = skip_white_space( parser );
+	if( '}' != c ) {
+		for( ;; ) {
+
+			// Get the key string
+			if( '"' != c ) {
+				report_error( parser, c,
+						"Expected quotation mark to begin hash key; didn't find it\n" );
+				parser->stack_top = base;
+				return NULL;
+			}
+
+			const char* key = get_string( parser );
+			if( ! key ) {
+				parser->stack_top = base;
+				return NULL;
+			}
+
+			size_t count = ( parser->stack_top - base ) / 2;
+			if( count < JSON_ARENA_SCAN_KEYS &&
+					find_member( parser->stack + base, count, key ) ) {
+				report_error( parser, '"', "Duplicate key in JSON object" );
+				parser->stack_top = base;
+				return NULL;
+			}
+			// Share the key from the intern table if we can; otherwise copy it.
+			const char* shared = jsonInternKeys() ? osrfHashIntern( key ) : NULL;
+			if( shared )
+				stack_push( parser, (void*) shared );
+			else
+				stack_push( parser, jsonArenaStrndup( parser->arena, key,
+					parser->str_buf->n_used ) );
+
+			// Get the colon
+			c = skip_white_space( parser );
+			if( c != ':' ) {
+				report_error( parser, c,
+						"Expected colon after hash key; didn't find it\n" );
+				parser->stack_top = base;
+				return NULL;
+			}
+
+			// Get the associated value
+			jsonObject* obj = get_json_node( parser, skip_white_space( parser ) );
+			if( !obj ) {
+				parser->stack_top = base;
+				return NULL;
+			}
+			stack_push( parser, obj );
+
+			// Look for comma or right brace
+			c = skip_white_space( parser );
+			if( '}' == c )
+				break;
+			else if( c != ',' ) {
+				report_error( parser, c,
+						"Expected comma or brace in hash, didn't find it" );
+				parser->stack_top = base;
+				return NULL;
+			}
+			c = skip_white_space( parser );
+		}
+	}
+
+	jsonObject* hash = build_arena_hash( parser, base );
+	if( !hash )
+		report_error( parser, '}', "Duplicate key in JSON object" );
+	return hash;
+}
+
+/**
+	@brief Create a JSON_ARRAY for the members piled on the parser's stack.
+	@param parser Pointer to a Parser.
+	@param base Index of the first member on the stack.
+	@return Pointer to the new JSON_ARRAY.
+
+	The osrfList gets a right-sized copy of the members, which are popped off the stack.
+*/
+static jsonObject* build_arena_array( Parser* parser, size_t base ) {
+	size_t count = parser->stack_top - base;
+	jsonObject* array = new_arena_node( parser, JSON_ARRAY );
+	osrfList* list = jsonArenaAlloc( parser->arena, sizeof( osrfList ) );
+	list->arrlist = jsonArenaAlloc( parser->arena, ( count + 1 ) * sizeof( void* ) );
+	list->size = count;
+	list->arrsize = count;
+	list->freeItem = NULL;
+
+	size_t i;
+	for( i = 0; i < count; ++i ) {
+		jsonObject* obj = parser->stack[ base + i ];
+		obj->parent = array;
+		list->arrlist[ i ] = obj;
+	}
+
+	array->value.l = list;
+	array->size = count;
+	parser->stack_top = base;
+	return array;
+}
+
+/**
+	@brief Create a JSON_HASH for the keys and values piled on the parser's stack.
+	@param parser Pointer to a Parser.
+	@param base Index of the first key on the stack.
+	@return Pointer to the new jsonObject, or NULL if there is a duplicate key.
+
+	Either hand the keys and values to osrfHashFromPairs() to build a complete osrfHash in
+	one go, or, if we're decoding class hints and the hash is one, return the data node and
+	never build the hash at all.  Either way, pop the keys and values off the stack.
+
+	Only the keys beyond the first JSON_ARENA_SCAN_KEYS are checked for duplicates here;
+	the calling code is expected to have checked the others.
+*/
+static jsonObject* build_arena_hash( Parser* parser, size_t base ) {
+
+	void** pairs = parser->stack + base;
+	size_t count = ( parser->stack_top - base ) / 2;
+	parser->stack_top = base;
+
+	const jsonObject* class_obj = NULL;
+	if( parser->decode )
+		class_obj = find_member( pairs, count, JSON_CLASS_KEY );
+
+	if( class_obj && ( JSON_STRING == class_obj->type || JSON_NUMBER == class_obj->type ) ) {
+
+		// Make sure the keys we didn't check on the way in are unique
+		size_t i, j;
+		for( i = JSON_ARENA_SCAN_KEYS; i < count; ++i ) {
+			for( j = 0; j < i; ++j ) {
+				if( !strcmp( pairs[ 2 * i ], pairs[ 2 * j ] ) )
+					return NULL;
+			}
+		}
+
+		// We found a class hint.  Return the data node.
+		const char* class_name = class_obj->value.s ? class_obj->value.s : "0";
+		jsonObject* class_data = (jsonObject*) find_member( pairs, count, JSON_DATA_KEY );
+		if( !class_data )
+			// Huh?  We have a class name but no data for it.  Return a JSON_NULL.
+			return new_arena_node( parser, JSON_NULL );
+
+		class_data->parent = NULL;
+		class_data->classname = jsonArenaStrndup( parser->arena,
+				class_name, strlen( class_name ) );
+		return class_data;
+	}
+
+	osrfHash* members = osrfHashFromPairs( arena_alloc, parser->arena, pairs, count );
+	if( !members )
+		return NULL;
+
+	jsonObject* hash = new_arena_node( parser, JSON_HASH );
+	size_t i;
+	for( i = 0; i < count; ++i )
+		( (jsonObject*) pairs[ 2 * i + 1 ] )->parent = hash;
+	hash->value.h = members;
+	hash->size = count;
+	return hash;
+}
+
+/**
+	@brief Put a complete value where it belongs: in the open array or hash, if any, or
+	else as the result.
+	@param builder Pointer to the jsonBuilder.
+	@param obj Pointer to the value.
+	@return Zero, so that the push parser carries on.
+*/
+static int build_value( jsonBuilder* builder, jsonObject* obj ) {
+	if( builder->depth )
+		stack_push( &builder->parser, obj );
+	else
+		builder->result = obj;
+	return 0;
+}
+
+/**
+	@brief Respond to a string from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@param str The string, with escapes already translated.
+	@return Zero, so that the push parser carries on.
+*/
+static int build_string( void* blob, const char* str ) {
+	jsonBuilder* builder = blob;
+	jsonObject* obj = new_arena_node( &builder->parser, JSON_STRING );
+	obj->value.s = jsonArenaStrndup( builder->parser.arena, str, strlen( str ) );
+	return build_value( builder, obj );
+}
+
+/**
+	@brief Respond to a number from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@param str The number, already validated (and scrubbed, if necessary).
+	@return Zero, so that the push parser carries on.
+*/
+static int build_number( void* blob, const char* str ) {
+	jsonBuilder* builder = blob;
+	jsonObject* obj = new_arena_node( &builder->parser, JSON_NUMBER );
+	obj->value.s = jsonArenaStrndup( builder->parser.arena, str, strlen( str ) );
+	return build_value( builder, obj );
+}
+
+/**
+	@brief Respond to the beginning of an array or hash from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@return Zero, so that the push parser carries on.
+
+	Remember where on the stack its members will begin.
+*/
+static int build_begin( void* blob ) {
+	jsonBuilder* builder = blob;
+	if( builder->depth == builder->frames_size ) {
+		builder->frames_size = builder->frames_size ? builder->frames_size * 2 : 16;
+		size_t* frames = realloc( builder->frames, builder->frames_size * sizeof( size_t ) );
+		if( !frames ) {
+			osrfLogError( OSRF_LOG_MARK, "Out of Memory" );
+			exit( 99 );
+		}
+		builder->frames = frames;
+	}
+	builder->frames[ builder->depth++ ] = builder->parser.stack_top;
+	return 0;
+}
+
+/**
+	@brief Respond to the end of an array from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@return Zero, so that the push parser carries on.
+*/
+static int build_end_array( void* blob ) {
+	jsonBuilder* builder = blob;
+	size_t base = builder->frames[ --builder->depth ];
+	return build_value( builder, build_arena_array( &builder->parser, base ) );
+}
+
+/**
+	@brief Respond to a hash key from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@param key The key.
+	@return Zero, so that the push parser carries on.
+
+	The push parser has already made sure that the key isn't a duplicate.
+*/
+static int build_key( void* blob, const char* key ) {
+	jsonBuilder* builder = blob;
+	const char* shared = jsonInternKeys() ? osrfHashIntern( key ) : NULL;
+	if( shared )
+		stack_push( &builder->parser, (void*) shared );
+	else
+		stack_push( &builder->parser,
+			jsonArenaStrndup( builder->parser.arena, key, strlen( key ) ) );
+	return 0;
+}
+
+/**
+	@brief Respond to the end of a hash from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@return Zero, so that the push parser carries on, or 1 to stop it.
+*/
+static int build_end_obj( void* blob ) {
+	jsonBuilder* builder = blob;
+	size_t base = builder->frames[ --builder->depth ];
+	jsonObject* obj = build_arena_hash( &builder->parser, base );
+	if( !obj ) {
+		osrfLogError( OSRF_LOG_MARK, "Duplicate key in JSON object" );
+		return 1;
+	}
+	return build_value( builder, obj );
+}
+
+/**
+	@brief Respond to a boolean from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@param b The value: true or false.
+	@return Zero, so that the push parser carries on.
+*/
+static int build_bool( void* blob, int b ) {
+	jsonBuilder* builder = blob;
+	jsonObject* obj = new_arena_node( &builder->parser, JSON_BOOL );
+	obj->value.b = b;
+	return build_value( builder, obj );
+}
+
+/**
+	@brief Respond to a null from the push parser.
+	@param blob Pointer to the jsonBuilder, cast to a void pointer.
+	@return Zero, so that the push parser carries on.
+*/
+static int build_null( void* blob ) {
+	return build_value( blob, new_arena_node( &( (jsonBuilder*) blob )->parser, JSON_NULL ) );
+}
+
+/**
+	@brief Find a member of a hash, among the keys and values piled on the parser's stack.
+	@param pairs Pointer to the first key on the stack.
+	@param count How many key/value pairs there are.
+	@param key The key to look for.
+	@return Pointer to the value for @a key, or NULL if there isn't one.
+*/
+static const jsonObject* find_member( void** pairs, size_t count, const char* key ) {
+	size_t i;
+	for( i = 0; i < count; ++i )
+		if( !strcmp( pairs[ 2 * i ], key ) )
+			return pairs[ 2 * i + 1 ];
+	return NULL;
+}
+
+/**
+	@brief Create a jsonObject of a given type in the parser's jsonArena.
+	@param parser Pointer to a Parser.
+	@param type The type of jsonObject to create.
+	@return Pointer to the new jsonObject, with no value, class name, or parent.
+*/
+static jsonObject* new_arena_node( Parser* parser, int type ) {
+	jsonObject* obj = jsonArenaAlloc( parser->arena, sizeof( jsonObject ) );
+	obj->size = 0;
+	obj->classname = NULL;
+	obj->type = type;
+	obj->parent = NULL;
+	obj->value.s = NULL;
+	return obj;
+}
+
+/**
+	@brief Allocate memory from a jsonArena, on behalf of osrfHashFromPairs().
+	@param arena Pointer to the jsonArena, cast to a void pointer.
+	@param size How many bytes are needed.
+	@return Pointer to the memory.
+*/
+static void* arena_alloc( void* arena, size_t size ) {
+	return jsonArenaAlloc( (jsonArena*) arena, size );
+}
+
+/**
+	@brief Push a pointer onto the parser's stack, growing the stack if necessary.
+	@param parser Pointer to a Parser.
+	@param item The pointer to push.
+*/
+static void stack_push( Parser* parser, void* item ) {
+	if( parser->stack_top == parser->stack_size ) {
+		parser->stack_size = parser->stack_size ? parser->stack_size * 2 : 64;
+		void** stack = realloc( parser->stack, parser->stack_size * sizeof( void* ) );
+		if( !stack ) {
+			osrfLogError( OSRF_LOG_MARK, "Out of Memory" );
+			exit( 99 );
+		}
+		parser->stack = stack;
+	}
+	parser->stack[ parser->stack_top++ ] = item;
+}
+
 /**
 	@brief Parse the JSON keyword "null", and create a JSON_NULL for it.
 	@param parser Pointer to a Parser.
@@ -597,6 +1263,8 @@ static jsonObject* get_null( Parser* parser ) {
 	}
 
 	// Everything's okay.  Return a JSON_NULL.
+	if( parser->arena )
+		return new_arena_node( parser, JSON_NULL );
 	return jsonNewObject( NULL );
 }
 
@@ -632,6 +1300,11 @@ static jsonObject* get_true( Parser* parser ) {
 	}
 
 	// Everything's okay.  Return a JSON_BOOL.
+	if( parser->arena ) {
+		jsonObject* obj = new_arena_node( parser, JSON_BOOL );
+		obj->value.b = 1;
+		return obj;
+	}
 	return jsonNewBoolObject( 1 );
 }
 
@@ -668,6 +1341,11 @@ static jsonObject* get_false( Parser* parser ) {
 	}
 
 	// Everything's okay.  Return a JSON_BOOL.
+	if( parser->arena ) {
+		jsonObject* obj = new_arena_node( parser, JSON_BOOL );
+		obj->value.b = 0;
+		return obj;
+	}
 	return jsonNewBoolObject( 0 );
 }
 
@@ -809,17 +1487,23 @@ static void report_error( Parser* parser, char badchar, const char* err ) {
 
 	const int max_margin = 15;  // How many characters to show
 	                            // on either side of the error
-	int pre = parser->index - max_margin;
+
+	// If we've just read the terminal nul, don't look past it
+	int index = parser->index;
+	if( index > 0 && '\0' == parser->buff[ index - 1 ] )
+		--index;
+
+	int pre = index - max_margin;
 	if( pre < 0 )
 		pre = 0;
 
-	int post = parser->index + 15;
-	if( '\0' == parser->buff[ parser->index ] ) {
-		post = parser->index - 1;
+	int post = index + 15;
+	if( '\0' == parser->buff[ index ] ) {
+		post = index - 1;
 	} else {
-		int remaining = strlen(parser->buff + parser->index);
+		int remaining = strlen(parser->buff + index);
 		if( remaining < max_margin )
-			post = parser->index + remaining;
+			post = index + remaining;
 	}
 
 	// Copy the fragment into a buffer
@@ -846,3 +1530,129 @@ static void report_error( Parser* parser, char badchar, const char* err ) {
 		"- index = %d\n - near  => %s\n - %s",
 		badchar, parser->index, buf, err );
 }
+
+/**
+	@brief Count the leading characters of a JSON string that need no translation.
+	@param s Pointer to the next character of the string.
+	@return The number of characters before the next quotation mark, backslash, or nul.
+
+	Control characters are passed through, as get_string() has always done, so they
+	don't stop the scan.
+
+	Most strings -- keys, dates, flags -- are short, so look at the first few characters
+	one at a time before bringing out the vector scan.
+*/
+static inline size_t json_string_span( const char* s ) {
+	size_t n;
+	for( n = 0; n < 16; ++n )
+		if( JSON_STRING_SPECIAL( s[ n ] ) )
+			return n;
+	return n + json_string_span_vector( s + n );
+}
+
+/**
+	@brief Count the leading characters of a JSON string that need no translation.
+	@param s Pointer to the next character of the string.
+	@return The number of characters before the next quotation mark, backslash, or nul.
+
+	Use the fastest version for the CPU at hand, as chosen by pick_string_span().
+*/
+static size_t json_string_span_vector( const char* s ) {
+	pthread_once( &string_span_once, pick_string_span );
+	return string_span( s );
+}
+
+/**
+	@brief Choose the version of json_string_span_vector() for the CPU at hand.
+
+	AVX2 if the CPU has it, or else SSE2 where the compiler targets it, or else a plain
+	loop.  Called once, through pthread_once().
+*/
+static void pick_string_span( void ) {
+#ifdef JSON_SPAN_AVX2
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) )
+		string_span = json_string_span_avx2;
+#endif
+}
+
+/**
+	@brief Count the leading characters of a JSON string that need no translation.
+	@param text Pointer to the next character of the string.
+	@return The number of characters before the next quotation mark, backslash, or nul.
+
+	Where SSE2 is available we examine sixteen bytes at a time.  Otherwise, go one byte at
+	a time.
+
+	We go a byte at a time up to a sixteen-byte boundary, and then load whole aligned
+	blocks.  The block holding the terminating nul may extend past the end of the string,
+	and of the memory allocated for it.  But an aligned block never crosses a page
+	boundary, so it lies entirely in a page that the string touches, and the load can't
+	fault.  AddressSanitizer would still report it as an overflow, so we tell it not to
+	look.
+*/
+JSON_NO_SANITIZE_ADDRESS
+static size_t json_string_span_sse2( const char* text ) {
+	const char* s = text;
+#ifdef __SSE2__
+	while( (uintptr_t) s & 15 ) {
+		if( JSON_STRING_SPECIAL( *s ) )
+			return s - text;
+		++s;
+	}
+
+	const __m128i quote = _mm_set1_epi8( '"' );
+	const __m128i backslash = _mm_set1_epi8( '\\' );
+	const __m128i nul = _mm_setzero_si128();
+	for( ;; ) {
+		__m128i chunk = _mm_load_si128( (const __m128i*) s );
+		__m128i hits = _mm_or_si128(
+			_mm_or_si128( _mm_cmpeq_epi8( chunk, quote ), _mm_cmpeq_epi8( chunk, backslash ) ),
+			_mm_cmpeq_epi8( chunk, nul ) );
+		int mask = _mm_movemask_epi8( hits );
+		if( mask )
+			return ( s - text ) + __builtin_ctz( mask );
+		s += 16;
+	}
+#else
+	while( ! JSON_STRING_SPECIAL( *s ) )
+		++s;
+	return s - text;
+#endif
+}
+
+#ifdef JSON_SPAN_AVX2
+/**
+	@brief Count the leading characters of a JSON string that need no translation.
+	@param text Pointer to the next character of the string.
+	@return The number of characters before the next quotation mark, backslash, or nul.
+
+	Like json_string_span_sse2(), but thirty-two bytes at a time, with the same reasoning
+	about reading past the end.  Compiled for AVX2 regardless of the compiler's target, so
+	call it only if the CPU supports AVX2.
+*/
+__attribute__(( target( "avx2" ) )) JSON_NO_SANITIZE_ADDRESS
+static size_t json_string_span_avx2( const char* text ) {
+	const char* s = text;
+	while( (uintptr_t) s & 31 ) {
+		if( JSON_STRING_SPECIAL( *s ) )
+			return s - text;
+		++s;
+	}
+
+	const __m256i quote = _mm256_set1_epi8( '"' );
+	const __m256i backslash = _mm256_set1_epi8( '\\' );
+	const __m256i nul = _mm256_setzero_si256();
+	for( ;; ) {
+		__m256i chunk = _mm256_load_si256( (const __m256i*) s );
+		__m256i hits = _mm256_or_si256(
+			_mm256_or_si256( _mm256_cmpeq_epi8( chunk, quote ),
+				_mm256_cmpeq_epi8( chunk, backslash ) ),
+			_mm256_cmpeq_epi8( chunk, nul ) );
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8( hits );
+		if( mask )
+			return ( s - text ) + __builtin_ctz( mask );
+		s += 32;
+	}
+}
+#endif
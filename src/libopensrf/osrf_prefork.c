@@ -9,6 +9,12 @@
 	child dies, either deliberately or otherwise, we can spawn another one to replace it,
 	keeping the number of children within a predefined range.
 
+	Within that range, the number of children follows the load.  We keep smoothed estimates
+	of the arrival rate and of the time a child takes to service a request; their product
+	is the number of children we expect to be busy.  We spawn children ahead of demand so
+	as to keep min_spare_children more than that, and, if child_idle_timeout is configured,
+	kill children that have sat idle that long while we have more than we need.
+
 	Use a doubly-linked circular list to keep track of the children to whom we have forwarded
 	a request, and who are still working on them.  Use a separate linear linked list to keep
 	track of children that are currently idle.  Move them back and forth as needed.
@@ -17,7 +23,15 @@
 	- One for the parent to send requests to the child.
 	- One for the child to notify the parent that it is available for another request.
 
-	The message sent to the child represents an XML stanza as received from Jabber.
+	The message sent to the child is normally packed by message_pack(), which spares both
+	processes an XML round trip.  If the application is configured with a pipe_format of
+	"xml", it is instead an XML stanza as built by message_prepare_xml().  The child can
+	tell which by looking at the first byte.
+
+	If the application is configured with a request_ring_size, each child also gets a ring
+	buffer in shared memory.  The parent places packed requests there and rings an eventfd
+	doorbell instead of writing them down the pipe, and the child reports its availability
+	through another eventfd.  A request too large for the ring still goes through the pipe.
 
 	When the child finishes processing the request, it writes the string "available" back
 	to the parent.  Then the parent knows that it can send that child another request.
@@ -33,6 +47,9 @@
 #include <string.h>
 #include <sys/select.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include "opensrf/utils.h"
 #include "opensrf/log.h"
@@ -43,6 +60,67 @@
 
 #define READ_BUFSIZE 1024
 #define ABS_MAX_CHILDREN 256
+/** Smallest request ring we'll bother with. */
+#define MIN_RING_SIZE 4096
+/** Space taken up in a ring by a record of a given length (keeps records 8-byte aligned). */
+#define RING_RECORD_SIZE(len) ((sizeof(uint32_t) + (len) + 7) & ~ (size_t) 7)
+/** Time constant, in seconds, for smoothing the arrival rate and service time. */
+#define SCALE_SMOOTHING 10.0
+/** Number of buckets in the time-in-backlog histogram.  Bucket i counts waits shorter
+	than 2^i milliseconds; the last one counts everything else. */
+#define BACKLOG_WAIT_BUCKETS 16
+
+/**
+	@brief A single-producer, single-consumer ring buffer in memory shared by the parent
+	and one child.
+
+	Each record is a uint32_t length followed by a packed transport_message.  Since records
+	are 8-byte aligned, the length never straddles the end of the ring, but the message
+	may wrap around to the beginning.  Hence a record fits whenever the ring has room for
+	it in all, wherever the free space happens to lie; an empty ring takes any record no
+	larger than itself.
+*/
+typedef struct {
+	uint64_t head;        /**< Bytes written so far; advanced only by the parent. */
+	uint64_t tail;        /**< Bytes consumed so far; advanced only by the child. */
+	size_t size;          /**< Capacity of data[]: a multiple of 8. */
+	char data[];          /**< The records. */
+} prefork_ring;
+
+/**
+	@brief What the parent knows about one child, for the prefork_metrics.
+*/
+typedef struct {
+	pid_t pid;            /**< Process ID of the child, or 0 if the slot is free. */
+	int busy;             /**< Boolean: the child has a request we haven't heard back about. */
+	unsigned long requests;  /**< How many requests the child has been given. */
+	double service_total; /**< Total seconds spent servicing them. */
+	double service_max;   /**< Longest time spent servicing one. */
+} prefork_drone_metrics;
+
+/**
+	@brief Counters and gauges describing a listener and its children.
+
+	These live in memory shared with the children, so that a child can report them in
+	response to a system method.  Only the parent writes them.
+*/
+typedef struct {
+	pid_t listener;       /**< Process ID of the parent. */
+	int backlog_depth;    /**< How many requests are waiting for a child. */
+	int backlog_max;      /**< The most that have ever been waiting at once. */
+	unsigned long backlog_wait[ BACKLOG_WAIT_BUCKETS ]; /**< Time-in-backlog histogram. */
+	unsigned long requests;  /**< Requests handed to children. */
+	unsigned long dropped;   /**< Requests refused because the backlog was full. */
+	unsigned long spawned;   /**< Children launched. */
+	unsigned long killed;    /**< Children killed by the parent. */
+	unsigned long spawned_ahead; /**< Children launched ahead of demand. */
+	unsigned long reaped_idle;   /**< Idle children killed as surplus. */
+	double arrival_rate;  /**< Smoothed requests per second. */
+	double service_time;  /**< Smoothed seconds per request. */
+	double busy_ratio;    /**< Smoothed fraction of children that are busy. */
+	int slots;            /**< Number of elements in drones[]: max_children. */
+	prefork_drone_metrics drones[];  /**< One slot per possible child. */
+} prefork_metrics;
 
 typedef struct {
 	int max_requests;     /**< How many requests a child processes before terminating. */
@@ -53,7 +131,19 @@ typedef struct {
 	int data_to_child;    /**< Unused. */
 	int data_to_parent;   /**< Unused. */
 	int current_num_children;   /**< How many children are currently on the list. */
+	int retiring;         /**< Surplus children told to terminate, but not yet reaped. */
+	int min_spare_children; /**< How many idle children to keep ahead of demand. */
+	int child_idle_timeout; /**< Seconds before a surplus idle child is killed (0 = never). */
+	int load_report_interval; /**< Seconds between load reports to the routers (0 = none). */
+	double last_load_report;  /**< When we last reported our load, by prefork_clock(). */
+	int reported_load;    /**< Busy children plus backlog, as last reported. */
+	double last_scaled;   /**< When prefork_scale() last took stock, by prefork_clock(). */
+	int arrivals;         /**< Requests received since prefork_scale() last took stock. */
+	prefork_metrics* metrics;  /**< Shared with the children. */
+	size_t metrics_size;  /**< Size of the mapping at metrics. */
 	int keepalive;        /**< Keepalive time for stateful sessions. */
+	int packed_pipe;      /**< Boolean: pack requests for the children instead of using XML. */
+	size_t ring_size;     /**< Size of each child's request ring, or 0 for none. */
 	char* appname;        /**< Name of the application. */
 	/** Points to a circular linked list of children. */
 	struct prefork_child_struct* first_child;
@@ -74,9 +164,15 @@ struct prefork_child_struct {
 	int write_data_fd;    /**< Parent uses to write request. */
 	int read_status_fd;   /**< Parent reads to see if child is available. */
 	int write_status_fd;  /**< Child uses to notify parent when it's available again. */
+	prefork_ring* ring;   /**< Shared memory for passing requests, or NULL if none. */
+	int request_efd;      /**< eventfd: parent signals a request in the ring (-1 if none). */
+	double dispatched;    /**< When the parent last sent the child a request, by prefork_clock(). */
+	double idle_since;    /**< When the child last became idle, by prefork_clock(). */
+	prefork_drone_metrics* drone;  /**< The child's slot in the metrics, if any. */
 	int max_requests;     /**< How many requests a child can process before terminating. */
 	const char* appname;  /**< Name of the application. */
 	int keepalive;        /**< Keepalive time for stateful sessions. */
+	int retiring;         /**< Boolean: sent SIGTERM as surplus; never to be given work. */
 	struct prefork_child_struct* next;  /**< Linkage pointer for linked list. */
 	struct prefork_child_struct* prev;  /**< Linkage pointer for linked list. */
 };
@@ -85,17 +181,38 @@ typedef struct prefork_child_struct prefork_child;
 
 /** Boolean.  Set to true by a signal handler when it traps SIGCHLD. */
 static volatile sig_atomic_t child_dead;
+static volatile sig_atomic_t stats_wanted;
 
 static int prefork_simple_init( prefork_simple* prefork, transport_client* client,
 	int max_requests, int min_children, int max_children, int max_backlog_queue );
 static prefork_child* launch_child( prefork_simple* forker );
 static void prefork_launch_children( prefork_simple* forker );
 static void prefork_run( prefork_simple* forker );
+static double prefork_clock( void );
+static void prefork_scale( prefork_simple* forker );
+static double prefork_smooth( double average, double sample, double elapsed );
+static int prefork_scale_target( double arrival_rate, double service_time, int busy,
+	int min_spare, int min_children, int max_children );
+static void prefork_retire_child( prefork_simple* forker, prefork_child* child,
+	prefork_child* prev );
+static int prefork_count_idle( const prefork_simple* forker );
+static void prefork_metrics_add_drone( prefork_simple* forker, prefork_child* child );
+static void prefork_metrics_backlog_depth( prefork_metrics* metrics, int depth );
+static void prefork_metrics_backlog_wait( prefork_metrics* metrics, double wait );
+static void prefork_log_stats( void );
 static void add_prefork_child( prefork_simple* forker, prefork_child* child );
 
 static void del_prefork_child( prefork_simple* forker, pid_t pid );
 static int check_children( prefork_simple* forker, int forever );
-static int  prefork_child_process_request( prefork_child*, char* data );
+static int prefork_send_request( prefork_simple* forker, prefork_child* child,
+	transport_message* msg );
+static int prefork_child_wait_request( prefork_child* child, growing_buffer* gbuf,
+	transport_message** msg );
+static int prefork_child_read_request( prefork_child* child, growing_buffer* gbuf );
+static int prefork_child_add_ring( prefork_child* child, size_t size );
+static int prefork_ring_put( prefork_ring* ring, const char* data, size_t size );
+static transport_message* prefork_ring_get( prefork_ring* ring );
+static int  prefork_child_process_request( prefork_child*, transport_message* msg );
 static int prefork_child_init_hook( prefork_child* );
 static prefork_child* prefork_child_init( prefork_simple* forker,
 	int read_data_fd, int write_data_fd,
@@ -106,6 +223,9 @@ static void prefork_child_wait( prefork_child* child );
 static void prefork_clear( prefork_simple*, bool graceful);
 static void prefork_child_free( prefork_simple* forker, prefork_child* );
 static void osrf_prefork_register_routers( const char* appname, bool unregister );
+static void osrf_prefork_notify_routers( const char* appname, const char* command );
+static char* prefork_load_hint( const prefork_simple* forker );
+static void prefork_report_load( prefork_simple* forker );
 static void osrf_prefork_child_exit( prefork_child* );
 
 static void sigchld_handler( int sig );
@@ -114,6 +234,7 @@ static void sigusr2_handler( int sig );
 static void sigterm_handler( int sig );
 static void sigint_handler( int sig );
 static void sighup_handler( int sig );
+static void sigwinch_handler( int sig );
 
 /** Maintain a global pointer to the prefork_simple object
  *  for the current process so we can refer to it later
@@ -141,6 +262,11 @@ int osrf_prefork_run( const char* appname ) {
 	int maxbq = 1000;
 	int minc = 3;
 	int kalive = 5;
+	int packed = 1;
+	size_t ringsz = 0;
+	int minspare = 0;
+	int idletime = 0;
+	int loadreport = 0;
 
 	// Get configuration settings
 	osrfLogInfo( OSRF_LOG_MARK, "Loading config in osrf_forker for app %s", appname );
@@ -150,6 +276,17 @@ int osrf_prefork_run( const char* appname ) {
 	char* max_children = osrf_settings_host_value( "/apps/%s/unix_config/max_children", appname );
 	char* max_backlog_queue = osrf_settings_host_value( "/apps/%s/unix_config/max_backlog_queue", appname );
 	char* keepalive    = osrf_settings_host_value( "/apps/%s/keepalive", appname );
+	char* pipe_format  = osrf_settings_host_value( "/apps/%s/unix_config/pipe_format", appname );
+	char* ring_size    = osrf_settings_host_value( "/apps/%s/unix_config/request_ring_size",
+		appname );
+	char* min_spare    = osrf_settings_host_value( "/apps/%s/unix_config/min_spare_children",
+		appname );
+	char* idle_timeout = osrf_settings_host_value( "/apps/%s/unix_config/child_idle_timeout",
+		appname );
+	char* load_report  = osrf_settings_host_value( "/apps/%s/unix_config/load_report_interval",
+		appname );
+	char* intern_keys  = osrf_settings_host_value( "/apps/%s/unix_config/intern_json_keys",
+		appname );
 
 	if( !keepalive )
 		osrfLogWarning( OSRF_LOG_MARK, "Keepalive is not defined, assuming %d", kalive );
@@ -176,11 +313,47 @@ int osrf_prefork_run( const char* appname ) {
 	else
 		maxbq = atoi( max_backlog_queue );
 
+	if( pipe_format && !strcmp( pipe_format, "xml" ))
+		packed = 0;
+
+	if( ring_size ) {
+		long size = atol( ring_size );
+		if( !packed )
+			osrfLogWarning( OSRF_LOG_MARK,
+				"request_ring_size requires packed requests; not using shared memory" );
+		else if( size > 0 ) {
+			if( size < MIN_RING_SIZE )
+				size = MIN_RING_SIZE;
+			ringsz = ( (size_t) size + 7 ) & ~ (size_t) 7;
+		}
+	}
+
 	free( keepalive );
 	free( max_req );
 	free( min_children );
 	free( max_children );
 	free( max_backlog_queue );
+	free( pipe_format );
+	if( min_spare )
+		minspare = atoi( min_spare );
+
+	if( idle_timeout )
+		idletime = atoi( idle_timeout );
+
+	if( load_report )
+		loadreport = atoi( load_report );
+
+	// Set before forking, so that the children inherit it
+	if( intern_keys && ( !strcasecmp( intern_keys, "true" ) || atoi( intern_keys ) > 0 ) ) {
+		osrfLogInfo( OSRF_LOG_MARK, "Interning JSON hash keys for app %s", appname );
+		jsonSetInternKeys( 1 );
+	}
+
+	free( ring_size );
+	free( min_spare );
+	free( idle_timeout );
+	free( load_report );
+	free( intern_keys );
 	/* --------------------------------------------------- */
 
 	char* resc = va_list_to_string( "%s_listener", appname );
@@ -194,6 +367,10 @@ int osrf_prefork_run( const char* appname ) {
 
 	free( resc );
 
+	// The listener passes message bodies on to the drones as text, without parsing them,
+	// so parsing them as they arrive would be wasted effort.
+	session_set_body_parsing( osrfSystemGetTransportClient()->session, 0 );
+
 	prefork_simple forker;
 
 	if( prefork_simple_init( &forker, osrfSystemGetTransportClient(), maxr, minc, maxc, maxbq )) {
@@ -205,6 +382,11 @@ int osrf_prefork_run( const char* appname ) {
 	// Finish initializing the prefork_simple.
 	forker.appname   = strdup( appname );
 	forker.keepalive = kalive;
+	forker.packed_pipe = packed;
+	forker.ring_size = ringsz;
+	forker.min_spare_children = minspare > 0 ? minspare : 0;
+	forker.child_idle_timeout = idletime > 0 ? idletime : 0;
+	forker.load_report_interval = loadreport > 0 ? loadreport : 0;
 	global_forker = &forker;
 
 	// Spawn the children; put them in the idle list.
@@ -219,6 +401,7 @@ int osrf_prefork_run( const char* appname ) {
 	signal( SIGINT,  sigint_handler );
 	signal( SIGQUIT, sigint_handler );
 	signal( SIGHUP,  sighup_handler );
+	signal( SIGWINCH, sigwinch_handler );
 
 	// Sit back and let the requests roll in
 	osrfLogInfo( OSRF_LOG_MARK, "Launching osrf_forker for app %s", appname );
@@ -234,14 +417,17 @@ int osrf_prefork_run( const char* appname ) {
 	@param appname Name of the application.
 	@param routerName Name of the router.
 	@param routerDomain Domain of the router.
+	@param command The router command: "register", "unregister", or "load".
 
-	Tell the router that you're open for business so that it can route requests to you.
+	Tell the router that you're open for business so that it can route requests to you,
+	or that you're closing, or how busy you are.  Registration and load reports carry a
+	load hint in the body, for routers that balance by load.
 
 	Called only by the parent process.
 */
 static void osrf_prefork_send_router_registration(
 		const char* appname, const char* routerName, 
-            const char* routerDomain, bool unregister ) {
+            const char* routerDomain, const char* command ) {
 
 	// Get a pointer to the global transport_client
 	transport_client* client = osrfSystemGetTransportClient();
@@ -251,18 +437,23 @@ static void osrf_prefork_send_router_registration(
 
 	// Create the registration message, and send it
 	transport_message* msg;
-    if (unregister) {
+    if (!strcmp( command, "unregister" )) {
 
 	    osrfLogInfo( OSRF_LOG_MARK, "%s un-registering with router %s", appname, jid );
 	    msg = message_init( "unregistering", NULL, NULL, jid, NULL );
-	    message_set_router_info( msg, NULL, NULL, appname, "unregister", 0 );
 
     } else {
 
-	    osrfLogInfo( OSRF_LOG_MARK, "%s registering with router %s", appname, jid );
-	    msg = message_init( "registering", NULL, NULL, jid, NULL );
-	    message_set_router_info( msg, NULL, NULL, appname, "register", 0 );
+	    char* hint = prefork_load_hint( global_forker );
+	    if( !strcmp( command, "register" ))
+		    osrfLogInfo( OSRF_LOG_MARK, "%s registering with router %s", appname, jid );
+	    else
+		    osrfLogDebug( OSRF_LOG_MARK, "%s reporting load to router %s: %s",
+			    appname, jid, hint ? hint : "" );
+	    msg = message_init( hint ? hint : "registering", NULL, NULL, jid, NULL );
+	    free( hint );
     }
+	message_set_router_info( msg, NULL, NULL, appname, command, 0 );
 
 	client_send_message( client, msg );
 
@@ -285,7 +476,7 @@ static void osrf_prefork_send_router_registration(
 	Called only by the parent process.
 */
 static void osrf_prefork_parse_router_chunk( 
-    const char* appname, const jsonObject* routerChunk, bool unregister ) {
+    const char* appname, const jsonObject* routerChunk, const char* command ) {
 
 	const char* routerName = jsonObjectGetString( jsonObjectGetKeyConst( routerChunk, "name" ));
 	const char* domain = jsonObjectGetString( jsonObjectGetKeyConst( routerChunk, "domain" ));
@@ -305,29 +496,42 @@ static void osrf_prefork_parse_router_chunk(
 			for( j = 0; j < service_obj->size; j++ ) {
 				const char* service = jsonObjectGetString( jsonObjectGetIndex( service_obj, j ));
 				if( service && !strcmp( appname, service ))
-					osrf_prefork_send_router_registration( appname, routerName, domain, unregister );
+					osrf_prefork_send_router_registration( appname, routerName, domain, command );
 			}
 		}
 		else if( JSON_STRING == service_obj->type ) {
 			// There's only one service listed.  Register with this router
 			// if and only if this service is the one listed.
 			if( !strcmp( appname, jsonObjectGetString( service_obj )) )
-				osrf_prefork_send_router_registration( appname, routerName, domain, unregister );
+				osrf_prefork_send_router_registration( appname, routerName, domain, command );
 		}
 	} else {
 		// This router is not restricted to any set of services,
 		// so go ahead and register with it.
-		osrf_prefork_send_router_registration( appname, routerName, domain, unregister );
+		osrf_prefork_send_router_registration( appname, routerName, domain, command );
 	}
 }
 
 /**
 	@brief Register the application with one or more routers, according to the configuration.
 	@param appname Name of the application.
+	@param unregister Boolean: unregister instead.
 
 	Called only by the parent process.
 */
 static void osrf_prefork_register_routers( const char* appname, bool unregister ) {
+	osrf_prefork_notify_routers( appname, unregister ? "unregister" : "register" );
+}
+
+/**
+	@brief Send a command to each router we're registered with, according to the
+	configuration.
+	@param appname Name of the application.
+	@param command The router command: "register", "unregister", or "load".
+
+	Called only by the parent process.
+*/
+static void osrf_prefork_notify_routers( const char* appname, const char* command ) {
 
 	jsonObject* routerInfo = osrfConfigGetValueObject( NULL, "/routers/router" );
 
@@ -341,12 +545,12 @@ static void osrf_prefork_register_routers( const char* appname, bool unregister
 			char* domain = osrfConfigGetValue( NULL, "/routers/router" );
 			osrfLogDebug( OSRF_LOG_MARK, "found simple router settings with router name %s",
 				routerName );
-			osrf_prefork_send_router_registration( appname, routerName, domain, unregister );
+			osrf_prefork_send_router_registration( appname, routerName, domain, command );
 
 			free( routerName );
 			free( domain );
 		} else {
-			osrf_prefork_parse_router_chunk( appname, routerChunk, unregister );
+			osrf_prefork_parse_router_chunk( appname, routerChunk, command );
 		}
 	}
 
@@ -410,13 +614,13 @@ static int prefork_child_init_hook( prefork_child* child ) {
 /**
 	@brief Respond to a client request forwarded by the parent.
 	@param child Pointer to the state of the child process.
-	@param data Pointer to the raw XMPP message received from the parent.
+	@param msg Pointer to the message received from the parent (NULL if it was unusable).
 	@return 0 on success; non-zero means that the child process should clean itself up
 		and terminate immediately, presumably due to a fatal error condition.
 
 	Called only by a child process.
 */
-static int prefork_child_process_request( prefork_child* child, char* data ) {
+static int prefork_child_process_request( prefork_child* child, transport_message* msg ) {
 	if( !child ) return 0;
 
 	transport_client* client = osrfSystemGetTransportClient();
@@ -433,9 +637,6 @@ static int prefork_child_process_request( prefork_child* child, char* data ) {
 		}
 	}
 
-	// Construct the message from the xml.
-	transport_message* msg = new_message_from_xml( data );
-
 	// Respond to the transport message.  This is where method calls are buried.
 	osrfAppSession* session = osrf_stack_transport_handler( msg, child->appname );
 	if( !session )
@@ -467,19 +668,20 @@ static int prefork_child_process_request( prefork_child* child, char* data ) {
 
 	osrfLogDebug( OSRF_LOG_MARK, "Entering keepalive loop for session %s", session->session_id );
 	int keepalive = child->keepalive;
+	int keepalive_ms = timeout_seconds_to_millis( keepalive );
 	int retval;
 	int recvd;
-	time_t start;
-	time_t end;
+	long long start;
+	long long end;
 
 	while( 1 ) {
 
 		// Respond to any input messages.  This is where the method calls are buried.
 		osrfLogDebug( OSRF_LOG_MARK,
 			"osrf_prefork calling queue_wait [%d] in keepalive loop", keepalive );
-		start   = time( NULL );
-		retval  = osrf_app_session_queue_wait( session, keepalive, &recvd );
-		end     = time( NULL );
+		start   = get_monotonic_millis();
+		retval  = osrf_app_session_queue_wait_ms( session, keepalive_ms, &recvd );
+		end     = get_monotonic_millis();
 
 		osrfLogDebug( OSRF_LOG_MARK, "Data received == %d", recvd );
 
@@ -501,7 +703,7 @@ static int prefork_child_process_request( prefork_child* child, char* data ) {
 			break;
 
 		// If we timed out while waiting for a request, exit the loop.
-		if( !recvd && (end - start) >= keepalive ) {
+		if( !recvd && (end - start) >= keepalive_ms ) {
 			osrfLogInfo( OSRF_LOG_MARK,
 				"No request was received in %d seconds, exiting stateful session", keepalive );
 			osrfAppSessionStatus(
@@ -561,7 +763,17 @@ static int prefork_simple_init( prefork_simple* prefork, transport_client* clien
 	prefork->data_to_child = 0;
 	prefork->data_to_parent = 0;
 	prefork->current_num_children = 0;
+	prefork->retiring     = 0;
+	prefork->min_spare_children = 0;
+	prefork->child_idle_timeout = 0;
+	prefork->load_report_interval = 0;
+	prefork->last_load_report = 0.0;
+	prefork->reported_load = 0;
+	prefork->last_scaled  = prefork_clock();
+	prefork->arrivals     = 0;
 	prefork->keepalive    = 0;
+	prefork->packed_pipe  = 1;
+	prefork->ring_size    = 0;
 	prefork->appname      = NULL;
 	prefork->first_child  = NULL;
 	prefork->idle_list    = NULL;
@@ -569,6 +781,21 @@ static int prefork_simple_init( prefork_simple* prefork, transport_client* clien
 	prefork->connection   = client;
 	prefork->sighup_pending_list = NULL;
 
+	// Map the metrics before forking anything, so that the children share them
+	prefork->metrics_size = sizeof( prefork_metrics )
+		+ max_children * sizeof( prefork_drone_metrics );
+	prefork->metrics = mmap( NULL, prefork->metrics_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if( MAP_FAILED == prefork->metrics ) {
+		osrfLogError( OSRF_LOG_MARK, "Unable to map prefork metrics: %s", strerror( errno ));
+		prefork->metrics = NULL;
+		return 1;
+	}
+
+	// An anonymous mapping starts out zeroed
+	prefork->metrics->listener = getpid();
+	prefork->metrics->slots = max_children;
+
 	return 0;
 }
 
@@ -594,7 +821,16 @@ static prefork_child* launch_child( prefork_simple* forker ) {
 		return NULL;
 	}
 
-	if( pipe( status_fd ) < 0 ) {/* build the status pipe */
+	if( forker->ring_size ) {
+		// With a request ring, an eventfd serves as both ends of the status "pipe"
+		status_fd[0] = status_fd[1] = eventfd( 0, 0 );
+		if( status_fd[0] < 0 ) {
+			osrfLogError( OSRF_LOG_MARK, "eventfd making error: %s", strerror( errno ));
+			close( data_fd[1] );
+			close( data_fd[0] );
+			return NULL;
+		}
+	} else if( pipe( status_fd ) < 0 ) {/* build the status pipe */
 		osrfLogError( OSRF_LOG_MARK,  "Pipe making error" );
 		close( data_fd[1] );
 		close( data_fd[0] );
@@ -608,6 +844,11 @@ static prefork_child* launch_child( prefork_simple* forker ) {
 	prefork_child* child = prefork_child_init( forker, data_fd[0],
 		data_fd[1], status_fd[0], status_fd[1] );
 
+	if( forker->ring_size && prefork_child_add_ring( child, forker->ring_size )) {
+		prefork_child_free( forker, child );
+		return NULL;
+	}
+
 	if( (pid=fork()) < 0 ) {
 		osrfLogError( OSRF_LOG_MARK, "Forking Error" );
 		prefork_child_free( forker, child );
@@ -623,6 +864,8 @@ static prefork_child* launch_child( prefork_simple* forker ) {
 		signal( SIGCHLD, sigchld_handler );
 		( forker->current_num_children )++;
 		child->pid = pid;
+		++forker->metrics->spawned;
+		prefork_metrics_add_drone( forker, child );
 
 		osrfLogDebug( OSRF_LOG_MARK, "Parent launched %d", pid );
 		/* *no* child pipe FD's can be closed or the parent will re-use fd's that
@@ -640,6 +883,7 @@ static prefork_child* launch_child( prefork_simple* forker ) {
 		signal( SIGQUIT, SIG_DFL );
 		signal( SIGCHLD, SIG_DFL );
 		signal( SIGHUP,  SIG_DFL );
+		signal( SIGWINCH, SIG_DFL );
 
 		osrfLogInternal( OSRF_LOG_MARK,
 			"I am new child with read_data_fd = %d and write_status_fd = %d",
@@ -647,7 +891,8 @@ static prefork_child* launch_child( prefork_simple* forker ) {
 
 		child->pid = getpid();
 		close( child->write_data_fd );
-		close( child->read_status_fd );
+		if( child->read_status_fd != child->write_status_fd )
+			close( child->read_status_fd );
 
 		/* do the initing */
 		if( prefork_child_init_hook( child ) == -1 ) {
@@ -722,6 +967,19 @@ static void sigusr2_handler( int sig ) {
 	signal( SIGUSR2, sigusr2_handler );
 }
 
+/**
+	@brief Signal handler for SIGWINCH
+	@param sig The value of the trapped signal; always SIGWINCH.
+
+	Set a boolean so that the main loop will write the listener's metrics to the log.
+	SIGUSR1 and SIGUSR2 are already spoken for, and SIGWINCH is harmless to send to a
+	process that doesn't catch it.
+*/
+static void sigwinch_handler( int sig ) {
+	signal( SIGWINCH, sigwinch_handler );
+	stats_wanted = 1;
+}
+
 /**
 	@brief Signal handler for SIGTERM
 	@param sig The value of the trapped signal; always SIGTERM
@@ -842,6 +1100,380 @@ static void reap_children( prefork_simple* forker ) {
 		launch_child( forker );
 }
 
+/**
+	@brief Read the clock used for scheduling and timing the children.
+	@return Seconds since some arbitrary starting point.
+
+	The monotonic clock, in seconds, so that setting the system clock neither stalls
+	nor hurries the scaling, nor skews the times we measure.
+*/
+static double prefork_clock( void ) {
+	return get_monotonic_millis() / 1000.0;
+}
+
+/**
+	@brief Grow or shrink the collection of child processes to follow the load.
+	@param forker Pointer to the prefork_simple that manages the child processes.
+
+	At most once a second, update the smoothed arrival rate and let
+	prefork_scale_target() decide how many children we want.  Children already
+	retiring don't count.
+
+	If we're short, spawn children now, so that a burst of requests doesn't have to
+	wait for them.  If we have a surplus and child_idle_timeout is set, retire children
+	that have been idle at least that long, starting with the one idle longest.
+*/
+static void prefork_scale( prefork_simple* forker ) {
+
+	double now = prefork_clock();
+	double elapsed = now - forker->last_scaled;
+	if( elapsed < 1.0 )
+		return;
+
+	// Notice any children that have finished since we last looked
+	check_children( forker, 0 );
+
+	prefork_metrics* metrics = forker->metrics;
+	metrics->arrival_rate = prefork_smooth( metrics->arrival_rate,
+		forker->arrivals / elapsed, elapsed );
+	forker->arrivals = 0;
+	forker->last_scaled = now;
+
+	int children = forker->current_num_children - forker->retiring;
+	int idle = prefork_count_idle( forker );
+	int busy = children - idle;
+	if( busy < 0 )
+		busy = 0;
+	if( children > 0 )
+		metrics->busy_ratio = prefork_smooth( metrics->busy_ratio,
+			(double) busy / children, elapsed );
+
+	int target = prefork_scale_target( metrics->arrival_rate, metrics->service_time, busy,
+		forker->min_spare_children, forker->min_children, forker->max_children );
+
+	if( children < target ) {
+		osrfLogInfo( OSRF_LOG_MARK, "Scaling up from %d to %d children "
+			"(%.1f requests/sec, %.3f sec/request, %d busy)",
+			children, target, metrics->arrival_rate, metrics->service_time, busy );
+		while( forker->current_num_children - forker->retiring < target ) {
+			if( ! launch_child( forker ))
+				break;
+			++metrics->spawned_ahead;
+		}
+		return;
+	}
+
+	if( ! forker->child_idle_timeout )
+		return;
+
+	// Since the idle list is a stack, the longest idle children are at the tail
+	int surplus = children - target;
+	while( surplus > 0 && forker->idle_list ) {
+		prefork_child* prev = NULL;
+		prefork_child* oldest = forker->idle_list;
+		while( oldest->next ) {
+			prev = oldest;
+			oldest = oldest->next;
+		}
+
+		if( now - oldest->idle_since < forker->child_idle_timeout )
+			break;
+
+		osrfLogInfo( OSRF_LOG_MARK, "Scaling down: retiring child %d, idle %.0f seconds",
+			oldest->pid, now - oldest->idle_since );
+		prefork_retire_child( forker, oldest, prev );
+		++metrics->killed;
+		++metrics->reaped_idle;
+		--surplus;
+	}
+}
+
+/**
+	@brief Fold a new sample into an exponentially weighted moving average.
+	@param average The average so far.
+	@param sample The new sample.
+	@param elapsed Seconds covered by the sample.
+	@return The new average.
+
+	The weight of the sample grows with the time it covers, so that the average
+	forgets at the same pace however irregularly it is updated.
+*/
+static double prefork_smooth( double average, double sample, double elapsed ) {
+	double alpha = elapsed / ( elapsed + SCALE_SMOOTHING );
+	return average + alpha * ( sample - average );
+}
+
+/**
+	@brief Decide how many children a listener should have.
+	@param arrival_rate Smoothed requests per second.
+	@param service_time Smoothed seconds per request.
+	@param busy How many children are busy now.
+	@param min_spare How many idle children to keep ahead of demand.
+	@param min_children Fewest children to have.
+	@param max_children Most children to have.
+	@return The number of children wanted.
+
+	Estimate how many children the load keeps busy: the arrival rate times the
+	service time, rounded up, or the number actually busy, whichever is greater.
+	Aim for that many plus @a min_spare, within the bounds of @a min_children and
+	@a max_children.
+*/
+static int prefork_scale_target( double arrival_rate, double service_time, int busy,
+		int min_spare, int min_children, int max_children ) {
+
+	double load = arrival_rate * service_time;
+	int demand = load < max_children ? (int) load : max_children;
+	if( demand < load )
+		++demand;
+	if( demand < busy )
+		demand = busy;
+
+	int target = demand + min_spare;
+	if( target < min_children )
+		target = min_children;
+	if( target > max_children )
+		target = max_children;
+	return target;
+}
+
+/**
+	@brief Tell a surplus idle child to terminate.
+	@param forker Pointer to the prefork_simple that manages the child processes.
+	@param child Pointer to the idle child.
+	@param prev Pointer to the child before it in the idle list, or NULL if it's first.
+
+	Move the child to the active list, so that it won't be picked for new work, and send
+	it SIGTERM.  When it's gone, reap_children() buries it like any other.  Until then it
+	still counts in current_num_children, so we count it in forker->retiring as well.
+*/
+static void prefork_retire_child( prefork_simple* forker, prefork_child* child,
+		prefork_child* prev ) {
+
+	if( prev )
+		prev->next = child->next;
+	else
+		forker->idle_list = child->next;
+	child->next = NULL;
+
+	child->retiring = 1;
+	++forker->retiring;
+	add_prefork_child( forker, child );
+	kill( child->pid, SIGTERM );
+}
+
+/**
+	@brief Count the children in the idle list.
+	@param forker Pointer to the prefork_simple that manages the child processes.
+	@return The number of idle children.
+*/
+static int prefork_count_idle( const prefork_simple* forker ) {
+	int count = 0;
+	const prefork_child* child = forker->idle_list;
+	while( child ) {
+		++count;
+		child = child->next;
+	}
+	return count;
+}
+
+/**
+	@brief Give a newly launched child a slot in the metrics.
+	@param forker Pointer to the prefork_simple that owns the child.
+	@param child Pointer to the new prefork_child.
+
+	If there's no free slot -- which shouldn't happen, since there are as many slots as
+	max_children -- the child goes unreported.
+*/
+static void prefork_metrics_add_drone( prefork_simple* forker, prefork_child* child ) {
+	prefork_metrics* metrics = forker->metrics;
+	int i;
+	for( i = 0; i < metrics->slots; ++i ) {
+		if( 0 == metrics->drones[ i ].pid ) {
+			child->drone = metrics->drones + i;
+			child->drone->pid = child->pid;
+			return;
+		}
+	}
+}
+
+/**
+	@brief Record how many requests are waiting in the backlog.
+	@param metrics Pointer to the prefork_metrics.
+	@param depth The number of requests waiting.
+
+	Besides the current depth, keep track of the deepest that the backlog has ever been.
+*/
+static void prefork_metrics_backlog_depth( prefork_metrics* metrics, int depth ) {
+	metrics->backlog_depth = depth;
+	if( depth > metrics->backlog_max )
+		metrics->backlog_max = depth;
+}
+
+/**
+	@brief Record how long a request waited in the backlog.
+	@param metrics Pointer to the prefork_metrics.
+	@param wait How long the request waited, in seconds.
+*/
+static void prefork_metrics_backlog_wait( prefork_metrics* metrics, double wait ) {
+	double limit = 0.001;
+	int i = 0;
+	while( i < BACKLOG_WAIT_BUCKETS - 1 && wait >= limit ) {
+		++i;
+		limit *= 2;
+	}
+	++metrics->backlog_wait[ i ];
+}
+
+/**
+	@brief Report the metrics of the current listener.
+	@return Pointer to a newly allocated jsonObject, or NULL if this process isn't a
+	prefork listener or one of its children.
+
+	The result is a JSON_HASH of counters and gauges, including a histogram of the time
+	requests spent waiting for a child, keyed on the upper bound of each bucket in
+	milliseconds, and a list of the children with their request counts and service
+	times.  The caller is responsible for freeing it.
+
+	A child may call this function as well as the parent, but the numbers are only as
+	current as the parent's last look at its children.
+*/
+jsonObject* osrf_prefork_stats( void ) {
+	if( !global_forker || !global_forker->metrics )
+		return NULL;
+
+	const prefork_metrics* metrics = global_forker->metrics;
+	jsonObject* stats = jsonNewObjectType( JSON_HASH );
+
+	jsonObjectSetKey( stats, "appname", jsonNewObject( global_forker->appname ));
+	jsonObjectSetKey( stats, "listener", jsonNewNumberObject( metrics->listener ));
+	jsonObjectSetKey( stats, "min_children",
+		jsonNewNumberObject( global_forker->min_children ));
+	jsonObjectSetKey( stats, "max_children",
+		jsonNewNumberObject( global_forker->max_children ));
+	jsonObjectSetKey( stats, "requests", jsonNewNumberObject( metrics->requests ));
+	jsonObjectSetKey( stats, "dropped", jsonNewNumberObject( metrics->dropped ));
+	jsonObjectSetKey( stats, "spawned", jsonNewNumberObject( metrics->spawned ));
+	jsonObjectSetKey( stats, "killed", jsonNewNumberObject( metrics->killed ));
+	jsonObjectSetKey( stats, "spawned_ahead", jsonNewNumberObject( metrics->spawned_ahead ));
+	jsonObjectSetKey( stats, "reaped_idle", jsonNewNumberObject( metrics->reaped_idle ));
+	jsonObjectSetKey( stats, "arrival_rate", jsonNewNumberObject( metrics->arrival_rate ));
+	jsonObjectSetKey( stats, "service_time", jsonNewNumberObject( metrics->service_time ));
+	jsonObjectSetKey( stats, "busy_ratio", jsonNewNumberObject( metrics->busy_ratio ));
+	jsonObjectSetKey( stats, "backlog_depth", jsonNewNumberObject( metrics->backlog_depth ));
+	jsonObjectSetKey( stats, "backlog_max", jsonNewNumberObject( metrics->backlog_max ));
+	jsonObjectSetKey( stats, "backlog_limit",
+		jsonNewNumberObject( global_forker->max_backlog_queue ));
+
+	// Time in backlog, keyed on each bucket's upper bound in milliseconds
+	jsonObject* waits = jsonNewObjectType( JSON_HASH );
+	int i;
+	for( i = 0; i < BACKLOG_WAIT_BUCKETS; ++i ) {
+		char key[ 16 ];
+		if( i < BACKLOG_WAIT_BUCKETS - 1 )
+			snprintf( key, sizeof( key ), "%d", 1 << i );
+		else
+			strcpy( key, "inf" );
+		jsonObjectSetKey( waits, key, jsonNewNumberObject( metrics->backlog_wait[ i ] ));
+	}
+	jsonObjectSetKey( stats, "backlog_wait_ms", waits );
+
+	int children = 0;
+	int busy = 0;
+	jsonObject* drones = jsonNewObjectType( JSON_ARRAY );
+	for( i = 0; i < metrics->slots; ++i ) {
+		const prefork_drone_metrics* drone = metrics->drones + i;
+		if( 0 == drone->pid )
+			continue;
+
+		++children;
+		if( drone->busy )
+			++busy;
+
+		// A busy child's latest request isn't in its service total yet
+		unsigned long serviced = drone->requests - ( drone->busy ? 1 : 0 );
+		jsonObject* d = jsonNewObjectType( JSON_HASH );
+		jsonObjectSetKey( d, "pid", jsonNewNumberObject( drone->pid ));
+		jsonObjectSetKey( d, "busy", jsonNewBoolObject( drone->busy ));
+		jsonObjectSetKey( d, "requests", jsonNewNumberObject( drone->requests ));
+		jsonObjectSetKey( d, "service_avg", jsonNewNumberObject(
+			serviced ? drone->service_total / serviced : 0.0 ));
+		jsonObjectSetKey( d, "service_max", jsonNewNumberObject( drone->service_max ));
+		jsonObjectPush( drones, d );
+	}
+	jsonObjectSetKey( stats, "children", jsonNewNumberObject( children ));
+	jsonObjectSetKey( stats, "busy", jsonNewNumberObject( busy ));
+	jsonObjectSetKey( stats, "drones", drones );
+
+	return stats;
+}
+
+/**
+	@brief Describe the listener's load for the routers.
+	@param forker Pointer to the prefork_simple, or NULL.
+	@return A newly allocated JSON string, or NULL if @a forker is NULL.
+
+	The hint gives our capacity (max_children), how many children are busy, how many
+	requests are waiting for one, and the smoothed service time in seconds.  The caller
+	is responsible for freeing it.
+*/
+static char* prefork_load_hint( const prefork_simple* forker ) {
+	if( !forker || !forker->metrics )
+		return NULL;
+
+	const prefork_metrics* metrics = forker->metrics;
+	int busy = 0;
+	int i;
+	for( i = 0; i < metrics->slots; ++i )
+		if( metrics->drones[ i ].pid && metrics->drones[ i ].busy )
+			++busy;
+
+	return va_list_to_string(
+		"{\"capacity\":%d,\"busy\":%d,\"backlog\":%d,\"latency\":%.6f}",
+		forker->max_children, busy, metrics->backlog_depth, metrics->service_time );
+}
+
+/**
+	@brief Tell the routers how busy we are, if it's time and anything has changed.
+	@param forker Pointer to the prefork_simple that manages the child processes.
+
+	Report at most once every load_report_interval seconds, and only when the number of
+	busy children plus the backlog differs from what we last reported.
+*/
+static void prefork_report_load( prefork_simple* forker ) {
+	if( ! forker->load_report_interval )
+		return;
+
+	double now = prefork_clock();
+	if( now - forker->last_load_report < forker->load_report_interval )
+		return;
+
+	check_children( forker, 0 );
+	int load = forker->current_num_children - forker->retiring - prefork_count_idle( forker );
+	if( load < 0 )
+		load = 0;
+	load += forker->metrics->backlog_depth;
+
+	forker->last_load_report = now;
+	if( load == forker->reported_load )
+		return;
+
+	forker->reported_load = load;
+	osrf_prefork_notify_routers( forker->appname, "load" );
+}
+
+/**
+	@brief Write the listener's metrics to the log.
+*/
+static void prefork_log_stats( void ) {
+	jsonObject* stats = osrf_prefork_stats();
+	if( stats ) {
+		char* json = jsonObjectToJSON( stats );
+		osrfLogInfo( OSRF_LOG_MARK, "Listener stats: %s", json );
+		free( json );
+		jsonObjectFree( stats );
+	}
+}
+
 /**
 	@brief Read transport_messages and dispatch them to child processes for servicing.
 	@param forker Pointer to the prefork_simple that manages the child processes.
@@ -851,7 +1483,7 @@ static void reap_children( prefork_simple* forker ) {
 	For each usable transport_message received: look for an idle child to service it.  If
 	no idle children are available, either spawn a new one or, if we've already spawned the
 	maximum number of children, wait for one to become available.  Once a child is available
-	by whatever means, write an XML version of the input message, to a pipe designated for
+	by whatever means, write the input message, packed or as XML, to a pipe designated for
 	use by that child.
 */
 static void prefork_run( prefork_simple* forker ) {
@@ -871,18 +1503,37 @@ static void prefork_run( prefork_simple* forker ) {
 	transport_message* backlog_queue_tail = NULL;
 	int backlog_queue_size = 0;
 
+	// When each queued message arrived, in a circular array parallel to the queue
+	int backlog_slots = forker->max_backlog_queue + 1;
+	double* backlog_times = safe_malloc( backlog_slots * sizeof( double ));
+	int backlog_times_head = 0;
+
+	prefork_metrics* metrics = forker->metrics;
+
 	while( 1 ) {
 
 		if( forker->first_child == NULL && forker->idle_list == NULL ) {/* no more children */
 			osrfLogWarning( OSRF_LOG_MARK, "No more children..." );
+			free( backlog_times );
 			return;
 		}
 
+		if( stats_wanted ) {
+			stats_wanted = 0;
+			prefork_log_stats();
+		}
+
+		prefork_scale( forker );
+		prefork_report_load( forker );
+
 		int received_from_network = 0;
 		if ( backlog_queue_size == 0 ) {
-			// Wait indefinitely for an input message
+			// Wait for an input message -- indefinitely, unless we have idle
+			// children to reap or load to report, in which case wake up now
+			// and then to look
 			osrfLogDebug( OSRF_LOG_MARK, "Forker going into wait for data..." );
-			cur_msg = client_recv( forker->connection, -1 );
+			cur_msg = client_recv( forker->connection,
+				( forker->child_idle_timeout || forker->load_report_interval ) ? 1 : -1 );
 			received_from_network = 1;
 		} else {
 			// We have queued messages, which means all of our drones
@@ -903,6 +1554,8 @@ static void prefork_run( prefork_simple* forker ) {
 				continue;
 			}
 
+			++forker->arrivals;
+
 			if (cur_msg->error_type) {
 				osrfLogInfo(OSRF_LOG_MARK,
 					"Listener received an XMPP error message.  "
@@ -912,13 +1565,15 @@ static void prefork_run( prefork_simple* forker ) {
 				continue;
 			}
 
-			message_prepare_xml( cur_msg );
-			const char* msg_data = cur_msg->msg_xml;
-			if( ! msg_data || ! *msg_data ) {
-				osrfLogWarning( OSRF_LOG_MARK, "Received % message from %s, thread %",
-					(msg_data ? "empty" : "NULL"), cur_msg->sender, cur_msg->thread );
-				message_free( cur_msg );
-				continue;       // Message not usable; go on to the next one.
+			if( ! forker->packed_pipe ) {
+				message_prepare_xml( cur_msg );
+				const char* msg_data = cur_msg->msg_xml;
+				if( ! msg_data || ! *msg_data ) {
+					osrfLogWarning( OSRF_LOG_MARK, "Received % message from %s, thread %",
+						(msg_data ? "empty" : "NULL"), cur_msg->sender, cur_msg->thread );
+					message_free( cur_msg );
+					continue;       // Message not usable; go on to the next one.
+				}
 			}
 
 			// stick message onto queue
@@ -944,13 +1599,17 @@ static void prefork_run( prefork_simple* forker ) {
 					client_send_message( client, tresponse );
 					message_free( tresponse );
 					message_free(cur_msg);
+					++metrics->dropped;
 					continue;
 				}
 				backlog_queue_tail->next = cur_msg;
 				backlog_queue_tail = cur_msg;
 				osrfLogWarning( OSRF_LOG_MARK, "Adding message to non-empty backlog queue." );
 			}
+			backlog_times[ ( backlog_times_head + backlog_queue_size ) % backlog_slots ] =
+				prefork_clock();
 			backlog_queue_size++;
+			prefork_metrics_backlog_depth( metrics, backlog_queue_size );
 		}
 
 		if (backlog_queue_size == 0) {
@@ -1001,14 +1660,13 @@ static void prefork_run( prefork_simple* forker ) {
 				osrfLogInternal( OSRF_LOG_MARK, "Writing to child fd %d",
 					cur_child->write_data_fd );
 
-				const char* msg_data = cur_msg->msg_xml;
-				int written = write( cur_child->write_data_fd, msg_data, strlen( msg_data ) + 1 );
-				if( written < 0 ) {
+				if( prefork_send_request( forker, cur_child, cur_msg ) < 0 ) {
 					// This child appears to be dead or unusable.  Discard it.
 					osrfLogWarning( OSRF_LOG_MARK, "Write returned error %d: %s",
 						errno, strerror( errno ));
 					kill( cur_child->pid, SIGKILL );
 					del_prefork_child( forker, cur_child->pid );
+					++metrics->killed;
 					continue;
 				}
 
@@ -1036,15 +1694,13 @@ static void prefork_run( prefork_simple* forker ) {
 						osrfLogDebug( OSRF_LOG_MARK, "Writing to new child fd %d : pid %d",
 							new_child->write_data_fd, new_child->pid );
 
-						const char* msg_data = cur_msg->msg_xml;
-						int written = write(
-							new_child->write_data_fd, msg_data, strlen( msg_data ) + 1 );
-						if( written < 0 ) {
+						if( prefork_send_request( forker, new_child, cur_msg ) < 0 ) {
 							// This child appears to be dead or unusable.  Discard it.
 							osrfLogWarning( OSRF_LOG_MARK, "Write returned error %d: %s",
 								errno, strerror( errno ));
-							kill( cur_child->pid, SIGKILL );
-							del_prefork_child( forker, cur_child->pid );
+							kill( new_child->pid, SIGKILL );
+							del_prefork_child( forker, new_child->pid );
+							++metrics->killed;
 						} else {
 							add_prefork_child( forker, new_child );
 							honored = 1;
@@ -1073,12 +1729,83 @@ static void prefork_run( prefork_simple* forker ) {
 			backlog_queue_size--;
 			cur_msg->next = NULL;
 			message_free( cur_msg );
+
+			prefork_metrics_backlog_wait( metrics,
+				prefork_clock() - backlog_times[ backlog_times_head ] );
+			backlog_times_head = ( backlog_times_head + 1 ) % backlog_slots;
+			prefork_metrics_backlog_depth( metrics, backlog_queue_size );
+			++metrics->requests;
 		}
 
 	} /* end top level listen loop */
 }
 
 
+/**
+	@brief Pass a request to a child process.
+	@param forker Pointer to the prefork_simple that owns the child.
+	@param child Pointer to the prefork_child that is to service the request.
+	@param msg Pointer to the request.
+	@return 0 if successful, or -1 if unable to write to the child's pipe.
+
+	Write the request either packed, or as a nul-terminated XML stanza, depending on
+	how the application is configured.  If the child has a request ring with room for
+	the packed request, put it there instead and ring the doorbell.
+*/
+static int prefork_send_request( prefork_simple* forker, prefork_child* child,
+		transport_message* msg ) {
+
+	char* packed = NULL;
+	const char* data;
+	size_t size;
+
+	child->dispatched = prefork_clock();
+	if( child->drone ) {
+		child->drone->busy = 1;
+		++child->drone->requests;
+	}
+
+	if( forker->packed_pipe ) {
+		packed = message_pack( msg, &size );
+		data = packed;
+
+		// Use the ring if there's room; otherwise fall back to the pipe
+		if( child->ring && 0 == prefork_ring_put( child->ring, data, size )) {
+			uint64_t one = 1;
+			int rc = 0;
+			while( write( child->request_efd, &one, sizeof( one )) < 0 ) {
+				if( EINTR != errno ) {
+					rc = -1;
+					break;
+				}
+			}
+			free( packed );
+			return rc;
+		}
+	} else {
+		message_prepare_xml( msg );
+		data = msg->msg_xml;
+		size = strlen( data ) + 1;
+	}
+
+	// Loop in case the write is interrupted by a signal
+	int rc = 0;
+	while( size > 0 ) {
+		ssize_t written = write( child->write_data_fd, data, size );
+		if( written < 0 ) {
+			if( EINTR == errno )
+				continue;
+			rc = -1;
+			break;
+		}
+		data += written;
+		size -= written;
+	}
+
+	free( packed );
+	return rc;
+}
+
 /**
 	@brief See if any children have become available.
 	@param forker Pointer to the prefork_simple that owns the children.
@@ -1169,7 +1896,8 @@ static int check_children( prefork_simple* forker, int forever ) {
 			}
 			else {
 				buf[n] = '\0';
-				osrfLogDebug( OSRF_LOG_MARK,  "Read %d bytes from status buffer: %s", n, buf );
+				osrfLogDebug( OSRF_LOG_MARK,  "Read %d bytes from status buffer: %s", n,
+					cur_child->ring ? "(eventfd)" : buf );
 			}
 
 
@@ -1199,6 +1927,7 @@ static int check_children( prefork_simple* forker, int forever ) {
 
                     free(hup_child); // clean up the thin clone
                     kill(hup_pid, SIGKILL);
+                    ++forker->metrics->killed;
                     hup_cleanup = 1;
                     break;
                 }
@@ -1207,7 +1936,9 @@ static int check_children( prefork_simple* forker, int forever ) {
                 hup_child = hup_child->next;
             }
 
-            if (!hup_cleanup) {
+            // A retiring child's pipe looks ready only because it has exited.
+            // Leave the child in the active list for reap_children().
+            if (!hup_cleanup && !cur_child->retiring) {
 
                 // Remove the child from the active list
                 if( forker->first_child == cur_child ) {
@@ -1225,6 +1956,26 @@ static int check_children( prefork_simple* forker, int forever ) {
                 cur_child->prev = NULL;
                 cur_child->next = forker->idle_list;
                 forker->idle_list = cur_child;
+
+                // Fold the time it took into our estimate of the service time
+                cur_child->idle_since = prefork_clock();
+                if( cur_child->dispatched > 0.0 ) {
+                    prefork_metrics* metrics = forker->metrics;
+                    double elapsed = cur_child->idle_since - cur_child->dispatched;
+                    if( metrics->service_time > 0.0 )
+                        metrics->service_time += ( elapsed - metrics->service_time ) / 8;
+                    else
+                        metrics->service_time = elapsed;
+                    cur_child->dispatched = 0.0;
+
+                    prefork_drone_metrics* drone = cur_child->drone;
+                    if( drone ) {
+                        drone->busy = 0;
+                        drone->service_total += elapsed;
+                        if( elapsed > drone->service_max )
+                            drone->service_max = elapsed;
+                    }
+                }
             }
         }
 
@@ -1250,49 +2001,27 @@ static int check_children( prefork_simple* forker, int forever ) {
 */
 static void prefork_child_wait( prefork_child* child ) {
 
-	int i,n;
+	int i;
 	growing_buffer* gbuf = buffer_init( READ_BUFSIZE );
-	char buf[READ_BUFSIZE];
 
 	for( i = 0; i < child->max_requests; i++ ) {
 
-		n = -1;
-		int gotdata = 0;    // boolean; set to true if we get data
-		clr_fl( child->read_data_fd, O_NONBLOCK );
-
-		// Read a request from the parent, via a pipe, into a growing_buffer.
-		while( (n = read( child->read_data_fd, buf, READ_BUFSIZE-1 )) > 0 ) {
-			buf[n] = '\0';
-			osrfLogDebug( OSRF_LOG_MARK, "Prefork child read %d bytes of data", n );
-			if( !gotdata ) {
-				set_fl( child->read_data_fd, O_NONBLOCK );
-				gotdata = 1;
-			}
-			buffer_add_n( gbuf, buf, n );
-		}
+		transport_message* msg = NULL;
+		int n = prefork_child_wait_request( child, gbuf, &msg );
 
-		if( errno == EAGAIN )
-			n = 0;
-
-		if( errno == EPIPE ) {
+		if( 0 == n ) {
 			osrfLogDebug( OSRF_LOG_MARK, "C child attempted read on broken pipe, exiting..." );
 			break;
-		}
-
-		int terminate_now = 0;     // Boolean
-
-		if( n < 0 ) {
+		} else if( n < 0 ) {
 			osrfLogWarning( OSRF_LOG_MARK,
 				"Prefork child read returned error with errno %d", errno );
 			break;
-
-		} else if( gotdata ) {
-			// Process the request
-			osrfLogDebug( OSRF_LOG_MARK, "Prefork child got a request.. processing.." );
-			terminate_now = prefork_child_process_request( child, gbuf->buf );
-			buffer_reset( gbuf );
 		}
 
+		// Process the request
+		osrfLogDebug( OSRF_LOG_MARK, "Prefork child got a request.. processing.." );
+		int terminate_now = prefork_child_process_request( child, msg );
+
 		if( terminate_now ) {
 			// We're terminating prematurely -- presumably due to a fatal error condition.
 			osrfLogWarning( OSRF_LOG_MARK, "Prefork child terminating abruptly" );
@@ -1301,9 +2030,10 @@ static void prefork_child_wait( prefork_child* child ) {
 
 		if( i < child->max_requests - 1 ) {
 			// Report back to the parent for another request.
-			size_t msg_len = 9;
-			ssize_t len = write(
-				child->write_status_fd, "available" /*less than 64 bytes*/, msg_len );
+			uint64_t one = 1;
+			size_t msg_len = child->ring ? sizeof( one ) : 9;
+			ssize_t len = write( child->write_status_fd,
+				child->ring ? (const void*) &one : "available" /*less than 64 bytes*/, msg_len );
 			if( len != msg_len ) {
 				osrfLogError( OSRF_LOG_MARK,
 					"Drone terminating: unable to notify listener of availability: %s",
@@ -1322,6 +2052,232 @@ static void prefork_child_wait( prefork_child* child ) {
 	osrf_prefork_child_exit( child );
 }
 
+/**
+	@brief Wait for the parent to send a request, and construct a transport_message from it.
+	@param child Pointer to the prefork_child representing the current process.
+	@param gbuf Pointer to an empty growing_buffer for use as a work area.
+	@param msg Pointer through which to return the request (NULL if it was unusable).
+	@return 1 if a request arrived, 0 if the parent closed the pipe, or -1 upon error.
+
+	Called only by child process.
+
+	A request may arrive through the pipe, or, if we have one, through the request ring.
+	In the latter case we wait on both, so that we still notice if the parent goes away.
+*/
+static int prefork_child_wait_request( prefork_child* child, growing_buffer* gbuf,
+		transport_message** msg ) {
+
+	if( child->ring ) {
+		struct pollfd fds[2] = {
+			{ child->request_efd, POLLIN, 0 },
+			{ child->read_data_fd, POLLIN, 0 }
+		};
+
+		while( poll( fds, 2, -1 ) < 0 ) {
+			if( EINTR != errno )
+				return -1;
+		}
+
+		if( fds[0].revents & POLLIN ) {
+			uint64_t count;
+			if( read( child->request_efd, &count, sizeof( count )) != sizeof( count ))
+				return -1;
+			*msg = prefork_ring_get( child->ring );
+			return 1;
+		}
+	}
+
+	int n = prefork_child_read_request( child, gbuf );
+	if( 1 == n ) {
+		// Construct the message, from whichever form the parent used
+		if( MESSAGE_PACKED_MAGIC == *gbuf->buf )
+			*msg = new_message_from_packed( gbuf->buf, gbuf->n_used );
+		else
+			*msg = new_message_from_xml( gbuf->buf );
+		buffer_reset( gbuf );
+	}
+	return n;
+}
+
+/**
+	@brief Read a request from the parent.
+	@param child Pointer to the prefork_child representing the current process.
+	@param gbuf Pointer to an empty growing_buffer to receive the request.
+	@return 1 if a request was read, 0 if the parent closed the pipe, or -1 upon error.
+
+	Called only by child process.
+
+	Wait indefinitely for a request.  A packed request announces its size in its header,
+	so we read exactly that much: once we have the header, we make room for the whole
+	request at once, and read the rest of it straight into the buffer, as much at a time
+	as the pipe will give us.  An XML request ends with a nul byte.  Either way, the parent
+	sends nothing more until we report that we're available again.
+*/
+static int prefork_child_read_request( prefork_child* child, growing_buffer* gbuf ) {
+
+	char buf[READ_BUFSIZE];
+	size_t size = 0;    // size of a packed request, once we've seen its header
+
+	clr_fl( child->read_data_fd, O_NONBLOCK );
+
+	while( 1 ) {
+		char* dest = buf;
+		size_t want = sizeof(buf);   // how much to ask for on this read
+		if( size ) {
+			dest = gbuf->buf + gbuf->n_used;
+			want = size - gbuf->n_used;
+		} else if( gbuf->n_used && MESSAGE_PACKED_MAGIC == *gbuf->buf )
+			want = MESSAGE_PACKED_HEADER_SIZE - gbuf->n_used;
+
+		ssize_t n = read( child->read_data_fd, dest, want );
+		if( n < 0 ) {
+			if( EINTR == errno )
+				continue;
+			return -1;
+		} else if( 0 == n ) {
+			return gbuf->n_used ? -1 : 0;   // a partial request is an error
+		}
+
+		osrfLogDebug( OSRF_LOG_MARK, "Prefork child read %ld bytes of data", (long) n );
+		if( size ) {
+			gbuf->n_used += n;
+			gbuf->buf[ gbuf->n_used ] = '\0';
+		} else if( buffer_add_n( gbuf, buf, n ) < 0 ) {
+			// The growing_buffer has freed itself, so we can't carry on
+			osrfLogError( OSRF_LOG_MARK, "Drone terminating: request too large" );
+			osrf_prefork_child_exit( child );
+		}
+
+		if( MESSAGE_PACKED_MAGIC == *gbuf->buf ) {
+			if( gbuf->n_used < MESSAGE_PACKED_HEADER_SIZE )
+				continue;
+			if( ! size ) {
+				size = message_packed_size( gbuf->buf );
+				if( gbuf->n_used < size && buffer_reserve( gbuf, size ) < 0 ) {
+					osrfLogError( OSRF_LOG_MARK, "Drone terminating: request too large" );
+					osrf_prefork_child_exit( child );
+				}
+			}
+			if( gbuf->n_used >= size )
+				return 1;
+		} else if( memchr( buf, '\0', n ) ) {
+			return 1;
+		}
+	}
+}
+
+/**
+	@brief Give a prefork_child a request ring and a doorbell.
+	@param child Pointer to the prefork_child.
+	@param size Capacity of the ring, in bytes: a multiple of 8.
+	@return 0 if successful, or -1 if not.
+
+	Called only by the parent, before forking.  The ring is an anonymous shared mapping, so
+	the child inherits it.  The doorbell is an eventfd in semaphore mode, so that each
+	read accounts for exactly one request.
+*/
+static int prefork_child_add_ring( prefork_child* child, size_t size ) {
+
+	prefork_ring* ring = mmap( NULL, sizeof( prefork_ring ) + size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if( MAP_FAILED == ring ) {
+		osrfLogError( OSRF_LOG_MARK, "Unable to map request ring: %s", strerror( errno ));
+		return -1;
+	}
+
+	int efd = eventfd( 0, EFD_SEMAPHORE );
+	if( efd < 0 ) {
+		osrfLogError( OSRF_LOG_MARK, "eventfd making error: %s", strerror( errno ));
+		munmap( ring, sizeof( prefork_ring ) + size );
+		return -1;
+	}
+
+	ring->head = 0;
+	ring->tail = 0;
+	ring->size = size;
+	child->ring = ring;
+	child->request_efd = efd;
+	return 0;
+}
+
+/**
+	@brief Put a packed request into a request ring.
+	@param ring Pointer to the ring.
+	@param data Pointer to the packed request.
+	@param size Size of the packed request.
+	@return 0 if successful, or 1 if there isn't room for it.
+
+	Called only by the parent.
+*/
+static int prefork_ring_put( prefork_ring* ring, const char* data, size_t size ) {
+
+	if( size > UINT32_MAX - 8 )
+		return 1;
+
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+	size_t need = RING_RECORD_SIZE( size );
+
+	if( ( head - tail ) + need > ring->size )
+		return 1;
+
+	size_t offset = head % ring->size;
+	uint32_t len = size;
+	memcpy( ring->data + offset, &len, sizeof( len ));
+	offset += sizeof( len );
+
+	// If the message runs past the end of the ring, the rest goes at the beginning
+	size_t first = ring->size - offset;
+	if( size <= first )
+		memcpy( ring->data + offset, data, size );
+	else {
+		memcpy( ring->data + offset, data, first );
+		memcpy( ring->data, data + first, size - first );
+	}
+
+	__atomic_store_n( &ring->head, head + need, __ATOMIC_RELEASE );
+	return 0;
+}
+
+/**
+	@brief Take the next request out of a request ring.
+	@param ring Pointer to the ring.
+	@return Pointer to a newly created transport_message, or NULL if the ring is empty or
+		the request is malformed.
+
+	Called only by the child.  The request is normally unpacked where it lies, without
+	copying it out of the ring first.  Only one that wraps around the end of the ring
+	has to be pieced together in a buffer.
+*/
+static transport_message* prefork_ring_get( prefork_ring* ring ) {
+
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+	transport_message* msg = NULL;
+
+	if( tail != head ) {
+		size_t offset = tail % ring->size;
+		uint32_t len;
+		memcpy( &len, ring->data + offset, sizeof( len ));
+		offset += sizeof( len );
+
+		size_t first = ring->size - offset;
+		if( len <= first )
+			msg = new_message_from_packed( ring->data + offset, len );
+		else {
+			char* buf = safe_malloc( len );
+			memcpy( buf, ring->data + offset, first );
+			memcpy( buf + first, ring->data, len - first );
+			msg = new_message_from_packed( buf, len );
+			free( buf );
+		}
+		tail += RING_RECORD_SIZE( len );
+	}
+
+	__atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+	return msg;
+}
+
 /**
 	@brief Add a prefork_child to the end of the active list.
 	@param forker Pointer to the prefork_simple that owns the list.
@@ -1404,8 +2360,11 @@ static void del_prefork_child( prefork_simple* forker, pid_t pid ) {
 	}
 
 	// If we found the node, destroy it.
-	if( cur_child )
+	if( cur_child ) {
+		if( cur_child->retiring )
+			--forker->retiring;
 		prefork_child_free( forker, cur_child );
+	}
 }
 
 /**
@@ -1438,9 +2397,15 @@ static prefork_child* prefork_child_init( prefork_simple* forker,
 	child->write_data_fd    = write_data_fd;
 	child->read_status_fd   = read_status_fd;
 	child->write_status_fd  = write_status_fd;
+	child->ring             = NULL;
+	child->request_efd      = -1;
+	child->dispatched       = 0.0;
+	child->idle_since       = prefork_clock();
+	child->drone            = NULL;
 	child->max_requests     = forker->max_requests;
 	child->appname          = forker->appname;  // We don't make a separate copy
 	child->keepalive        = forker->keepalive;
+	child->retiring         = 0;
 	child->next             = NULL;
 	child->prev             = NULL;
 
@@ -1514,6 +2479,11 @@ static void prefork_clear( prefork_simple* prefork, bool graceful ) {
 
 	free( prefork->appname );
 	prefork->appname = NULL;
+
+	if( prefork->metrics ) {
+		munmap( prefork->metrics, prefork->metrics_size );
+		prefork->metrics = NULL;
+	}
 }
 
 /**
@@ -1525,7 +2495,20 @@ static void prefork_child_free( prefork_simple* forker, prefork_child* child ) {
 	close( child->read_data_fd );
 	close( child->write_data_fd );
 	close( child->read_status_fd );
-	close( child->write_status_fd );
+	if( child->write_status_fd != child->read_status_fd )
+		close( child->write_status_fd );
+
+	if( child->ring ) {
+		close( child->request_efd );
+		munmap( child->ring, sizeof( prefork_ring ) + child->ring->size );
+		child->ring = NULL;
+		child->request_efd = -1;
+	}
+
+	if( child->drone ) {
+		memset( child->drone, 0, sizeof( prefork_drone_metrics ));
+		child->drone = NULL;
+	}
 
 	// Stick the prefork_child in a free list for potential reuse.  This is a
 	// non-circular, singly linked list.
@@ -20,6 +20,19 @@ static void _do_server( osrfAppSession*, osrfMessage* );
 	@param msg_received A pointer through which to report whether a message was received.
 	@return 0 upon success (even if a timeout occurs), or -1 upon failure.
 
+	A wrapper for osrf_stack_process_ms(), for a timeout in whole seconds.
+*/
+int osrf_stack_process( transport_client* client, int timeout, int* msg_received ) {
+	return osrf_stack_process_ms( client, timeout_seconds_to_millis( timeout ), msg_received );
+}
+
+/**
+	@brief Read and process available transport_messages for a transport_client.
+	@param client Pointer to the transport_client whose socket is to be read.
+	@param timeout_ms How many milliseconds to wait for the first message.
+	@param msg_received A pointer through which to report whether a message was received.
+	@return 0 upon success (even if a timeout occurs), or -1 upon failure.
+
 	Read and process all available transport_messages from the socket of the specified
 	transport_client.  Pass each one through osrf_stack_transport().
 
@@ -33,17 +46,17 @@ static void _do_server( osrfAppSession*, osrfMessage* );
 	if you don't.  A timeout is not treated as an error; it just means you must set that
 	boolean to false.
 */
-int osrf_stack_process( transport_client* client, int timeout, int* msg_received ) {
+int osrf_stack_process_ms( transport_client* client, int timeout_ms, int* msg_received ) {
 	if( !client ) return -1;
 	transport_message* msg = NULL;
 	if(msg_received) *msg_received = 0;
 
 	// Loop through the available input messages
-	while( (msg = client_recv( client, timeout )) ) {
+	while( (msg = client_recv_ms( client, timeout_ms )) ) {
 		if(msg_received) *msg_received = 1;
 		osrfLogDebug( OSRF_LOG_MARK, "Received message from transport code from %s", msg->sender );
 		osrf_stack_transport_handler( msg, NULL );
-		timeout = 0;
+		timeout_ms = 0;
 	}
 
 	if( client->error ) {
@@ -115,10 +128,27 @@ struct osrf_app_session_struct* osrf_stack_transport_handler( transport_message*
 		osrfLogDebug( OSRF_LOG_MARK, "Session [%s] found or built", session->session_id );
 
 	osrf_app_session_set_remote( session, msg->sender );
+
+	/* A raw chunk of a result isn't an array of osrfMessages.  It goes straight
+	   to the request it answers. */
+	if( osrfMessageIsRawChunk( msg->body ) ) {
+		if( session->type == OSRF_SESSION_CLIENT && !msg->is_error )
+			osrf_app_session_push_raw_chunk( session, msg->body );
+		else
+			osrfLogWarning( OSRF_LOG_MARK, "Dropping a raw chunk that isn't for a client" );
+		message_free( msg );
+		return session;
+	}
+
 	osrfMessage* arr[OSRF_MAX_MSGS_PER_PACKET];
 
-	/* Convert the message body into one or more osrfMessages */
-	int num_msgs = osrf_message_deserialize(msg->body, arr, OSRF_MAX_MSGS_PER_PACKET);
+	/* Convert the message body into one or more osrfMessages.  If the body
+	   was long, the transport_session may have parsed it already. */
+	int num_msgs;
+	if( msg->body_json )
+		num_msgs = osrfMessageDeserializeJSON( msg->body_json, arr, OSRF_MAX_MSGS_PER_PACKET );
+	else
+		num_msgs = osrf_message_deserialize(msg->body, arr, OSRF_MAX_MSGS_PER_PACKET);
 
 	osrfLogDebug( OSRF_LOG_MARK, "We received %d messages from %s", num_msgs, msg->sender );
 
@@ -279,6 +309,14 @@ static void _do_server( osrfAppSession* session, osrfMessage* msg ) {
 
 	osrfLogDebug( OSRF_LOG_MARK, "Message has locale %s and tz %s", session->session_locale, session->session_tz );
 
+	// Once the client says it can read CBOR, answer in CBOR for the rest of the session
+	if( msg->accept_cbor )
+		session->peer_accepts_cbor = 1;
+
+	// Likewise for raw chunks
+	if( msg->accept_raw_chunks )
+		session->peer_accepts_raw_chunks = 1;
+
 	switch( msg->m_type ) {
 
 		case STATUS:
@@ -454,6 +454,24 @@ int osrfSystemBootstrapClientResc( const char* config_file,
 		domain, iport, unixpath ? unixpath : "(none)" );
 	transport_client* client = client_init( domain, iport, unixpath, 0 );
 
+	// If so configured, parse long message bodies while they arrive.  That pays only in
+	// a process that parses the bodies it receives, so it's off unless asked for.
+	char* body_parse = osrfConfigGetValue( NULL, "/body_parse_threshold" );
+	if( body_parse )
+		session_set_body_parsing( client->session, strtoul( body_parse, NULL, 10 ));
+	free( body_parse );
+
+	// Offer to read message bodies as CBOR, and send them that way when asked
+	char* cbor = osrfConfigGetValue( NULL, "/cbor_bodies" );
+	osrfAppSessionSetCBOR( cbor && ( !strcasecmp( cbor, "true" ) || atoi( cbor ) > 0 ) );
+	free( cbor );
+
+	// Likewise for raw chunks of chunked results
+	char* raw_chunks = osrfConfigGetValue( NULL, "/raw_chunks" );
+	osrfAppSessionSetRawChunks( raw_chunks
+		&& ( !strcasecmp( raw_chunks, "true" ) || atoi( raw_chunks ) > 0 ) );
+	free( raw_chunks );
+
 	char host[HOST_NAME_MAX + 1] = "";
 	gethostname(host, sizeof(host) );
 	host[HOST_NAME_MAX] = '\0';
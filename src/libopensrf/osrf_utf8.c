@@ -345,11 +345,22 @@ typedef enum {
  pairs  where needed.  Append the result to a growing_buffer.
 */
 int buffer_append_utf8( growing_buffer* buf, const char* string ) {
+	return buffer_append_utf8_xml( buf, string, NULL );
+}
+
+/**
+ Same as buffer_append_utf8(), but also add to *xml_extra (unless
+ xml_extra is NULL) what osrfXmlEscapingLength() would report for
+ the text appended.  That spares a second pass over the output to
+ find out how much it will grow when wrapped in XML.
+*/
+int buffer_append_utf8_xml( growing_buffer* buf, const char* string, size_t* xml_extra ) {
 	utf8_state state = S_BEGIN;
 	unsigned long utf8_char = 0;
 	const unsigned char* s = (unsigned char *) string;
 	int i = 0;
 	int rc = 0;
+	size_t extra = 0;
 
 	do
 	{
@@ -362,8 +373,18 @@ int buffer_append_utf8( growing_buffer* buf, const char* string ) {
 						switch( s[i] )
 						{
 							case '"' :
+								extra += OSRF_XML_EXTRA_QUOTE;
 							case '\\' :
 								OSRF_BUFFER_ADD_CHAR( buf, '\\' );
+								OSRF_BUFFER_ADD_CHAR( buf, s[i] );
+								break;
+							case '<' :
+							case '>' :
+								extra += OSRF_XML_EXTRA_LT_GT;
+								OSRF_BUFFER_ADD_CHAR( buf, s[i] );
+								break;
+							case '&' :
+								extra += OSRF_XML_EXTRA_AMP;
 							default :
 								OSRF_BUFFER_ADD_CHAR( buf, s[i] );
 								break;
@@ -538,7 +559,9 @@ int buffer_append_utf8( growing_buffer* buf, const char* string ) {
 				break;
 		}
 	} while ( state != S_END );
-	
+
+	if( xml_extra )
+		*xml_extra += extra;
 	return rc;
 }
 
@@ -4,6 +4,8 @@
 */
 
 #include <opensrf/socket_bundle.h>
+#include <poll.h>
+#include <sys/epoll.h>
 
 #define LISTENER_SOCKET   1
 #define DATA_SOCKET       2
@@ -26,15 +28,33 @@ struct socket_node_struct {
 	int parent_id;      /**< For a socket created by accept() for a listener socket,
 	                        this is the listener socket we spawned from. */
 	struct socket_node_struct* next;  /**< Linkage pointer for linked list. */
+	struct socket_node_struct* prev;  /**< Back pointer, so that removal needn't search. */
+	int nonblocking;    /**< Boolean: true once we have set O_NONBLOCK on the socket. */
+	char* rbuf;         /**< Receive buffer, reused from one read to the next. */
+	size_t rbuf_size;   /**< Allocated size of rbuf. */
 };
 
-/** @brief Size of buffer used to read from the sockets */
-#define RBUFSIZE 1024
+/** @brief Initial size of the buffer used to read from a socket */
+#define RBUFSIZE 16384
+
+/** @brief Size beyond which a socket's receive buffer doesn't grow */
+#define RBUF_MAX_SIZE (4 * 1024 * 1024)
+
+/** @brief Minimum number of slots allocated for a socket_manager's node table. */
+#define SOCKET_TABLE_MIN_SIZE 64
+
+/** @brief Maximum number of events collected by a single call to epoll_wait(). */
+#define SOCKET_MAX_EVENTS 64
 
 static socket_node* _socket_add_node(socket_manager* mgr,
 		int endpoint, int addr_type, int sock_fd, int parent_id );
 static socket_node* socket_find_node(socket_manager* mgr, int sock_fd);
 static void socket_remove_node(socket_manager*, int sock_fd);
+static void socket_table_set(socket_manager* mgr, int sock_fd, socket_node* node);
+static int socket_epoll_sync(socket_manager* mgr);
+static int _socket_wait_all_select(socket_manager* mgr, int timeout_ms);
+static int _socket_wait_all_epoll(socket_manager* mgr, int timeout_ms);
+static void _socket_handle_activity(socket_manager* mgr, socket_node* node);
 static int _socket_send(int sock_fd, const char* data, int flags);
 static int _socket_handle_new_client(socket_manager* mgr, socket_node* node);
 static int _socket_handle_client_data(socket_manager* mgr, socket_node* node);
@@ -88,6 +108,10 @@ int main(int argc, char* argv[]) {
 	@return Pointer to the new socket_node.
 
 	If @a parent_id is negative, the new socket_node receives a parent_id of 0.
+
+	Besides linking the node into the list, enter it into the table indexed by file
+	descriptor, and, if the socket_manager already has an epoll instance, register the
+	socket with it.  (Otherwise the socket gets registered when the instance is created.)
 */
 static socket_node* _socket_add_node(socket_manager* mgr,
 		int endpoint, int addr_type, int sock_fd, int parent_id ) {
@@ -105,7 +129,22 @@ static socket_node* _socket_add_node(socket_manager* mgr,
 		new_node->parent_id = parent_id;
 
 	new_node->next			= mgr->socket;
+	new_node->prev			= NULL;
+	if(mgr->socket)
+		mgr->socket->prev	= new_node;
 	mgr->socket				= new_node;
+	socket_table_set(mgr, sock_fd, new_node);
+
+	if(mgr->backend == SOCKET_BACKEND_EPOLL && mgr->epoll_pid == getpid()) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = sock_fd;
+		if(epoll_ctl(mgr->epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev))
+			osrfLogWarning( OSRF_LOG_MARK, "Unable to add socket %d to epoll set: %s",
+				sock_fd, strerror(errno));
+	}
+
 	return new_node;
 }
 
@@ -448,32 +487,62 @@ int socket_open_unix_client(socket_manager* mgr, const char* sock_path) {
 
 
 /**
-	@brief Search a socket_manager's list for a socket node for a given file descriptor.
+	@brief Find the socket node for a given file descriptor.
 	@param mgr Pointer to the socket manager.
 	@param sock_fd The file descriptor to be sought.
 	@return A pointer to the socket_node if found; otherwise NULL.
 
-	Traverse a linked list owned by the socket_manager.
+	Look it up in the table, indexed by file descriptor, owned by the socket_manager.
 */
 static socket_node* socket_find_node(socket_manager* mgr, int sock_fd) {
-	if(mgr == NULL) return NULL;
-	socket_node* node = mgr->socket;
-	while(node) {
-		if(node->sock_fd == sock_fd)
-			return node;
-		node = node->next;
+	if(mgr == NULL || sock_fd < 0 || sock_fd >= mgr->node_table_size)
+		return NULL;
+	return mgr->node_table[sock_fd];
+}
+
+/**
+	@brief Store a socket_node pointer in a socket_manager's table of nodes.
+	@param mgr Pointer to the socket_manager.
+	@param sock_fd File descriptor, used as a subscript into the table.
+	@param node Pointer to the socket_node to be stored (may be NULL, to clear the slot).
+
+	Grow the table as needed.  Like an osrfList, it never shrinks.
+*/
+static void socket_table_set(socket_manager* mgr, int sock_fd, socket_node* node) {
+	if(mgr == NULL || sock_fd < 0) return;
+
+	if(sock_fd >= mgr->node_table_size) {
+		if(node == NULL)
+			return;     // Nothing to clear
+
+		int newsize = mgr->node_table_size ? mgr->node_table_size : SOCKET_TABLE_MIN_SIZE;
+		while(sock_fd >= newsize)
+			newsize *= 2;
+
+		socket_node** newtable;
+		OSRF_MALLOC(newtable, newsize * sizeof(socket_node*));
+		int i;
+		for(i = 0; i < mgr->node_table_size; i++)
+			newtable[i] = mgr->node_table[i];
+		free(mgr->node_table);
+		mgr->node_table = newtable;
+		mgr->node_table_size = newsize;
 	}
-	return NULL;
+
+	mgr->node_table[sock_fd] = node;
 }
 
-/* removes the node with the given sock_fd from the list and frees it */
 /**
 	@brief Remove a socket node for a given fd from a socket_manager's list.
 	@param mgr Pointer to the socket_manager.
 	@param sock_fd The file descriptor whose socket_node is to be removed.
 
-	This function does @em not close the socket.  It just removes a node from the list, and
-	frees it.  The disposition of the socket is the responsibility of the calling code.
+	This function does @em not close the socket.  It just removes a node from the list and
+	from the epoll set, if any, and frees it.  The disposition of the socket is the
+	responsibility of the calling code.
+
+	Since a forked child may still hold a copy of the socket, closing it doesn't necessarily
+	take it out of the epoll set.  So call this function before closing the socket, not after.
 */
 static void socket_remove_node(socket_manager* mgr, int sock_fd) {
 
@@ -481,29 +550,23 @@ static void socket_remove_node(socket_manager* mgr, int sock_fd) {
 
 	osrfLogDebug( OSRF_LOG_MARK, "removing socket %d", sock_fd);
 
-	socket_node* head = mgr->socket;
-	socket_node* tail = head;
-	if(head == NULL) return;
+	socket_node* node = socket_find_node(mgr, sock_fd);
+	if(node == NULL) return;
 
-	/* if removing the first node in the list */
-	if(head->sock_fd == sock_fd) {
-		mgr->socket = head->next;
-		free(head);
-		return;
-	}
+	if(node->prev)
+		node->prev->next = node->next;
+	else
+		mgr->socket = node->next;
+	if(node->next)
+		node->next->prev = node->prev;
 
-	head = head->next;
+	socket_table_set(mgr, sock_fd, NULL);
 
-	/* if removing any other node */
-	while(head) {
-		if(head->sock_fd == sock_fd) {
-			tail->next = head->next;
-			free(head);
-			return;
-		}
-		tail = head;
-		head = head->next;
-	}
+	if(mgr->epoll_pid == getpid())
+		epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, sock_fd, NULL);
+
+	free(node->rbuf);
+	free(node);
 }
 
 
@@ -547,19 +610,43 @@ int socket_send(int sock_fd, const char* data) {
 	@return 0 if successful, -1 if not.
 
 	This function is the final common pathway for all outgoing socket traffic.
+
+	Keep sending until the whole string is gone.  If the socket is in non-blocking mode and
+	its buffer fills up, wait until there's room for more.
 */
 static int _socket_send(int sock_fd, const char* data, int flags) {
 
 	signal(SIGPIPE, SIG_IGN); /* in case a unix socket was closed */
 
-	errno = 0;
-	size_t r = send( sock_fd, data, strlen(data), flags );
-	int local_errno = errno;
+	size_t len = strlen(data);
+	size_t sent = 0;
+
+	while( sent < len ) {
+		errno = 0;
+		ssize_t r = send( sock_fd, data + sent, len - sent, flags );
+		int local_errno = errno;
+
+		if( r == -1 ) {
+			if( EINTR == local_errno )
+				continue;
+
+			if( EAGAIN == local_errno || EWOULDBLOCK == local_errno ) {
+				struct pollfd pfd;
+				pfd.fd = sock_fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				if( poll( &pfd, 1, -1 ) >= 0 || EINTR == errno )
+					continue;
+				local_errno = errno;
+			}
 
-	if( r == -1 ) {
-		osrfLogWarning( OSRF_LOG_MARK, "_socket_send(): Error sending data with return %d", r );
-		osrfLogWarning( OSRF_LOG_MARK, "Last Sys Error: %s", strerror(local_errno));
-		return -1;
+			osrfLogWarning( OSRF_LOG_MARK, "_socket_send(): Error sending data with return %d",
+				(int) r );
+			osrfLogWarning( OSRF_LOG_MARK, "Last Sys Error: %s", strerror(local_errno));
+			return -1;
+		}
+
+		sent += r;
 	}
 
 	return 0;
@@ -582,29 +669,27 @@ static int _socket_send(int sock_fd, const char* data, int flags) {
 	@param usecs How long to wait, in microseconds, before timing out.
 	@return 0 if successful, -1 if not.
 
-	The socket may not accept all the data we want to give it.
+	The socket may not accept all the data we want to give it.  We wait with poll(), whose
+	resolution is a millisecond, so @a usecs is rounded up to the next millisecond.
 */
 int socket_send_timeout( int sock_fd, const char* data, int usecs ) {
 
-	fd_set write_set;
-	FD_ZERO( &write_set );
-	FD_SET( sock_fd, &write_set );
+	// poll() counts in milliseconds; round up, so that a short wait isn't no wait at all
+	int timeout_ms = usecs > 0 ? ( usecs + 999 ) / 1000 : 0;
 
-	const int mil = 1000000;
-	int secs = (int) usecs / mil;
-	usecs = usecs - (secs * mil);
-
-	struct timeval tv;
-	tv.tv_sec = secs;
-	tv.tv_usec = usecs;
+	struct pollfd pfd;
+	pfd.fd = sock_fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
 
 	errno = 0;
-	int ret = select( sock_fd + 1, NULL, &write_set, NULL, &tv);
-	if( ret > 0 ) return _socket_send( sock_fd, data, 0);
+	int ret = poll( &pfd, 1, timeout_ms );
+	if( ret > 0 && ! ( pfd.revents & POLLNVAL ) )
+		return _socket_send( sock_fd, data, 0);
 
 	osrfLogError(OSRF_LOG_MARK, "socket_send_timeout(): "
-		"timed out on send for socket %d after %d secs, %d usecs: %s",
-		sock_fd, secs, usecs, strerror( errno ) );
+		"timed out on send for socket %d after %d usecs: %s",
+		sock_fd, usecs, strerror( errno ) );
 
 	return -1;
 }
@@ -617,12 +702,12 @@ int socket_send_timeout( int sock_fd, const char* data, int usecs ) {
 	@param mgr Pointer to the socket_manager.
 	@param sock_fd File descriptor for the socket to be closed.
 
-	We close the socket before determining whether it belongs to the socket_manager in question.
+	We close the socket whether or not it belongs to the socket_manager in question.
 */
 void socket_disconnect(socket_manager* mgr, int sock_fd) {
 	osrfLogInternal( OSRF_LOG_MARK, "Closing socket %d", sock_fd);
-	close( sock_fd );
 	socket_remove_node(mgr, sock_fd);
+	close( sock_fd );
 }
 
 
@@ -631,43 +716,61 @@ void socket_disconnect(socket_manager* mgr, int sock_fd) {
 	@param sock_fd File descriptor for the socket.
 	@return 1 if the socket is valid, or 0 if it isn't.
 
-	The test is based on a call to select().  If the socket is valid but is not ready to be
-	written to, we wait until it is ready, then return 1.
+	The test is based on a call to poll().  If the socket is valid but has no input waiting,
+	we wait until it does, then return 1.
 
-	If the select() fails, it may be because it was interrupted by a signal.  In that case
-	we try again.  Otherwise we assume that the socket is no longer valid.  This can happen
-	if, for example, the other end of a connection has closed the connection.
+	If the poll() fails because it was interrupted by a signal, we try again.  Otherwise,
+	or if poll() reports that the descriptor isn't open, we assume that the socket is no
+	longer valid.
 
-	The select() can also fail if it is unable to allocate enough memory for its own internal
+	The poll() can also fail if it is unable to allocate enough memory for its own internal
 	use.  If that happens, we may erroneously report a valid socket as invalid, but we
 	probably wouldn't be able to use it anyway if we're that close to exhausting memory.
 */
 int socket_connected(int sock_fd) {
-	fd_set read_set;
-	FD_ZERO( &read_set );
-	FD_SET( sock_fd, &read_set );
+	struct pollfd pfd;
+	pfd.fd = sock_fd;
+	pfd.events = POLLIN;
 	while( 1 ) {
-		if( select( sock_fd + 1, &read_set, NULL, NULL, NULL) == -1 )
+		pfd.revents = 0;
+		if( poll( &pfd, 1, -1 ) == -1 ) {
+			if( EINTR == errno )
+				continue;
 			return 0;
-		else if( EINTR == errno )
-			continue;
-		else
-			return 1;
+		}
+		return ( pfd.revents & POLLNVAL ) ? 0 : 1;
 	}
 }
 
 /**
 	@brief Look for input on a given socket.  If you find some, react to it.
 	@param mgr Pointer to the socket_manager that presumably owns the socket.
-	@param timeout Timeout interval, in seconds (see notes).
+	@param timeout Timeout interval, in seconds (see socket_wait_ms()).
+	@param sock_fd The file descriptor to look at.
+	@return 0 if successful, or -1 if a timeout or other error occurs, or if the sender
+		closes the connection.
+
+	A wrapper for socket_wait_ms(), for a timeout in whole seconds.
+*/
+int socket_wait( socket_manager* mgr, int timeout, int sock_fd ) {
+	return socket_wait_ms( mgr, timeout_seconds_to_millis( timeout ), sock_fd );
+}
+
+/**
+	@brief Look for input on a given socket.  If you find some, react to it.
+	@param mgr Pointer to the socket_manager that presumably owns the socket.
+	@param timeout_ms Timeout interval, in milliseconds (see notes).
 	@param sock_fd The file descriptor to look at.
 	@return 0 if successful, or -1 if a timeout or other error occurs, or if the sender
 		closes the connection.
 
-	If @a timeout is -1, wait indefinitely for input activity to appear.  If @a timeout is
-	zero, don't wait at all.  If @a timeout is positive, wait that number of seconds
-	before timing out.  If @a timeout has a negative value other than -1, the results are not
-	well defined, but we'll probably get an EINVAL error from select().
+	If @a timeout_ms is -1, wait indefinitely for input activity to appear.  If
+	@a timeout_ms is zero, don't wait at all.  If @a timeout_ms is positive, wait that
+	number of milliseconds before timing out.  If @a timeout_ms has a negative value other
+	than -1, the results are not well defined.
+
+	We wait with poll() rather than select(), so that the value of the file descriptor
+	isn't limited by FD_SETSIZE.
 
 	If we detect activity, branch on the type of socket:
 
@@ -676,37 +779,26 @@ int socket_connected(int sock_fd) {
 	- Otherwise, read as much data as is available from the input socket, passing it a
 	buffer at a time to whatever callback function has been defined to the socket_manager.
 */
-int socket_wait( socket_manager* mgr, int timeout, int sock_fd ) {
+int socket_wait_ms( socket_manager* mgr, int timeout_ms, int sock_fd ) {
 
 	int retval = 0;
-	fd_set read_set;
-	FD_ZERO( &read_set );
-	FD_SET( sock_fd, &read_set );
-
-	struct timeval tv;
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0;
+	struct pollfd pfd;
+	pfd.fd = sock_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 	errno = 0;
 
-	if( timeout < 0 ) {
+	if( timeout_ms != 0 ) { /* timeout of 0 means don't block */
 
 		// If timeout is -1, we block indefinitely
-		if( (retval = select( sock_fd + 1, &read_set, NULL, NULL, NULL)) == -1 ) {
-			osrfLogDebug( OSRF_LOG_MARK, "Call to select() interrupted: Sys Error: %s",
-					strerror(errno));
-			return -1;
-		}
-
-	} else if( timeout > 0 ) { /* timeout of 0 means don't block */
-
-		if( (retval = select( sock_fd + 1, &read_set, NULL, NULL, &tv)) == -1 ) {
-			osrfLogDebug( OSRF_LOG_MARK, "Call to select() interrupted: Sys Error: %s",
+		if( (retval = poll( &pfd, 1, timeout_ms < 0 ? -1 : timeout_ms )) == -1 ) {
+			osrfLogDebug( OSRF_LOG_MARK, "Call to poll() interrupted: Sys Error: %s",
 					strerror(errno));
 			return -1;
 		}
 	}
 
-	osrfLogInternal( OSRF_LOG_MARK, "%d active sockets after select()", retval);
+	osrfLogInternal( OSRF_LOG_MARK, "%d active sockets after poll()", retval);
 
 	socket_node* node = socket_find_node(mgr, sock_fd);
 	if( node ) {
@@ -715,8 +807,8 @@ int socket_wait( socket_manager* mgr, int timeout, int sock_fd ) {
 		} else {
 			int status = _socket_handle_client_data( mgr, node );   // read data
 			if( status == -1 ) {
-				close( sock_fd );
 				socket_remove_node( mgr, sock_fd );
+				close( sock_fd );
 				return -1;
 			}
 		}
@@ -730,13 +822,28 @@ int socket_wait( socket_manager* mgr, int timeout, int sock_fd ) {
 /**
 	@brief Wait for input on all of a socket_manager's sockets; react to any input found.
 	@param mgr Pointer to the socket_manager.
-	@param timeout How many seconds to wait before timing out (see notes).
+	@param timeout How many seconds to wait before timing out (see socket_wait_all_ms()).
+	@return 0 if successful, or -1 if a timeout or other error occurs.
+
+	A wrapper for socket_wait_all_ms(), for a timeout in whole seconds.
+*/
+int socket_wait_all(socket_manager* mgr, int timeout) {
+	return socket_wait_all_ms(mgr, timeout_seconds_to_millis(timeout));
+}
+
+/**
+	@brief Wait for input on all of a socket_manager's sockets; react to any input found.
+	@param mgr Pointer to the socket_manager.
+	@param timeout_ms How many milliseconds to wait before timing out (see notes).
 	@return 0 if successful, or -1 if a timeout or other error occurs.
 
-	If @a timeout is -1, wait indefinitely for input activity to appear.  If @a timeout is
-	zero, don't wait at all.  If @a timeout is positive, wait that number of seconds
-	before timing out.  If @a timeout has a negative value other than -1, the results are not
-	well defined, but we'll probably get an EINVAL error from select().
+	If @a timeout_ms is -1, wait indefinitely for input activity to appear.  If
+	@a timeout_ms is zero, don't wait at all.  If @a timeout_ms is positive, wait that
+	number of milliseconds before timing out.  If @a timeout_ms has a negative value other
+	than -1, the results are not well defined.
+
+	How we wait depends on the backend chosen by socket_manager_set_backend().  By default
+	we use epoll.
 
 	For each active socket found:
 
@@ -745,13 +852,34 @@ int socket_wait( socket_manager* mgr, int timeout, int sock_fd ) {
 	- Otherwise, read as much data as is available from the input socket, passing it a
 	buffer at a time to whatever callback function has been defined to the socket_manager.
 */
-int socket_wait_all(socket_manager* mgr, int timeout) {
+int socket_wait_all_ms(socket_manager* mgr, int timeout_ms) {
 
 	if(mgr == NULL) {
 		osrfLogWarning( OSRF_LOG_MARK,  "socket_wait_all(): null mgr" );
 		return -1;
 	}
 
+	if(mgr->backend == SOCKET_BACKEND_SELECT)
+		return _socket_wait_all_select(mgr, timeout_ms);
+	else
+		return _socket_wait_all_epoll(mgr, timeout_ms);
+}
+
+/**
+	@brief Implement socket_wait_all_ms() by means of select().
+	@param mgr Pointer to the socket_manager.
+	@param timeout_ms How many milliseconds to wait before timing out (see
+		socket_wait_all_ms()).
+	@return 0 if successful, or -1 if a timeout or other error occurs.
+
+	Every call rebuilds the fd_set from the list of sockets, and every file descriptor
+	must be less than FD_SETSIZE.  If one isn't, we fail rather than overrun the fd_set.
+
+	Like the epoll version, we find each active socket through the node table, rather
+	than by walking the list, because a callback may disconnect any socket in the list.
+*/
+static int _socket_wait_all_select(socket_manager* mgr, int timeout_ms) {
+
 	int num_active = 0;
 	fd_set read_set;
 	FD_ZERO( &read_set );
@@ -759,6 +887,11 @@ int socket_wait_all(socket_manager* mgr, int timeout) {
 	socket_node* node = mgr->socket;
 	int max_fd = 0;
 	while(node) {
+		if( node->sock_fd >= FD_SETSIZE ) {
+			osrfLogError( OSRF_LOG_MARK, "Socket %d is beyond the reach of select(); "
+				"use the epoll backend", node->sock_fd );
+			return -1;
+		}
 		osrfLogInternal( OSRF_LOG_MARK, "Adding socket fd %d to select set",node->sock_fd);
 		FD_SET( node->sock_fd, &read_set );
 		if(node->sock_fd > max_fd) max_fd = node->sock_fd;
@@ -767,11 +900,11 @@ int socket_wait_all(socket_manager* mgr, int timeout) {
 	max_fd += 1;
 
 	struct timeval tv;
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = ( timeout_ms % 1000 ) * 1000;
 	errno = 0;
 
-	if( timeout < 0 ) {
+	if( timeout_ms < 0 ) {
 
 		// If timeout is -1, there is no timeout passed to the call to select
 		if( (num_active = select( max_fd, &read_set, NULL, NULL, NULL)) == -1 ) {
@@ -779,7 +912,7 @@ int socket_wait_all(socket_manager* mgr, int timeout) {
 			return -1;
 		}
 
-	} else if( timeout != 0 ) { /* timeout of 0 means don't block */
+	} else if( timeout_ms != 0 ) { /* timeout of 0 means don't block */
 
 		if( (num_active = select( max_fd, &read_set, NULL, NULL, &tv)) == -1 ) {
 			osrfLogWarning( OSRF_LOG_MARK, "select() call aborted: %s", strerror(errno));
@@ -789,39 +922,160 @@ int socket_wait_all(socket_manager* mgr, int timeout) {
 
 	osrfLogDebug( OSRF_LOG_MARK, "%d active sockets after select()", num_active);
 
-	node = mgr->socket;
+	int sock_fd;
 	int handled = 0;
 
-	while(node && (handled < num_active)) {
-
-		socket_node* next_node = node->next;
-		int sock_fd = node->sock_fd;
+	for( sock_fd = 0; sock_fd < max_fd && handled < num_active; sock_fd++ ) {
 
 		/* does this socket have data? */
 		if( FD_ISSET( sock_fd, &read_set ) ) {
 
-			osrfLogInternal( OSRF_LOG_MARK, "Socket %d active", sock_fd);
 			handled++;
-			FD_CLR(sock_fd, &read_set);
+			// A callback for an earlier socket may have removed this one
+			node = socket_find_node( mgr, sock_fd );
+			if( node ) {
+				osrfLogInternal( OSRF_LOG_MARK, "Socket %d active", sock_fd);
+				_socket_handle_activity(mgr, node);
+			}
+		}
+	}
 
-			if(node->endpoint == LISTENER_SOCKET)
-				_socket_handle_new_client(mgr, node);
+	return 0;
+}
 
-			else {
-				if( _socket_handle_client_data(mgr, node) == -1 ) {
-					/* someone may have yanked a socket_node out from under us */
-					close( sock_fd );
-					socket_remove_node( mgr, sock_fd );
-				}
-			}
+/**
+	@brief Implement socket_wait_all_ms() by means of epoll.
+	@param mgr Pointer to the socket_manager.
+	@param timeout_ms How many milliseconds to wait before timing out (see
+		socket_wait_all_ms()).
+	@return 0 if successful, or -1 if a timeout or other error occurs.
+
+	The sockets stay registered with the epoll instance from one call to the next, and
+	each active socket is found through the node table, so the cost of a call depends
+	on the number of active sockets rather than on the number of managed sockets.
+
+	We use level-triggered notification, so that a listener with several pending
+	connections, from which we accept only one at a time, is reported again next time.
+*/
+static int _socket_wait_all_epoll(socket_manager* mgr, int timeout_ms) {
+
+	if(socket_epoll_sync(mgr))
+		return -1;
+
+	struct epoll_event events[SOCKET_MAX_EVENTS];
+	errno = 0;
+
+	int num_active = epoll_wait(mgr->epoll_fd, events, SOCKET_MAX_EVENTS,
+			timeout_ms < 0 ? -1 : timeout_ms);
+	if(num_active == -1) {
+		osrfLogWarning( OSRF_LOG_MARK, "epoll_wait() call aborted: %s", strerror(errno));
+		return -1;
+	}
+
+	osrfLogDebug( OSRF_LOG_MARK, "%d active sockets after epoll_wait()", num_active);
+
+	int i;
+	for(i = 0; i < num_active; i++) {
+		// A callback for an earlier socket may have removed this one
+		socket_node* node = socket_find_node(mgr, events[i].data.fd);
+		if(node) {
+			osrfLogInternal( OSRF_LOG_MARK, "Socket %d active", node->sock_fd);
+			_socket_handle_activity(mgr, node);
 		}
+	}
+
+	return 0;
+}
+
+/**
+	@brief Make sure that a socket_manager has an epoll instance of its own.
+	@param mgr Pointer to the socket_manager.
+	@return 0 if successful, or -1 if we can't create an epoll instance.
 
-		node = next_node;
-	} // is_set
+	Create the instance on first use, registering every socket already in the list.
+
+	An epoll instance inherited across fork() is shared with the parent process, so that
+	any change we make to it would change the parent's as well.  If the instance was
+	created by some other process, close our copy and build a new one.
+*/
+static int socket_epoll_sync(socket_manager* mgr) {
+
+	pid_t pid = getpid();
+	if(mgr->epoll_pid == pid)
+		return 0;
+
+	if(mgr->epoll_pid)
+		close(mgr->epoll_fd);    // inherited from our parent; leave its set alone
+
+	mgr->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(mgr->epoll_fd < 0) {
+		osrfLogError( OSRF_LOG_MARK, "Unable to create epoll instance: %s", strerror(errno));
+		mgr->epoll_pid = 0;
+		return -1;
+	}
+	mgr->epoll_pid = pid;
+
+	socket_node* node = mgr->socket;
+	while(node) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = node->sock_fd;
+		if(epoll_ctl(mgr->epoll_fd, EPOLL_CTL_ADD, node->sock_fd, &ev))
+			osrfLogWarning( OSRF_LOG_MARK, "Unable to add socket %d to epoll set: %s",
+				node->sock_fd, strerror(errno));
+		node = node->next;
+	}
 
 	return 0;
 }
 
+/**
+	@brief React to activity on a socket reported by socket_wait_all().
+	@param mgr Pointer to the socket_manager.
+	@param node Pointer to the socket_node for the active socket.
+
+	For a listener, accept a new connection.  Otherwise read the available data; if the
+	read fails or the other end has closed the connection, drop the socket.
+*/
+static void _socket_handle_activity(socket_manager* mgr, socket_node* node) {
+
+	if(node->endpoint == LISTENER_SOCKET)
+		_socket_handle_new_client(mgr, node);
+
+	else {
+		int sock_fd = node->sock_fd;
+		if( _socket_handle_client_data(mgr, node) == -1 ) {
+			/* someone may have yanked a socket_node out from under us */
+			socket_remove_node( mgr, sock_fd );
+			close( sock_fd );
+		}
+	}
+}
+
+/**
+	@brief Choose the mechanism used by socket_wait_all() to detect activity.
+	@param mgr Pointer to the socket_manager.
+	@param backend SOCKET_BACKEND_EPOLL or SOCKET_BACKEND_SELECT.
+	@return 0 if successful, or -1 if either parameter is invalid.
+
+	May be called at any time.  Switching away from epoll releases the epoll instance;
+	switching to it defers the creation of a new instance until the next call to
+	socket_wait_all().
+*/
+int socket_manager_set_backend( socket_manager* mgr, socket_backend backend ) {
+	if(mgr == NULL) return -1;
+	if(backend != SOCKET_BACKEND_EPOLL && backend != SOCKET_BACKEND_SELECT) return -1;
+
+	if(backend != SOCKET_BACKEND_EPOLL && mgr->epoll_pid) {
+		close(mgr->epoll_fd);
+		mgr->epoll_pid = 0;
+	}
+
+	mgr->backend = backend;
+	return 0;
+}
+
 /**
 	@brief Accept a new socket from a listener, and add it to the socket_manager's list.
 	@param mgr Pointer to the socket_manager that will own the new socket.
@@ -861,9 +1115,15 @@ static int _socket_handle_new_client(socket_manager* mgr, socket_node* node) {
 	@param node Pointer to the socket_node that owns the socket.
 	@return 0 if successful, or -1 upon failure.
 
-	Receive one or more buffers until no more bytes are available for receipt.  Add a
-	terminal nul to each buffer and pass it to a callback function previously defined by the
-	application to the socket_manager.
+	Receive until no more bytes are available for receipt, accumulating them in a
+	receive buffer that belongs to the socket_node and that grows as needed, up to
+	RBUF_MAX_SIZE.  Add a terminal nul and pass the buffer to a callback function previously
+	defined by the application to the socket_manager -- once, unless the buffer fills up
+	before the input runs out, in which case the callback sees a series of large slices.
+	Once the input runs out, a buffer that has grown is freed, so that an idle socket
+	holds no more than RBUFSIZE bytes however large a burst it has seen.
+
+	The first time through, put the socket into non-blocking mode, and leave it there.
 
 	If the sender closes the connection, call another callback function, if one has been
 	defined.
@@ -877,34 +1137,89 @@ static int _socket_handle_new_client(socket_manager* mgr, socket_node* node) {
 static int _socket_handle_client_data(socket_manager* mgr, socket_node* node) {
 	if(mgr == NULL || node == NULL) return -1;
 
-	char buf[RBUFSIZE];
-	int read_bytes;
+	int read_bytes = 0;
+	int local_errno = 0;
 	int sock_fd = node->sock_fd;
 
-	set_fl(sock_fd, O_NONBLOCK);
+	if( ! node->nonblocking ) {
+		set_fl(sock_fd, O_NONBLOCK);
+		mgr->stats.fcntl_calls += 2;    // F_GETFL and F_SETFL
+		node->nonblocking = 1;
+	}
 
 	osrfLogInternal( OSRF_LOG_MARK, "%ld : Received data at %f\n",
 			(long) getpid(), get_timestamp_millis());
 
-	while( (read_bytes = recv(sock_fd, buf, RBUFSIZE-1, 0) ) > 0 ) {
-		buf[read_bytes] = '\0';
-		osrfLogInternal( OSRF_LOG_MARK, "Socket %d Read %d bytes and data: %s",
-				sock_fd, read_bytes, buf);
-		if(mgr->data_received)
-			mgr->data_received(mgr->blob, mgr, sock_fd, buf, node->parent_id);
-	}
-	int local_errno = errno; /* capture errno as set by recv() */
-
-	if(socket_find_node(mgr, sock_fd)) {  /* someone may have closed this socket */
-		clr_fl(sock_fd, O_NONBLOCK);
-		if(read_bytes < 0) {
-			// EAGAIN would have meant that no more data was available
-			if(local_errno != EAGAIN)   // but if that's not the case...
-				osrfLogWarning( OSRF_LOG_MARK, " * Error reading socket with error %s",
-					strerror(local_errno) );
+	int more = 1;
+	while( more ) {
+
+		// Detach the buffer from the node while we use it.  The callback
+		// may close the socket and free the node out from under us.
+		char* buf = node->rbuf;
+		size_t bufsize = node->rbuf_size;
+		node->rbuf = NULL;
+		node->rbuf_size = 0;
+		if( ! buf ) {
+			bufsize = RBUFSIZE;
+			OSRF_MALLOC( buf, bufsize );
+		}
+
+		size_t used = 0;
+		while( 1 ) {
+			if( used + 1 >= bufsize ) {
+				if( bufsize >= RBUF_MAX_SIZE )
+					break;       // Full; pass along what we have, then come back for more
+
+				char* newbuf;
+				OSRF_MALLOC( newbuf, bufsize * 2 );
+				memcpy( newbuf, buf, used );
+				free( buf );
+				buf = newbuf;
+				bufsize *= 2;
+			}
+
+			errno = 0;
+			read_bytes = recv( sock_fd, buf + used, bufsize - used - 1, 0 );
+			local_errno = errno; /* capture errno as set by recv() */
+			mgr->stats.recv_calls++;
+
+			if( read_bytes <= 0 ) {
+				more = 0;
+				break;
+			}
+
+			used += read_bytes;
+			mgr->stats.bytes += read_bytes;
+		}
+
+		if( used > 0 ) {
+			buf[used] = '\0';
+			osrfLogInternal( OSRF_LOG_MARK, "Socket %d Read %lu bytes and data: %s",
+					sock_fd, (unsigned long) used, buf);
+			if(mgr->data_received) {
+				mgr->stats.deliveries++;
+				mgr->data_received(mgr->blob, mgr, sock_fd, buf, node->parent_id);
+			}
 		}
 
-	} else { return -1; } /* inform the caller that this node has been tampered with */
+		/* someone may have closed this socket */
+		node = socket_find_node( mgr, sock_fd );
+		if( node && ! node->rbuf && ( more || bufsize <= RBUFSIZE ) ) {
+			node->rbuf = buf;
+			node->rbuf_size = bufsize;
+		} else
+			free( buf );
+
+		if( ! node )
+			return -1;  /* inform the caller that this node has been tampered with */
+	}
+
+	if(read_bytes < 0) {
+		// EAGAIN would have meant that no more data was available
+		if(local_errno != EAGAIN)   // but if that's not the case...
+			osrfLogWarning( OSRF_LOG_MARK, " * Error reading socket with error %s",
+				strerror(local_errno) );
+	}
 
 	if(read_bytes == 0) {  /* socket closed by client */
 		if(mgr->on_socket_closed) {
@@ -924,12 +1239,11 @@ static int _socket_handle_client_data(socket_manager* mgr, socket_node* node) {
 */
 void socket_manager_free(socket_manager* mgr) {
 	if(mgr == NULL) return;
-	socket_node* tmp;
-	while(mgr->socket) {
-		tmp = mgr->socket->next;
+	while(mgr->socket)
 		socket_disconnect(mgr, mgr->socket->sock_fd);
-		mgr->socket = tmp;
-	}
+	free(mgr->node_table);
+	if(mgr->epoll_pid)
+		close(mgr->epoll_fd);
 	free(mgr);
 
 }
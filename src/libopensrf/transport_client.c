@@ -176,20 +176,33 @@ int client_send_message( transport_client* client, transport_message* msg ) {
 /**
 	@brief Fetch an input message, if one is available.
 	@param client Pointer to a transport_client.
-	@param timeout How long to wait for a message to arrive, in seconds (see remarks).
+	@param timeout How long to wait for a message to arrive, in seconds (see client_recv_ms()).
+	@return A pointer to a transport_message if successful, or NULL if not.
+
+	A wrapper for client_recv_ms(), for a timeout in whole seconds.
+*/
+transport_message* client_recv( transport_client* client, int timeout ) {
+	return client_recv_ms( client, timeout_seconds_to_millis( timeout ) );
+}
+
+/**
+	@brief Fetch an input message, if one is available.
+	@param client Pointer to a transport_client.
+	@param timeout_ms How long to wait for a message to arrive, in milliseconds (see
+	remarks).
 	@return A pointer to a transport_message if successful, or NULL if not.
 
 	If there is a message already in the queue, return it immediately.  Otherwise read any
 	available messages from the transport_session (subject to a timeout), and return the
 	first one.
 
-	If the value of @a timeout is -1, then there is no time limit -- wait indefinitely until a
-	message arrives (or we error out for other reasons).  If the value of @a timeout is zero,
-	don't wait at all.
+	If the value of @a timeout_ms is -1, then there is no time limit -- wait indefinitely
+	until a message arrives (or we error out for other reasons).  If the value of
+	@a timeout_ms is zero, don't wait at all.
 
 	The calling code is responsible for freeing the transport_message by calling message_free().
 */
-transport_message* client_recv( transport_client* client, int timeout ) {
+transport_message* client_recv_ms( transport_client* client, int timeout_ms ) {
 	if( client == NULL ) { return NULL; }
 
 	int error = 0;  /* boolean */
@@ -215,35 +228,32 @@ transport_message* client_recv( transport_client* client, int timeout ) {
 		// Likewise we could time out while still receiving the second or subsequent message,
 		// return the first message, and resume receiving messages later.
 
-		if( timeout == -1 ) {  /* wait potentially forever for data to arrive */
+		if( timeout_ms == -1 ) {  /* wait potentially forever for data to arrive */
 
 			int x;
 			do {
-				if( (x = session_wait( client->session, -1 )) ) {
+				if( (x = session_wait_ms( client->session, -1 )) ) {
 					osrfLogDebug(OSRF_LOG_MARK, "session_wait returned failure code %d\n", x);
 					error = 1;
 					break;
 				}
 			} while( client->msg_q_head == NULL );
 
-		} else {    /* loop up to 'timeout' seconds waiting for data to arrive  */
-
-			/* This loop assumes that a time_t is denominated in seconds -- not */
-			/* guaranteed by Standard C, but a fair bet for Linux or UNIX       */
+		} else {    /* loop up to 'timeout_ms' milliseconds waiting for data to arrive */
 
-			time_t start = time(NULL);
-			time_t remaining = (time_t) timeout;
+			long long deadline = get_monotonic_millis() + timeout_ms;
+			long long remaining = timeout_ms;
 
 			int wait_ret;
 			do {
-				if( (wait_ret = session_wait( client->session, (int) remaining)) ) {
+				if( (wait_ret = session_wait_ms( client->session, (int) remaining)) ) {
 					error = 1;
 					osrfLogDebug(OSRF_LOG_MARK,
 						"session_wait returned failure code %d: setting error=1\n", wait_ret);
 					break;
 				}
 
-				remaining -= time(NULL) - start;
+				remaining = deadline - get_monotonic_millis();
 			} while( NULL == client->msg_q_head && remaining > 0 );
 		}
 	}
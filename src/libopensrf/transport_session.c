@@ -1,4 +1,6 @@
 #include <opensrf/transport_session.h>
+#include <opensrf/osrf_cbor.h>
+#include <opensrf/osrf_message.h>
 
 /**
 	@file transport_session.c
@@ -91,6 +93,8 @@ static const xmlSAXHandlerPtr SAXHandler = &SAXHandlerStruct;
 
 static void grab_incoming(void* blob, socket_manager* mgr, int sockid, char* data, int parent);
 static void reset_session_buffers( transport_session* session );
+static void parse_body_text( transport_session* ses, const char* text, int len );
+static void take_parsed_body( transport_session* ses, transport_message* msg );
 static const char* get_xml_attr( const xmlChar** atts, const char* attr_name );
 static int get_xmpp_error_code( const xmlChar *name );
 
@@ -181,6 +185,11 @@ transport_session* init_transport( const char* server,
 	session->sock_id = 0;
 	session->message_callback = NULL;
 
+	session->body_parse_threshold = 0;
+	session->body_builder = NULL;
+	session->body_arena = NULL;
+	session->body_parsing = 0;
+
 	return session;
 }
 
@@ -228,6 +237,10 @@ int session_discard( transport_session* session ) {
 	xmlDictCleanup();
 	xmlCleanupParser();
 
+	jsonBuilderFree( session->body_builder );
+	if( session->body_arena )
+		jsonArenaFree( session->body_arena );
+
 	buffer_free(session->body_buffer);
 	buffer_free(session->subject_buffer);
 	buffer_free(session->thread_buffer);
@@ -261,14 +274,27 @@ int session_connected( transport_session* session ) {
 /**
 	@brief Wait on the client socket connected to Jabber, and process any resulting input.
 	@param session Pointer to the transport_session.
-	@param timeout How seconds to wait before timing out (see notes).
+	@param timeout How many seconds to wait before timing out (see session_wait_ms()).
+	@return 0 if successful, or -1 if a timeout or other error occurs, or if the server
+		closes the connection at the other end.
+
+	A wrapper for session_wait_ms(), for a timeout in whole seconds.
+*/
+int session_wait( transport_session* session, int timeout ) {
+	return session_wait_ms( session, timeout_seconds_to_millis( timeout ) );
+}
+
+/**
+	@brief Wait on the client socket connected to Jabber, and process any resulting input.
+	@param session Pointer to the transport_session.
+	@param timeout_ms How many milliseconds to wait before timing out (see notes).
 	@return 0 if successful, or -1 if a timeout or other error occurs, or if the server
 		closes the connection at the other end.
 
-	If @a timeout is -1, wait indefinitely for input activity to appear.  If @a timeout is
-	zero, don't wait at all.  If @a timeout is positive, wait that number of seconds
-	before timing out.  If @a timeout has a negative value other than -1, the results are not
-	well defined.
+	If @a timeout_ms is -1, wait indefinitely for input activity to appear.  If
+	@a timeout_ms is zero, don't wait at all.  If @a timeout_ms is positive, wait that
+	number of milliseconds before timing out.  If @a timeout_ms has a negative value other
+	than -1, the results are not well defined.
 
 	Read all available input from the socket and pass it through grab_incoming() (a
 	callback function previously installed in the socket_manager).
@@ -277,12 +303,12 @@ int session_connected( transport_session* session ) {
 	result, the calling code should call this function in a loop until it gets a complete
 	message, or until an error occurs.
 */
-int session_wait( transport_session* session, int timeout ) {
+int session_wait_ms( transport_session* session, int timeout_ms ) {
 	if( ! session || ! session->sock_mgr ) {
 		return 0;
 	}
 
-	int ret =  socket_wait( session->sock_mgr, timeout, session->sock_id );
+	int ret =  socket_wait_ms( session->sock_mgr, timeout_ms, session->sock_id );
 
 	if( ret ) {
 		osrfLogDebug(OSRF_LOG_MARK, "socket_wait returned error code %d", ret);
@@ -800,6 +826,8 @@ static void endElementHandler( void *session, const xmlChar *name) {
 				OSRF_BUFFER_C_STR( ses->recipient_buffer ),
 				OSRF_BUFFER_C_STR( ses->from_buffer ) );
 
+			if( msg == NULL ) { return; }
+
 			message_set_router_info( msg,
 				ses->router_from_buffer->buf,
 				ses->router_to_buffer->buf,
@@ -808,12 +836,21 @@ static void endElementHandler( void *session, const xmlChar *name) {
 				ses->router_broadcast );
 
 			message_set_osrf_xid( msg, ses->osrf_xid_buffer->buf );
+			take_parsed_body( ses, msg );
 
 			if( ses->message_error_type->n_used > 0 ) {
 				set_msg_error( msg, ses->message_error_type->buf, ses->message_error_code );
 			}
 
-			if( msg == NULL ) { return; }
+			const socket_stats* stats = &ses->sock_mgr->stats;
+			osrfLogInternal( OSRF_LOG_MARK, "Message received: %lu bytes in %lu recv() calls, "
+				"%lu fcntl() calls, %lu parser pushes",
+				stats->bytes - ses->msg_stats_mark.bytes,
+				stats->recv_calls - ses->msg_stats_mark.recv_calls,
+				stats->fcntl_calls - ses->msg_stats_mark.fcntl_calls,
+				stats->deliveries - ses->msg_stats_mark.deliveries );
+			ses->msg_stats_mark = *stats;
+
 			ses->message_callback( ses->user_data, msg );
 		}
 
@@ -895,6 +932,64 @@ static void reset_session_buffers( transport_session* ses ) {
 	OSRF_BUFFER_RESET( ses->message_error_type );
 	OSRF_BUFFER_RESET( ses->session_id );
 	OSRF_BUFFER_RESET( ses->status_buffer );
+
+	if( ses->body_parsing ) {
+		jsonBuilderReset( ses->body_builder, NULL );
+		jsonArenaReset( ses->body_arena );
+		ses->body_parsing = 0;
+	}
+}
+
+/**
+	@brief Parse the text of a message body as JSON, if the body is long enough to bother.
+	@param ses Pointer to the transport_session.
+	@param text Pointer to the latest text of the body, already appended to body_buffer.
+	@param len Length of the text.
+
+	Parsing a long body as it arrives, rather than after the whole message is in, means
+	that by the time the message is complete, most of the parsing is already done.  For a
+	short body, a single pass of the recursive descent parser at the end is cheaper.
+
+	The parsing starts once body_buffer grows long enough.  At that point we catch up on
+	what we have so far, and then keep up with the rest as it comes in.  A CBOR body, or a
+	raw chunk of a result, isn't JSON, so we leave it alone.
+*/
+static void parse_body_text( transport_session* ses, const char* text, int len ) {
+	if( ses->body_parsing ) {
+		jsonBuilderPush( ses->body_builder, text, len );
+	} else if( ses->body_buffer->n_used >= ses->body_parse_threshold
+			&& !osrfCborIsBody( ses->body_buffer->buf )
+			&& !osrfMessageIsRawChunk( ses->body_buffer->buf ) ) {
+		if( !ses->body_builder ) {
+			ses->body_arena = jsonNewArena( 0 );
+			ses->body_builder = jsonNewBuilder( ses->body_arena );
+		}
+		ses->body_parsing = 1;
+		jsonBuilderPush( ses->body_builder, ses->body_buffer->buf, ses->body_buffer->n_used );
+	}
+}
+
+/**
+	@brief Hand a parsed message body, if we have one, to a new transport_message.
+	@param ses Pointer to the transport_session.
+	@param msg Pointer to the transport_message being built for the message stanza.
+
+	The transport_message takes over the jsonArena holding the tree, and the jsonBuilder
+	gets a new one for the next message.  If the body isn't valid JSON, leave it to the
+	calling code to discover that from the text, the same as for a short body.
+*/
+static void take_parsed_body( transport_session* ses, transport_message* msg ) {
+	if( !ses->body_parsing )
+		return;
+
+	jsonObject* body = jsonBuilderFinish( ses->body_builder );
+	if( body ) {
+		msg->body_json = body;
+		msg->body_arena = ses->body_arena;
+		ses->body_arena = jsonNewArena( 0 );
+		jsonBuilderReset( ses->body_builder, ses->body_arena );
+		ses->body_parsing = 0;
+	}
 }
 
 // ------------------------------------------------------------------
@@ -926,6 +1021,8 @@ static void characterHandler(
 
 		if( machine->in_message_body ) {
 			buffer_add_n( ses->body_buffer, p, len );
+			if( ses->body_parse_threshold )
+				parse_body_text( ses, p, len );
 		}
 
 		if( machine->in_subject ) {
@@ -991,3 +1088,18 @@ int session_disconnect( transport_session* session ) {
 	return 0;
 }
 
+/**
+	@brief Parse long message bodies as JSON while they arrive.
+	@param session Pointer to the transport_session.
+	@param threshold How long a body must get before we start parsing it, or zero to
+		parse none of them.
+
+	Each transport_message whose body was parsed this way carries the resulting jsonObject
+	tree in its body_json member, alongside the text of the body.  That's worth doing only
+	if the calling code will parse the body anyway; a router, for example, would not.
+*/
+void session_set_body_parsing( transport_session* session, size_t threshold ) {
+	if( session )
+		session->body_parse_threshold = threshold;
+}
+
@@ -24,6 +24,9 @@ GNU General Public License for more details.
 #include <opensrf/utils.h>
 #include <opensrf/log.h>
 #include <errno.h>
+#include <poll.h>
+#include <limits.h>
+#include <time.h>
 
 /**
 	@brief A thin wrapper for malloc().
@@ -150,6 +153,36 @@ double get_timestamp_millis( void ) {
 	return time;
 }
 
+/**
+	@brief Read a clock that only moves forward.
+	@return Milliseconds since some arbitrary starting point.
+
+	Used for measuring timeouts.  Unlike the time of day, the monotonic clock doesn't
+	jump when somebody sets the system clock.
+*/
+long long get_monotonic_millis( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+	@brief Convert a timeout in seconds to one in milliseconds.
+	@param seconds The timeout in seconds.
+	@return The timeout in milliseconds.
+
+	A negative timeout, meaning no time limit, becomes -1.  A timeout too long to express
+	in milliseconds becomes the longest one that we can express.
+*/
+int timeout_seconds_to_millis( int seconds ) {
+	if( seconds < 0 )
+		return -1;
+	else if( seconds > INT_MAX / 1000 )
+		return INT_MAX;
+	else
+		return seconds * 1000;
+}
+
 
 /**
 	@brief Set designated file status flags for an open file descriptor.
@@ -418,6 +451,27 @@ int buffer_add_n(growing_buffer* gb, const char* data, size_t n) {
 	return total_len;
 }
 
+/**
+	@brief Make sure that a growing_buffer can hold a given length without growing.
+	@param gb A pointer to the growing_buffer.
+	@param total_len How many characters the buffer must hold, not counting the terminal nul.
+	@return 0 if successful, or -1 if not.
+
+	For a caller that knows how much is coming, and would rather allocate for it once than
+	let the buffer grow a piece at a time.  If the length is excessive, the growing_buffer
+	frees itself, just as it does when buffer_add_n() fails.
+*/
+int buffer_reserve( growing_buffer* gb, size_t total_len ) {
+	if( !gb ) return -1;
+
+	if( total_len >= gb->size ) {
+		if( buffer_expand( gb, total_len ) )
+			return -1;
+	}
+
+	return 0;
+}
+
 
 /**
 	@brief Reset a growing_buffer so that it contains an empty string.
@@ -763,21 +817,21 @@ char* md5sum( const char* text ) {
 	@param fd The file descriptor to be checked.
 	@return 0 if the file descriptor is valid, or -1 if it isn't.
 
-	The most likely reason a file descriptor would be invalid is if it isn't open.
+	The most likely reason a file descriptor would be invalid is if it isn't open.  We
+	ask poll() rather than select(), so that a descriptor beyond FD_SETSIZE is no problem.
 */
 int osrfUtilsCheckFileDescriptor( int fd ) {
 
-	fd_set tmpset;
-	FD_ZERO(&tmpset);
-	FD_SET(fd, &tmpset);
+	if( fd < 0 )
+		return -1;
 
-	struct timeval tv;
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = 0;
+	pfd.revents = 0;
 
-	if( select(fd + 1, &tmpset, NULL, NULL, &tv) == -1 ) {
-		if( errno == EBADF ) return -1;
-	}
+	if( poll( &pfd, 1, 0 ) == 1 && ( pfd.revents & POLLNVAL ) )
+		return -1;
 
 	return 0;
 }
@@ -789,13 +843,13 @@ size_t osrfXmlEscapingLength ( const char* str ) {
 		switch (*s) {
 			case '>':
 			case '<':
-				extra += 3;
+				extra += OSRF_XML_EXTRA_LT_GT;
 				break;
 			case '&':
-				extra += 4;
+				extra += OSRF_XML_EXTRA_AMP;
 				break;
 			case '"':
-				extra += 11;
+				extra += OSRF_XML_EXTRA_QUOTE;
 				break;
 			default:
 				break;
@@ -1,4 +1,4 @@
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <signal.h>
 #include "opensrf/utils.h"
 #include "opensrf/log.h"
@@ -20,6 +20,14 @@
 
 	For each server class there may be multiple server nodes.  Each node corresponds to a
 	listener process for a service.
+
+	A balancing policy decides which node of a class gets each message.  Apart from plain
+	round-robin, the policies rely on an estimate of how many requests each node has in
+	flight.  Since responses bypass the router, that estimate comes from the listeners
+	themselves: they may attach a load hint (a JSON object with "capacity", "busy",
+	"backlog" and "latency") to the body of a register command, or send one on its own
+	with a "load" command.  Between hints, we add the messages we've sent the node since,
+	letting them decay over the node's reported latency as it presumably works them off.
 */
 
 /**
@@ -35,6 +43,14 @@ struct osrfRouterStruct {
 	*/
 	osrfHash* classes;
 	osrfHashIterator* class_itr;  /**< For traversing the list of classes. */
+	/**
+		@brief Sparse list of server classes, indexed by socket descriptor.
+
+		Lets the main loop map a ready socket back to its osrfRouterClass without
+		scanning the whole hash.  The list does not own its entries.
+	*/
+	osrfList* class_fds;
+	int epoll_fd;         /**< epoll instance watching the router socket and class sockets. */
 	char* domain;         /**< Domain name of Jabber server. */
 	char* name;           /**< Router's username for the Jabber logon. */
 	char* resource;       /**< Router's resource name for the Jabber logon. */
@@ -48,6 +64,7 @@ struct osrfRouterStruct {
 	osrfStringArray* trustedServers;
 	/** List of osrfMessages to be returned from osrfMessageDeserialize() */
 	osrfList* message_list;
+	const struct osrfRouterBalanceStruct* balance;  /**< How we pick a node for a message. */
 
 	transport_client* connection;
 };
@@ -57,6 +74,8 @@ struct osrfRouterStruct {
 */
 struct _osrfRouterClassStruct {
 	osrfRouter* router;         /**< The osrfRouter that owns this osrfRouterClass. */
+	char* classname;            /**< Name of the class; same as its key in router->classes. */
+	int sock_fd;                /**< Socket registered with the router's epoll instance. */
 	osrfHashIterator* itr;      /**< Iterator for set of osrfRouterNodes. */
 	/**
 		@brief Hash store of server nodes.
@@ -77,14 +96,29 @@ struct _osrfRouterNodeStruct {
 	char* remoteId;     /**< Send message to me via this login. */
 	int count;          /**< How many message have been sent to this node. */
 	transport_message* lastMessage;
+	int capacity;       /**< Advertised number of drones, or 0 if unknown. */
+	int outstanding;    /**< Busy drones plus backlog, as of the last load hint. */
+	double latency;     /**< Advertised seconds per request, or 0 if unknown. */
+	double pending;     /**< Messages sent since the last load hint, decaying. */
+	double pending_since; /**< When pending was last brought up to date. */
+	int current_weight; /**< Running total for smooth weighted round-robin. */
 };
 typedef struct _osrfRouterNodeStruct osrfRouterNode;
 
+/**
+	@brief A way of picking a node for a message.
+*/
+typedef struct osrfRouterBalanceStruct {
+	const char* name;   /**< Name used in the configuration. */
+	/** Return the chosen node, or NULL if the class has none. */
+	osrfRouterNode* (*pick)( osrfRouterClass* rclass );
+} osrfRouterBalance;
+
 static osrfRouterClass* osrfRouterAddClass( osrfRouter* router, const char* classname );
 static void osrfRouterClassAddNode( osrfRouterClass* rclass, const char* remoteId );
 static void osrfRouterHandleCommand( osrfRouter* router, const transport_message* msg );
 static void osrfRouterClassHandleMessage( osrfRouter* router,
-		osrfRouterClass* rclass, const transport_message* msg );
+		osrfRouterClass* rclass, transport_message* msg );
 static void osrfRouterRemoveClass( osrfRouter* router, const char* classname );
 static void osrfRouterClassRemoveNode( osrfRouter* router, const char* classname,
 		const char* remoteId );
@@ -93,7 +127,11 @@ static void osrfRouterNodeFree( char* remoteId, void* node );
 static osrfRouterClass* osrfRouterFindClass( osrfRouter* router, const char* classname );
 static osrfRouterNode* osrfRouterClassFindNode( osrfRouterClass* rclass,
 		const char* remoteId );
-static int _osrfRouterFillFDSet( osrfRouter* router, fd_set* set );
+static int osrfRouterWatchFD( osrfRouter* router, int fd );
+static int osrfRouterWatchClass( osrfRouter* router, osrfRouterClass* rclass, int fd );
+static void osrfRouterUnwatchClass( osrfRouter* router, osrfRouterClass* rclass );
+static int osrfRouterClassHungUp( osrfRouter* router, osrfRouterClass* rclass,
+		int fd, uint32_t events );
 static void osrfRouterHandleIncoming( osrfRouter* router );
 static void osrfRouterClassHandleIncoming( osrfRouter* router,
 		const char* classname,  osrfRouterClass* class );
@@ -108,15 +146,45 @@ static void osrfRouterSendAppResponse( osrfRouter* router, const transport_messa
 		const osrfMessage* omsg, const jsonObject* response );
 static void osrfRouterHandleMethodNFound( osrfRouter* router,
 		const transport_message* msg, const osrfMessage* omsg );
+static void osrfRouterNodeSetLoad( osrfRouterNode* node, const char* hint );
+static double osrfRouterNodeInFlight( osrfRouterNode* node, double now );
+static osrfRouterNode* osrfRouterClassNextNode( osrfRouterClass* rclass );
+static osrfRouterNode* osrfRouterClassPickBest( osrfRouterClass* rclass,
+		double (*cost)( osrfRouterNode* node, double in_flight, double latency ) );
+static osrfRouterNode* osrfRouterPickRoundRobin( osrfRouterClass* rclass );
+static osrfRouterNode* osrfRouterPickLeastOutstanding( osrfRouterClass* rclass );
+static osrfRouterNode* osrfRouterPickLatency( osrfRouterClass* rclass );
+static osrfRouterNode* osrfRouterPickWeighted( osrfRouterClass* rclass );
+static double osrfRouterOutstandingCost( osrfRouterNode* node, double in_flight,
+		double latency );
+static double osrfRouterLatencyCost( osrfRouterNode* node, double in_flight,
+		double latency );
+
+/** @brief Maximum number of ready sockets to collect from a single epoll_wait(). */
+#define ROUTER_MAX_EVENTS 64
 
 #define ROUTER_REGISTER "register"
 #define ROUTER_UNREGISTER "unregister"
+#define ROUTER_LOAD "load"
 
 #define ROUTER_REQUEST_CLASS_LIST "opensrf.router.info.class.list"
 #define ROUTER_REQUEST_STATS_NODE_FULL "opensrf.router.info.stats.class.node.all"
 #define ROUTER_REQUEST_STATS_CLASS_FULL "opensrf.router.info.stats.class.all"
 #define ROUTER_REQUEST_STATS_CLASS "opensrf.router.info.stats.class"
 #define ROUTER_REQUEST_STATS_CLASS_SUMMARY "opensrf.router.info.stats.class.summary"
+#define ROUTER_REQUEST_STATS_LOAD "opensrf.router.info.stats.class.load"
+
+/** @brief Node capacity to assume for weighting when a listener hasn't advertised one. */
+#define ROUTER_DEFAULT_CAPACITY 1
+
+/** @brief The balancing policies, by name.  The first is the default. */
+static const osrfRouterBalance balance_policies[] = {
+	{ "round-robin",       osrfRouterPickRoundRobin },
+	{ "least-outstanding", osrfRouterPickLeastOutstanding },
+	{ "latency",           osrfRouterPickLatency },
+	{ "weighted",          osrfRouterPickWeighted },
+	{ NULL, NULL }
+};
 
 /**
 	@brief Stop the otherwise endless main loop of the router.
@@ -131,6 +199,40 @@ void router_stop( osrfRouter* router )
 		router->stop = 1;
 }
 
+/**
+	@brief Choose how a router spreads messages across the nodes of a class.
+	@param router Pointer to the osrfRouter.
+	@param name Name of the policy: "round-robin", "least-outstanding", "latency", or
+	"weighted".
+	@return 0 if successful, or -1 if the name isn't recognized.
+
+	- round-robin: each node in turn, regardless of load.
+	- least-outstanding: the node with the fewest requests in flight per drone.
+	- latency: the node with the least expected wait, i.e. requests in flight per drone
+	times its advertised latency.
+	- weighted: round-robin, with each node's share in proportion to its advertised
+	capacity.
+
+	Without load hints from the listeners, the estimate of requests in flight reflects
+	only what the router has sent lately, and every node counts as having one drone.
+*/
+int osrfRouterSetBalance( osrfRouter* router, const char* name ) {
+	if(!(router && name)) return -1;
+
+	const osrfRouterBalance* policy;
+	for( policy = balance_policies; policy->name; ++policy ) {
+		if( !strcmp( policy->name, name ) ) {
+			router->balance = policy;
+			osrfLogInfo( OSRF_LOG_MARK, "Router balancing policy: %s", name );
+			return 0;
+		}
+	}
+
+	osrfLogWarning( OSRF_LOG_MARK, "Unknown router balancing policy \"%s\"; using %s",
+			name, router->balance->name );
+	return -1;
+}
+
 /**
 	@brief Allocate and initialize a new osrfRouter.
 	@param domain Domain name of Jabber server.
@@ -161,6 +263,7 @@ osrfRouter* osrfNewRouter(
 	router->resource       = strdup(resource);
 	router->port           = port;
 	router->stop           = 0;
+	router->balance        = balance_policies;
 
 	router->trustedClients = trustedClients;
 	router->trustedServers = trustedServers;
@@ -169,8 +272,20 @@ osrfRouter* osrfNewRouter(
 	router->classes = osrfNewHash();
 	osrfHashSetCallback(router->classes, &osrfRouterClassFree);
 	router->class_itr = osrfNewHashIterator( router->classes );
+	router->class_fds = osrfNewList();
 	router->message_list = NULL;   // We'll allocate one later
 
+	router->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+	if( router->epoll_fd < 0 ) {
+		osrfLogError( OSRF_LOG_MARK, "Unable to create epoll instance for router: %s",
+				strerror( errno ) );
+		router->connection = NULL;
+		router->trustedClients = NULL;
+		router->trustedServers = NULL;
+		osrfRouterFree( router );
+		return NULL;
+	}
+
 	// Prepare to connect to Jabber, as a non-component, over TCP (not UNIX domain).
 	router->connection = client_init( domain, port, NULL, 0 );
 
@@ -184,13 +299,16 @@ osrfRouter* osrfNewRouter(
 
 	Allow up to 10 seconds for the logon to succeed.
 
-	We connect over TCP (not over a UNIX domain), as a non-component.
+	We connect over TCP (not over a UNIX domain), as a non-component.  Once connected,
+	the top level socket is registered with the router's epoll instance.
 */
 int osrfRouterConnect( osrfRouter* router ) {
 	if(!router) return -1;
 	int ret = client_connect( router->connection, router->name,
 			router->password, router->resource, 10, AUTH_DIGEST );
 	if( ret == 0 ) return -1;
+	if( osrfRouterWatchFD( router, client_sock_fd( router->connection ) ) )
+		return -1;
 	return 0;
 }
 
@@ -202,22 +320,26 @@ int osrfRouterConnect( osrfRouter* router ) {
 	either the top level socket belonging to the router or any of the lower level sockets
 	belonging to the classes.  React to the incoming activity as needed.
 
+	Every socket is registered with an edge-triggered epoll instance when it is opened,
+	so each wakeup costs time in proportion to the number of ready sockets, not to the
+	number of classes.  Since an edge is reported only once, the handlers must drain each
+	ready socket completely; client_recv() with a zero timeout does just that.
+
 	We don't exit the loop until we receive a signal to stop, or until we encounter an error.
 */
 void osrfRouterRun( osrfRouter* router ) {
 	if(!(router && router->classes)) return;
 
 	int routerfd = client_sock_fd( router->connection );
-	int selectret = 0;
+	struct epoll_event events[ ROUTER_MAX_EVENTS ];
+	int nfds = 0;
+	int i;
 
 	// Loop until a signal handler sets router->stop
 	while( ! router->stop ) {
 
-		fd_set set;
-		int maxfd = _osrfRouterFillFDSet( router, &set );
-
 		// Wait indefinitely for an incoming message
-		if( (selectret = select(maxfd + 1, &set, NULL, NULL, NULL)) < 0 ) {
+		if( (nfds = epoll_wait( router->epoll_fd, events, ROUTER_MAX_EVENTS, -1 )) < 0 ) {
 			if( EINTR == errno ) {
 				if( router->stop ) {
 					osrfLogInfo(OSRF_LOG_MARK, "Router shutting down");
@@ -226,38 +348,43 @@ void osrfRouterRun( osrfRouter* router ) {
 				else
 					continue;    // Irrelevant signal; ignore it
 			} else {
-				osrfLogWarning( OSRF_LOG_MARK, "Top level select call failed with errno %d: %s",
+				osrfLogWarning( OSRF_LOG_MARK, "Top level epoll_wait call failed with errno %d: %s",
 						errno, strerror( errno ) );
 				break;
 			}
 		}
 
-		/* see if there is a top level router message */
-		if( FD_ISSET(routerfd, &set) ) {
-			osrfLogDebug( OSRF_LOG_MARK, "Top router socket is active: %d", routerfd );
-			osrfRouterHandleIncoming( router );
-		}
+		for( i = 0; i < nfds; ++i ) {
 
-		/* Check each of the connected classes and see if they have data to route */
-		osrfRouterClass* class;
-		osrfHashIterator* itr = router->class_itr;  // remove a layer of indirection
-		osrfHashIteratorReset( itr );
+			int sockfd = events[ i ].data.fd;
 
-		while( (class = osrfHashIteratorNext(itr)) ) {   // for each class
+			/* see if there is a top level router message */
+			if( sockfd == routerfd ) {
+				osrfLogDebug( OSRF_LOG_MARK, "Top router socket is active: %d", routerfd );
+				osrfRouterHandleIncoming( router );
+				continue;
+			}
 
-			const char* classname = osrfHashIteratorKey(itr);
+			// An earlier event in this batch may have removed the class,
+			// so look it up again instead of trusting a cached pointer.
+			osrfRouterClass* class = osrfListGetIndex( router->class_fds, sockfd );
+			if( !class )
+				continue;
 
-			if( classname ) {
+			osrfLogDebug( OSRF_LOG_MARK, "Socket is active: %d", sockfd );
 
-				osrfLogDebug( OSRF_LOG_MARK, "Checking %s for activity...", classname );
+			// Copy the class name; if the class gets deleted, class->classname goes with it.
+			char classname[ strlen( class->classname ) + 1 ];
+			strcpy( classname, class->classname );
+			osrfRouterClassHandleIncoming( router, classname, class );
 
-				int sockfd = client_sock_fd( class->connection );
-				if(FD_ISSET( sockfd, &set )) {
-					osrfLogDebug( OSRF_LOG_MARK, "Socket is active: %d", sockfd );
-					osrfRouterClassHandleIncoming( router, classname, class );
-				}
+			if( osrfRouterClassHungUp( router, class, sockfd, events[ i ].events ) ) {
+				osrfLogWarning(OSRF_LOG_MARK,
+					"Removing router class '%s' because of a bad top-level file descriptor [%d]",
+					classname, sockfd );
+				osrfRouterRemoveClass( router, classname );
 			}
-		} // end while
+		}
 	} // end while
 }
 
@@ -395,6 +522,9 @@ static void osrfRouterClassHandleIncoming( osrfRouter* router, const char* class
 	- "register" -- Add a server class and/or a server node to our lists.
 	- "unregister" -- Remove a node from a class, and the class as well if no nodes are
 	left for it.
+	- "load" -- Update what we know about the load on a node.
+
+	The body of a "register" or "load" command may carry a load hint for the node.
 */
 static void osrfRouterHandleCommand( osrfRouter* router, const transport_message* msg ) {
 	if(!(router && msg && msg->router_class)) return;
@@ -412,12 +542,20 @@ static void osrfRouterHandleCommand( osrfRouter* router, const transport_message
 		if(class && ! osrfRouterClassFindNode( class, msg->sender ) )
 			osrfRouterClassAddNode( class, msg->sender );
 
+		osrfRouterNodeSetLoad( osrfRouterClassFindNode( class, msg->sender ), msg->body );
+
 	} else if( !strcmp( msg->router_command, ROUTER_UNREGISTER ) ) {
 
 		if( msg->router_class && *msg->router_class ) {
 			osrfLogInfo( OSRF_LOG_MARK, "Unregistering router class %s", msg->router_class );
 			osrfRouterClassRemoveNode( router, msg->router_class, msg->sender );
 		}
+
+	} else if( !strcmp( msg->router_command, ROUTER_LOAD ) ) {
+
+		// Ignore hints from nodes that haven't registered
+		osrfRouterNodeSetLoad( osrfRouterClassFindNode(
+			osrfRouterFindClass( router, msg->router_class ), msg->sender ), msg->body );
 	}
 }
 
@@ -439,6 +577,8 @@ static osrfRouterClass* osrfRouterAddClass( osrfRouter* router, const char* clas
 	class->itr = osrfNewHashIterator(class->nodes);
 	osrfHashSetCallback(class->nodes, &osrfRouterNodeFree);
 	class->router = router;
+	class->classname = strdup( classname );
+	class->sock_fd = -1;
 
 	class->connection = client_init( router->domain, router->port, NULL, 0 );
 
@@ -453,6 +593,12 @@ static osrfRouterClass* osrfRouterAddClass( osrfRouter* router, const char* clas
 		return NULL;
 	}
 
+	// Watch the new socket from now on, so that the main loop sees its input
+	if( osrfRouterWatchClass( router, class, client_sock_fd( class->connection ) ) ) {
+		osrfRouterClassFree( (char *) classname, class );
+		return NULL;
+	}
+
 	osrfHashSet( router->classes, class, classname );
 	return class;
 }
@@ -472,6 +618,12 @@ static void osrfRouterClassAddNode( osrfRouterClass* rclass, const char* remoteI
 	node->count = 0;
 	node->lastMessage = NULL;
 	node->remoteId = strdup(remoteId);
+	node->capacity = 0;
+	node->outstanding = 0;
+	node->latency = 0.0;
+	node->pending = 0.0;
+	node->pending_since = get_timestamp_millis();
+	node->current_weight = 0;
 
 	osrfHashSet( rclass->nodes, node, remoteId );
 }
@@ -532,12 +684,9 @@ static transport_message* osrfRouterClassHandleBounce( osrfRouter* router,
 
 		if( node->lastMessage ) {
 			osrfLogDebug( OSRF_LOG_MARK, "Cloning lastMessage so next node can send it");
-			lastSent = message_init( node->lastMessage->body,
-				node->lastMessage->subject, node->lastMessage->thread, "",
+			// The node is about to go away, so the clone can take over its body
+			lastSent = message_forward( node->lastMessage, "",
 				node->lastMessage->router_from );
-			message_set_router_info( lastSent, node->lastMessage->router_from,
-				NULL, NULL, NULL, 0 );
-			message_set_osrf_xid( lastSent, node->lastMessage->osrf_xid );
 		}
 
 		/* remove the dead node */
@@ -553,32 +702,24 @@ static transport_message* osrfRouterClassHandleBounce( osrfRouter* router,
 	@param rclass Pointer to the class to which the message is directed.
 	@param msg Pointer to the message to be forwarded.
 
-	Pick a node for the specified class, and forward the message to it.
-
-	We use an iterator, stored with the class, to maintain a position in the class's list
-	of nodes.  Advance the iterator to pick the next node, and if we reach the end, go
-	back to the beginning of the list.
+	Pick a node for the specified class, according to the router's balancing policy, and
+	forward the message to it.  The forwarded copy takes over the body of @a msg, which is
+	left empty.
 */
 static void osrfRouterClassHandleMessage(
-		osrfRouter* router, osrfRouterClass* rclass, const transport_message* msg ) {
+		osrfRouter* router, osrfRouterClass* rclass, transport_message* msg ) {
 	if(!(router && rclass && msg)) return;
 
 	osrfLogDebug( OSRF_LOG_MARK, "osrfRouterClassHandleMessage()");
 
-	// Pick a node, in a round-robin.
-	osrfRouterNode* node = osrfHashIteratorNext( rclass->itr );
-	if(!node) {   // wrap around to the beginning of the list
-		osrfHashIteratorReset(rclass->itr);
-		node = osrfHashIteratorNext( rclass->itr );
-	}
+	osrfRouterNode* node = router->balance->pick( rclass );
 
 	if(node) {  // should always be true -- no class without a node
 
-		// Build a transport message
-		transport_message* new_msg = message_init( msg->body,
-				msg->subject, msg->thread, node->remoteId, msg->sender );
-		message_set_router_info( new_msg, msg->sender, NULL, NULL, NULL, 0 );
-		message_set_osrf_xid( new_msg, msg->osrf_xid );
+		// Build a transport message, taking over the body of the original
+		transport_message* new_msg = message_forward( msg, node->remoteId, msg->sender );
+		if( !new_msg )
+			return;
 
 		osrfLogInfo( OSRF_LOG_MARK,  "Routing message:\nfrom: [%s]\nto: [%s]",
 				new_msg->router_from, new_msg->recipient );
@@ -588,8 +729,11 @@ static void osrfRouterClassHandleMessage(
 		node->lastMessage = new_msg;
 
 		// Send it
-		if ( client_send_message( rclass->connection, new_msg ) == 0 )
+		if ( client_send_message( rclass->connection, new_msg ) == 0 ) {
 			node->count++;
+			osrfRouterNodeInFlight( node, get_timestamp_millis() );
+			node->pending += 1.0;
+		}
 
 		else {
 			message_prepare_xml(new_msg);
@@ -601,17 +745,237 @@ static void osrfRouterClassHandleMessage(
 }
 
 
+/**
+	@brief Apply a load hint from a listener to the corresponding node.
+	@param node Pointer to the osrfRouterNode (may be NULL).
+	@param hint The body of the message carrying the hint (may be NULL).
+
+	A hint is a JSON object with any of the following numeric members:
+	- "capacity" -- how many drones the listener may run.
+	- "busy" -- how many drones are busy.
+	- "backlog" -- how many requests are waiting for a drone.
+	- "latency" -- smoothed seconds per request.
+
+	Anything else, such as the plain text that older listeners send, or a member that isn't
+	a number, is ignored.  A hint of busy drones or backlog replaces our own reckoning of
+	the messages we've sent the node.
+*/
+static void osrfRouterNodeSetLoad( osrfRouterNode* node, const char* hint ) {
+	if(!(node && hint && '{' == *hint)) return;
+
+	jsonObject* load = jsonParse( hint );
+	if( !load || load->type != JSON_HASH ) {
+		jsonObjectFree( load );
+		return;
+	}
+
+	const jsonObject* capacity = jsonObjectGetKeyConst( load, "capacity" );
+	if( capacity && capacity->type == JSON_NUMBER )
+		node->capacity = (int) jsonObjectGetNumber( capacity );
+
+	const jsonObject* latency = jsonObjectGetKeyConst( load, "latency" );
+	if( latency && latency->type == JSON_NUMBER )
+		node->latency = jsonObjectGetNumber( latency );
+
+	const jsonObject* busy = jsonObjectGetKeyConst( load, "busy" );
+	if( busy && busy->type != JSON_NUMBER )
+		busy = NULL;
+	const jsonObject* backlog = jsonObjectGetKeyConst( load, "backlog" );
+	if( backlog && backlog->type != JSON_NUMBER )
+		backlog = NULL;
+	if( busy || backlog ) {
+		int outstanding = (int) ( jsonObjectGetNumber( busy )
+			+ jsonObjectGetNumber( backlog ) );
+		node->outstanding = outstanding > 0 ? outstanding : 0;
+		node->pending = 0.0;
+		node->pending_since = get_timestamp_millis();
+	}
+
+	jsonObjectFree( load );
+}
+
+/**
+	@brief Estimate how many requests a node has in flight.
+	@param node Pointer to the osrfRouterNode.
+	@param now The current time, from get_timestamp_millis().
+	@return The estimate.
+
+	Bring the node's pending count up to date by letting it decay, with the node's
+	advertised latency (or one second) as the time constant.
+*/
+static double osrfRouterNodeInFlight( osrfRouterNode* node, double now ) {
+	double elapsed = now - node->pending_since;
+	if( elapsed > 0.0 ) {
+		double tau = node->latency > 0.0 ? node->latency : 1.0;
+		node->pending *= tau / ( tau + elapsed );
+		node->pending_since = now;
+	}
+	return node->outstanding + node->pending;
+}
+
+/**
+	@brief Advance a class's iterator to the next node, wrapping around at the end.
+	@param rclass Pointer to the osrfRouterClass.
+	@return Pointer to the next osrfRouterNode, or NULL if the class has none.
+*/
+static osrfRouterNode* osrfRouterClassNextNode( osrfRouterClass* rclass ) {
+	osrfRouterNode* node = osrfHashIteratorNext( rclass->itr );
+	if(!node) {   // wrap around to the beginning of the list
+		osrfHashIteratorReset(rclass->itr);
+		node = osrfHashIteratorNext( rclass->itr );
+	}
+	return node;
+}
+
+/**
+	@brief Pick the node of a class that costs least, by a given measure.
+	@param rclass Pointer to the osrfRouterClass.
+	@param cost Function computing the cost of sending a node one more request, given its
+	requests in flight and its latency.
+	@return Pointer to the cheapest node, or NULL if the class has none.
+
+	Nodes that haven't advertised a latency are charged the average of those that have, or
+	one second if none have.  The scan starts one node further along each time, so that
+	ties go to each node in turn.
+*/
+static osrfRouterNode* osrfRouterClassPickBest( osrfRouterClass* rclass,
+		double (*cost)( osrfRouterNode* node, double in_flight, double latency ) ) {
+
+	int n = osrfHashGetCount( rclass->nodes );
+	if( n < 1 )
+		return NULL;
+
+	// Find the average advertised latency
+	double latency_sum = 0.0;
+	int latency_count = 0;
+	osrfRouterNode* node;
+	osrfHashIterator* itr = osrfNewHashIterator( rclass->nodes );
+	while( (node = osrfHashIteratorNext( itr )) ) {
+		if( node->latency > 0.0 ) {
+			latency_sum += node->latency;
+			++latency_count;
+		}
+	}
+	osrfHashIteratorFree( itr );
+	double default_latency = latency_count ? latency_sum / latency_count : 1.0;
+
+	double now = get_timestamp_millis();
+	osrfRouterNode* best = NULL;
+	double best_cost = 0.0;
+	int i;
+	for( i = 0; i < n; ++i ) {
+		node = osrfRouterClassNextNode( rclass );
+		double c = cost( node, osrfRouterNodeInFlight( node, now ),
+			node->latency > 0.0 ? node->latency : default_latency );
+		if( !best || c < best_cost ) {
+			best = node;
+			best_cost = c;
+		}
+	}
+
+	// Having gone all the way around, step once more to rotate the starting point
+	osrfRouterClassNextNode( rclass );
+	return best;
+}
+
+/**
+	@brief Balancing policy: pick each node of a class in turn.
+	@param rclass Pointer to the osrfRouterClass.
+	@return Pointer to the chosen node, or NULL if the class has none.
+
+	We use an iterator, stored with the class, to maintain a position in the class's list
+	of nodes.
+*/
+static osrfRouterNode* osrfRouterPickRoundRobin( osrfRouterClass* rclass ) {
+	return osrfRouterClassNextNode( rclass );
+}
+
+/**
+	@brief Balancing policy: pick the node with the fewest requests in flight per drone.
+	@param rclass Pointer to the osrfRouterClass.
+	@return Pointer to the chosen node, or NULL if the class has none.
+*/
+static osrfRouterNode* osrfRouterPickLeastOutstanding( osrfRouterClass* rclass ) {
+	return osrfRouterClassPickBest( rclass, osrfRouterOutstandingCost );
+}
+
+/**
+	@brief Balancing policy: pick the node where a request can expect the shortest wait.
+	@param rclass Pointer to the osrfRouterClass.
+	@return Pointer to the chosen node, or NULL if the class has none.
+*/
+static osrfRouterNode* osrfRouterPickLatency( osrfRouterClass* rclass ) {
+	return osrfRouterClassPickBest( rclass, osrfRouterLatencyCost );
+}
+
+/**
+	@brief Balancing policy: round-robin in proportion to advertised capacity.
+	@param rclass Pointer to the osrfRouterClass.
+	@return Pointer to the chosen node, or NULL if the class has none.
+
+	This is the "smooth" weighted round-robin: on each pick, every node's running total
+	grows by its weight; the node with the largest total wins, and gives back the sum of
+	all the weights.  The result interleaves the nodes instead of sending each one its
+	share in a burst.
+*/
+static osrfRouterNode* osrfRouterPickWeighted( osrfRouterClass* rclass ) {
+	osrfRouterNode* best = NULL;
+	osrfRouterNode* node;
+	int total = 0;
+
+	osrfHashIterator* itr = osrfNewHashIterator( rclass->nodes );
+	while( (node = osrfHashIteratorNext( itr )) ) {
+		int weight = node->capacity > 0 ? node->capacity : ROUTER_DEFAULT_CAPACITY;
+		node->current_weight += weight;
+		total += weight;
+		if( !best || node->current_weight > best->current_weight )
+			best = node;
+	}
+	osrfHashIteratorFree( itr );
+
+	if( best )
+		best->current_weight -= total;
+	return best;
+}
+
+/**
+	@brief Cost function for the least-outstanding policy.
+	@param node Pointer to the osrfRouterNode.
+	@param in_flight Estimated requests in flight at the node.
+	@param latency The node's latency (not used).
+	@return Requests in flight per drone, counting the one we're about to send.
+*/
+static double osrfRouterOutstandingCost( osrfRouterNode* node, double in_flight,
+		double latency ) {
+	int capacity = node->capacity > 0 ? node->capacity : ROUTER_DEFAULT_CAPACITY;
+	return ( in_flight + 1.0 ) / capacity;
+}
+
+/**
+	@brief Cost function for the latency policy.
+	@param node Pointer to the osrfRouterNode.
+	@param in_flight Estimated requests in flight at the node.
+	@param latency The node's latency, in seconds.
+	@return Expected seconds until a request sent now would be done.
+*/
+static double osrfRouterLatencyCost( osrfRouterNode* node, double in_flight,
+		double latency ) {
+	return osrfRouterOutstandingCost( node, in_flight, latency ) * latency;
+}
+
 /**
 	@brief Remove a given osrfRouterClass from an osrfRouter
 	@param router Pointer to the osrfRouter.
 	@param classname The name of the class to be removed.
 
-	Delete an osrfRouterClass from the router's list of classes.  Indirectly (via a callback
-	function installed in the osrfHash), free the osrfRouterClass and any associated nodes.
+	Stop watching the class's socket, and delete the osrfRouterClass from the router's list
+	of classes.  Indirectly (via a callback function installed in the osrfHash), free the
+	osrfRouterClass and any associated nodes.
 */
 static void osrfRouterRemoveClass( osrfRouter* router, const char* classname ) {
 	if( router && router->classes && classname ) {
 		osrfLogInfo( OSRF_LOG_MARK, "Removing router class %s", classname );
+		osrfRouterUnwatchClass( router, osrfRouterFindClass( router, classname ) );
 		osrfHashRemove( router->classes, classname );
 	}
 }
@@ -665,6 +1029,7 @@ static void osrfRouterClassFree( char* classname, void* c ) {
 	osrfHashIteratorFree(rclass->itr);
 	osrfHashFree(rclass->nodes);
 
+	free(rclass->classname);
 	free(rclass);
 }
 
@@ -696,6 +1061,9 @@ void osrfRouterFree( osrfRouter* router ) {
 
 	osrfHashIteratorFree( router->class_itr);
 	osrfHashFree(router->classes);
+	osrfListFree( router->class_fds );
+	if( router->epoll_fd >= 0 )
+		close( router->epoll_fd );
 	free(router->domain);
 	free(router->name);
 	free(router->resource);
@@ -736,48 +1104,91 @@ static osrfRouterNode* osrfRouterClassFindNode( osrfRouterClass* rclass,
 
 
 /**
-	@brief Fill an fd_set with all the sockets owned by the osrfRouter.
-	@param router Pointer to the osrfRouter whose sockets are to be used.
-	@param set Pointer to the fd_set that is to be filled.
-	@return The largest file descriptor loaded into the fd_set; or -1 upon error.
+	@brief Register a socket with the router's epoll instance.
+	@param router Pointer to the osrfRouter.
+	@param fd File descriptor of the socket to be watched.
+	@return 0 if successful, or -1 upon error.
 
-	There's one socket for the osrfRouter as a whole, and one for each osrfRouterClass
-	that belongs to it.  We load them all.
+	We ask for edge-triggered notification of input, so the socket must be read until it
+	would block each time it is reported ready.  We also ask to hear when the peer hangs
+	up, which osrfRouterClassHungUp() looks for.
 */
-static int _osrfRouterFillFDSet( osrfRouter* router, fd_set* set ) {
-	if(!(router && router->classes && set)) return -1;
+static int osrfRouterWatchFD( osrfRouter* router, int fd ) {
+	if(!(router && fd > 0)) return -1;
 
-	FD_ZERO(set);
-	int maxfd = client_sock_fd( router->connection );
-	FD_SET(maxfd, set);
+	struct epoll_event ev;
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = fd;
 
-	int sockid;
+	if( epoll_ctl( router->epoll_fd, EPOLL_CTL_ADD, fd, &ev ) ) {
+		osrfLogError( OSRF_LOG_MARK, "Unable to watch socket %d: %s", fd, strerror( errno ) );
+		return -1;
+	}
 
-	osrfRouterClass* class = NULL;
-	osrfHashIterator* itr = router->class_itr;
-	osrfHashIteratorReset( itr );
+	return 0;
+}
 
-	while( (class = osrfHashIteratorNext(itr)) ) {
-		const char* classname = osrfHashIteratorKey(itr);
+/**
+	@brief Watch the socket belonging to an osrfRouterClass.
+	@param router Pointer to the osrfRouter.
+	@param rclass Pointer to the osrfRouterClass.
+	@param fd File descriptor of the class's socket.
+	@return 0 if successful, or -1 upon error.
 
-		if( classname && (class = osrfRouterFindClass( router, classname )) ) {
-			sockid = client_sock_fd( class->connection );
+	Register the socket with the router's epoll instance, and map its descriptor to the
+	class, so that the main loop can tell which class a ready socket belongs to.
+*/
+static int osrfRouterWatchClass( osrfRouter* router, osrfRouterClass* rclass, int fd ) {
+	if(!(router && rclass)) return -1;
 
-			if( osrfUtilsCheckFileDescriptor( sockid ) ) {
+	if( osrfRouterWatchFD( router, fd ) )
+		return -1;
 
-				osrfLogWarning(OSRF_LOG_MARK,
-					"Removing router class '%s' because of a bad top-level file descriptor [%d]",
-					classname, sockid );
-				osrfRouterRemoveClass( router, classname );
+	rclass->sock_fd = fd;
+	osrfListSet( router->class_fds, rclass, fd );
+	return 0;
+}
 
-			} else {
-				if( sockid > maxfd ) maxfd = sockid;
-				FD_SET(sockid, set);
-			}
-		}
+/**
+	@brief Stop watching the socket belonging to an osrfRouterClass.
+	@param router Pointer to the osrfRouter.
+	@param rclass Pointer to the osrfRouterClass whose socket is no longer to be watched.
+
+	The socket may already have been closed, in which case the kernel has dropped it from
+	the epoll set on its own, and its descriptor may even have been reused by a newer class.
+	So we only touch the registration if the descriptor still maps to this class.
+*/
+static void osrfRouterUnwatchClass( osrfRouter* router, osrfRouterClass* rclass ) {
+	if(!(router && rclass && rclass->sock_fd > 0)) return;
+
+	if( osrfListGetIndex( router->class_fds, rclass->sock_fd ) == rclass ) {
+		epoll_ctl( router->epoll_fd, EPOLL_CTL_DEL, rclass->sock_fd, NULL );
+		osrfListRemove( router->class_fds, rclass->sock_fd );
 	}
+	rclass->sock_fd = -1;
+}
+
+/**
+	@brief Determine whether the peer of a class's socket has gone away.
+	@param router Pointer to the osrfRouter.
+	@param rclass Pointer to the osrfRouterClass that the socket belonged to.
+	@param fd File descriptor of the socket.
+	@param events The events that epoll reported for the socket.
+	@return Non-zero if the class should be removed; otherwise zero.
+
+	Called after the class has read whatever input was waiting.  By then the class may be
+	gone, or its descriptor taken by another class, in which case there's nothing to do.
+	Otherwise the peer is gone if epoll reported a hangup or an error, or if the socket
+	has been closed underneath the class.
+*/
+static int osrfRouterClassHungUp( osrfRouter* router, osrfRouterClass* rclass,
+		int fd, uint32_t events ) {
+	if( osrfListGetIndex( router->class_fds, fd ) != rclass )
+		return 0;
 
-	return maxfd;
+	return ( events & ( EPOLLHUP | EPOLLRDHUP | EPOLLERR ) )
+		|| osrfUtilsCheckFileDescriptor( fd );
 }
 
 /**
@@ -881,6 +1292,7 @@ static void osrfRouterRespondConnect( osrfRouter* router, const transport_messag
 	- "opensrf.router.info.stats.class" -- count for every node of a specified class.
 	- "opensrf.router.info.stats.class.all" -- count for every node of every class.
 	- "opensrf.router.info.stats.class.node.all" -- total count for every class.
+	- "opensrf.router.info.stats.class.load" -- load on every node of every class.
 */
 static void osrfRouterProcessAppRequest( osrfRouter* router, const transport_message* msg,
 		const osrfMessage* omsg ) {
@@ -1003,6 +1415,44 @@ static void osrfRouterProcessAppRequest( osrfRouter* router, const transport_mes
 
 		osrfHashIteratorFree(class_itr);
 
+	} else if(!strcmp( omsg->method_name, ROUTER_REQUEST_STATS_LOAD )) {
+
+		// Prepare a hash of hashes of hashes.  For each class, for each node: the count,
+		// what we think is in flight, and what the node last told us about itself.
+
+		osrfRouterClass* class;
+		osrfRouterNode* node;
+		double now = get_timestamp_millis();
+		jresponse = jsonNewObjectType(JSON_HASH);  // Key: class name.
+
+		osrfHashIterator* class_itr = osrfNewHashIterator(router->classes);
+		while( (class = osrfHashIteratorNext(class_itr)) ) {
+
+			jsonObject* class_res = jsonNewObjectType(JSON_HASH);  // Key: remoteId of node.
+			const char* classname = osrfHashIteratorKey(class_itr);
+
+			osrfHashIterator* node_itr = osrfNewHashIterator(class->nodes);
+			while( (node = osrfHashIteratorNext(node_itr)) ) {
+				jsonObject* node_res = jsonNewObjectType(JSON_HASH);
+				jsonObjectSetKey( node_res, "count",
+						jsonNewNumberObject( (double) node->count ) );
+				jsonObjectSetKey( node_res, "in_flight",
+						jsonNewNumberObject( osrfRouterNodeInFlight( node, now ) ) );
+				jsonObjectSetKey( node_res, "outstanding",
+						jsonNewNumberObject( (double) node->outstanding ) );
+				jsonObjectSetKey( node_res, "capacity",
+						jsonNewNumberObject( (double) node->capacity ) );
+				jsonObjectSetKey( node_res, "latency",
+						jsonNewNumberObject( node->latency ) );
+				jsonObjectSetKey( class_res, node->remoteId, node_res );
+			}
+			osrfHashIteratorFree(node_itr);
+
+			jsonObjectSetKey( jresponse, classname, class_res );
+		}
+
+		osrfHashIteratorFree(class_itr);
+
 	} else {  // None of the above
 
 		osrfRouterHandleMethodNFound( router, msg, omsg );
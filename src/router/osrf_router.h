@@ -7,8 +7,10 @@
 
 	The router receives messages from clients and passes each one to a listener for the
 	targeted service.  Where there are multiple listeners for the same service, the router
-	picks one on a round-robin basis.  If a message bounces because the listener has died,
-	the router sends it to another listener for the same service, if one is available.
+	picks one according to a configurable balancing policy: round-robin by default, or
+	based on the load that the listeners report.  If a message bounces because the listener
+	has died, the router sends it to another listener for the same service, if one is
+	available.
 
 	The server's response to the client, if any, bypasses the router.  If the server needs to
 	set up a stateful session with a client, it does so directly (well, via Jabber).  Only the
@@ -44,6 +46,8 @@ void osrfRouterRun( osrfRouter* router );
 
 void router_stop( osrfRouter* router );
 
+int osrfRouterSetBalance( osrfRouter* router, const char* name );
+
 void osrfRouterFree( osrfRouter* router );
 
 #ifdef __cplusplus
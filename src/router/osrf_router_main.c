@@ -258,6 +258,7 @@ static void setupRouter( const jsonObject* configChunk, int configPos ) {
 	const char* log_file = jsonObjectGetString( jsonObjectGetKeyConst( configChunk, "logfile" ));
 	const char* log_tag  = jsonObjectGetString( jsonObjectGetKeyConst( configChunk, "logtag" ));
 	const char* facility = jsonObjectGetString( jsonObjectGetKeyConst( configChunk, "syslog" ));
+	const char* balance  = jsonObjectGetString( jsonObjectGetKeyConst( configChunk, "balance" ));
 
 	int llevel = 1;
 	if(level) llevel = atoi(level);
@@ -329,6 +330,9 @@ static void setupRouter( const jsonObject* configChunk, int configPos ) {
 	router = osrfNewRouter( server,
 			username, resource, password, iport, tclients, tservers );
 
+	if( balance )
+		osrfRouterSetBalance( router, balance );
+
 	signal(SIGHUP,routerSignalHandler);
 	signal(SIGINT,routerSignalHandler);
 	signal(SIGTERM,routerSignalHandler);
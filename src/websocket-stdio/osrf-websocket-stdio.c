@@ -257,6 +257,8 @@ static void child_init(int argc, char* argv[]) {
     }
 
 	osrf_handle = osrfSystemGetTransportClient();
+    // read_one_osrf_message() parses the text of each body itself
+    session_set_body_parsing(osrf_handle->session, 0);
 	osrfAppSessionSetIngress(WEBSOCKET_INGRESS);
 
     osrf_router = osrfConfigGetValue(NULL, "/router_name");
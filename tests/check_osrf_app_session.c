@@ -0,0 +1,452 @@
+#include <check.h>
+#include "opensrf/osrf_app_session.h"
+
+//How many requests to keep pending at once
+#define PENDING 5000
+
+osrfAppSession *a_session;
+int dummy_client;
+
+// Stub functions to isolate osrf_app_session.c from the network: sessions get a
+// transport_client that is never used, sending always succeeds, and nothing ever
+// arrives
+
+transport_client* osrfSystemGetTransportClient(void) {
+  return (transport_client*) &dummy_client;
+}
+
+char* osrf_settings_host_value(const char* path, ...) {
+  return NULL;
+}
+
+int client_send_message(transport_client* client, transport_message* msg) {
+  return 0;
+}
+
+int osrf_stack_process_ms(transport_client* client, int timeout_ms, int* msg_received) {
+  if (msg_received)
+    *msg_received = 0;
+  return 0;
+}
+
+//Set up the test fixture
+void setup(void) {
+  a_session = osrf_app_server_session_init("session", "service", "remote");
+  a_session->state = OSRF_SESSION_CONNECTED;
+}
+
+//Clean up the test fixture
+void teardown(void) {
+  osrfAppSessionFree(a_session);
+}
+
+static int send_request(void) {
+  return osrfAppSessionSendRequest(a_session, NULL, "opensrf.system.echo", 1);
+}
+
+//True if the session has a pending request with the given id
+static int is_pending(int request_id) {
+  return osrfAppSessionSetResultHandler(a_session, request_id, NULL, NULL) == 0;
+}
+
+//Queue a result for a request, as if it had arrived
+static void push_result(osrfAppSession *session, int request_id) {
+  osrfMessage *msg = osrf_message_init(RESULT, request_id, 1);
+  osrf_message_set_status_info(msg, NULL, "OK", OSRF_STATUS_OK);
+  osrf_message_set_result_content(msg, "\"result\"");
+  osrf_app_session_push_queue(session, msg);
+}
+
+//Queue a result carrying a number, as if it had arrived
+static void push_number(osrfAppSession *session, int request_id, int n) {
+  char content[16];
+  snprintf(content, sizeof(content), "%d", n);
+  osrfMessage *msg = osrf_message_init(RESULT, request_id, 1);
+  osrf_message_set_status_info(msg, NULL, "OK", OSRF_STATUS_OK);
+  osrf_message_set_result_content(msg, content);
+  osrf_app_session_push_queue(session, msg);
+}
+
+//The number carried by a result, or -1 if there's no result
+static int result_number(osrfMessage *msg) {
+  int n = msg ? (int) jsonObjectGetNumber(msg->_result_content) : -1;
+  osrfMessageFree(msg);
+  return n;
+}
+
+//The numbers passed to a result handler, in the order they came
+int handled[32];
+int n_handled;
+
+static void collect_result(osrfAppSession *session, osrfMessage *msg, void *data) {
+  fail_unless(session == a_session && data == &n_handled,
+      "A result handler should get its session and data");
+  if (n_handled < sizeof(handled) / sizeof(handled[0]))
+    handled[n_handled++] = result_number(msg);
+  else
+    osrfMessageFree(msg);
+}
+
+// BEGIN TESTS
+
+START_TEST(test_osrf_app_session_ManyRequests)
+{
+  int i;
+  for (i = 1; i <= PENDING; ++i)
+    fail_unless(send_request() == i,
+        "osrfAppSessionSendRequest should number requests in sequence");
+
+  for (i = 1; i <= PENDING; ++i)
+    fail_unless(is_pending(i), "Every request should be pending");
+  fail_if(is_pending(0), "Request 0 was never sent");
+  fail_if(is_pending(PENDING + 1), "Request PENDING + 1 was never sent");
+  fail_if(is_pending(-PENDING), "Request -PENDING was never sent");
+
+  //Finish the odd-numbered requests
+  for (i = 1; i <= PENDING; i += 2)
+    osrf_app_session_request_finish(a_session, i);
+  for (i = 1; i <= PENDING; ++i)
+    fail_unless(is_pending(i) == !(i % 2),
+        "Only the even-numbered requests should still be pending");
+
+  //Finishing an unknown request does nothing
+  osrf_app_session_request_finish(a_session, 1);
+  osrf_app_session_request_finish(a_session, PENDING + 1);
+  fail_unless(is_pending(2), "Request 2 should still be pending");
+
+  //A result reaches its own request, and no other
+  for (i = 2; i <= PENDING; i += 2)
+    push_result(a_session, i);
+  for (i = 2; i <= PENDING; i += 2) {
+    osrfMessage *msg = osrfAppSessionRequestRecvMs(a_session, i, 0);
+    fail_unless(msg != NULL && msg->thread_trace == i,
+        "Each request should receive its own result");
+    osrfMessageFree(msg);
+    fail_unless(osrfAppSessionRequestRecvMs(a_session, i, 0) == NULL,
+        "Each request should receive one result");
+  }
+
+  osrf_app_session_set_complete(a_session, PENDING);
+  fail_unless(osrf_app_session_request_complete(a_session, PENDING),
+      "osrf_app_session_set_complete should mark the request complete");
+  fail_if(osrf_app_session_request_complete(a_session, PENDING - 2),
+      "osrf_app_session_set_complete should mark no other request complete");
+
+  //New requests go on pending alongside the old
+  for (i = PENDING + 1; i <= 2 * PENDING; ++i)
+    fail_unless(send_request() == i,
+        "osrfAppSessionSendRequest should number requests in sequence");
+  for (i = 1; i <= 2 * PENDING; ++i)
+    fail_unless(is_pending(i) == (i > PENDING || !(i % 2)),
+        "The new requests and the even-numbered old ones should be pending");
+
+  for (i = 1; i <= 2 * PENDING; ++i)
+    osrf_app_session_request_finish(a_session, i);
+  for (i = 1; i <= 2 * PENDING; ++i)
+    fail_if(is_pending(i), "No request should be pending");
+
+  fail_unless(send_request() == 2 * PENDING + 1 && is_pending(2 * PENDING + 1),
+      "A session should take new requests after finishing all the old ones");
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_ScatteredRequests)
+{
+  //Request ids that share their low bits compete for the same slots
+  int ids[PENDING];
+  int i;
+  for (i = 0; i < PENDING; ++i) {
+    a_session->thread_trace = (i % 4) * 1048576 + i * 64 - 1;
+    ids[i] = send_request();
+  }
+
+  //Finish a scattering of them, and send more
+  for (i = 0; i < PENDING; i += 3)
+    osrf_app_session_request_finish(a_session, ids[i]);
+  a_session->thread_trace = 0;
+  for (i = 0; i < 100; ++i)
+    send_request();
+
+  for (i = 0; i < PENDING; ++i)
+    fail_unless(is_pending(ids[i]) == (i % 3 != 0),
+        "Only the unfinished requests should be pending");
+  for (i = 1; i <= 100; ++i)
+    fail_unless(is_pending(i), "The later requests should be pending");
+  fail_if(is_pending(ids[1] + 1), "A request that was never sent should not be pending");
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_WaitAny)
+{
+  osrfAppRequestHandle handles[3];
+  int i;
+  for (i = 0; i < 3; ++i) {
+    handles[i].session = a_session;
+    handles[i].request_id = send_request();
+  }
+
+  //Nothing ever arrives, so the time runs out
+  double start = get_timestamp_millis();
+  fail_unless(osrfAppSessionWaitAnyMs(handles, 3, 20) == -1,
+      "osrfAppSessionWaitAnyMs should return -1 when the time runs out");
+  fail_unless(get_timestamp_millis() - start >= 0.015,
+      "osrfAppSessionWaitAnyMs should wait out the timeout");
+  fail_unless(osrfAppSessionWaitAnyMs(handles, 3, 0) == -1,
+      "osrfAppSessionWaitAnyMs should look once with a timeout of zero");
+
+  //A request that's already complete is ready at once
+  osrf_app_session_set_complete(a_session, handles[1].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 3, 0), 1);
+
+  //So is one with a result waiting, and the first one ready wins
+  push_result(a_session, handles[2].request_id);
+  handles[1].session = NULL;
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 3, 0), 2);
+  ck_assert_int_eq(osrfAppSessionWaitAny(handles, 3, 1), 2);
+
+  //A request that's been finished counts as complete
+  osrf_app_session_request_finish(a_session, handles[0].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 3, 0), 0);
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_WaitAll)
+{
+  osrfAppRequestHandle handles[3];
+  int i;
+  for (i = 0; i < 3; ++i) {
+    handles[i].session = a_session;
+    handles[i].request_id = send_request();
+  }
+
+  fail_unless(osrfAppSessionWaitAllMs(handles, 3, 0) == -1,
+      "osrfAppSessionWaitAllMs should return -1 when the time runs out");
+
+  //A result isn't enough; every request must be complete
+  push_result(a_session, handles[0].request_id);
+  osrf_app_session_set_complete(a_session, handles[1].request_id);
+  fail_unless(osrfAppSessionWaitAllMs(handles, 3, 0) == -1,
+      "osrfAppSessionWaitAllMs should wait for every request to be complete");
+
+  osrf_app_session_set_complete(a_session, handles[0].request_id);
+  osrf_app_session_request_finish(a_session, handles[2].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAllMs(handles, 3, 0), 0);
+  ck_assert_int_eq(osrfAppSessionWaitAll(handles, 3, 1), 0);
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_WaitDuplicates)
+{
+  //The same request twice, and another
+  osrfAppRequestHandle handles[3];
+  handles[0].session = handles[1].session = handles[2].session = a_session;
+  handles[0].request_id = handles[1].request_id = send_request();
+  handles[2].request_id = send_request();
+
+  osrf_app_session_set_complete(a_session, handles[0].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 3, 0), 0);
+  handles[0].session = NULL;
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 3, 0), 1);
+
+  handles[0].session = a_session;
+  fail_unless(osrfAppSessionWaitAllMs(handles, 3, 0) == -1,
+      "A duplicate handle shouldn't stand in for another request");
+  osrf_app_session_set_complete(a_session, handles[2].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAllMs(handles, 3, 0), 0);
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_WaitSessions)
+{
+  //Each session numbers its requests from 1, so the ids are the same
+  osrfAppSession *b_session = osrf_app_server_session_init("session2", "service", "remote");
+  b_session->state = OSRF_SESSION_CONNECTED;
+  osrfAppRequestHandle handles[2];
+  handles[0].session = a_session;
+  handles[0].request_id = send_request();
+  handles[1].session = b_session;
+  handles[1].request_id = osrfAppSessionSendRequest(b_session, NULL, "opensrf.system.echo", 1);
+  ck_assert_int_eq(handles[0].request_id, handles[1].request_id);
+
+  //Each handle looks only at its own session
+  push_result(b_session, handles[1].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 2, 0), 1);
+  osrf_app_session_set_complete(b_session, handles[1].request_id);
+  fail_unless(osrfAppSessionWaitAllMs(handles, 2, 0) == -1,
+      "A request in one session shouldn't stand in for one in another");
+
+  osrf_app_session_set_complete(a_session, handles[0].request_id);
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 2, 0), 0);
+  ck_assert_int_eq(osrfAppSessionWaitAllMs(handles, 2, 0), 0);
+  osrfAppSessionFree(b_session);
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_WaitNothing)
+{
+  //With nothing to wait on, nothing is ready, and everything is complete
+  osrfAppRequestHandle handles[1];
+  handles[0].session = a_session;
+  handles[0].request_id = send_request();
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 0, 0), -1);
+  ck_assert_int_eq(osrfAppSessionWaitAllMs(handles, 0, 0), 0);
+
+  handles[0].session = NULL;
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(handles, 1, 0), -1);
+  ck_assert_int_eq(osrfAppSessionWaitAllMs(handles, 1, 0), 0);
+
+  ck_assert_int_eq(osrfAppSessionWaitAnyMs(NULL, 1, 0), -1);
+  ck_assert_int_eq(osrfAppSessionWaitAllMs(NULL, 1, 0), -1);
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_RequestRecvMs)
+{
+  int request_id = send_request();
+
+  //Nothing arrives, so a timeout of a fraction of a second runs out
+  long long start = get_monotonic_millis();
+  fail_unless(osrfAppSessionRequestRecvMs(a_session, request_id, 30) == NULL,
+      "osrfAppSessionRequestRecvMs should return NULL when the time runs out");
+  long long waited = get_monotonic_millis() - start;
+  fail_unless(waited >= 30 && waited < 1000,
+      "osrfAppSessionRequestRecvMs should wait out a timeout of less than a second");
+
+  //A timeout of zero doesn't wait, in milliseconds or seconds
+  start = get_monotonic_millis();
+  fail_unless(osrfAppSessionRequestRecvMs(a_session, request_id, 0) == NULL
+      && osrfAppSessionRequestRecv(a_session, request_id, 0) == NULL,
+      "There should be no result");
+  fail_unless(get_monotonic_millis() - start < 30, "A timeout of zero should not wait");
+
+  //A result already queued comes back at once
+  push_result(a_session, request_id);
+  start = get_monotonic_millis();
+  osrfMessage *msg = osrfAppSessionRequestRecvMs(a_session, request_id, 5000);
+  fail_unless(msg != NULL && msg->thread_trace == request_id,
+      "osrfAppSessionRequestRecvMs should return a queued result");
+  fail_unless(get_monotonic_millis() - start < 1000, "A queued result should not wait");
+  osrfMessageFree(msg);
+
+  fail_unless(osrfAppSessionRequestRecvMs(a_session, -1, 0) == NULL
+      && osrfAppSessionRequestRecvMs(NULL, request_id, 0) == NULL,
+      "osrfAppSessionRequestRecvMs should reject a bad request");
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_ResultHandler)
+{
+  n_handled = 0;
+  int request_id = send_request();
+  int other_id = send_request();
+  ck_assert_int_eq(osrfAppSessionSetResultHandler(a_session, request_id,
+      collect_result, &n_handled), 0);
+
+  //Each result goes to the handler as it arrives, in order, and isn't queued
+  push_number(a_session, request_id, 1);
+  ck_assert_int_eq(n_handled, 1);
+  push_number(a_session, request_id, 2);
+  push_number(a_session, request_id, 3);
+  ck_assert_int_eq(n_handled, 3);
+  fail_unless(handled[0] == 1 && handled[1] == 2 && handled[2] == 3,
+      "The handler should see the results in the order they arrived");
+  fail_unless(osrfAppSessionRequestRecvMs(a_session, request_id, 0) == NULL,
+      "Results passed to a handler should not be queued");
+
+  //Another request's results are queued as usual
+  push_number(a_session, other_id, 4);
+  ck_assert_int_eq(n_handled, 3);
+  ck_assert_int_eq(result_number(osrfAppSessionRequestRecvMs(a_session, other_id, 0)), 4);
+
+  fail_unless(osrfAppSessionSetResultHandler(a_session, -1, collect_result, NULL) == -1
+      && osrfAppSessionSetResultHandler(NULL, request_id, collect_result, NULL) == -1,
+      "There is no handler for a request that doesn't exist");
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_ResultHandlerFlush)
+{
+  n_handled = 0;
+  int request_id = send_request();
+
+  //Results already queued go to a new handler at once, oldest first
+  push_number(a_session, request_id, 1);
+  push_number(a_session, request_id, 2);
+  push_number(a_session, request_id, 3);
+  ck_assert_int_eq(n_handled, 0);
+  osrfAppSessionSetResultHandler(a_session, request_id, collect_result, &n_handled);
+  ck_assert_int_eq(n_handled, 3);
+  fail_unless(handled[0] == 1 && handled[1] == 2 && handled[2] == 3,
+      "Queued results should go to the handler in order");
+
+  //and later ones follow them
+  push_number(a_session, request_id, 4);
+  ck_assert_int_eq(n_handled, 4);
+  ck_assert_int_eq(handled[3], 4);
+
+  //Without the handler, results are queued again
+  osrfAppSessionSetResultHandler(a_session, request_id, NULL, NULL);
+  push_number(a_session, request_id, 5);
+  ck_assert_int_eq(n_handled, 4);
+  ck_assert_int_eq(result_number(osrfAppSessionRequestRecvMs(a_session, request_id, 0)), 5);
+}
+END_TEST
+
+START_TEST(test_osrf_app_session_ResultOrder)
+{
+  int request_id = send_request();
+  int i;
+
+  //Queued results come out in the order they went in
+  for (i = 1; i <= 10; ++i)
+    push_number(a_session, request_id, i);
+  for (i = 1; i <= 4; ++i)
+    ck_assert_int_eq(result_number(osrfAppSessionRequestRecvMs(a_session, request_id, 0)), i);
+
+  //including those added while some are still waiting
+  push_number(a_session, request_id, 11);
+  for (i = 5; i <= 11; ++i)
+    ck_assert_int_eq(result_number(osrfAppSessionRequestRecvMs(a_session, request_id, 0)), i);
+  fail_unless(osrfAppSessionRequestRecvMs(a_session, request_id, 0) == NULL,
+      "The queue should be empty");
+
+  //and those added once the queue has emptied
+  push_number(a_session, request_id, 12);
+  push_number(a_session, request_id, 13);
+  ck_assert_int_eq(result_number(osrfAppSessionRequestRecvMs(a_session, request_id, 0)), 12);
+  ck_assert_int_eq(result_number(osrfAppSessionRequestRecvMs(a_session, request_id, 0)), 13);
+  fail_unless(osrfAppSessionRequestRecvMs(a_session, request_id, 0) == NULL,
+      "The queue should be empty again");
+}
+END_TEST
+
+//END TESTS
+
+Suite *osrf_app_session_suite(void) {
+  //Create test suite, test case, initialize fixture
+  Suite *s = suite_create("osrf_app_session");
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_checked_fixture(tc_core, setup, teardown);
+
+  //Add tests to test case
+  tcase_add_test(tc_core, test_osrf_app_session_ManyRequests);
+  tcase_add_test(tc_core, test_osrf_app_session_ScatteredRequests);
+  tcase_add_test(tc_core, test_osrf_app_session_WaitAny);
+  tcase_add_test(tc_core, test_osrf_app_session_WaitAll);
+  tcase_add_test(tc_core, test_osrf_app_session_WaitDuplicates);
+  tcase_add_test(tc_core, test_osrf_app_session_WaitSessions);
+  tcase_add_test(tc_core, test_osrf_app_session_WaitNothing);
+  tcase_add_test(tc_core, test_osrf_app_session_RequestRecvMs);
+  tcase_add_test(tc_core, test_osrf_app_session_ResultHandler);
+  tcase_add_test(tc_core, test_osrf_app_session_ResultHandlerFlush);
+  tcase_add_test(tc_core, test_osrf_app_session_ResultOrder);
+
+  //Add test case to test suite
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+void run_tests(SRunner *sr) {
+  srunner_add_suite(sr, osrf_app_session_suite());
+}
@@ -0,0 +1,490 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "opensrf/osrf_hash.h"
+
+osrfHash *testOsrfHash;
+int globalItem1 = 7;
+int globalItem2 = 11;
+int globalItem3 = 15;
+
+//Keep track of how many items have been freed using osrfCustomHashFree
+unsigned int freedItemsSize;
+
+//Define a custom freeing function for hash items
+void osrfCustomHashFree(char *key, void *item) {
+  freedItemsSize++;
+}
+
+//Allocator for osrfHashFromPairs: remember every block so we can free them all
+static void *pairBlocks[16];
+static int pairBlockCount;
+
+static void *pairAlloc(void *ctx, size_t size) {
+  void *block = malloc(size);
+  pairBlocks[pairBlockCount++] = block;
+  return block;
+}
+
+static void pairFree(void) {
+  while (pairBlockCount > 0)
+    free(pairBlocks[--pairBlockCount]);
+}
+
+//Set up the test fixture
+void setup(void) {
+  freedItemsSize = 0;
+  pairBlockCount = 0;
+  //Set up a hash with three items, in a known order
+  testOsrfHash = osrfNewHash();
+  osrfHashSet(testOsrfHash, &globalItem1, "key1");
+  osrfHashSet(testOsrfHash, &globalItem2, "key2");
+  osrfHashSet(testOsrfHash, &globalItem3, "key3");
+}
+
+//Clean up the test fixture
+void teardown(void) {
+  osrfHashFree(testOsrfHash);
+  pairFree();
+}
+
+// BEGIN TESTS
+
+START_TEST(test_osrf_hash_osrfNewHash)
+{
+  osrfHash *newHash = osrfNewHash();
+  fail_if(newHash == NULL, "osrfHash object not successfully created");
+  fail_unless(osrfHashGetCount(newHash) == 0, "A new osrfHash should be empty");
+  fail_unless(osrfHashGet(newHash, "key1") == NULL,
+      "Nothing should be found in an empty osrfHash");
+  osrfHashFree(newHash);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashSet)
+{
+  fail_unless(osrfHashSet(NULL, &globalItem1, "key") == NULL,
+      "Passing a null hash to osrfHashSet should return NULL");
+  fail_unless(osrfHashSet(testOsrfHash, NULL, "key") == NULL,
+      "Passing a null item to osrfHashSet should return NULL");
+  fail_unless(osrfHashGetCount(testOsrfHash) == 3,
+      "A null item should not have been stored");
+
+  int newItem = 42;
+  fail_unless(osrfHashSet(testOsrfHash, &newItem, "key%d", 4) == NULL,
+      "osrfHashSet should return NULL when adding a new key");
+  fail_unless(osrfHashGet(testOsrfHash, "key4") == &newItem,
+      "osrfHashSet should expand a printf-style key");
+
+  //Without a callback, replacing an item hands back the old one
+  fail_unless(osrfHashSet(testOsrfHash, &newItem, "key1") == &globalItem1,
+      "osrfHashSet should return the replaced item when there is no callback");
+  fail_unless(osrfHashGet(testOsrfHash, "key1") == &newItem,
+      "osrfHashSet did not replace the item for key1");
+  fail_unless(osrfHashGetCount(testOsrfHash) == 4,
+      "Replacing an item should not change the count");
+
+  //With a callback, the old item is freed instead
+  osrfHashSetCallback(testOsrfHash, osrfCustomHashFree);
+  fail_unless(osrfHashSet(testOsrfHash, &globalItem1, "key1") == NULL,
+      "osrfHashSet should return NULL when the callback frees the replaced item");
+  fail_unless(freedItemsSize == 1, "The callback should have been called once");
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashGet)
+{
+  fail_unless(osrfHashGet(NULL, "key1") == NULL,
+      "Passing a null hash to osrfHashGet should return NULL");
+  fail_unless(osrfHashGet(testOsrfHash, NULL) == NULL,
+      "Passing a null key to osrfHashGet should return NULL");
+  fail_unless(osrfHashGet(testOsrfHash, "key2") == &globalItem2,
+      "osrfHashGet did not find the item for key2");
+  fail_unless(osrfHashGet(testOsrfHash, "key") == NULL,
+      "osrfHashGet should not match a prefix of a key");
+  fail_unless(osrfHashGet(testOsrfHash, "key22") == NULL,
+      "osrfHashGet should not match a key with extra characters");
+  fail_unless(osrfHashGetFmt(testOsrfHash, "key%d", 3) == &globalItem3,
+      "osrfHashGetFmt did not find the item for key3");
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashRemove)
+{
+  fail_unless(osrfHashRemove(NULL, "key1") == NULL,
+      "Passing a null hash to osrfHashRemove should return NULL");
+  fail_unless(osrfHashRemove(testOsrfHash, "nokey") == NULL,
+      "Removing a missing key should return NULL");
+  fail_unless(osrfHashRemove(testOsrfHash, "key2") == &globalItem2,
+      "osrfHashRemove should return the item when there is no callback");
+  fail_unless(osrfHashGet(testOsrfHash, "key2") == NULL,
+      "key2 should be gone after osrfHashRemove");
+  fail_unless(osrfHashGetCount(testOsrfHash) == 2,
+      "osrfHashRemove did not update the count");
+
+  osrfHashSetCallback(testOsrfHash, osrfCustomHashFree);
+  fail_unless(osrfHashRemove(testOsrfHash, "key%d", 1) == NULL,
+      "osrfHashRemove should return NULL when the callback frees the item");
+  fail_unless(freedItemsSize == 1, "The callback should have been called once");
+
+  //A removed key can come back
+  osrfHashSetCallback(testOsrfHash, NULL);
+  osrfHashSet(testOsrfHash, &globalItem2, "key2");
+  fail_unless(osrfHashGet(testOsrfHash, "key2") == &globalItem2,
+      "A removed key should be able to be added again");
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashExtract)
+{
+  osrfHashSetCallback(testOsrfHash, osrfCustomHashFree);
+  fail_unless(osrfHashExtract(testOsrfHash, "key3") == &globalItem3,
+      "osrfHashExtract should return the item");
+  fail_unless(freedItemsSize == 0, "osrfHashExtract should not call the callback");
+  fail_unless(osrfHashGet(testOsrfHash, "key3") == NULL,
+      "key3 should be gone after osrfHashExtract");
+  fail_unless(osrfHashGetCount(testOsrfHash) == 2,
+      "osrfHashExtract did not update the count");
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashKeys)
+{
+  fail_unless(osrfHashKeys(NULL) == NULL,
+      "Passing a null hash to osrfHashKeys should return NULL");
+  osrfHashRemove(testOsrfHash, "key1");
+  osrfHashSet(testOsrfHash, &globalItem1, "key1");
+
+  osrfStringArray *keys = osrfHashKeys(testOsrfHash);
+  fail_unless(keys->size == 3, "osrfHashKeys should return three keys");
+  fail_unless(strcmp(osrfStringArrayGetString(keys, 0), "key2") == 0 &&
+      strcmp(osrfStringArrayGetString(keys, 1), "key3") == 0 &&
+      strcmp(osrfStringArrayGetString(keys, 2), "key1") == 0,
+      "osrfHashKeys should return the keys in the order they were added");
+  osrfStringArrayFree(keys);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashFree)
+{
+  osrfHashSetCallback(testOsrfHash, osrfCustomHashFree);
+  osrfHashRemove(testOsrfHash, "key2");
+  osrfHashFree(testOsrfHash);
+  fail_unless(freedItemsSize == 3,
+      "osrfHashFree should call the callback once for each remaining item");
+  testOsrfHash = osrfNewHash();
+}
+END_TEST
+
+START_TEST(test_osrf_hash_LargeHash)
+{
+  //Enough keys to need a table, and to make it grow several times
+  osrfHash *bigHash = osrfNewHash();
+  long i;
+  for (i = 1; i <= 20000; i++)
+    osrfHashSet(bigHash, (void *) i, "big_%ld", i);
+  fail_unless(osrfHashGetCount(bigHash) == 20000, "bigHash should hold 20000 items");
+
+  for (i = 1; i <= 20000; i++)
+    fail_unless(osrfHashGetFmt(bigHash, "big_%ld", i) == (void *) i,
+        "bigHash lost an item");
+  fail_unless(osrfHashGet(bigHash, "big_0") == NULL, "bigHash found a missing key");
+
+  //Churn: remove and re-add, as a session cache would
+  int round;
+  for (round = 0; round < 5; round++) {
+    for (i = 1; i <= 20000; i += 2)
+      fail_unless(osrfHashRemove(bigHash, "big_%ld", i) == (void *) i,
+          "bigHash failed to remove an item");
+    fail_unless(osrfHashGetCount(bigHash) == 10000, "bigHash should hold 10000 items");
+    for (i = 1; i <= 20000; i += 2)
+      osrfHashSet(bigHash, (void *) i, "big_%ld", i);
+  }
+
+  for (i = 1; i <= 20000; i++)
+    fail_unless(osrfHashGetFmt(bigHash, "big_%ld", i) == (void *) i,
+        "bigHash lost an item after removals");
+
+  //The re-added keys come last, in the order they were re-added
+  osrfHashIterator *itr = osrfNewHashIterator(bigHash);
+  long expected = 2;
+  long count = 0;
+  void *item;
+  while ((item = osrfHashIteratorNext(itr))) {
+    fail_unless(item == (void *) expected, "bigHash iterated out of order");
+    expected += 2;
+    if (expected > 20000)
+      expected = 1;
+    count++;
+  }
+  fail_unless(count == 20000, "bigHash iteration should visit every item");
+  osrfHashIteratorFree(itr);
+  osrfHashFree(bigHash);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfNewHashIterator)
+{
+  fail_unless(osrfNewHashIterator(NULL) == NULL,
+      "Passing a null hash to osrfNewHashIterator should return NULL");
+  osrfHashIterator *itr = osrfNewHashIterator(testOsrfHash);
+  fail_if(itr == NULL, "osrfHashIterator not successfully created");
+  fail_unless(osrfHashIteratorKey(itr) == NULL,
+      "A new iterator should not be positioned on a key");
+  fail_unless(osrfHashIteratorHasNext(itr) == 1,
+      "A new iterator on a non-empty hash should have a next item");
+  osrfHashIteratorFree(itr);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashIteratorNext)
+{
+  osrfHashIterator *itr = osrfNewHashIterator(testOsrfHash);
+  fail_unless(osrfHashIteratorNext(itr) == &globalItem1 &&
+      strcmp(osrfHashIteratorKey(itr), "key1") == 0,
+      "The first item should be key1");
+  fail_unless(osrfHashIteratorNext(itr) == &globalItem2 &&
+      strcmp(osrfHashIteratorKey(itr), "key2") == 0,
+      "The second item should be key2");
+  fail_unless(osrfHashIteratorNext(itr) == &globalItem3 &&
+      strcmp(osrfHashIteratorKey(itr), "key3") == 0,
+      "The third item should be key3");
+  fail_unless(osrfHashIteratorHasNext(itr) == 0,
+      "The iterator should have no next item at the end");
+  fail_unless(osrfHashIteratorNext(itr) == NULL,
+      "osrfHashIteratorNext should return NULL at the end");
+
+  //Having run off the end, the iterator starts over
+  fail_unless(osrfHashIteratorNext(itr) == &globalItem1,
+      "osrfHashIteratorNext should start over after the end");
+
+  osrfHashIteratorReset(itr);
+  fail_unless(osrfHashIteratorKey(itr) == NULL,
+      "A reset iterator should not be positioned on a key");
+  fail_unless(osrfHashIteratorNext(itr) == &globalItem1,
+      "osrfHashIteratorReset should return the iterator to the first item");
+  osrfHashIteratorFree(itr);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_IteratorRemoveCurrent)
+{
+  //Removing the entry under an iterator doesn't invalidate the iterator
+  osrfHashIterator *itr = osrfNewHashIterator(testOsrfHash);
+  osrfHashIteratorNext(itr);
+  osrfHashIteratorNext(itr);
+  osrfHashRemove(testOsrfHash, "key2");
+  fail_unless(osrfHashIteratorKey(itr) == NULL,
+      "The iterator should have no key after its entry is removed");
+  fail_unless(osrfHashIteratorNext(itr) == &globalItem3,
+      "The iterator should advance past a removed entry");
+  osrfHashIteratorFree(itr);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_IteratorCompaction)
+{
+  //Park an iterator, then remove and add enough entries to squeeze the
+  //removed ones out of the hash; the iterator should keep its place
+  osrfHash *hash = osrfNewHash();
+  long i;
+  for (i = 1; i <= 64; i++)
+    osrfHashSet(hash, (void *) i, "item_%ld", i);
+
+  osrfHashIterator *itr = osrfNewHashIterator(hash);
+  for (i = 1; i <= 40; i++)
+    osrfHashIteratorNext(itr);
+  fail_unless(strcmp(osrfHashIteratorKey(itr), "item_40") == 0,
+      "The iterator should be on item_40");
+
+  for (i = 1; i <= 39; i++)
+    osrfHashRemove(hash, "item_%ld", i);
+  for (i = 65; i <= 200; i++)
+    osrfHashSet(hash, (void *) i, "item_%ld", i);
+
+  fail_unless(strcmp(osrfHashIteratorKey(itr), "item_40") == 0,
+      "The iterator should still be on item_40");
+  fail_unless(osrfHashIteratorNext(itr) == (void *) 41,
+      "The iterator should advance to item_41");
+
+  //Now remove the current entry, and squeeze it out too
+  osrfHashRemove(hash, "item_41");
+  for (i = 42; i <= 180; i++)
+    osrfHashRemove(hash, "item_%ld", i);
+  for (i = 201; i <= 400; i++)
+    osrfHashSet(hash, (void *) i, "item_%ld", i);
+
+  fail_unless(osrfHashIteratorKey(itr) == NULL,
+      "The iterator should have no key after its entry is removed");
+  fail_unless(osrfHashIteratorNext(itr) == (void *) 181,
+      "The iterator should advance to the first entry after the removed one");
+
+  osrfHashIteratorFree(itr);
+  osrfHashFree(hash);
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashIntern)
+{
+  fail_unless(osrfHashIntern(NULL) == NULL,
+      "Passing a null string to osrfHashIntern should return NULL");
+  char key[] = "interned_key";
+  const char *shared = osrfHashIntern(key);
+  fail_if(shared == NULL || shared == key, "osrfHashIntern should return a copy");
+  fail_unless(osrfHashIntern("interned_key") == shared,
+      "osrfHashIntern should return the same copy for the same string");
+
+  char longKey[100];
+  memset(longKey, 'x', sizeof(longKey) - 1);
+  longKey[sizeof(longKey) - 1] = '\0';
+  fail_unless(osrfHashIntern(longKey) == NULL,
+      "osrfHashIntern should not intern long strings");
+
+  //Interned keys work just like copied ones, and aren't freed by the hash
+  osrfHash *hash = osrfNewHash();
+  osrfHashSetInternKeys(hash, 1);
+  osrfHashSet(hash, &globalItem1, "interned_key");
+  osrfHashSet(hash, &globalItem2, "%s", longKey);
+  fail_unless(osrfHashGet(hash, shared) == &globalItem1,
+      "The interned key should be found");
+  fail_unless(osrfHashGet(hash, longKey) == &globalItem2,
+      "A key too long to intern should be found");
+  osrfHashIterator *itr = osrfNewHashIterator(hash);
+  osrfHashIteratorNext(itr);
+  fail_unless(osrfHashIteratorKey(itr) == shared,
+      "The hash should store the interned copy of the key");
+  osrfHashIteratorFree(itr);
+  osrfHashRemove(hash, "interned_key");
+  osrfHashFree(hash);
+  fail_unless(strcmp(osrfHashIntern("interned_key"), "interned_key") == 0,
+      "The interned copy should outlive the hash");
+}
+END_TEST
+
+//Intern a run of keys, some shared with the other threads and some not, and record
+//the copy returned for each shared one
+#define INTERN_THREADS 8
+#define INTERN_KEYS 500
+static const char *internedBy[INTERN_THREADS][INTERN_KEYS];
+
+static void *internKeys(void *arg) {
+  int t = (int) (intptr_t) arg;
+  int i;
+  for (i = 0; i < INTERN_KEYS; i++) {
+    char key[32];
+    //Each thread starts at a different point, so that they race for every key
+    int k = (i + t * INTERN_KEYS / INTERN_THREADS) % INTERN_KEYS;
+    snprintf(key, sizeof(key), "shared_%d", k);
+    internedBy[t][k] = osrfHashIntern(key);
+    snprintf(key, sizeof(key), "thread_%d_%d", t, i);
+    if (osrfHashIntern(key) == NULL)
+      return NULL;
+  }
+  return arg;
+}
+
+START_TEST(test_osrf_hash_osrfHashInternThreads)
+{
+  unsigned long countBefore;
+  osrfHashInternStats(&countBefore, NULL);
+
+  pthread_t threads[INTERN_THREADS];
+  int t;
+  for (t = 0; t < INTERN_THREADS; t++)
+    fail_unless(pthread_create(&threads[t], NULL, internKeys, (void *) (intptr_t) t) == 0,
+        "pthread_create failed");
+  for (t = 0; t < INTERN_THREADS; t++) {
+    void *result;
+    pthread_join(threads[t], &result);
+    fail_unless(result == (void *) (intptr_t) t, "Every key should have been interned");
+  }
+
+  //Every thread got the one and only copy of each shared key
+  int i;
+  for (i = 0; i < INTERN_KEYS; i++) {
+    char key[32];
+    snprintf(key, sizeof(key), "shared_%d", i);
+    const char *shared = osrfHashIntern(key);
+    fail_unless(shared != NULL && strcmp(shared, key) == 0, "The key should be interned");
+    for (t = 0; t < INTERN_THREADS; t++)
+      fail_unless(internedBy[t][i] == shared,
+          "Threads interning the same key should share one copy");
+  }
+
+  unsigned long countAfter;
+  osrfHashInternStats(&countAfter, NULL);
+  ck_assert_int_eq(countAfter - countBefore, INTERN_KEYS * (INTERN_THREADS + 1));
+}
+END_TEST
+
+START_TEST(test_osrf_hash_osrfHashFromPairs)
+{
+  fail_unless(osrfHashFromPairs(NULL, NULL, NULL, 0) == NULL,
+      "Passing a null allocator to osrfHashFromPairs should return NULL");
+
+  //Enough pairs to need a table
+  char keys[40][16];
+  void *pairs[80];
+  int i;
+  for (i = 0; i < 40; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "pair_%d", i);
+    pairs[2 * i] = keys[i];
+    pairs[2 * i + 1] = &keys[i];
+  }
+
+  osrfHash *hash = osrfHashFromPairs(pairAlloc, NULL, pairs, 40);
+  fail_if(hash == NULL, "osrfHashFromPairs should build a hash");
+  fail_unless(osrfHashGetCount(hash) == 40, "The hash should hold 40 items");
+  for (i = 0; i < 40; i++)
+    fail_unless(osrfHashGetFmt(hash, "pair_%d", i) == &keys[i],
+        "osrfHashFromPairs lost an item");
+
+  osrfHashIterator *itr = osrfNewHashIterator(hash);
+  fail_unless(osrfHashIteratorNext(itr) == &keys[0] &&
+      osrfHashIteratorKey(itr) == keys[0],
+      "osrfHashFromPairs should keep the order, and the keys, given");
+  osrfHashIteratorFree(itr);
+  pairFree();
+
+  //A duplicate key is refused
+  pairs[2 * 39] = keys[3];
+  fail_unless(osrfHashFromPairs(pairAlloc, NULL, pairs, 40) == NULL,
+      "osrfHashFromPairs should refuse a duplicate key");
+}
+END_TEST
+
+//END TESTS
+
+Suite *osrf_hash_suite(void) {
+  //Create test suite, test case, initialize fixture
+  Suite *s = suite_create("osrf_hash");
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_checked_fixture(tc_core, setup, teardown);
+
+  //Add tests to test case
+  tcase_add_test(tc_core, test_osrf_hash_osrfNewHash);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashSet);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashGet);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashRemove);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashExtract);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashKeys);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashFree);
+  tcase_add_test(tc_core, test_osrf_hash_LargeHash);
+  tcase_add_test(tc_core, test_osrf_hash_osrfNewHashIterator);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashIteratorNext);
+  tcase_add_test(tc_core, test_osrf_hash_IteratorRemoveCurrent);
+  tcase_add_test(tc_core, test_osrf_hash_IteratorCompaction);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashIntern);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashInternThreads);
+  tcase_add_test(tc_core, test_osrf_hash_osrfHashFromPairs);
+
+  //Add test case to test suite
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+void run_tests(SRunner *sr) {
+  srunner_add_suite(sr, osrf_hash_suite());
+}
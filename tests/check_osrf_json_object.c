@@ -1,4 +1,5 @@
 #include <check.h>
+#include <pthread.h>
 #include "opensrf/osrf_json.h"
 
 jsonObject *jsonObj;
@@ -348,6 +349,300 @@ START_TEST(test_osrf_json_object_jsonBoolIsTrue)
 }
 END_TEST
 
+START_TEST(test_osrf_json_object_jsonParseArena)
+{
+  jsonArena *arena = jsonNewArena(0);
+  fail_unless(jsonParseArena(NULL, "[1]") == NULL,
+      "jsonParseArena should return NULL if passed a NULL arena");
+  fail_unless(jsonParseArena(arena, "{\"a\":1,\"a\":2}") == NULL,
+      "jsonParseArena should reject a duplicate key");
+
+  const char *json = "[{\"__c\":\"aou\",\"__p\":[1,\"two\",null,true]},"
+      "{\"key1\":\"value1\",\"key2\":[]}]";
+  jsonObject *heapObj = jsonParse(json);
+  jsonObject *arenaObj = jsonParseArena(arena, json);
+  fail_unless(strcmp(jsonObjectToJSON(arenaObj), jsonObjectToJSON(heapObj)) == 0,
+      "jsonParseArena should build the same tree as jsonParse");
+  fail_unless(strcmp(jsonObjectGetClass(jsonObjectGetIndex(arenaObj, 0)), "aou") == 0,
+      "jsonParseArena should decode class hints");
+  fail_unless(strcmp(jsonObjectGetString(
+      jsonObjectGetKeyConst(jsonObjectGetIndex(arenaObj, 1), "key1")), "value1") == 0,
+      "jsonParseArena should build a hash that supports lookups");
+  fail_unless(jsonArenaUsed(arena) > 0,
+      "jsonArenaUsed should report the memory taken by the tree");
+
+  jsonArenaReset(arena);
+  fail_unless(jsonArenaUsed(arena) == 0,
+      "jsonArenaReset should release everything in the arena");
+  jsonObjectFree(heapObj);
+  jsonArenaFree(arena);
+}
+END_TEST
+
+//Parse JSON copied into a buffer of exactly the right size, starting the given
+//number of bytes past a 64-byte boundary
+static jsonObject *parseAligned(const char *json, size_t misalign) {
+  size_t len = strlen(json) + 1;
+  void *block;
+  if (posix_memalign(&block, 64, misalign + len))
+    return NULL;
+  memcpy((char *) block + misalign, json, len);
+  jsonObject *obj = jsonParse((char *) block + misalign);
+  free(block);
+  return obj;
+}
+
+START_TEST(test_osrf_json_object_stringScan)
+{
+  //Sequences that end a run of plain characters, as JSON and as they come out.
+  //Control characters don't, but they must survive the block scan.
+  const char *specials[][2] = {
+    {"\\\"", "\""}, {"\\\\", "\\"}, {"\\n", "\n"}, {"\\u00e9", "\xc3\xa9"},
+    {"\x01", "\x01"}, {"\x1f", "\x1f"}, {"", ""}
+  };
+  const size_t offsets[] = {15, 16, 17, 31, 32, 33};
+  char json[128];
+  char expected[128];
+  size_t i, j, misalign;
+
+  //Put each sequence at each offset from the start of the string, with the string at
+  //every position relative to a 32-byte boundary; an empty sequence ends the string
+  for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+    for (j = 0; j < sizeof(specials) / sizeof(specials[0]); ++j) {
+      const char *tail = *specials[j][0] ? "bcd" : "";
+      snprintf(json, sizeof(json), "\"%.*s%s%s\"", (int) offsets[i],
+          "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", specials[j][0], tail);
+      snprintf(expected, sizeof(expected), "%.*s%s%s", (int) offsets[i],
+          "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", specials[j][1], tail);
+      for (misalign = 0; misalign < 32; ++misalign) {
+        jsonObject *obj = parseAligned(json, misalign);
+        fail_unless(obj != NULL && strcmp(jsonObjectGetString(obj), expected) == 0,
+            "jsonParse should translate a string whatever its alignment");
+        jsonObjectFree(obj);
+      }
+    }
+  }
+
+  //Input ending exactly on a 16- or 32-byte boundary, with and without the closing quote
+  size_t len;
+  for (len = 16; len <= 96; len += 16) {
+    memset(json, 'a', len);
+    json[0] = '"';
+    json[len - 2] = '"';
+    json[len - 1] = '\0';
+    jsonObject *obj = parseAligned(json, 0);
+    fail_unless(obj != NULL && strlen(jsonObjectGetString(obj)) == len - 3,
+        "jsonParse should read a string that ends on a block boundary");
+    jsonObjectFree(obj);
+
+    json[len - 2] = 'a';
+    fail_unless(parseAligned(json, 0) == NULL,
+        "jsonParse should reject an unterminated string that ends on a block boundary");
+  }
+}
+END_TEST
+
+START_TEST(test_osrf_json_object_jsonBuilder)
+{
+  jsonArena *arena = jsonNewArena(0);
+  fail_unless(jsonNewBuilder(NULL) == NULL,
+      "jsonNewBuilder should return NULL if passed a NULL arena");
+  jsonBuilder *builder = jsonNewBuilder(arena);
+
+  const char *json = "[{\"__c\":\"aou\",\"__p\":[1,\"two\",null,true,-2.5e3]},"
+      "{\"key1\":\"va\\\"l\\u00e9\",\"key2\":[],\"key3\":{}}, false, 12345]";
+  jsonObject *heapObj = jsonParse(json);
+  char *expected = jsonObjectToJSON(heapObj);
+
+  // Feed the JSON a byte at a time, several bytes at a time, and all at once
+  size_t len = strlen(json);
+  size_t chunk;
+  for (chunk = 1; chunk <= len; chunk = chunk * 4 + 1) {
+    size_t i;
+    for (i = 0; i < len; i += chunk)
+      fail_unless(jsonBuilderPush(builder, json + i,
+          i + chunk > len ? len - i : chunk) == 0,
+          "jsonBuilderPush should accept valid JSON");
+    jsonObject *built = jsonBuilderFinish(builder);
+    fail_unless(built != NULL, "jsonBuilderFinish should return the tree");
+    char *actual = jsonObjectToJSON(built);
+    fail_unless(strcmp(actual, expected) == 0,
+        "jsonBuilder should build the same tree as jsonParse");
+    free(actual);
+    fail_unless(strcmp(jsonObjectGetClass(jsonObjectGetIndex(built, 0)), "aou") == 0,
+        "jsonBuilder should decode class hints");
+    fail_unless(strcmp(jsonObjectGetString(
+        jsonObjectGetKeyConst(jsonObjectGetIndex(built, 1), "key1")), "va\"l\xc3\xa9") == 0,
+        "jsonBuilder should build a hash that supports lookups");
+    jsonBuilderReset(builder, NULL);
+    jsonArenaReset(arena);
+  }
+
+  // A number at the very end isn't complete until the builder is told so
+  fail_unless(jsonBuilderPush(builder, "42", 2) == 0,
+      "jsonBuilderPush should accept a bare number");
+  fail_unless(jsonObjectGetNumber(jsonBuilderFinish(builder)) == 42,
+      "jsonBuilderFinish should complete a number at the end of the input");
+  jsonBuilderReset(builder, NULL);
+
+  jsonBuilderPush(builder, "{\"a\":1,\"a\":2}", 13);
+  fail_unless(jsonBuilderFinish(builder) == NULL,
+      "jsonBuilder should reject a duplicate key");
+  jsonBuilderReset(builder, NULL);
+
+  fail_unless(jsonBuilderPush(builder, "[1,{\"b\":", 9) == 0,
+      "jsonBuilderPush should accept the beginning of valid JSON");
+  fail_unless(jsonBuilderPush(builder, "]", 1) != 0,
+      "jsonBuilderPush should reject invalid JSON");
+  fail_unless(jsonBuilderFinish(builder) == NULL,
+      "jsonBuilderFinish should fail after invalid JSON");
+
+  // Start over in the middle of a tree, in a different arena
+  jsonArena *arena2 = jsonNewArena(0);
+  jsonBuilderPush(builder, "[[[", 3);
+  jsonBuilderReset(builder, arena2);
+  jsonBuilderPush(builder, json, len);
+  jsonObject *built = jsonBuilderFinish(builder);
+  char *actual = jsonObjectToJSON(built);
+  fail_unless(strcmp(actual, expected) == 0,
+      "jsonBuilderReset should abandon an incomplete tree");
+  free(actual);
+  fail_unless(jsonArenaUsed(arena2) > 0,
+      "jsonBuilderReset should switch to the new arena");
+
+  jsonBuilderFree(builder);
+  free(expected);
+  jsonObjectFree(heapObj);
+  jsonArenaFree(arena);
+  jsonArenaFree(arena2);
+}
+END_TEST
+
+START_TEST(test_osrf_json_object_poolStats)
+{
+  jsonObjectPoolStats stats;
+  jsonObject *objs[20];
+  int i;
+
+  jsonObjectFreeUnused();
+  jsonSetFreeListCap(8);
+  jsonObjectGetPoolStats(&stats);
+  fail_unless(stats.length == 0 && stats.depot == 0,
+      "jsonObjectFreeUnused should empty the free list and the depot");
+
+  unsigned long misses = stats.misses;
+  for (i = 0; i < 20; i++)
+    objs[i] = jsonNewObject("pooled");
+  jsonObjectGetPoolStats(&stats);
+  ck_assert_int_eq(stats.misses - misses, 20);
+
+  for (i = 0; i < 20; i++)
+    jsonObjectFree(objs[i]);
+  jsonObjectGetPoolStats(&stats);
+  fail_unless(stats.length <= 8,
+      "A thread's free list should not grow past the cap");
+  ck_assert_int_eq(stats.length + stats.depot, 20);
+
+  // Reuse all 20, from the free list and then from the depot
+  unsigned long hits = stats.hits;
+  misses = stats.misses;
+  for (i = 0; i < 20; i++)
+    objs[i] = jsonNewObject(NULL);
+  jsonObjectGetPoolStats(&stats);
+  ck_assert_int_eq(stats.hits - hits, 20);
+  ck_assert_int_eq(stats.misses, misses);
+  ck_assert_int_eq(stats.length + stats.depot, 0);
+
+  // With no cap, nothing is kept
+  jsonSetFreeListCap(0);
+  for (i = 0; i < 20; i++)
+    jsonObjectFree(objs[i]);
+  jsonObjectGetPoolStats(&stats);
+  ck_assert_int_eq(stats.length + stats.depot, 0);
+  jsonSetFreeListCap(4096);
+}
+END_TEST
+
+#define POOL_THREADS 8
+#define POOL_ROUNDS 2000
+
+/* A slot for handing trees from one thread to another, so that threads free each other's */
+static pthread_mutex_t swap_lock = PTHREAD_MUTEX_INITIALIZER;
+static jsonObject *swap_slot = NULL;
+
+/* Build trees, check them, and free them -- some of them in a different thread */
+static void *pool_worker(void *arg) {
+  long id = (long) arg;
+  long errors = 0;
+  int round;
+  char text[32];
+
+  for (round = 0; round < POOL_ROUNDS; round++) {
+    jsonObject *tree = jsonNewObjectType(JSON_HASH);
+    int i;
+    for (i = 0; i < 10; i++) {
+      jsonObject *row = jsonNewObjectType(JSON_ARRAY);
+      snprintf(text, sizeof(text), "%ld-%d-%d", id, round, i);
+      jsonObjectPush(row, jsonNewObject(text));
+      jsonObjectPush(row, jsonNewNumberObject(i));
+      jsonObjectPush(row, jsonNewBoolObject(1));
+      jsonObjectSetKey(tree, text, row);
+    }
+
+    for (i = 0; i < 10; i++) {
+      snprintf(text, sizeof(text), "%ld-%d-%d", id, round, i);
+      const jsonObject *row = jsonObjectGetKeyConst(tree, text);
+      if (!row || strcmp(jsonObjectGetString(jsonObjectGetIndex(row, 0)), text))
+        errors++;
+    }
+
+    pthread_mutex_lock(&swap_lock);
+    jsonObject *other = swap_slot;
+    swap_slot = tree;
+    pthread_mutex_unlock(&swap_lock);
+
+    if (other && other->size != 10)
+      errors++;
+    jsonObjectFree(other);
+  }
+
+  return (void *) errors;
+}
+
+START_TEST(test_osrf_json_object_poolThreads)
+{
+  pthread_t threads[POOL_THREADS];
+  long i;
+
+  // A small cap, so that the threads trade batches through the depot all the time
+  jsonSetFreeListCap(64);
+  for (i = 0; i < POOL_THREADS; i++)
+    fail_unless(pthread_create(&threads[i], NULL, pool_worker, (void *) i) == 0,
+        "pthread_create failed");
+
+  long errors = 0;
+  for (i = 0; i < POOL_THREADS; i++) {
+    void *result;
+    pthread_join(threads[i], &result);
+    errors += (long) result;
+  }
+  ck_assert_int_eq(errors, 0);
+
+  jsonObjectFree(swap_slot);
+  swap_slot = NULL;
+
+  // The exiting threads handed their free lists over to the depot
+  jsonObjectPoolStats stats;
+  jsonObjectGetPoolStats(&stats);
+  fail_unless(stats.depot > 0, "Exiting threads should leave their free lists in the depot");
+
+  jsonObjectFreeUnused();
+  jsonObjectGetPoolStats(&stats);
+  ck_assert_int_eq(stats.depot, 0);
+  jsonSetFreeListCap(4096);
+}
+END_TEST
+
 //END Tests
 
 
@@ -381,6 +676,11 @@ Suite *osrf_json_object_suite (void) {
   tcase_add_test(tc_core, test_osrf_json_object_jsonObjectSetIndex);
   tcase_add_test(tc_core, test_osrf_json_object_jsonObjectGetIndex);
   tcase_add_test(tc_core, test_osrf_json_object_jsonObjectClone);
+  tcase_add_test(tc_core, test_osrf_json_object_jsonParseArena);
+  tcase_add_test(tc_core, test_osrf_json_object_stringScan);
+  tcase_add_test(tc_core, test_osrf_json_object_jsonBuilder);
+  tcase_add_test(tc_core, test_osrf_json_object_poolStats);
+  tcase_add_test(tc_core, test_osrf_json_object_poolThreads);
 
   //Add test case to test suite
   suite_add_tcase(s, tc_core);
@@ -1,6 +1,8 @@
 #include <check.h>
+#include <pthread.h>
 #include "opensrf/osrf_json.h"
 #include "opensrf/osrf_message.h"
+#include "opensrf/osrf_cbor.h"
 
 osrfMessage *o;
 
@@ -83,6 +85,276 @@ START_TEST(test_osrf_message_set_params)
 }
 END_TEST
 
+START_TEST(test_osrf_message_to_buffer)
+{
+  // osrfMessageToBuffer() should write exactly what we'd get by way of a jsonObject
+  const char* results[] = {
+    "\"plain string\"",
+    "[1,2.5,null,true,\"tab\\there\"]",
+    "{\"__c\":\"aou\",\"__p\":[1,\"Main \\\"Branch\\\"\",{\"__c\":\"aout\",\"__p\":[2]}]}",
+    "{\"__c\":\"aou\"}",
+    "{\"a\":{\"b\":[{}, []]}}",
+    "{\"<key>\":\"Tom & \\\"Jerry\\\"\",\"n\":-1.5e3,\"__c\":\"a&b\",\"__p\":\"<>\"}",
+    "{\"__c\":\"<x>\",\"__p\":{\"k\":\"&\"}}",
+    "[\"caf\\u00e9 <b>\\u00fc</b>\",\"\\n\\u0001\"]"
+  };
+  int i;
+  for (i = 0; i < sizeof(results) / sizeof(results[0]); ++i) {
+    jsonObject* result = jsonParse(results[i]);
+    fail_if(result == NULL, "test data failed to parse");
+
+    osrfMessage* msgs[4];
+    msgs[0] = osrf_message_init(RESULT, 3, 1);
+    osrf_message_set_status_info(msgs[0], NULL, "OK", OSRF_STATUS_OK);
+    osrf_message_set_result(msgs[0], result);
+    msgs[1] = osrf_message_init(RESULT, 4, 1);
+    osrf_message_set_status_info(msgs[1], "osrfResultPartial", "Partial Response",
+        OSRF_STATUS_PARTIAL);
+    osrf_message_set_result(msgs[1], result);
+    msgs[2] = osrf_message_init(REQUEST, 5, 1);
+    osrf_message_set_method(msgs[2], "opensrf.system.echo");
+    osrf_message_add_object_param(msgs[2], result);
+    osrf_message_set_locale(msgs[2], "fr-CA");
+    msgs[3] = osrf_message_init(STATUS, 6, 1);
+    osrf_message_set_status_info(msgs[3], "osrfConnectStatus", "Request Complete",
+        OSRF_STATUS_COMPLETE);
+
+    int j;
+    for (j = 0; j < 4; ++j) {
+      jsonObject* obj = osrfMessageToJSON(msgs[j]);
+      char* expected = jsonObjectToJSON(obj);
+      growing_buffer* buf = buffer_init(64);
+      osrfMessageToBuffer(msgs[j], buf);
+      fail_unless(strcmp(OSRF_BUFFER_C_STR(buf), expected) == 0,
+          "osrfMessageToBuffer should match osrfMessageToJSON");
+
+      // The same RESULT, written from the response itself
+      if (msgs[j]->m_type == RESULT) {
+        buffer_reset(buf);
+        buffer_add(buf, "[");
+        size_t start;
+        size_t xml_extra = 0;
+        size_t len = osrfMessageResultToBuffer(msgs[j], result, buf, &start, &xml_extra);
+        fail_unless(strcmp(OSRF_BUFFER_C_STR(buf) + 1, expected) == 0,
+            "osrfMessageResultToBuffer should match osrfMessageToJSON");
+        char* result_json = jsonObjectToJSON(result);
+        fail_unless(len == strlen(result_json)
+            && strncmp(OSRF_BUFFER_C_STR(buf) + start, result_json, len) == 0,
+            "osrfMessageResultToBuffer should report where the result lies");
+        ck_assert_int_eq(xml_extra, osrfXmlEscapingLength(result_json));
+        free(result_json);
+      }
+
+      buffer_free(buf);
+      free(expected);
+      jsonObjectFree(obj);
+      osrfMessageFree(msgs[j]);
+    }
+    jsonObjectFree(result);
+  }
+}
+END_TEST
+
+START_TEST(test_osrf_message_cbor)
+{
+  // CBOR should decode to the same tree as the JSON it came from
+  const char* translatable[] = {
+    "[1,2.5,null,true,false,\"tab\\there\"]",
+    "{\"__c\":\"aou\",\"__p\":[1,\"Main \\\"Branch\\\"\",{\"__c\":\"aout\",\"__p\":[2]}]}",
+    "{\"a\":{\"b\":[{}, []]},\"__p\":\"not a class\"}",
+    "[0,-7,25.00,-0.05,0.0,100,123456789012345678,-9.5]",
+    "[\"caf\\u00e9 <b>\\u00fc</b>\",\"\"]"
+  };
+  jsonArena* arena = jsonNewArena(0);
+  growing_buffer* buf = buffer_init(64);
+  int i;
+  for (i = 0; i < sizeof(translatable) / sizeof(translatable[0]); ++i) {
+    buffer_reset(buf);
+    fail_unless(osrfCborFromJSON(buf, translatable[i]) == 0,
+        "osrfCborFromJSON should translate plain JSON");
+    jsonObject* decoded = osrfCborParse(arena, (unsigned char*) buf->buf, buf->n_used);
+    fail_if(decoded == NULL, "osrfCborParse should decode what osrfCborFromJSON encodes");
+    jsonObject* parsed = jsonParse(translatable[i]);
+    char* expected = jsonObjectToJSON(parsed);
+    char* actual = jsonObjectToJSON(decoded);
+    ck_assert_str_eq(actual, expected);
+    free(actual);
+    free(expected);
+    jsonObjectFree(parsed);
+    jsonArenaReset(arena);
+  }
+
+  // Leave alone what wouldn't come back exactly
+  const char* untranslatable[] = {
+    "[1e5]", "[-0]", "[1234567890123456789]", "{\"a\":1,\"__c\":\"aou\",\"__p\":2}",
+    "{\"__c\":\"aou\"}", "{\"__c\":5,\"__p\":2}", "[1,", ""
+  };
+  for (i = 0; i < sizeof(untranslatable) / sizeof(untranslatable[0]); ++i) {
+    buffer_reset(buf);
+    fail_unless(osrfCborFromJSON(buf, untranslatable[i]) == -1 && buf->n_used == 0,
+        "osrfCborFromJSON should refuse JSON that it can't translate exactly");
+  }
+  buffer_free(buf);
+
+  // Garbage shouldn't decode
+  const unsigned char truncated[] = { 0x9f, 0x01, 0x62, 'a' };
+  const unsigned char floating[] = { 0xfb, 0, 0, 0, 0, 0, 0, 0, 0xf6 };
+  fail_unless(osrfCborParse(arena, truncated, sizeof(truncated)) == NULL
+      && osrfCborParse(arena, floating, sizeof(floating)) == NULL,
+      "osrfCborParse should reject what it can't decode");
+  jsonArenaFree(arena);
+
+  // A whole message body, by way of base64
+  jsonObject* rows = jsonNewObjectType(JSON_ARRAY);
+  for (i = 0; i < 50; ++i)
+    jsonObjectPush(rows, jsonParseFmt("{\"__c\":\"acp\",\"__p\":[null,%d,\"t\",\"f\","
+        "\"2009-10-14T11:27:36-0400\",\"25.00\",null,null,%d]}", i, i * 3));
+  osrfMessage* msgs[2];
+  msgs[0] = osrf_message_init(RESULT, 3, 1);
+  osrf_message_set_status_info(msgs[0], NULL, "OK", OSRF_STATUS_OK);
+  osrf_message_set_result(msgs[0], rows);
+  msgs[1] = osrf_message_init(REQUEST, 4, 1);
+  osrf_message_set_method(msgs[1], "opensrf.system.echo");
+  msgs[1]->accept_cbor = 1;
+  char* json = osrfMessageSerializeBatch(msgs, 2);
+  char* body = osrfCborBodyFromJSON(json);
+  fail_unless(osrfCborIsBody(body) && strlen(body) < strlen(json),
+      "osrfCborBodyFromJSON should make a shorter body");
+
+  osrfMessage* received[4];
+  ck_assert_int_eq(osrf_message_deserialize(body, received, 4), 2);
+  char* expected = jsonObjectToJSON(rows);
+  char* actual = jsonObjectToJSON(osrfMessageGetResult(received[0]));
+  ck_assert_str_eq(actual, expected);
+  fail_unless(received[1]->accept_cbor && !received[0]->accept_cbor,
+      "accept_encoding should survive the trip");
+  ck_assert_str_eq(received[1]->method_name, "opensrf.system.echo");
+  ck_assert_int_eq(osrf_message_deserialize("cbor:!!!!", received + 2, 2), 0);
+
+  free(actual);
+  free(expected);
+  osrfMessageFree(received[0]);
+  osrfMessageFree(received[1]);
+  free(body);
+  free(json);
+  osrfMessageFree(msgs[0]);
+  osrfMessageFree(msgs[1]);
+  jsonObjectFree(rows);
+}
+END_TEST
+
+START_TEST(test_osrf_message_raw_chunk)
+{
+  const char* json = "[{\"__c\":\"acp\",\"__p\":[1,\"25.00\",\"caf\u00e9 <&>\"]}]";
+  size_t json_len = strlen(json);
+  growing_buffer* buf = buffer_init(64);
+  osrfMessageRawChunkToBuffer(buf, 12, 40, json, json_len);
+  fail_unless(osrfMessageIsRawChunk(OSRF_BUFFER_C_STR(buf)),
+      "osrfMessageRawChunkToBuffer should make a raw chunk");
+  fail_if(osrfMessageIsRawChunk(json),
+      "JSON should not pass for a raw chunk");
+
+  int request_id = 0;
+  size_t offset = 0;
+  const char* data = NULL;
+  size_t len = 0;
+  ck_assert_int_eq(osrfMessageParseRawChunk(OSRF_BUFFER_C_STR(buf), &request_id,
+      &offset, &data, &len), 0);
+  ck_assert_int_eq(request_id, 12);
+  ck_assert_int_eq(offset, 40);
+  ck_assert_int_eq(len, json_len);
+  fail_unless(!memcmp(data, json, json_len),
+      "The chunk should come back as it went");
+
+  // A chunk cut short, or a damaged header
+  buf->buf[--buf->n_used] = '\0';
+  ck_assert_int_eq(osrfMessageParseRawChunk(OSRF_BUFFER_C_STR(buf), &request_id,
+      &offset, &data, &len), -1);
+  ck_assert_int_eq(osrfMessageParseRawChunk("chunk:12:-1:0:", &request_id,
+      &offset, &data, &len), -1);
+  ck_assert_int_eq(osrfMessageParseRawChunk("chunk:12:0:", &request_id,
+      &offset, &data, &len), -1);
+  ck_assert_int_eq(osrfMessageParseRawChunk("chunk:99999999999:0:0:", &request_id,
+      &offset, &data, &len), -1);
+
+  // Whoever asks for raw chunks says so in the message
+  osrfMessage* msg = osrf_message_init(REQUEST, 3, 1);
+  osrf_message_set_method(msg, "opensrf.system.echo");
+  msg->accept_raw_chunks = 1;
+  char* body = osrfMessageSerializeBatch(&msg, 1);
+  osrfMessage* received[1];
+  ck_assert_int_eq(osrf_message_deserialize(body, received, 1), 1);
+  fail_unless(received[0]->accept_raw_chunks && !received[0]->accept_cbor,
+      "accept_chunking should survive the trip");
+
+  osrfMessageFree(received[0]);
+  free(body);
+  osrfMessageFree(msg);
+  buffer_free(buf);
+}
+END_TEST
+
+#define DESERIALIZE_THREADS 4
+#define DESERIALIZE_ROUNDS 2000
+
+/* Send messages to ourselves and check what comes back, while other threads do the same */
+static void *deserialize_worker(void *arg) {
+  long id = (long) arg;
+  long errors = 0;
+  int round;
+  char text[32];
+
+  for (round = 0; round < DESERIALIZE_ROUNDS; round++) {
+    osrfMessage *msg = osrf_message_init(RESULT, round, 1);
+    jsonObject *content = jsonNewObjectType(JSON_ARRAY);
+    int i;
+    for (i = 0; i < 20; i++) {
+      snprintf(text, sizeof(text), "%ld-%d-%d", id, round, i);
+      jsonObjectPush(content, jsonNewObject(text));
+    }
+    osrf_message_set_result(msg, content);
+    char *body = osrfMessageSerializeBatch(&msg, 1);
+
+    osrfMessage *received[1];
+    if (osrf_message_deserialize(body, received, 1) != 1) {
+      errors++;
+    } else {
+      for (i = 0; i < 20; i++) {
+        snprintf(text, sizeof(text), "%ld-%d-%d", id, round, i);
+        const char *got = jsonObjectGetString(
+            jsonObjectGetIndex(received[0]->_result_content, i));
+        if (!got || strcmp(got, text))
+          errors++;
+      }
+      osrfMessageFree(received[0]);
+    }
+
+    free(body);
+    jsonObjectFree(content);
+    osrfMessageFree(msg);
+  }
+
+  return (void *) errors;
+}
+
+START_TEST(test_osrf_message_deserializeThreads)
+{
+  pthread_t threads[DESERIALIZE_THREADS];
+  long i;
+  for (i = 0; i < DESERIALIZE_THREADS; i++)
+    fail_unless(pthread_create(&threads[i], NULL, deserialize_worker, (void *) i) == 0,
+        "pthread_create failed");
+
+  long errors = 0;
+  for (i = 0; i < DESERIALIZE_THREADS; i++) {
+    void *result;
+    pthread_join(threads[i], &result);
+    errors += (long) result;
+  }
+  ck_assert_int_eq(errors, 0);
+}
+END_TEST
+
 //END Tests
 
 Suite *osrf_message_suite(void) {
@@ -98,6 +370,10 @@ Suite *osrf_message_suite(void) {
   tcase_add_test(tc_core, test_osrf_message_set_default_locale);
   tcase_add_test(tc_core, test_osrf_message_set_method);
   tcase_add_test(tc_core, test_osrf_message_set_params);
+  tcase_add_test(tc_core, test_osrf_message_to_buffer);
+  tcase_add_test(tc_core, test_osrf_message_cbor);
+  tcase_add_test(tc_core, test_osrf_message_raw_chunk);
+  tcase_add_test(tc_core, test_osrf_message_deserializeThreads);
 
   //Add test case to test suite
   suite_add_tcase(s, tc_core);
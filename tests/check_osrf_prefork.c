@@ -0,0 +1,429 @@
+#include <check.h>
+#include <sys/wait.h>
+
+//The request ring and the scaling decisions are private to the prefork code,
+//so we compile its source right in
+#include "osrf_prefork.c"
+
+#define TEST_RING_SIZE MIN_RING_SIZE
+
+prefork_ring *a_ring;
+
+//Set up the test fixture
+void setup(void) {
+  a_ring = safe_malloc(sizeof(prefork_ring) + TEST_RING_SIZE);
+  a_ring->head = 0;
+  a_ring->tail = 0;
+  a_ring->size = TEST_RING_SIZE;
+}
+
+//Clean up the test fixture
+void teardown(void) {
+  free(a_ring);
+}
+
+//Make a message body of the given length, filled with a letter
+static char *make_body(size_t len, char c) {
+  char *body = safe_malloc(len + 1);
+  memset(body, c, len);
+  return body;
+}
+
+//Pack a message with the given body and put it into the ring
+static int put_body(const char *body) {
+  transport_message *msg = message_init(body, "subject", "thread", "recipient", "sender");
+  size_t size;
+  char *data = message_pack(msg, &size);
+  int rc = prefork_ring_put(a_ring, data, size);
+  free(data);
+  message_free(msg);
+  return rc;
+}
+
+//Take the next message out of the ring, and check its body
+static int get_body(const char *body) {
+  transport_message *msg = prefork_ring_get(a_ring);
+  int ok = msg && !strcmp(msg->body, body) && !strcmp(msg->thread, "thread");
+  message_free(msg);
+  return ok;
+}
+
+//Tests
+
+START_TEST(test_osrf_prefork_RingRoundTrip)
+{
+  fail_unless(prefork_ring_get(a_ring) == NULL, "A new ring should be empty");
+
+  fail_unless(put_body("one") == 0 && put_body("two") == 0 && put_body("three") == 0,
+      "prefork_ring_put should accept requests while there's room");
+  fail_unless(get_body("one") && get_body("two") && get_body("three"),
+      "prefork_ring_get should return the requests in order");
+  fail_unless(prefork_ring_get(a_ring) == NULL, "The ring should be empty again");
+  fail_unless(a_ring->head == a_ring->tail, "The child should have caught up");
+}
+END_TEST
+
+START_TEST(test_osrf_prefork_RingWrap)
+{
+  //An empty ring takes a request as big as itself, wherever it left off
+  char *body = make_body(TEST_RING_SIZE / 2, 'a');
+  size_t offsets[] = { 8, TEST_RING_SIZE / 2, TEST_RING_SIZE - 16, TEST_RING_SIZE - 8 };
+  int i;
+  for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+    a_ring->head = a_ring->tail = 3 * TEST_RING_SIZE + offsets[i];
+    fail_unless(put_body(body) == 0,
+        "An empty ring should take a request that fits in it");
+    fail_unless(get_body(body), "A request should survive wrapping around the ring");
+  }
+  free(body);
+
+  char *big = make_body(TEST_RING_SIZE, 'b');
+  fail_unless(put_body(big) != 0, "A request larger than the ring should go by pipe");
+  free(big);
+}
+END_TEST
+
+START_TEST(test_osrf_prefork_RingFreeSpace)
+{
+  //Three requests fill most of the ring
+  char *body = make_body(1100, 'c');
+  fail_unless(put_body(body) == 0 && put_body(body) == 0 && put_body(body) == 0,
+      "prefork_ring_put should accept requests while there's room");
+
+  //Taking out the first one leaves room for a bigger one, split between the
+  //end of the ring and the beginning
+  char *bigger = make_body(1400, 'd');
+  fail_unless(put_body(bigger) != 0, "The ring should be too full for a bigger request");
+  fail_unless(get_body(body), "The first request should come out first");
+  fail_unless(put_body(bigger) == 0,
+      "prefork_ring_put should use all of the space that's free");
+  fail_unless(put_body(body) != 0, "The ring should be full again");
+
+  fail_unless(get_body(body) && get_body(body) && get_body(bigger),
+      "Every request should come out intact");
+  fail_unless(prefork_ring_get(a_ring) == NULL, "The ring should be empty");
+  free(body);
+  free(bigger);
+}
+END_TEST
+
+START_TEST(test_osrf_prefork_Smooth)
+{
+  fail_unless(prefork_smooth(4.0, 4.0, 1.0) == 4.0,
+      "A steady sample should leave the average alone");
+
+  //After the smoothing time, the average is halfway to a new sample
+  double avg = prefork_smooth(0.0, 8.0, SCALE_SMOOTHING);
+  fail_unless(avg > 3.99 && avg < 4.01,
+      "The average should move halfway in one smoothing time");
+
+  //A longer sample weighs more
+  fail_unless(prefork_smooth(0.0, 8.0, 5.0) > prefork_smooth(0.0, 8.0, 1.0),
+      "A sample covering more time should count for more");
+}
+END_TEST
+
+START_TEST(test_osrf_prefork_ScaleTarget)
+{
+  //10 requests/sec at 0.25 sec each keep 2.5 children busy, so we want 3
+  ck_assert_int_eq(prefork_scale_target(10.0, 0.25, 0, 0, 1, 20), 3);
+  //plus the spares
+  ck_assert_int_eq(prefork_scale_target(10.0, 0.25, 0, 2, 1, 20), 5);
+  //unless more than that are busy already
+  ck_assert_int_eq(prefork_scale_target(10.0, 0.25, 7, 2, 1, 20), 9);
+  //An exact load needs no extra child
+  ck_assert_int_eq(prefork_scale_target(8.0, 0.5, 0, 0, 1, 20), 4);
+
+  //No load at all leaves min_children
+  ck_assert_int_eq(prefork_scale_target(0.0, 0.0, 0, 0, 3, 20), 3);
+  ck_assert_int_eq(prefork_scale_target(0.0, 0.0, 0, 5, 3, 20), 5);
+
+  //Never more than max_children, however heavy the load
+  ck_assert_int_eq(prefork_scale_target(100.0, 1.0, 0, 0, 1, 20), 20);
+  ck_assert_int_eq(prefork_scale_target(1e300, 1e300, 0, 0, 1, 20), 20);
+  ck_assert_int_eq(prefork_scale_target(0.0, 0.0, 30, 0, 1, 20), 20);
+  ck_assert_int_eq(prefork_scale_target(0.0, 0.0, 0, 30, 1, 20), 20);
+}
+END_TEST
+
+START_TEST(test_osrf_prefork_BacklogWait)
+{
+  prefork_metrics metrics;
+  memset(&metrics, 0, sizeof(metrics));
+
+  //Bucket i counts waits shorter than 2^i milliseconds
+  prefork_metrics_backlog_wait(&metrics, 0.0);
+  prefork_metrics_backlog_wait(&metrics, 0.0009);
+  ck_assert_int_eq(metrics.backlog_wait[0], 2);
+  prefork_metrics_backlog_wait(&metrics, 0.001);
+  prefork_metrics_backlog_wait(&metrics, 0.0019);
+  ck_assert_int_eq(metrics.backlog_wait[1], 2);
+  prefork_metrics_backlog_wait(&metrics, 0.002);
+  ck_assert_int_eq(metrics.backlog_wait[2], 1);
+
+  //The last bounded bucket counts waits up to 16.384 seconds
+  prefork_metrics_backlog_wait(&metrics, 8.2);
+  prefork_metrics_backlog_wait(&metrics, 16.38);
+  ck_assert_int_eq(metrics.backlog_wait[BACKLOG_WAIT_BUCKETS - 2], 2);
+
+  //and the overflow bucket everything longer
+  prefork_metrics_backlog_wait(&metrics, 16.39);
+  prefork_metrics_backlog_wait(&metrics, 1e9);
+  ck_assert_int_eq(metrics.backlog_wait[BACKLOG_WAIT_BUCKETS - 1], 2);
+
+  unsigned long total = 0;
+  int i;
+  for (i = 0; i < BACKLOG_WAIT_BUCKETS; ++i)
+    total += metrics.backlog_wait[i];
+  ck_assert_int_eq(total, 9);
+
+  //The high-water mark stays put as the backlog drains
+  prefork_metrics_backlog_depth(&metrics, 1);
+  prefork_metrics_backlog_depth(&metrics, 3);
+  prefork_metrics_backlog_depth(&metrics, 2);
+  prefork_metrics_backlog_depth(&metrics, 0);
+  ck_assert_int_eq(metrics.backlog_depth, 0);
+  ck_assert_int_eq(metrics.backlog_max, 3);
+  prefork_metrics_backlog_depth(&metrics, 4);
+  ck_assert_int_eq(metrics.backlog_max, 4);
+}
+END_TEST
+
+//The number stored under a key of a JSON hash
+static double number(const jsonObject *obj, const char *key) {
+  const jsonObject *value = jsonObjectGetKeyConst(obj, key);
+  fail_unless(value != NULL && value->type == JSON_NUMBER, "Missing number: %s", key);
+  return jsonObjectGetNumber(value);
+}
+
+START_TEST(test_osrf_prefork_Stats)
+{
+  fail_unless(osrf_prefork_stats() == NULL, "Only a listener has stats");
+
+  prefork_simple forker;
+  memset(&forker, 0, sizeof(forker));
+  fail_unless(prefork_simple_init(&forker, NULL, 100, 1, 4, 10) == 0,
+      "prefork_simple_init failed");
+  forker.appname = "opensrf.test";
+  global_forker = &forker;
+
+  prefork_metrics *metrics = forker.metrics;
+  metrics->requests = 12;
+  metrics->dropped = 1;
+  metrics->spawned = 5;
+  prefork_metrics_backlog_depth(metrics, 6);
+  prefork_metrics_backlog_depth(metrics, 2);
+  prefork_metrics_backlog_wait(metrics, 0.0005);
+  prefork_metrics_backlog_wait(metrics, 0.003);
+  prefork_metrics_backlog_wait(metrics, 100.0);
+
+  //Two children, one of them busy with its third request
+  metrics->drones[0].pid = 1001;
+  metrics->drones[0].requests = 2;
+  metrics->drones[0].service_total = 1.0;
+  metrics->drones[0].service_max = 0.75;
+  metrics->drones[2].pid = 1002;
+  metrics->drones[2].busy = 1;
+  metrics->drones[2].requests = 3;
+  metrics->drones[2].service_total = 3.0;
+
+  jsonObject *stats = osrf_prefork_stats();
+  fail_unless(stats != NULL && stats->type == JSON_HASH, "Stats should be a hash");
+  fail_unless(!strcmp(jsonObjectGetString(jsonObjectGetKeyConst(stats, "appname")),
+      "opensrf.test"), "The stats should name the application");
+  ck_assert_int_eq(number(stats, "listener"), getpid());
+  ck_assert_int_eq(number(stats, "min_children"), 1);
+  ck_assert_int_eq(number(stats, "max_children"), 4);
+  ck_assert_int_eq(number(stats, "requests"), 12);
+  ck_assert_int_eq(number(stats, "dropped"), 1);
+  ck_assert_int_eq(number(stats, "spawned"), 5);
+  ck_assert_int_eq(number(stats, "killed"), 0);
+  ck_assert_int_eq(number(stats, "backlog_depth"), 2);
+  ck_assert_int_eq(number(stats, "backlog_max"), 6);
+  ck_assert_int_eq(number(stats, "backlog_limit"), 10);
+  ck_assert_int_eq(number(stats, "children"), 2);
+  ck_assert_int_eq(number(stats, "busy"), 1);
+
+  //The histogram is keyed on each bucket's upper bound in milliseconds
+  const jsonObject *waits = jsonObjectGetKeyConst(stats, "backlog_wait_ms");
+  fail_unless(waits != NULL && waits->type == JSON_HASH, "Missing backlog_wait_ms");
+  ck_assert_int_eq(waits->size, BACKLOG_WAIT_BUCKETS);
+  ck_assert_int_eq(number(waits, "1"), 1);
+  ck_assert_int_eq(number(waits, "2"), 0);
+  ck_assert_int_eq(number(waits, "4"), 1);
+  ck_assert_int_eq(number(waits, "16384"), 0);
+  ck_assert_int_eq(number(waits, "inf"), 1);
+
+  //A busy child's latest request doesn't count toward its average yet
+  const jsonObject *drones = jsonObjectGetKeyConst(stats, "drones");
+  fail_unless(drones != NULL && drones->type == JSON_ARRAY && drones->size == 2,
+      "There should be a report for each child");
+  const jsonObject *idle = jsonObjectGetIndex(drones, 0);
+  const jsonObject *busy = jsonObjectGetIndex(drones, 1);
+  ck_assert_int_eq(number(idle, "pid"), 1001);
+  fail_unless(!jsonBoolIsTrue(jsonObjectGetKeyConst(idle, "busy")), "The first is idle");
+  fail_unless(number(idle, "service_avg") == 0.5 && number(idle, "service_max") == 0.75,
+      "The service times should be reported");
+  ck_assert_int_eq(number(busy, "pid"), 1002);
+  fail_unless(jsonBoolIsTrue(jsonObjectGetKeyConst(busy, "busy")), "The second is busy");
+  ck_assert_int_eq(number(busy, "requests"), 3);
+  fail_unless(number(busy, "service_avg") == 1.5, "The average should leave out the busy one");
+
+  jsonObjectFree(stats);
+  global_forker = NULL;
+  munmap(forker.metrics, forker.metrics_size);
+}
+END_TEST
+
+//Fork a process that writes data to a pipe, a piece at a time, and exits
+static pid_t fork_writer(int fd, const char *data, size_t len, size_t piece) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    size_t sent = 0;
+    while (sent < len) {
+      size_t n = len - sent < piece ? len - sent : piece;
+      if (write(fd, data + sent, n) != n)
+        _exit(1);
+      sent += n;
+    }
+    _exit(0);
+  }
+  return pid;
+}
+
+START_TEST(test_osrf_prefork_ReadRequest)
+{
+  prefork_simple forker;
+  memset(&forker, 0, sizeof(forker));
+  int fds[2];
+  fail_unless(pipe(fds) == 0, "pipe failed");
+  prefork_child *child = prefork_child_init(&forker, fds[0], -1, -1, -1);
+  growing_buffer *gbuf = buffer_init(READ_BUFSIZE);
+
+  //A packed request much bigger than the pipe, dribbled in by the parent, comes out
+  //whole, in a buffer allocated once for it
+  char *body = make_body(300000, 'e');
+  transport_message *msg = message_init(body, "subject", "thread", "recipient", "sender");
+  size_t size;
+  char *data = message_pack(msg, &size);
+  int status;
+  pid_t writer = fork_writer(fds[1], data, size, 777);
+  ck_assert_int_eq(prefork_child_read_request(child, gbuf), 1);
+  ck_assert_int_eq(gbuf->n_used, size);
+  fail_unless(gbuf->size > size && gbuf->size <= 2 * size,
+      "The buffer should be sized from the header");
+  fail_unless(memcmp(gbuf->buf, data, size) == 0, "The request should arrive intact");
+  fail_unless(waitpid(writer, &status, 0) == writer && WIFEXITED(status)
+      && WEXITSTATUS(status) == 0, "The writer should have finished");
+
+  //The next request, small and in one piece, doesn't spill into the first
+  buffer_reset(gbuf);
+  free(data);
+  message_free(msg);
+  msg = message_init("small", "subject", "thread", "recipient", "sender");
+  data = message_pack(msg, &size);
+  fail_unless(write(fds[1], data, size) == size, "write failed");
+  ck_assert_int_eq(prefork_child_read_request(child, gbuf), 1);
+  ck_assert_int_eq(gbuf->n_used, size);
+  transport_message *got = new_message_from_packed(gbuf->buf, gbuf->n_used);
+  fail_unless(got && !strcmp(got->body, "small"), "The request should unpack");
+  message_free(got);
+
+  //An XML request ends with a nul byte
+  buffer_reset(gbuf);
+  fail_unless(write(fds[1], "<message/>", 11) == 11, "write failed");
+  ck_assert_int_eq(prefork_child_read_request(child, gbuf), 1);
+  fail_unless(!strcmp(gbuf->buf, "<message/>"), "An XML request should arrive whole");
+
+  //A request cut short is an error; a pipe closed between requests is not
+  buffer_reset(gbuf);
+  fail_unless(write(fds[1], data, size - 1) == size - 1, "write failed");
+  close(fds[1]);
+  ck_assert_int_eq(prefork_child_read_request(child, gbuf), -1);
+  buffer_reset(gbuf);
+  ck_assert_int_eq(prefork_child_read_request(child, gbuf), 0);
+
+  close(fds[0]);
+  free(data);
+  free(body);
+  message_free(msg);
+  buffer_free(gbuf);
+  free(child);
+}
+END_TEST
+
+//Fork a child that waits for a signal
+static pid_t fork_sleeper(void) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    pause();
+    _exit(0);
+  }
+  return pid;
+}
+
+START_TEST(test_osrf_prefork_RetireChild)
+{
+  prefork_simple forker;
+  memset(&forker, 0, sizeof(forker));
+
+  //Two idle children; the older one is at the tail of the idle list
+  prefork_child *newer = prefork_child_init(&forker, -1, -1, -1, -1);
+  prefork_child *older = prefork_child_init(&forker, -1, -1, -1, -1);
+  newer->pid = fork_sleeper();
+  older->pid = fork_sleeper();
+  forker.current_num_children = 2;
+  forker.idle_list = newer;
+  newer->next = older;
+
+  prefork_retire_child(&forker, older, newer);
+  fail_unless(forker.idle_list == newer && newer->next == NULL,
+      "A retiring child should leave the idle list");
+  fail_unless(forker.first_child == older && older->retiring && forker.retiring == 1,
+      "A retiring child should wait in the active list, where it gets no work");
+
+  int status;
+  fail_unless(waitpid(older->pid, &status, 0) == older->pid
+      && WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM,
+      "A retiring child should be sent SIGTERM");
+
+  //Burying it forgets it
+  del_prefork_child(&forker, older->pid);
+  fail_unless(forker.first_child == NULL && forker.retiring == 0,
+      "del_prefork_child should clean up a retired child");
+
+  kill(newer->pid, SIGKILL);
+  waitpid(newer->pid, NULL, 0);
+  free(newer);
+  free(forker.free_list);
+}
+END_TEST
+
+//END TESTS
+
+Suite *osrf_prefork_suite(void) {
+  //Create test suite, test case, initialize fixture
+  Suite *s = suite_create("osrf_prefork");
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_checked_fixture(tc_core, setup, teardown);
+
+  //Add tests to test case
+  tcase_add_test(tc_core, test_osrf_prefork_RingRoundTrip);
+  tcase_add_test(tc_core, test_osrf_prefork_RingWrap);
+  tcase_add_test(tc_core, test_osrf_prefork_RingFreeSpace);
+  tcase_add_test(tc_core, test_osrf_prefork_Smooth);
+  tcase_add_test(tc_core, test_osrf_prefork_ScaleTarget);
+  tcase_add_test(tc_core, test_osrf_prefork_BacklogWait);
+  tcase_add_test(tc_core, test_osrf_prefork_Stats);
+  tcase_add_test(tc_core, test_osrf_prefork_ReadRequest);
+  tcase_add_test(tc_core, test_osrf_prefork_RetireChild);
+
+  //Add test case to test suite
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+void run_tests(SRunner *sr) {
+  srunner_add_suite(sr, osrf_prefork_suite());
+}
@@ -0,0 +1,357 @@
+#include <check.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+//The balancing policies and the load hints are private to the router, so we
+//compile the router's source right in
+#include "osrf_router.c"
+
+osrfRouterClass *a_class;
+osrfRouterNode *node_a;
+osrfRouterNode *node_b;
+osrfRouterNode *node_c;
+
+//Make a class of nodes with no connection, which the policies never need
+static osrfRouterClass *new_class(void) {
+  osrfRouterClass *rclass = safe_malloc(sizeof(osrfRouterClass));
+  rclass->nodes = osrfNewHash();
+  rclass->itr = osrfNewHashIterator(rclass->nodes);
+  osrfHashSetCallback(rclass->nodes, &osrfRouterNodeFree);
+  rclass->router = NULL;
+  rclass->classname = strdup("opensrf.test");
+  rclass->sock_fd = -1;
+  rclass->connection = NULL;
+  return rclass;
+}
+
+//Set up the test fixture
+void setup(void) {
+  a_class = new_class();
+  osrfRouterClassAddNode(a_class, "a");
+  osrfRouterClassAddNode(a_class, "b");
+  osrfRouterClassAddNode(a_class, "c");
+  node_a = osrfRouterClassFindNode(a_class, "a");
+  node_b = osrfRouterClassFindNode(a_class, "b");
+  node_c = osrfRouterClassFindNode(a_class, "c");
+}
+
+//Clean up the test fixture
+void teardown(void) {
+  osrfRouterClassFree(NULL, a_class);
+}
+
+//Pick a node the given number of times, and count how often each one comes up
+static void pick_many(osrfRouterNode *(*pick)(osrfRouterClass *), int times,
+    int *a, int *b, int *c) {
+  *a = *b = *c = 0;
+  int i;
+  for (i = 0; i < times; ++i) {
+    osrfRouterNode *node = pick(a_class);
+    if (node == node_a)
+      ++*a;
+    else if (node == node_b)
+      ++*b;
+    else if (node == node_c)
+      ++*c;
+  }
+}
+
+//Make a router with nothing but its epoll instance and its map of sockets to classes
+static osrfRouter *new_router(void) {
+  osrfRouter *router = safe_malloc(sizeof(osrfRouter));
+  router->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  router->class_fds = osrfNewList();
+  return router;
+}
+
+static void free_router(osrfRouter *router) {
+  close(router->epoll_fd);
+  osrfListFree(router->class_fds);
+  free(router);
+}
+
+//Move a descriptor as high as we're allowed, preferably beyond FD_SETSIZE
+static int raise_fd(int fd) {
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < FD_SETSIZE + 64
+      && lim.rlim_max >= FD_SETSIZE + 64) {
+    lim.rlim_cur = FD_SETSIZE + 64;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  int high = fcntl(fd, F_DUPFD, FD_SETSIZE + 8);
+  if (high < 0)
+    return fd;
+  close(fd);
+  return high;
+}
+
+//Wait briefly for one event on the router's epoll instance
+static int wait_event(osrfRouter *router, struct epoll_event *event) {
+  return epoll_wait(router->epoll_fd, event, 1, 100);
+}
+
+//Tests
+
+START_TEST(test_osrf_router_osrfRouterNodeSetLoad)
+{
+  osrfRouterNodeSetLoad(node_a,
+      "{\"capacity\":8,\"busy\":3,\"backlog\":2,\"latency\":0.25}");
+  ck_assert_int_eq(node_a->capacity, 8);
+  ck_assert_int_eq(node_a->outstanding, 5);
+  fail_unless(node_a->latency == 0.25, "A hint should set the latency");
+
+  //A hint without busy or backlog leaves our reckoning alone
+  node_a->pending = 2.0;
+  osrfRouterNodeSetLoad(node_a, "{\"latency\":0.5}");
+  fail_unless(node_a->latency == 0.5 && node_a->outstanding == 5 && node_a->pending == 2.0,
+      "A hint should change only what it mentions");
+
+  //A hint of busy drones or backlog replaces it
+  osrfRouterNodeSetLoad(node_a, "{\"busy\":1}");
+  fail_unless(node_a->outstanding == 1 && node_a->pending == 0.0,
+      "A hint of busy drones should replace the messages we've counted");
+  osrfRouterNodeSetLoad(node_a, "{\"busy\":-4,\"backlog\":1}");
+  ck_assert_int_eq(node_a->outstanding, 0);
+
+  //Malformed hints change nothing
+  node_a->pending = 2.0;
+  const char *malformed[] = {
+    "registering", "{\"capacity\":", "{capacity:4}", "[{\"capacity\":4}]", "",
+    "{\"capacity\":\"eight\",\"busy\":\"lots\",\"backlog\":[1],\"latency\":null}"
+  };
+  int i;
+  for (i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    osrfRouterNodeSetLoad(node_a, malformed[i]);
+    fail_unless(node_a->capacity == 8 && node_a->outstanding == 0
+        && node_a->latency == 0.5 && node_a->pending == 2.0,
+        "osrfRouterNodeSetLoad should ignore a malformed hint");
+  }
+  osrfRouterNodeSetLoad(node_a, NULL);
+  osrfRouterNodeSetLoad(NULL, "{\"busy\":1}");
+}
+END_TEST
+
+START_TEST(test_osrf_router_LeastOutstanding)
+{
+  //Requests in flight per drone, counting the next one: 1.25, 0.5, 1.5
+  osrfRouterNodeSetLoad(node_a, "{\"capacity\":4,\"busy\":4}");
+  osrfRouterNodeSetLoad(node_b, "{\"capacity\":4,\"busy\":1}");
+  osrfRouterNodeSetLoad(node_c, "{\"capacity\":2,\"busy\":1,\"backlog\":1}");
+  int i;
+  for (i = 0; i < 3; ++i)
+    fail_unless(osrfRouterPickLeastOutstanding(a_class) == node_b,
+        "least-outstanding should pick the node with the least load per drone");
+
+  //Messages sent since the last hint count too
+  node_b->pending = 4.0;
+  fail_unless(osrfRouterPickLeastOutstanding(a_class) == node_a,
+      "least-outstanding should count messages sent since the last hint");
+}
+END_TEST
+
+START_TEST(test_osrf_router_Latency)
+{
+  //Expected waits: 0.2, 1.0, and 0.55 for c, which is charged the average latency
+  osrfRouterNodeSetLoad(node_a, "{\"capacity\":1,\"busy\":1,\"latency\":0.1}");
+  osrfRouterNodeSetLoad(node_b, "{\"capacity\":1,\"busy\":0,\"latency\":1.0}");
+  osrfRouterNodeSetLoad(node_c, "{\"capacity\":1,\"busy\":0}");
+  fail_unless(osrfRouterPickLatency(a_class) == node_a,
+      "latency should pick the node with the shortest expected wait");
+
+  osrfRouterNodeSetLoad(node_a, "{\"busy\":9}");
+  fail_unless(osrfRouterPickLatency(a_class) == node_c,
+      "latency should charge a node without a latency the average of the others");
+}
+END_TEST
+
+START_TEST(test_osrf_router_Ties)
+{
+  //Without any hints, every node is alike, and each gets its turn
+  int a, b, c;
+  pick_many(osrfRouterPickLeastOutstanding, 6, &a, &b, &c);
+  fail_unless(a == 2 && b == 2 && c == 2, "least-outstanding should rotate ties");
+  pick_many(osrfRouterPickLatency, 6, &a, &b, &c);
+  fail_unless(a == 2 && b == 2 && c == 2, "latency should rotate ties");
+  pick_many(osrfRouterPickRoundRobin, 6, &a, &b, &c);
+  fail_unless(a == 2 && b == 2 && c == 2, "round-robin should pick each node in turn");
+
+  //Likewise with identical hints
+  osrfRouterNodeSetLoad(node_a, "{\"capacity\":2,\"busy\":1,\"latency\":0.5}");
+  osrfRouterNodeSetLoad(node_b, "{\"capacity\":2,\"busy\":1,\"latency\":0.5}");
+  osrfRouterNodeSetLoad(node_c, "{\"capacity\":2,\"busy\":1,\"latency\":0.5}");
+  pick_many(osrfRouterPickLeastOutstanding, 3, &a, &b, &c);
+  fail_unless(a == 1 && b == 1 && c == 1, "least-outstanding should rotate ties");
+}
+END_TEST
+
+START_TEST(test_osrf_router_StaleHints)
+{
+  //Messages sent long ago have presumably been worked off
+  double now = get_timestamp_millis();
+  node_a->pending = 5.0;
+  node_a->pending_since = now - 100.0;
+  node_b->pending = 1.0;
+  node_b->pending_since = now;
+  node_c->pending = 1.0;
+  node_c->pending_since = now;
+  fail_unless(osrfRouterNodeInFlight(node_a, now) < 0.1,
+      "Messages sent long ago should no longer count as in flight");
+  fail_unless(osrfRouterPickLeastOutstanding(a_class) == node_a,
+      "least-outstanding should forget messages sent long ago");
+
+  //Half of them, after one latency
+  node_a->pending = 4.0;
+  node_a->latency = 2.0;
+  node_a->pending_since = now - 2.0;
+  double in_flight = osrfRouterNodeInFlight(node_a, now);
+  fail_unless(in_flight > 1.99 && in_flight < 2.01,
+      "Messages in flight should decay over the node's latency");
+
+  //A fresh hint replaces what we've counted
+  osrfRouterNodeSetLoad(node_b, "{\"busy\":0,\"backlog\":0}");
+  fail_unless(osrfRouterNodeInFlight(node_b, now) == 0.0,
+      "A hint should replace the messages we've counted");
+}
+END_TEST
+
+START_TEST(test_osrf_router_Weighted)
+{
+  //Weights 3, 1 and 1: a capacity of zero counts as the default of one
+  osrfRouterNodeSetLoad(node_a, "{\"capacity\":3}");
+  osrfRouterNodeSetLoad(node_b, "{\"capacity\":1}");
+  osrfRouterNodeSetLoad(node_c, "{\"capacity\":0}");
+  int a, b, c;
+  pick_many(osrfRouterPickWeighted, 5, &a, &b, &c);
+  fail_unless(a == 3 && b == 1 && c == 1,
+      "weighted should pick each node in proportion to its capacity");
+
+  //The picks are spread out rather than bunched
+  int i;
+  osrfRouterNode *previous = NULL;
+  for (i = 0; i < 20; ++i) {
+    osrfRouterNode *node = osrfRouterPickWeighted(a_class);
+    fail_if(node != node_a && node == previous,
+        "weighted should not pick a light node twice running");
+    previous = node;
+  }
+
+  //With no weights at all, it's plain round-robin
+  osrfRouterNodeSetLoad(node_a, "{\"capacity\":0}");
+  pick_many(osrfRouterPickWeighted, 6, &a, &b, &c);
+  fail_unless(a == 2 && b == 2 && c == 2,
+      "weighted should spread the load evenly if every weight is zero");
+}
+END_TEST
+
+START_TEST(test_osrf_router_EmptyClass)
+{
+  osrfRouterClass *empty = new_class();
+  const osrfRouterBalance *policy;
+  for (policy = balance_policies; policy->name; ++policy)
+    fail_unless(policy->pick(empty) == NULL,
+        "A policy should pick nothing from a class without nodes");
+  osrfRouterClassFree(NULL, empty);
+}
+END_TEST
+
+START_TEST(test_osrf_router_WatchClass)
+{
+  osrfRouter *router = new_router();
+  osrfRouterClass *b_class = new_class();
+  int sv_a[2], sv_b[2];
+  fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_a) == 0
+      && socketpair(AF_UNIX, SOCK_STREAM, 0, sv_b) == 0, "socketpair failed");
+  int fd_a = raise_fd(sv_a[0]);
+  int fd_b = sv_b[0];
+
+  fail_unless(osrfRouterWatchClass(router, a_class, fd_a) == 0
+      && osrfRouterWatchClass(router, b_class, fd_b) == 0,
+      "osrfRouterWatchClass should watch a socket, however high its descriptor");
+  fail_unless(a_class->sock_fd == fd_a && b_class->sock_fd == fd_b,
+      "osrfRouterWatchClass should record the socket in the class");
+  fail_unless(osrfListGetIndex(router->class_fds, fd_a) == a_class
+      && osrfListGetIndex(router->class_fds, fd_b) == b_class,
+      "osrfRouterWatchClass should map the socket to its class");
+  fail_unless(osrfRouterWatchClass(router, b_class, fd_b) != 0,
+      "A socket can't be watched twice");
+
+  //Input is reported for the right socket, and isn't a hangup
+  struct epoll_event event;
+  fail_unless(write(sv_a[1], "x", 1) == 1, "write failed");
+  fail_unless(wait_event(router, &event) == 1 && event.data.fd == fd_a,
+      "Input should be reported for its own socket");
+  fail_if(osrfRouterClassHungUp(router, a_class, fd_a, event.events),
+      "Input alone isn't a hangup");
+
+  //When the peer goes away, we hear about it, though the socket is still open
+  char c;
+  fail_unless(read(fd_a, &c, 1) == 1, "read failed");
+  close(sv_a[1]);
+  fail_unless(wait_event(router, &event) == 1 && event.data.fd == fd_a,
+      "A hangup should be reported");
+  fail_unless(osrfRouterClassHungUp(router, a_class, fd_a, event.events),
+      "osrfRouterClassHungUp should notice that the peer hung up");
+
+  //Unwatching forgets the socket
+  osrfRouterUnwatchClass(router, a_class);
+  fail_unless(osrfListGetIndex(router->class_fds, fd_a) == NULL && a_class->sock_fd == -1,
+      "osrfRouterUnwatchClass should unmap the socket");
+  fail_unless(wait_event(router, &event) == 0,
+      "An unwatched socket should report nothing");
+  close(fd_a);
+
+  //A socket closed underneath its class counts as a hangup
+  osrfRouterClass *c_class = new_class();
+  close(fd_b);
+  fail_unless(osrfRouterClassHungUp(router, b_class, fd_b, 0),
+      "osrfRouterClassHungUp should notice a closed socket");
+
+  //If its descriptor is reused by another class, the old class leaves it alone
+  int fd_c = dup2(sv_b[1], fd_b);
+  fail_unless(fd_c == fd_b, "dup2 failed");
+  osrfListRemove(router->class_fds, fd_b);
+  fail_unless(osrfRouterWatchClass(router, c_class, fd_c) == 0,
+      "osrfRouterWatchClass should take a reused descriptor");
+  fail_if(osrfRouterClassHungUp(router, b_class, fd_b, EPOLLHUP),
+      "A hangup is no concern of a class that no longer owns the socket");
+  osrfRouterUnwatchClass(router, b_class);
+  fail_unless(osrfListGetIndex(router->class_fds, fd_c) == c_class,
+      "Unwatching a stale class should leave the new one alone");
+  fail_unless(b_class->sock_fd == -1, "The stale class should forget its socket");
+
+  osrfRouterUnwatchClass(router, c_class);
+  close(fd_c);
+  close(sv_b[1]);
+  osrfRouterClassFree(NULL, b_class);
+  osrfRouterClassFree(NULL, c_class);
+  free_router(router);
+}
+END_TEST
+
+//END TESTS
+
+Suite *osrf_router_suite(void) {
+  //Create test suite, test case, initialize fixture
+  Suite *s = suite_create("osrf_router");
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_checked_fixture(tc_core, setup, teardown);
+
+  //Add tests to test case
+  tcase_add_test(tc_core, test_osrf_router_osrfRouterNodeSetLoad);
+  tcase_add_test(tc_core, test_osrf_router_LeastOutstanding);
+  tcase_add_test(tc_core, test_osrf_router_Latency);
+  tcase_add_test(tc_core, test_osrf_router_Ties);
+  tcase_add_test(tc_core, test_osrf_router_StaleHints);
+  tcase_add_test(tc_core, test_osrf_router_Weighted);
+  tcase_add_test(tc_core, test_osrf_router_EmptyClass);
+  tcase_add_test(tc_core, test_osrf_router_WatchClass);
+
+  //Add test case to test suite
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+void run_tests(SRunner *sr) {
+  srunner_add_suite(sr, osrf_router_suite());
+}
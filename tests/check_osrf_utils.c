@@ -1,4 +1,9 @@
 #include <check.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <sys/select.h>
+#include <unistd.h>
 #include "opensrf/utils.h"
 
 
@@ -23,6 +28,71 @@ START_TEST(test_osrfXmlEscapingLength)
 }
 END_TEST
 
+START_TEST(test_osrfUtilsCheckFileDescriptor)
+{
+  int fds[2];
+  fail_unless(pipe(fds) == 0, "pipe failed");
+  ck_assert_int_eq(osrfUtilsCheckFileDescriptor(fds[0]), 0);
+  ck_assert_int_eq(osrfUtilsCheckFileDescriptor(-1), -1);
+
+  //A descriptor beyond FD_SETSIZE is no different, if we're allowed one
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < FD_SETSIZE + 64
+      && lim.rlim_max >= FD_SETSIZE + 64) {
+    lim.rlim_cur = FD_SETSIZE + 64;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  int high = fcntl(fds[1], F_DUPFD, FD_SETSIZE + 8);
+  if (high >= 0) {
+    ck_assert_int_eq(osrfUtilsCheckFileDescriptor(high), 0);
+    close(high);
+    ck_assert_int_eq(osrfUtilsCheckFileDescriptor(high), -1);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  ck_assert_int_eq(osrfUtilsCheckFileDescriptor(fds[0]), -1);
+}
+END_TEST
+
+START_TEST(test_timeout_seconds_to_millis)
+{
+  //Any negative timeout means no limit
+  ck_assert_int_eq(timeout_seconds_to_millis(-1), -1);
+  ck_assert_int_eq(timeout_seconds_to_millis(-30), -1);
+  ck_assert_int_eq(timeout_seconds_to_millis(INT_MIN), -1);
+
+  //Zero means don't wait, in either unit
+  ck_assert_int_eq(timeout_seconds_to_millis(0), 0);
+  ck_assert_int_eq(timeout_seconds_to_millis(1), 1000);
+  ck_assert_int_eq(timeout_seconds_to_millis(90), 90000);
+
+  //A timeout too long for milliseconds is as long as we can make it
+  ck_assert_int_eq(timeout_seconds_to_millis(INT_MAX / 1000), INT_MAX / 1000 * 1000);
+  ck_assert_int_eq(timeout_seconds_to_millis(INT_MAX / 1000 + 1), INT_MAX);
+  ck_assert_int_eq(timeout_seconds_to_millis(INT_MAX), INT_MAX);
+}
+END_TEST
+
+START_TEST(test_get_monotonic_millis)
+{
+  //The clock counts milliseconds, and never goes backwards
+  long long start = get_monotonic_millis();
+  usleep(20000);
+  long long end = get_monotonic_millis();
+  fail_unless(end - start >= 19 && end - start < 1000,
+      "get_monotonic_millis should count milliseconds");
+
+  long long prev = end;
+  int i;
+  for (i = 0; i < 1000; ++i) {
+    long long now = get_monotonic_millis();
+    fail_unless(now >= prev, "get_monotonic_millis should never go backwards");
+    prev = now;
+  }
+}
+END_TEST
+
 //END TESTS
 
 Suite *osrf_utils_suite(void) {
@@ -33,6 +103,9 @@ Suite *osrf_utils_suite(void) {
 
   //Add tests to test case
   tcase_add_test(tc_core, test_osrfXmlEscapingLength);
+  tcase_add_test(tc_core, test_osrfUtilsCheckFileDescriptor);
+  tcase_add_test(tc_core, test_timeout_seconds_to_millis);
+  tcase_add_test(tc_core, test_get_monotonic_millis);
 
   //Add test case to test suite
   suite_add_tcase(s, tc_core);
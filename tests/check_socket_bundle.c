@@ -0,0 +1,445 @@
+#include <check.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+//The node table and the receive buffers are private to the socket code, so we
+//compile its source right in
+#include "socket_bundle.c"
+
+socket_manager *a_mgr;
+growing_buffer *received;   //Everything delivered, in order
+int deliveries;             //How many times data_received was called
+size_t largest;             //The largest slice delivered
+int closed_fd;              //The socket on_socket_closed was called for, if any
+int last_fd;                //The socket data was last delivered from
+int doomed[2];              //A pair of sockets, one of which disconnects the other
+
+static void collect(void *blob, socket_manager *mgr, int sock_fd, char *data,
+    int parent_id) {
+  size_t len = strlen(data);
+  buffer_add_n(received, data, len);
+  ++deliveries;
+  last_fd = sock_fd;
+  if (len > largest)
+    largest = len;
+
+  //Whichever of the doomed pair delivers first disconnects the other
+  if (doomed[0] >= 0) {
+    int other = sock_fd == doomed[0] ? doomed[1] : doomed[0];
+    doomed[0] = doomed[1] = -1;
+    socket_disconnect(mgr, other);
+  }
+}
+
+static void note_closed(void *blob, int sock_fd) {
+  closed_fd = sock_fd;
+}
+
+//Set up the test fixture
+void setup(void) {
+  a_mgr = safe_malloc(sizeof(socket_manager));
+  a_mgr->data_received = collect;
+  a_mgr->on_socket_closed = note_closed;
+  received = buffer_init(RBUFSIZE);
+  deliveries = 0;
+  largest = 0;
+  closed_fd = -1;
+  last_fd = -1;
+  doomed[0] = doomed[1] = -1;
+}
+
+//Clean up the test fixture
+void teardown(void) {
+  socket_manager_free(a_mgr);
+  buffer_free(received);
+}
+
+//Make a connected pair of sockets, and give the first one to the manager
+static void add_pair(int sv[2]) {
+  fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+  _socket_add_node(a_mgr, DATA_SOCKET, UNIX, sv[0], 0);
+}
+
+//A string of the given length, in a pattern that shows if anything is out of place
+static char *make_data(size_t len) {
+  char *data = safe_malloc(len + 1);
+  size_t i;
+  for (i = 0; i < len; ++i)
+    data[i] = 'a' + (i * 7 + i / 4093) % 26;
+  return data;
+}
+
+//Fork a process that writes data to a socket and exits
+static pid_t fork_writer(int fd, const char *data, size_t len) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    size_t sent = 0;
+    while (sent < len) {
+      ssize_t n = write(fd, data + sent, len - sent);
+      if (n <= 0)
+        _exit(1);
+      sent += n;
+    }
+    _exit(0);
+  }
+  return pid;
+}
+
+//Fork a process that reads a socket until end of file, and exits with status 0
+//if it read exactly the expected data.  It closes its copy of the other end of
+//the socket, so that it sees the end of file when we close ours.
+static pid_t fork_reader(int fd, int other_fd, const char *expected, size_t len) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(other_fd);
+    char buf[65536];
+    size_t got = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+      if (got + n > len || memcmp(buf, expected + got, n))
+        _exit(1);
+      got += n;
+    }
+    _exit(got == len ? 0 : 1);
+  }
+  return pid;
+}
+
+//True if a forked process exited with status 0
+static int exited_ok(pid_t pid) {
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//Wait for input until the given number of bytes have arrived, or nothing more comes
+static void receive(size_t len) {
+  while (received->n_used < len && socket_wait_all_ms(a_mgr, 2000) == 0)
+    ;
+}
+
+//Forget what has been delivered so far
+static void forget(void) {
+  buffer_reset(received);
+  deliveries = 0;
+  closed_fd = -1;
+  last_fd = -1;
+}
+
+static const socket_backend backends[] = { SOCKET_BACKEND_EPOLL, SOCKET_BACKEND_SELECT };
+
+//Tests
+
+START_TEST(test_socket_bundle_BackendParity)
+{
+  //Each backend finds the same active sockets, in one call, and the same hang-up
+  int b;
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    socket_manager_set_backend(a_mgr, backends[b]);
+    forget();
+
+    int one[2], two[2], three[2];
+    add_pair(one);
+    add_pair(two);
+    add_pair(three);
+    fail_unless(write(one[1], "x", 1) == 1 && write(three[1], "y", 1) == 1,
+        "write failed");
+
+    ck_assert_int_eq(socket_wait_all_ms(a_mgr, 2000), 0);
+    fail_unless(deliveries == 2 && received->n_used == 2
+        && strchr(received->buf, 'x') && strchr(received->buf, 'y'),
+        "Both active sockets should be handled in one call");
+
+    //Nothing more to read: the wait times out without delivering anything
+    forget();
+    socket_wait_all_ms(a_mgr, 10);
+    ck_assert_int_eq(deliveries, 0);
+
+    close(two[1]);
+    ck_assert_int_eq(socket_wait_all_ms(a_mgr, 2000), 0);
+    ck_assert_int_eq(closed_fd, two[0]);
+    fail_unless(socket_find_node(a_mgr, two[0]) == NULL,
+        "A socket closed by its peer should be dropped");
+
+    socket_disconnect(a_mgr, one[0]);
+    socket_disconnect(a_mgr, three[0]);
+    close(one[1]);
+    close(three[1]);
+    fail_unless(a_mgr->socket == NULL, "Every socket should be gone");
+  }
+}
+END_TEST
+
+START_TEST(test_socket_bundle_FindNode)
+{
+  fail_unless(socket_find_node(a_mgr, -1) == NULL && socket_find_node(a_mgr, 5) == NULL,
+      "An empty manager should have no sockets");
+
+  int sv[2];
+  add_pair(sv);
+  socket_node *node = socket_find_node(a_mgr, sv[0]);
+  fail_unless(node != NULL && node->sock_fd == sv[0], "A new socket should be found");
+  fail_unless(socket_find_node(a_mgr, sv[1]) == NULL, "The other end isn't managed");
+
+  //Removed, it's gone from the table as well as the list
+  socket_remove_node(a_mgr, sv[0]);
+  fail_unless(socket_find_node(a_mgr, sv[0]) == NULL && a_mgr->socket == NULL,
+      "A removed socket should not be found");
+
+  //The same descriptor can come back, as a different node
+  _socket_add_node(a_mgr, DATA_SOCKET, UNIX, sv[0], 7);
+  node = socket_find_node(a_mgr, sv[0]);
+  fail_unless(node != NULL && node->parent_id == 7,
+      "A descriptor added again should find its new node");
+
+  //A high descriptor grows the table, and leaves the others where they were
+  int high = fcntl(sv[1], F_DUPFD, 3 * SOCKET_TABLE_MIN_SIZE);
+  fail_unless(high >= 0, "fcntl failed");
+  _socket_add_node(a_mgr, DATA_SOCKET, UNIX, high, 0);
+  fail_unless(a_mgr->node_table_size > high, "The table should grow to fit");
+  fail_unless(socket_find_node(a_mgr, high) != NULL
+      && socket_find_node(a_mgr, sv[0]) == node,
+      "Every socket should still be found after the table grows");
+  fail_unless(socket_find_node(a_mgr, a_mgr->node_table_size) == NULL,
+      "A descriptor beyond the table should not be found");
+
+  socket_disconnect(a_mgr, high);
+  socket_disconnect(a_mgr, sv[0]);
+  close(sv[1]);
+  fail_unless(a_mgr->socket == NULL, "Every socket should be gone");
+}
+END_TEST
+
+START_TEST(test_socket_bundle_DisconnectInCallback)
+{
+  //A callback may disconnect a socket that's active in the same call
+  int b;
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    socket_manager_set_backend(a_mgr, backends[b]);
+    forget();
+
+    int one[2], two[2];
+    add_pair(one);
+    add_pair(two);
+    doomed[0] = one[0];
+    doomed[1] = two[0];
+    fail_unless(write(one[1], "x", 1) == 1 && write(two[1], "y", 1) == 1,
+        "write failed");
+
+    ck_assert_int_eq(socket_wait_all_ms(a_mgr, 2000), 0);
+    ck_assert_int_eq(deliveries, 1);
+    fail_unless(a_mgr->socket != NULL && a_mgr->socket->next == NULL
+        && a_mgr->socket->sock_fd == last_fd,
+        "Only the socket that delivered should be left");
+
+    socket_disconnect(a_mgr, last_fd);
+    close(one[1]);
+    close(two[1]);
+  }
+}
+END_TEST
+
+START_TEST(test_socket_bundle_WaitMs)
+{
+  int sv[2];
+  add_pair(sv);
+
+  //A timeout of a fraction of a second is honored, by either backend
+  int b;
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    socket_manager_set_backend(a_mgr, backends[b]);
+    long long start = get_monotonic_millis();
+    socket_wait_all_ms(a_mgr, 50);
+    long long waited = get_monotonic_millis() - start;
+    fail_unless(waited >= 45 && waited < 1000,
+        "socket_wait_all_ms should wait out a timeout of less than a second");
+
+    //A timeout of zero doesn't wait, in milliseconds or seconds
+    start = get_monotonic_millis();
+    socket_wait_all_ms(a_mgr, 0);
+    socket_wait_all(a_mgr, 0);
+    fail_unless(get_monotonic_millis() - start < 45,
+        "socket_wait_all should not wait with a timeout of zero");
+  }
+
+  long long start = get_monotonic_millis();
+  socket_wait_ms(a_mgr, 50, sv[0]);
+  long long waited = get_monotonic_millis() - start;
+  fail_unless(waited >= 45 && waited < 1000,
+      "socket_wait_ms should wait out a timeout of less than a second");
+  ck_assert_int_eq(deliveries, 0);
+
+  //Input cuts the wait short
+  fail_unless(write(sv[1], "hi", 2) == 2, "write failed");
+  start = get_monotonic_millis();
+  ck_assert_int_eq(socket_wait_ms(a_mgr, 5000, sv[0]), 0);
+  fail_unless(get_monotonic_millis() - start < 1000, "Input should end the wait");
+  fail_unless(strcmp(received->buf, "hi") == 0, "The input should be delivered");
+
+  socket_disconnect(a_mgr, sv[0]);
+  close(sv[1]);
+}
+END_TEST
+
+START_TEST(test_socket_bundle_Stats)
+{
+  int sv[2];
+  add_pair(sv);
+
+  fail_unless(write(sv[1], "hello", 5) == 5, "write failed");
+  receive(5);
+  fail_unless(deliveries == 1 && strcmp(received->buf, "hello") == 0,
+      "A short message should be delivered whole");
+
+  //One recv() for the data, one to find that there's no more
+  ck_assert_int_eq(a_mgr->stats.recv_calls, 2);
+  ck_assert_int_eq(a_mgr->stats.fcntl_calls, 2);
+  ck_assert_int_eq(a_mgr->stats.deliveries, 1);
+  ck_assert_int_eq(a_mgr->stats.bytes, 5);
+
+  //The socket stays non-blocking, so no more fcntl() calls
+  fail_unless(write(sv[1], "world", 5) == 5, "write failed");
+  receive(10);
+  ck_assert_int_eq(a_mgr->stats.recv_calls, 4);
+  ck_assert_int_eq(a_mgr->stats.fcntl_calls, 2);
+  ck_assert_int_eq(a_mgr->stats.deliveries, 2);
+  ck_assert_int_eq(a_mgr->stats.bytes, 10);
+  fail_unless(strcmp(received->buf, "helloworld") == 0, "Data should arrive in order");
+
+  //The peer hanging up is reported, and the socket dropped
+  close(sv[1]);
+  socket_wait_all_ms(a_mgr, 2000);
+  ck_assert_int_eq(closed_fd, sv[0]);
+  fail_unless(socket_find_node(a_mgr, sv[0]) == NULL,
+      "A socket closed by its peer should be dropped");
+}
+END_TEST
+
+START_TEST(test_socket_bundle_LargeMessage)
+{
+  int sv[2];
+  add_pair(sv);
+
+  //More than RBUF_MAX_SIZE, so it must come in slices
+  size_t len = 2 * RBUF_MAX_SIZE + 12345;
+  char *data = make_data(len);
+  pid_t writer = fork_writer(sv[1], data, len);
+  receive(len);
+
+  ck_assert_int_eq(received->n_used, len);
+  fail_unless(memcmp(received->buf, data, len) == 0,
+      "A large message should arrive intact and in order");
+  fail_unless(deliveries >= 3, "A large message should be delivered in slices");
+  fail_unless(largest < RBUF_MAX_SIZE, "No slice should exceed the receive buffer");
+  ck_assert_int_eq(a_mgr->stats.bytes, len);
+  ck_assert_int_eq(a_mgr->stats.deliveries, deliveries);
+  fail_unless(exited_ok(writer), "The writer should have finished");
+
+  //Once it's over, the receive buffer goes back to its initial size
+  socket_node *node = socket_find_node(a_mgr, sv[0]);
+  fail_unless(node != NULL && node->rbuf_size <= RBUFSIZE,
+      "The receive buffer should shrink after a large delivery");
+
+  close(sv[1]);
+  free(data);
+}
+END_TEST
+
+START_TEST(test_socket_bundle_PartialSends)
+{
+  int sv[2];
+  fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+  set_fl(sv[0], O_NONBLOCK);
+
+  //Much more than the socket will hold at once, so most sends are partial
+  size_t len = 8 * 1024 * 1024;
+  char *data = make_data(len);
+  pid_t reader = fork_reader(sv[1], sv[0], data, len);
+  close(sv[1]);
+  ck_assert_int_eq(socket_send(sv[0], data), 0);
+  close(sv[0]);
+  fail_unless(exited_ok(reader), "The reader should get every byte, in order");
+  free(data);
+}
+END_TEST
+
+START_TEST(test_socket_bundle_SendTimeout)
+{
+  int sv[2];
+  fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+  ck_assert_int_eq(socket_send_timeout(sv[0], "hello", 10000), 0);
+  fail_unless(socket_connected(sv[1]) == 1, "A socket with input is connected");
+
+  //Fill the socket up, so that nothing more can go
+  set_fl(sv[0], O_NONBLOCK);
+  char buf[4096];
+  memset(buf, 'x', sizeof(buf));
+  while (write(sv[0], buf, sizeof(buf)) > 0)
+    ;
+  ck_assert_int_eq(socket_send_timeout(sv[0], "more", 1000), -1);
+
+  close(sv[0]);
+  close(sv[1]);
+  fail_unless(socket_connected(sv[1]) == 0, "A closed socket isn't connected");
+}
+END_TEST
+
+START_TEST(test_socket_bundle_SelectLimit)
+{
+  //The select backend refuses a descriptor it can't fit in an fd_set
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < FD_SETSIZE + 64
+      && lim.rlim_max >= FD_SETSIZE + 64) {
+    lim.rlim_cur = FD_SETSIZE + 64;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  int sv[2];
+  fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+  int high = fcntl(sv[0], F_DUPFD, FD_SETSIZE + 8);
+  if (high < 0)
+    return;       //Not allowed a descriptor that high; nothing to test
+  close(sv[0]);
+  _socket_add_node(a_mgr, DATA_SOCKET, UNIX, high, 0);
+  fail_unless(write(sv[1], "hi", 2) == 2, "write failed");
+
+  socket_manager_set_backend(a_mgr, SOCKET_BACKEND_SELECT);
+  ck_assert_int_eq(socket_wait_all_ms(a_mgr, 0), -1);
+
+  //The epoll backend has no such limit
+  socket_manager_set_backend(a_mgr, SOCKET_BACKEND_EPOLL);
+  receive(2);
+  fail_unless(strcmp(received->buf, "hi") == 0,
+      "The epoll backend should handle any descriptor");
+  close(sv[1]);
+}
+END_TEST
+
+//END TESTS
+
+Suite *socket_bundle_suite(void) {
+  //Create test suite, test case, initialize fixture
+  Suite *s = suite_create("socket_bundle");
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_checked_fixture(tc_core, setup, teardown);
+  tcase_set_timeout(tc_core, 30);
+
+  //Add tests to test case
+  tcase_add_test(tc_core, test_socket_bundle_BackendParity);
+  tcase_add_test(tc_core, test_socket_bundle_FindNode);
+  tcase_add_test(tc_core, test_socket_bundle_DisconnectInCallback);
+  tcase_add_test(tc_core, test_socket_bundle_WaitMs);
+  tcase_add_test(tc_core, test_socket_bundle_Stats);
+  tcase_add_test(tc_core, test_socket_bundle_LargeMessage);
+  tcase_add_test(tc_core, test_socket_bundle_PartialSends);
+  tcase_add_test(tc_core, test_socket_bundle_SendTimeout);
+  tcase_add_test(tc_core, test_socket_bundle_SelectLimit);
+
+  //Add test case to test suite
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+void run_tests(SRunner *sr) {
+  srunner_add_suite(sr, socket_bundle_suite());
+}
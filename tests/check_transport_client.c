@@ -63,7 +63,7 @@ int session_send_msg(transport_session* session, transport_message* message) {
   return 0;
 }
 
-int session_wait(transport_session* session, int timeout) {
+int session_wait_ms(transport_session* session, int timeout) {
   if (session == a_client->session && timeout == -1) {
     transport_message* recvd_msg = message_init("body1", "subject1", "thread1", "recipient1", "sender1");
     a_client->msg_q_head = recvd_msg;
@@ -222,6 +222,118 @@ START_TEST(test_transport_message_prepare_xml)
 }
 END_TEST
 
+START_TEST(test_transport_message_prepare_xml_escaping)
+{
+  transport_message *msg = message_init("a&b<c>d\"e'f\r\ng\th \xc3\xa9 \xe4\xb8\xad",
+      "s\"ub&", "th<", "to\"x\n\t&\xc3\xa9", "from");
+  message_set_router_info(msg, "rf&\"", NULL, NULL, NULL, 0);
+  message_set_osrf_xid(msg, "x");
+
+  fail_unless(message_prepare_xml(msg) == 1,
+      "message_prepare_xml should return 1 upon success");
+  fail_unless(strcmp(msg->msg_xml, "<message to=\"to&quot;x&#10;&#9;&amp;&#xE9;\" from=\"from\"><opensrf router_from=\"rf&amp;&quot;\" router_to=\"\" router_class=\"\" router_command=\"\" osrf_xid=\"x\"/><thread>th&lt;</thread><subject>s\"ub&amp;</subject><body>a&amp;b&lt;c&gt;d\"e'f&#13;\ng\th \xc3\xa9 \xe4\xb8\xad</body></message>") == 0,
+      "message_prepare_xml should escape attributes and text the way libxml2 does");
+
+  message_free(msg);
+}
+END_TEST
+
+START_TEST(test_transport_message_forward)
+{
+  fail_unless(message_forward(NULL, "recipient", "sender") == NULL,
+      "Passing a NULL msg arg to message_forward should return NULL");
+
+  const char* body = "a&b<c>d\"e'f\r\ng\th \xc3\xa9 \xe4\xb8\xad";
+  transport_message *orig = message_init(body, "s\"ub&", "th<", "ignored", "from");
+  message_set_osrf_xid(orig, "xid");
+
+  transport_message *fwd = message_forward(orig, "to\"x\n\t&\xc3\xa9", "rf&\"");
+  fail_if(fwd == NULL, "message_forward should create a new transport_message");
+  fail_unless(strcmp(fwd->body, body) == 0,
+      "message_forward should move the body to the new message");
+  fail_unless(strcmp(orig->body, "") == 0,
+      "message_forward should leave the original with an empty body");
+  fail_unless(strcmp(fwd->sender, "rf&\"") == 0 && strcmp(fwd->router_from, "rf&\"") == 0,
+      "message_forward should set sender and router_from to the router_from arg");
+  fail_unless(strcmp(fwd->osrf_xid, "xid") == 0,
+      "message_forward should copy the osrf_xid");
+
+  // The forwarded XML must match that of a message built from scratch
+  transport_message *fresh = message_init(body, "s\"ub&", "th<", "to\"x\n\t&\xc3\xa9", "rf&\"");
+  message_set_router_info(fresh, "rf&\"", NULL, NULL, NULL, 0);
+  message_set_osrf_xid(fresh, "xid");
+  fail_unless(message_prepare_xml(fresh) == 1 && message_prepare_xml(fwd) == 1,
+      "message_prepare_xml should return 1 upon success");
+  fail_unless(strcmp(fwd->msg_xml, fresh->msg_xml) == 0,
+      "message_prepare_xml should produce the same xml for a forwarded message");
+
+  // Forwarding again reuses the encoded body already in msg_xml
+  transport_message *again = message_forward(fwd, "to\"x\n\t&\xc3\xa9", "rf&\"");
+  fail_unless(message_prepare_xml(again) == 1 && strcmp(again->msg_xml, fresh->msg_xml) == 0,
+      "A message forwarded twice should still produce the same xml");
+
+  message_free(orig);
+  message_free(fwd);
+  message_free(again);
+  message_free(fresh);
+}
+END_TEST
+
+START_TEST(test_transport_message_pack)
+{
+  fail_unless(message_pack(NULL, NULL) == NULL,
+      "Passing a NULL msg arg to message_pack should return NULL");
+  fail_unless(new_message_from_packed(NULL, 0) == NULL,
+      "Passing NULL data to new_message_from_packed should return NULL");
+
+  message_set_router_info(a_message, "routerfrom", "routerto", "routerclass", "register", 1);
+  message_set_osrf_xid(a_message, "xid");
+
+  size_t size = 0;
+  char* packed = message_pack(a_message, &size);
+  fail_if(packed == NULL, "message_pack should return the packed message");
+  fail_unless(packed[0] == MESSAGE_PACKED_MAGIC,
+      "A packed message should begin with MESSAGE_PACKED_MAGIC");
+  fail_unless(message_packed_size(packed) == size,
+      "message_packed_size should report the size of the whole packed message");
+
+  fail_unless(new_message_from_packed(packed, size - 1) == NULL,
+      "new_message_from_packed should reject a truncated message");
+
+  transport_message* msg = new_message_from_packed(packed, size);
+  fail_if(msg == NULL, "new_message_from_packed should create a new transport_message");
+  fail_unless(strcmp(msg->body, "body") == 0 && strcmp(msg->subject, "subject") == 0
+      && strcmp(msg->thread, "thread") == 0 && strcmp(msg->recipient, "recipient") == 0,
+      "new_message_from_packed should restore the body, subject, thread and recipient");
+  fail_unless(strcmp(msg->sender, "routerfrom") == 0,
+      "new_message_from_packed should take the sender from router_from");
+  fail_unless(strcmp(msg->router_from, "routerfrom") == 0
+      && strcmp(msg->router_to, "routerto") == 0
+      && strcmp(msg->router_class, "routerclass") == 0
+      && strcmp(msg->router_command, "register") == 0,
+      "new_message_from_packed should restore the router info");
+  fail_unless(strcmp(msg->osrf_xid, "xid") == 0,
+      "new_message_from_packed should restore the osrf_xid");
+  fail_unless(msg->broadcast == 1,
+      "new_message_from_packed should restore the broadcast field");
+  fail_unless(msg->msg_xml == NULL,
+      "new_message_from_packed should leave msg_xml NULL");
+
+  free(packed);
+  message_free(msg);
+
+  //A message without a router command gets an empty one, as from XML
+  transport_message* plain = message_init("body", "subject", "thread", "recipient", "sender");
+  packed = message_pack(plain, &size);
+  msg = new_message_from_packed(packed, size);
+  fail_unless(msg != NULL && strcmp(msg->router_command, "") == 0,
+      "new_message_from_packed should restore a missing router_command as empty");
+  free(packed);
+  message_free(msg);
+  message_free(plain);
+}
+END_TEST
+
 START_TEST(test_transport_message_jid_get_username)
 {
   int buf_size = 15;
@@ -290,6 +402,9 @@ Suite *transport_message_suite(void) {
   tcase_add_test(tc_core, test_transport_message_set_router_info_populated);
   tcase_add_test(tc_core, test_transport_message_free);
   tcase_add_test(tc_core, test_transport_message_prepare_xml);
+  tcase_add_test(tc_core, test_transport_message_prepare_xml_escaping);
+  tcase_add_test(tc_core, test_transport_message_forward);
+  tcase_add_test(tc_core, test_transport_message_pack);
   tcase_add_test(tc_core, test_transport_message_jid_get_username);
   tcase_add_test(tc_core, test_transport_message_jid_get_resource);
   tcase_add_test(tc_core, test_transport_message_jid_get_domain);